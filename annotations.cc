@@ -0,0 +1,330 @@
+#include "annotations.h"
+
+#include <cstring>
+
+namespace egorich {
+namespace rev {
+namespace {
+
+bool SetContains(const DexScanner& scanner, uint32_t offs, uint32_t type_idx) {
+  return offs && AnnotationSet(scanner, offs).Contains(type_idx);
+}
+
+void PrintString(const char* s, ostream& out) {
+  out << '"';
+  for (; *s; ++s) {
+    switch (*s) {
+    case '"': out << "\\\""; break;
+    case '\\': out << "\\\\"; break;
+    case '\n': out << "\\n"; break;
+    case '\t': out << "\\t"; break;
+    default: out << *s;
+    }
+  }
+  out << '"';
+}
+
+}  // namespace
+
+constexpr int EncodedValue::kMaxDepth;
+
+uint64_t EncodedValue::Bytes() const {
+  const uint8_t* const p = reinterpret_cast<const uint8_t*>(scanner_->data()) + offs_ + 1;
+  const size_t n = (header() >> 5) + 1;
+  uint64_t result = 0;
+  for (size_t i = 0; i < n; ++i) {
+    result |= static_cast<uint64_t>(p[i]) << (8*i);
+  }
+  return result;
+}
+
+int64_t EncodedValue::AsLong() const {
+  switch (type()) {
+  case VALUE_BOOLEAN:
+    return header() >> 5;
+  case VALUE_CHAR:
+    return Bytes();
+  default: {
+    const int shift = 64 - 8*((header() >> 5) + 1);
+    return static_cast<int64_t>(Bytes() << shift) >> shift;
+  }
+  }
+}
+
+// Floating point values keep their high-order bytes only: the bytes given
+// are the top of the value, and the rest is zero.
+float EncodedValue::AsFloat() const {
+  const uint32_t bits = static_cast<uint32_t>(Bytes() << (32 - 8*((header() >> 5) + 1)));
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+double EncodedValue::AsDouble() const {
+  const uint64_t bits = Bytes() << (64 - 8*((header() >> 5) + 1));
+  double result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+uint32_t EncodedValue::AsIndex() const {
+  return static_cast<uint32_t>(Bytes());
+}
+
+EncodedArray EncodedValue::AsArray() const {
+  return EncodedArray(*scanner_, offs_ + 1);
+}
+
+EncodedAnnotation EncodedValue::AsAnnotation() const {
+  return EncodedAnnotation(*scanner_, offs_ + 1);
+}
+
+size_t EncodedValue::end() const {
+  switch (type()) {
+  case VALUE_ARRAY: {
+    size_t pos = offs_ + 1;
+    const uint32_t size = scanner_->ReadUleb128(&pos);
+    for (uint32_t i = 0; i < size; ++i) {
+      pos = EncodedValue(*scanner_, pos).end();
+    }
+    return pos;
+  }
+  case VALUE_ANNOTATION: {
+    size_t pos = offs_ + 1;
+    scanner_->ReadUleb128(&pos);
+    const uint32_t size = scanner_->ReadUleb128(&pos);
+    for (uint32_t i = 0; i < size; ++i) {
+      scanner_->ReadUleb128(&pos);
+      pos = EncodedValue(*scanner_, pos).end();
+    }
+    return pos;
+  }
+  case VALUE_NULL:
+  case VALUE_BOOLEAN:
+    return offs_ + 1;
+  default:
+    return offs_ + 2 + (header() >> 5);
+  }
+}
+
+EncodedArray::EncodedArray(const DexScanner& scanner, size_t offs) : scanner_(&scanner) {
+  values_ = offs;
+  size_ = scanner.ReadUleb128(&values_);
+}
+
+EncodedAnnotation::EncodedAnnotation(const DexScanner& scanner, size_t offs)
+    : scanner_(&scanner) {
+  elements_ = offs;
+  type_idx_ = scanner.ReadUleb128(&elements_);
+  size_ = scanner.ReadUleb128(&elements_);
+}
+
+EncodedAnnotation::Element EncodedAnnotation::Iterator::operator*() const {
+  size_t pos = pos_;
+  const uint32_t name_idx = scanner_->ReadUleb128(&pos);
+  return {name_idx, EncodedValue(*scanner_, pos)};
+}
+
+EncodedAnnotation::Iterator& EncodedAnnotation::Iterator::operator++() {
+  pos_ = (**this).value.end();
+  --left_;
+  return *this;
+}
+
+bool EncodedAnnotation::Find(uint32_t name_idx, EncodedValue* value) const {
+  for (const Element element : *this) {
+    if (element.name_idx >= name_idx) {
+      if (element.name_idx != name_idx) break;
+      *value = element.value;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t AnnotationSet::type_idx(size_t i) const {
+  // Skips the visibility byte.
+  size_t pos = entry(i) + 1;
+  return scanner_->ReadUleb128(&pos);
+}
+
+size_t AnnotationSet::LowerBound(uint32_t type_idx) const {
+  size_t lo = 0;
+  size_t hi = size_;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (this->type_idx(mid) < type_idx) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+bool AnnotationSet::Find(uint32_t type_idx, Annotation* annotation) const {
+  const size_t i = LowerBound(type_idx);
+  if (i == size_ || this->type_idx(i) != type_idx) return false;
+  *annotation = Get(i);
+  return true;
+}
+
+bool AnnotationSet::Contains(uint32_t type_idx) const {
+  const size_t i = LowerBound(type_idx);
+  return i < size_ && this->type_idx(i) == type_idx;
+}
+
+AnnotationsDirectory::AnnotationsDirectory(const DexScanner& scanner, size_t offs)
+    : scanner_(&scanner), class_offs_(0), sizes_(), lists_() {
+  if (!offs) return;
+  class_offs_ = scanner.ReadUint32(offs);
+  size_t list = offs + 16;
+  for (int k = FIELDS; k <= PARAMETERS; ++k) {
+    sizes_[k] = scanner.ReadUint32(offs + 4 + 4*k);
+    lists_[k] = list;
+    list += 8*sizes_[k];
+  }
+}
+
+AnnotationsDirectory::Member AnnotationsDirectory::member(Kind kind, size_t i) const {
+  const size_t offs = lists_[kind] + 8*i;
+  return {scanner_->ReadUint32(offs), scanner_->ReadUint32(offs + 4)};
+}
+
+uint32_t AnnotationsDirectory::Find(Kind kind, uint32_t idx) const {
+  size_t lo = 0;
+  size_t hi = sizes_[kind];
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    const Member m = member(kind, mid);
+    if (m.idx == idx) return m.offs;
+    if (m.idx < idx) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return 0;
+}
+
+AnnotationSet AnnotationsDirectory::FieldAnnotations(uint32_t field_idx) const {
+  return AnnotationSet(*scanner_, Find(FIELDS, field_idx));
+}
+
+AnnotationSet AnnotationsDirectory::MethodAnnotations(uint32_t method_idx) const {
+  return AnnotationSet(*scanner_, Find(METHODS, method_idx));
+}
+
+uint32_t AnnotationsDirectory::ParameterCount(uint32_t method_idx) const {
+  const uint32_t offs = Find(PARAMETERS, method_idx);
+  return offs ? scanner_->ReadUint32(offs) : 0;
+}
+
+AnnotationSet AnnotationsDirectory::ParameterAnnotations(uint32_t method_idx, size_t i) const {
+  const uint32_t offs = Find(PARAMETERS, method_idx);
+  return AnnotationSet(*scanner_, offs ? scanner_->ReadUint32(offs + 4 + 4*i) : 0);
+}
+
+vector<uint32_t> FindAnnotatedClasses(const DexScanner& scanner, uint32_t type_idx, bool members) {
+  vector<uint32_t> result;
+  if (type_idx == DexScanner::kNoIndex) return result;
+  for (uint32_t t = 0; t < scanner.class_defs_size(); ++t) {
+    const uint32_t offs = scanner.class_annotations_offs(t);
+    if (!offs) continue;
+    const AnnotationsDirectory directory(scanner, offs);
+    bool found = directory.class_annotations().Contains(type_idx);
+    for (uint32_t i = 0; members && !found && i < directory.fields_size(); ++i) {
+      found = SetContains(scanner, directory.field(i).offs, type_idx);
+    }
+    for (uint32_t i = 0; members && !found && i < directory.methods_size(); ++i) {
+      found = SetContains(scanner, directory.method(i).offs, type_idx);
+    }
+    for (uint32_t i = 0; members && !found && i < directory.parameters_size(); ++i) {
+      const uint32_t list = directory.parameters(i).offs;
+      const uint32_t count = scanner.ReadUint32(list);
+      for (uint32_t p = 0; !found && p < count; ++p) {
+        found = SetContains(scanner, scanner.ReadUint32(list + 4 + 4*p), type_idx);
+      }
+    }
+    if (found) {
+      result.push_back(t);
+    }
+  }
+  return result;
+}
+
+void PrintValue(const DexScanner& scanner, const EncodedValue& value, ostream& out) {
+  switch (value.type()) {
+  case EncodedValue::VALUE_BYTE:
+  case EncodedValue::VALUE_SHORT:
+  case EncodedValue::VALUE_CHAR:
+  case EncodedValue::VALUE_INT:
+    out << value.AsLong();
+    break;
+  case EncodedValue::VALUE_LONG:
+    out << value.AsLong() << 'L';
+    break;
+  case EncodedValue::VALUE_FLOAT:
+    out << value.AsFloat() << 'f';
+    break;
+  case EncodedValue::VALUE_DOUBLE:
+    out << value.AsDouble();
+    break;
+  case EncodedValue::VALUE_METHOD_TYPE:
+    out << "proto@" << value.AsIndex();
+    break;
+  case EncodedValue::VALUE_METHOD_HANDLE:
+    out << "method_handle@" << value.AsIndex();
+    break;
+  case EncodedValue::VALUE_STRING:
+    PrintString(scanner.string_data(value.AsIndex()), out);
+    break;
+  case EncodedValue::VALUE_TYPE:
+    out << scanner.type_data(value.AsIndex());
+    break;
+  case EncodedValue::VALUE_FIELD:
+    out << scanner.FieldDescriptor(value.AsIndex());
+    break;
+  case EncodedValue::VALUE_METHOD:
+    out << scanner.MethodDescriptor(value.AsIndex());
+    break;
+  case EncodedValue::VALUE_ENUM:
+    out << ".enum " << scanner.FieldDescriptor(value.AsIndex());
+    break;
+  case EncodedValue::VALUE_ARRAY: {
+    const char* separator = "{ ";
+    for (const EncodedValue element : value.AsArray()) {
+      out << separator;
+      PrintValue(scanner, element, out);
+      separator = ", ";
+    }
+    out << (value.AsArray().size() ? " }" : "{}");
+    break;
+  }
+  case EncodedValue::VALUE_ANNOTATION:
+    out << '@';
+    PrintAnnotation(scanner, value.AsAnnotation(), out);
+    break;
+  case EncodedValue::VALUE_NULL:
+    out << "null";
+    break;
+  case EncodedValue::VALUE_BOOLEAN:
+    out << (value.AsLong() ? "true" : "false");
+    break;
+  }
+}
+
+void PrintAnnotation(const DexScanner& scanner, const EncodedAnnotation& annotation,
+                     ostream& out) {
+  out << scanner.type_data(annotation.type_idx()) << '(';
+  const char* separator = "";
+  for (const EncodedAnnotation::Element element : annotation) {
+    out << separator << scanner.string_data(element.name_idx) << " = ";
+    PrintValue(scanner, element.value, out);
+    separator = ", ";
+  }
+  out << ')';
+}
+
+}  // namespace rev
+}  // namespace egorich
@@ -0,0 +1,262 @@
+#ifndef REV_ANNOTATIONS_H__
+#define REV_ANNOTATIONS_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "dex_scanner.h"
+
+using std::ostream;
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Views of annotations and encoded values, read straight from the file.
+// A view is a scanner and an offset: constructing one decodes nothing, and
+// a nested array or annotation is only walked when it is accessed. Like the
+// scanner, the views need a file DexValidator accepted, which also bounds
+// the nesting of values so that walking them may recurse.
+
+class EncodedArray;
+class EncodedAnnotation;
+
+class EncodedValue {
+ public:
+  enum Type {
+    VALUE_BYTE = 0x00,
+    VALUE_SHORT = 0x02,
+    VALUE_CHAR = 0x03,
+    VALUE_INT = 0x04,
+    VALUE_LONG = 0x06,
+    VALUE_FLOAT = 0x10,
+    VALUE_DOUBLE = 0x11,
+    VALUE_METHOD_TYPE = 0x15,
+    VALUE_METHOD_HANDLE = 0x16,
+    VALUE_STRING = 0x17,
+    VALUE_TYPE = 0x18,
+    VALUE_FIELD = 0x19,
+    VALUE_METHOD = 0x1A,
+    VALUE_ENUM = 0x1B,
+    VALUE_ARRAY = 0x1C,
+    VALUE_ANNOTATION = 0x1D,
+    VALUE_NULL = 0x1E,
+    VALUE_BOOLEAN = 0x1F,
+  };
+
+  // Deeper values are rejected by the validator.
+  static constexpr int kMaxDepth = 32;
+
+  EncodedValue(const DexScanner& scanner, size_t offs) : scanner_(&scanner), offs_(offs) {
+  }
+
+  Type type() const { return static_cast<Type>(header() & 0x1F); }
+
+  // BYTE, SHORT, INT and LONG sign-extended, CHAR zero-extended, and
+  // BOOLEAN as 0 or 1.
+  int64_t AsLong() const;
+  float AsFloat() const;
+  double AsDouble() const;
+  // The index of a STRING, TYPE, FIELD, METHOD, ENUM, METHOD_TYPE or
+  // METHOD_HANDLE.
+  uint32_t AsIndex() const;
+  EncodedArray AsArray() const;
+  EncodedAnnotation AsAnnotation() const;
+
+  // Offset past the value, nested values included.
+  size_t end() const;
+
+ private:
+  uint8_t header() const { return scanner_->data()[offs_]; }
+  // The value_arg + 1 bytes following the header, little-endian.
+  uint64_t Bytes() const;
+
+  const DexScanner* scanner_;
+  size_t offs_;
+};
+
+// An encoded_array, e.g. the static_values of a class.
+class EncodedArray {
+ public:
+  class Iterator {
+   public:
+    Iterator(const DexScanner* scanner, size_t pos, uint32_t left)
+        : scanner_(scanner), pos_(pos), left_(left) {
+    }
+    EncodedValue operator*() const { return EncodedValue(*scanner_, pos_); }
+    Iterator& operator++() {
+      pos_ = EncodedValue(*scanner_, pos_).end();
+      --left_;
+      return *this;
+    }
+    bool operator!=(const Iterator& other) const { return left_ != other.left_; }
+
+   private:
+    const DexScanner* scanner_;
+    size_t pos_;
+    uint32_t left_;
+  };
+
+  EncodedArray(const DexScanner& scanner, size_t offs);
+
+  uint32_t size() const { return size_; }
+  Iterator begin() const { return Iterator(scanner_, values_, size_); }
+  Iterator end() const { return Iterator(scanner_, 0, 0); }
+
+ private:
+  const DexScanner* scanner_;
+  uint32_t size_;
+  size_t values_;
+};
+
+// An encoded_annotation: a type and name-value pairs, ordered by name_idx.
+class EncodedAnnotation {
+ public:
+  struct Element {
+    uint32_t name_idx;
+    EncodedValue value;
+  };
+
+  class Iterator {
+   public:
+    Iterator(const DexScanner* scanner, size_t pos, uint32_t left)
+        : scanner_(scanner), pos_(pos), left_(left) {
+    }
+    Element operator*() const;
+    Iterator& operator++();
+    bool operator!=(const Iterator& other) const { return left_ != other.left_; }
+
+   private:
+    const DexScanner* scanner_;
+    size_t pos_;
+    uint32_t left_;
+  };
+
+  EncodedAnnotation(const DexScanner& scanner, size_t offs);
+
+  uint32_t type_idx() const { return type_idx_; }
+  uint32_t size() const { return size_; }
+  Iterator begin() const { return Iterator(scanner_, elements_, size_); }
+  Iterator end() const { return Iterator(scanner_, 0, 0); }
+  // Looks an element up by name; returns false if there is none.
+  bool Find(uint32_t name_idx, EncodedValue* value) const;
+
+ private:
+  const DexScanner* scanner_;
+  uint32_t type_idx_;
+  uint32_t size_;
+  size_t elements_;
+};
+
+// An annotation_item of a set.
+class Annotation {
+ public:
+  enum Visibility {
+    VISIBILITY_BUILD = 0,
+    VISIBILITY_RUNTIME = 1,
+    VISIBILITY_SYSTEM = 2,
+  };
+
+  Annotation(const DexScanner& scanner, size_t offs) : scanner_(&scanner), offs_(offs) {
+  }
+
+  Visibility visibility() const { return static_cast<Visibility>(scanner_->data()[offs_]); }
+  EncodedAnnotation annotation() const { return EncodedAnnotation(*scanner_, offs_ + 1); }
+
+ private:
+  const DexScanner* scanner_;
+  size_t offs_;
+};
+
+// An annotation_set_item, ordered by type_idx. The empty set has offset zero.
+class AnnotationSet {
+ public:
+  AnnotationSet(const DexScanner& scanner, size_t offs)
+      : scanner_(&scanner), offs_(offs), size_(offs ? scanner.ReadUint32(offs) : 0) {
+  }
+
+  uint32_t size() const { return size_; }
+  Annotation Get(size_t i) const { return Annotation(*scanner_, entry(i)); }
+  // Type of Get(i), read without the elements of the annotation.
+  uint32_t type_idx(size_t i) const;
+  // Binary search by type; returns false if no annotation has the type.
+  bool Find(uint32_t type_idx, Annotation* annotation) const;
+  bool Contains(uint32_t type_idx) const;
+
+ private:
+  size_t entry(size_t i) const { return scanner_->ReadUint32(offs_ + 4 + 4*i); }
+  // Index of the first annotation of type_idx or above.
+  size_t LowerBound(uint32_t type_idx) const;
+
+  const DexScanner* scanner_;
+  size_t offs_;
+  uint32_t size_;
+};
+
+// The annotations_directory_item of a class. Members are ordered by index,
+// so they are looked up by binary search.
+class AnnotationsDirectory {
+ public:
+  // An annotated field, method, or method with annotated parameters.
+  struct Member {
+    uint32_t idx;
+    // annotation_set_item, or annotation_set_ref_list for parameters.
+    uint32_t offs;
+  };
+
+  // Takes the annotations_offs of a class_def, which may be zero.
+  AnnotationsDirectory(const DexScanner& scanner, size_t offs);
+
+  AnnotationSet class_annotations() const { return AnnotationSet(*scanner_, class_offs_); }
+
+  uint32_t fields_size() const { return sizes_[FIELDS]; }
+  uint32_t methods_size() const { return sizes_[METHODS]; }
+  uint32_t parameters_size() const { return sizes_[PARAMETERS]; }
+  Member field(size_t i) const { return member(FIELDS, i); }
+  Member method(size_t i) const { return member(METHODS, i); }
+  Member parameters(size_t i) const { return member(PARAMETERS, i); }
+
+  // Annotations of a member; empty for members without any.
+  AnnotationSet FieldAnnotations(uint32_t field_idx) const;
+  AnnotationSet MethodAnnotations(uint32_t method_idx) const;
+  // Number of parameters with an entry for the method, and the annotations
+  // of parameter i.
+  uint32_t ParameterCount(uint32_t method_idx) const;
+  AnnotationSet ParameterAnnotations(uint32_t method_idx, size_t i) const;
+
+ private:
+  enum Kind {
+    FIELDS,
+    METHODS,
+    PARAMETERS,
+  };
+
+  Member member(Kind kind, size_t i) const;
+  // Offset of the entry for idx, or zero.
+  uint32_t Find(Kind kind, uint32_t idx) const;
+
+  const DexScanner* scanner_;
+  uint32_t class_offs_;
+  uint32_t sizes_[3];
+  // Offsets of the member lists.
+  size_t lists_[3];
+};
+
+// Returns the indices of the class_defs with an annotation of the type, in
+// class_def order. With members, annotations of fields, methods and
+// parameters count as well. Only the type indices of the annotations are
+// read, and the scanner needs no more than ParseHeader().
+vector<uint32_t> FindAnnotatedClasses(const DexScanner& scanner, uint32_t type_idx, bool members);
+
+// Prints the value in smali notation, e.g. "{ 1, 2 }" for an array.
+void PrintValue(const DexScanner& scanner, const EncodedValue& value, ostream& out);
+// Prints the annotation as "Lpkg/Type;(name = value, ...)".
+void PrintAnnotation(const DexScanner& scanner, const EncodedAnnotation& annotation,
+                     ostream& out);
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_ANNOTATIONS_H__
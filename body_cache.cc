@@ -0,0 +1,209 @@
+#include "body_cache.h"
+
+#include "dex_asm.h"
+
+namespace egorich {
+namespace rev {
+namespace {
+
+const uint32_t kAccStatic = 0x8;
+
+// Finalizer of splitmix64.
+uint64_t Mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+uint64_t Combine(uint64_t hash, uint64_t value) {
+  return Mix(hash * 0x9E3779B97F4A7C15ULL + value);
+}
+
+// FNV-1a, mixed.
+uint64_t HashString(const string& s) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (const char c : s) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001B3ULL;
+  }
+  return Mix(hash);
+}
+
+template <typename T>
+void Append(T value, string* key) {
+  key->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+}  // namespace
+
+constexpr size_t BodyCache::kShards;
+
+BodyCache::BodyCache() {
+  for (Shard& shard : shards_) {
+    shard.lookups = 0;
+    shard.hits = 0;
+    shard.saved = std::chrono::nanoseconds(0);
+  }
+}
+
+BodyCache::Shard& BodyCache::ShardOf(const string& key) {
+  return shards_[std::hash<string>()(key) % kShards];
+}
+
+const BodyCache::Body* BodyCache::Find(const string& key) {
+  Shard& shard = ShardOf(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  ++shard.lookups;
+  const auto it = shard.bodies.find(key);
+  if (it == shard.bodies.end()) {
+    return NULL;
+  }
+  ++shard.hits;
+  shard.saved += it->second.time;
+  return &it->second;
+}
+
+const BodyCache::Body* BodyCache::Insert(const string& key, Body body) {
+  Shard& shard = ShardOf(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  // Nodes of an unordered_map stay put as it grows, so the pointer handed
+  // out outlives the lock.
+  return &shard.bodies.emplace(key, std::move(body)).first->second;
+}
+
+size_t BodyCache::size() const {
+  size_t size = 0;
+  for (Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    size += shard.bodies.size();
+  }
+  return size;
+}
+
+size_t BodyCache::lookups() const {
+  size_t lookups = 0;
+  for (Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    lookups += shard.lookups;
+  }
+  return lookups;
+}
+
+size_t BodyCache::hits() const {
+  size_t hits = 0;
+  for (Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    hits += shard.hits;
+  }
+  return hits;
+}
+
+std::chrono::nanoseconds BodyCache::saved() const {
+  std::chrono::nanoseconds saved(0);
+  for (Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    saved += shard.saved;
+  }
+  return saved;
+}
+
+BodyKeys::BodyKeys(const DexScanner& scanner) : scanner_(scanner) {
+  // The sections are hashed in order, each from the ones before it, and
+  // told apart from one another by a tag.
+  const vector<string>& strings = scanner_.string_ids();
+  strings_.reserve(strings.size());
+  for (const string& s : strings) {
+    strings_.push_back(HashString(s));
+  }
+  types_.reserve(scanner_.type_ids().size());
+  for (const TypeIdItem& type : scanner_.type_ids()) {
+    types_.push_back(Combine(1, strings_[type.descriptor_idx]));
+  }
+  fields_.reserve(scanner_.field_ids().size());
+  for (const FieldIdItem& field : scanner_.field_ids()) {
+    fields_.push_back(Combine(Combine(Combine(2, types_[field.class_idx]), strings_[field.name_idx]),
+                              types_[field.type_idx]));
+  }
+  vector<uint64_t> protos;
+  protos.reserve(scanner_.proto_ids().size());
+  for (const ProtoIdItem& proto : scanner_.proto_ids()) {
+    uint64_t hash = Combine(3, types_[proto.return_type_idx]);
+    if (proto.parameters_offs) {
+      const uint32_t size = scanner_.ReadUint32(proto.parameters_offs);
+      for (uint32_t i = 0; i < size; ++i) {
+        hash = Combine(hash, types_[scanner_.ReadUShort(proto.parameters_offs + 4 + 2*i)]);
+      }
+    }
+    protos.push_back(hash);
+  }
+  methods_.reserve(scanner_.method_ids().size());
+  for (const MethodIdItem& method : scanner_.method_ids()) {
+    methods_.push_back(Combine(Combine(Combine(4, types_[method.class_idx]), strings_[method.name_idx]),
+                               protos[method.proto_idx]));
+  }
+}
+
+template <typename Reader>
+void BodyKeys::AppendInstructions(const Reader& reader, const CodeItem& code, string* key) const {
+  size_t offs = code.instr_offs();
+  const size_t end = offs + 2*code.instr_size();
+  while (offs < end) {
+    const size_t size = InstructionSize(&reader, offs);
+    uint32_t index = 0;
+    const ReferenceKind kind = ReadReference(&reader, offs, &index);
+    // The index takes the second code unit, and the third one too for
+    // const-string/jumbo.
+    const size_t index_units = kind == REF_NONE ? 0 : (reader.ReadUShort(offs) & 0xFF) == 0x1B ? 2 : 1;
+    for (size_t u = 0; u < size; ++u) {
+      Append<uint16_t>(u >= 1 && u <= index_units ? 0 : reader.ReadUShort(offs + 2*u), key);
+    }
+    switch (kind) {
+    case REF_NONE: break;
+    case REF_STRING: Append(strings_[index], key); break;
+    case REF_TYPE: Append(types_[index], key); break;
+    case REF_FIELD: Append(fields_[index], key); break;
+    case REF_METHOD: Append(methods_[index], key); break;
+    }
+    offs += 2*size;
+  }
+}
+
+void BodyKeys::Compute(const CodeItem& code, uint32_t access_flags, const DebugInfo* debug_info,
+                       string* key) const {
+  key->clear();
+  Append<uint8_t>(access_flags & kAccStatic ? 1 : 0, key);
+  Append(code.register_size(), key);
+  Append(code.ins_size(), key);
+  Append(code.outs_size(), key);
+  Append(code.instr_size(), key);
+  if (scanner_.IsMachineEndian()) {
+    AppendInstructions(DexReader<NativeOrder>(scanner_), code, key);
+  } else {
+    AppendInstructions(DexReader<SwappedOrder>(scanner_), code, key);
+  }
+  Append<uint32_t>(code.tries().size(), key);
+  for (const TryItem& item : code.tries()) {
+    Append(item.start_addr, key);
+    Append(item.insn_count, key);
+    Append(item.handler_idx, key);
+  }
+  Append<uint32_t>(code.handlers().size(), key);
+  for (const EncodedCatchHandler& handler : code.handlers()) {
+    Append<uint32_t>(handler.handlers.size(), key);
+    for (const EncodedTypeAddrPair& pair : handler.handlers) {
+      Append(types_[pair.type_idx], key);
+      Append(pair.addr, key);
+    }
+    Append(handler.catch_all_addr, key);
+  }
+  const size_t positions = debug_info != NULL ? debug_info->position_count() : 0;
+  Append<uint32_t>(positions, key);
+  for (size_t p = 0; p < positions; ++p) {
+    Append(debug_info->positions()[p].pc, key);
+    Append(debug_info->positions()[p].line, key);
+  }
+}
+
+}  // namespace rev
+}  // namespace egorich
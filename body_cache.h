@@ -0,0 +1,108 @@
+#ifndef REV_BODY_CACHE_H__
+#define REV_BODY_CACHE_H__
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "debug_info.h"
+#include "dex_scanner.h"
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Decompiled method bodies by their content, so that methods with the same
+// code, such as getters, synthetic accessors and lambdas, are analyzed and
+// printed once: within a dex, and across the dex files of a multidex app
+// sharing the cache. Only bodies decompiled within budget are kept, as a
+// body printed raw refers to the items of its dex by index.
+//
+// The key of a body is all its text depends on: the code item, with the
+// index operands of the instructions and the exception types of the
+// handlers replaced by hashes of the items they refer to, so that the key
+// is the same in any dex; the source positions of the debug info; and
+// whether the method is static, which tells "this" from an argument.
+//
+// Find() and Insert() may be called from any number of threads; the map is
+// split into shards by key, each behind a mutex of its own, as in
+// CallResolver. Two workers missing on the same key both decompile it, and
+// the first body is kept.
+class BodyCache {
+ public:
+  struct Body {
+    // From the opening brace on, the signature left out.
+    string text;
+    // Spent decompiling and printing the body.
+    std::chrono::nanoseconds time;
+  };
+
+  BodyCache();
+
+  // Returns NULL if the key is not cached yet. A body returned stays valid
+  // as long as the cache.
+  const Body* Find(const string& key);
+  // Returns the body kept for the key.
+  const Body* Insert(const string& key, Body body);
+
+  // Distinct bodies, lookups, lookups answered from the cache and the time
+  // the bodies found would have taken to decompile.
+  size_t size() const;
+  size_t lookups() const;
+  size_t hits() const;
+  std::chrono::nanoseconds saved() const;
+
+ private:
+  struct Shard {
+    std::mutex mutex;
+    unordered_map<string, Body> bodies;
+    size_t lookups;
+    size_t hits;
+    std::chrono::nanoseconds saved;
+  };
+
+  static constexpr size_t kShards = 64;
+
+  Shard& ShardOf(const string& key);
+
+  mutable Shard shards_[kShards];
+
+  BodyCache(const BodyCache&) = delete;
+};
+
+// Hashes of the strings, types, fields and methods of a dex by content,
+// which keys of BodyCache refer to items by.
+class BodyKeys {
+ public:
+  explicit BodyKeys(const DexScanner& scanner);
+
+  // Sets *key to the key of the code of a method with the access flags.
+  // The debug info may be NULL.
+  void Compute(const CodeItem& code, uint32_t access_flags, const DebugInfo* debug_info,
+               string* key) const;
+
+ private:
+  // Reader is the DexReader of the byte order of the file.
+  template <typename Reader>
+  void AppendInstructions(const Reader& reader, const CodeItem& code, string* key) const;
+
+  const DexScanner& scanner_;
+  vector<uint64_t> strings_;
+  vector<uint64_t> types_;
+  vector<uint64_t> fields_;
+  vector<uint64_t> methods_;
+
+  BodyKeys(const BodyKeys&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_BODY_CACHE_H__
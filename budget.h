@@ -0,0 +1,62 @@
+#ifndef REV_BUDGET_H__
+#define REV_BUDGET_H__
+
+#include <chrono>
+#include <cstddef>
+
+namespace egorich {
+namespace rev {
+
+// Time and memory allowed for the analysis of a single method. The analyses
+// check it between their phases and estimate the size of their tables up
+// front; a method going over is left with its raw disassembly.
+class Budget {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  enum Verdict {
+    WITHIN,
+    TIME,
+    MEMORY,
+  };
+
+  // No limits.
+  Budget() : time_(0), memory_(0) {
+  }
+  // Zero means no limit.
+  Budget(std::chrono::milliseconds time, size_t memory) : time_(time), memory_(memory) {
+  }
+
+  std::chrono::milliseconds time() const { return time_; }
+  size_t memory() const { return memory_; }
+
+  void Start() { start_ = Clock::now(); }
+  bool TimeExceeded() const {
+    return time_.count() && Clock::now() - start_ > time_;
+  }
+  bool Fits(size_t bytes) const {
+    return !memory_ || bytes <= memory_;
+  }
+
+ private:
+  std::chrono::milliseconds time_;
+  size_t memory_;
+  Clock::time_point start_;
+};
+
+inline const char* VerdictName(Budget::Verdict verdict) {
+  switch (verdict) {
+  case Budget::WITHIN:
+    return "within budget";
+  case Budget::TIME:
+    return "over the time budget";
+  case Budget::MEMORY:
+    return "over the memory budget";
+  }
+  return "";
+}
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_BUDGET_H__
@@ -0,0 +1,83 @@
+#include "call_graph.h"
+
+#include <algorithm>
+
+#include "dex_asm.h"
+#include "parallel.h"
+
+namespace egorich {
+namespace rev {
+
+template <typename Reader>
+void CallGraph::ScanClass(const Reader& reader, const ClassDefItem& class_def,
+                          vector<pair<uint32_t, uint32_t>>* edges) const {
+  for (int k = 0; k < 2; ++k) {
+    const vector<EncodedMethod>& methods =
+        k ? class_def.virtual_methods() : class_def.direct_methods();
+    uint32_t method_idx = 0;
+    for (const EncodedMethod& method : methods) {
+      method_idx += method.method_idx_diff;
+      if (!method.code_offs) continue;
+      const CodeItem code(&scanner_, method.code_offs);
+      size_t offs = code.instr_offs();
+      const size_t end = offs + 2*code.instr_size();
+      for (; offs < end; offs += 2*InstructionSize(&reader, offs)) {
+        uint32_t callee;
+        if (ReadReference(&reader, offs, &callee) == REF_METHOD) {
+          edges->push_back({method_idx, callee});
+        }
+      }
+    }
+  }
+  std::sort(edges->begin(), edges->end());
+  edges->erase(std::unique(edges->begin(), edges->end()), edges->end());
+}
+
+void CallGraph::Build(size_t threads) {
+  const vector<ClassDefItem>& class_defs = scanner_.class_defs();
+  vector<vector<pair<uint32_t, uint32_t>>> edges(class_defs.size());
+  ParallelFor(class_defs.size(), threads, [this, &class_defs, &edges] (size_t c, size_t worker) {
+    if (scanner_.IsMachineEndian()) {
+      ScanClass(DexReader<NativeOrder>(scanner_), class_defs[c], &edges[c]);
+    } else {
+      ScanClass(DexReader<SwappedOrder>(scanner_), class_defs[c], &edges[c]);
+    }
+  });
+
+  // Counting sorts by caller and by callee. Every class holds its edges in a
+  // slot of its own, so no locking was needed while scanning.
+  const size_t methods = scanner_.method_ids().size();
+  callee_offs_.assign(methods + 1, 0);
+  caller_offs_.assign(methods + 1, 0);
+  size_t total = 0;
+  for (const auto& slot : edges) {
+    for (const auto& edge : slot) {
+      ++callee_offs_[edge.first + 1];
+      ++caller_offs_[edge.second + 1];
+    }
+    total += slot.size();
+  }
+  for (size_t m = 0; m < methods; ++m) {
+    callee_offs_[m + 1] += callee_offs_[m];
+    caller_offs_[m + 1] += caller_offs_[m];
+  }
+
+  callees_.resize(total);
+  vector<uint32_t> next(callee_offs_.begin(), callee_offs_.end() - 1);
+  for (const auto& slot : edges) {
+    for (const auto& edge : slot) {
+      callees_[next[edge.first]++] = edge.second;
+    }
+  }
+  // Walking the rows by caller leaves every list of callers sorted.
+  callers_.resize(total);
+  next.assign(caller_offs_.begin(), caller_offs_.end() - 1);
+  for (uint32_t m = 0; m < methods; ++m) {
+    for (const uint32_t* callee = callees_begin(m); callee != callees_end(m); ++callee) {
+      callers_[next[*callee]++] = m;
+    }
+  }
+}
+
+}  // namespace rev
+}  // namespace egorich
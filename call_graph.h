@@ -0,0 +1,58 @@
+#ifndef REV_CALL_GRAPH_H__
+#define REV_CALL_GRAPH_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "dex_scanner.h"
+
+using std::pair;
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Caller -> callee edges of a whole dex, keyed by method_ids index and kept
+// in compressed sparse rows both ways. An edge is recorded once however many
+// times the caller invokes the callee.
+class CallGraph {
+ public:
+  explicit CallGraph(const DexScanner& scanner) : scanner_(scanner) {
+  }
+
+  // Scans the invoke-* instructions of every class on up to `threads`
+  // threads.
+  void Build(size_t threads);
+
+  size_t edge_count() const { return callees_.size(); }
+
+  // Methods invoked by method, sorted.
+  const uint32_t* callees_begin(uint32_t method) const { return callees_.data() + callee_offs_[method]; }
+  const uint32_t* callees_end(uint32_t method) const { return callees_.data() + callee_offs_[method + 1]; }
+  // Methods invoking method, sorted.
+  const uint32_t* callers_begin(uint32_t method) const { return callers_.data() + caller_offs_[method]; }
+  const uint32_t* callers_end(uint32_t method) const { return callers_.data() + caller_offs_[method + 1]; }
+
+ private:
+  // Appends the (caller, callee) edges of the class, sorted and unique.
+  // Reader is the DexReader of the byte order of the file.
+  template <typename Reader>
+  void ScanClass(const Reader& reader, const ClassDefItem& class_def,
+                 vector<pair<uint32_t, uint32_t>>* edges) const;
+
+  const DexScanner& scanner_;
+
+  vector<uint32_t> callee_offs_;
+  vector<uint32_t> callees_;
+  vector<uint32_t> caller_offs_;
+  vector<uint32_t> callers_;
+
+  CallGraph(const CallGraph&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_CALL_GRAPH_H__
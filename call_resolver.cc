@@ -0,0 +1,130 @@
+#include "call_resolver.h"
+
+#include <algorithm>
+
+namespace egorich {
+namespace rev {
+namespace {
+
+const uint32_t kAccAbstract = 0x400;
+const uint32_t kAccInterface = 0x200;
+
+}  // namespace
+
+constexpr size_t CallResolver::kShards;
+
+CallResolver::CallResolver(const DexScanner& scanner, const ClassHierarchy& hierarchy)
+    : scanner_(scanner), hierarchy_(hierarchy), flags_(scanner.method_ids().size(), 0) {
+  for (const ClassDefItem& class_def : scanner_.class_defs()) {
+    uint32_t method_idx = 0;
+    for (const EncodedMethod& method : class_def.virtual_methods()) {
+      method_idx += method.method_idx_diff;
+      flags_[method_idx] = VIRTUAL | ((method.access_flags & kAccAbstract) ? ABSTRACT : 0);
+    }
+  }
+  for (Shard& shard : shards_) {
+    shard.hits = 0;
+  }
+}
+
+const CallTargets& CallResolver::Resolve(uint32_t method_idx) {
+  const MethodIdItem method = scanner_.method_id(method_idx);
+  return Resolve(method.class_idx, method.name_idx, method.proto_idx);
+}
+
+const CallTargets& CallResolver::Resolve(uint32_t type_idx, uint32_t name_idx,
+                                         uint32_t proto_idx) {
+  // Laid out as method_ids are sorted. A multiplicative hash spreads the
+  // keys of one class over the shards.
+  const uint64_t key = (static_cast<uint64_t>(type_idx) << 48)
+      | (static_cast<uint64_t>(name_idx) << 16) | proto_idx;
+  Shard& shard = shards_[(key * 0x9E3779B97F4A7C15ULL) >> 58];
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    const auto it = shard.targets.find(key);
+    if (it != shard.targets.end()) {
+      ++shard.hits;
+      return it->second;
+    }
+  }
+  CallTargets targets;
+  Compute(type_idx, name_idx, proto_idx, &targets);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  // Nodes of an unordered_map stay put as it grows, so the reference
+  // handed out outlives the lock.
+  return shard.targets.emplace(key, std::move(targets)).first->second;
+}
+
+size_t CallResolver::size() const {
+  size_t size = 0;
+  for (Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    size += shard.targets.size();
+  }
+  return size;
+}
+
+size_t CallResolver::hits() const {
+  size_t hits = 0;
+  for (Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    hits += shard.hits;
+  }
+  return hits;
+}
+
+uint32_t CallResolver::Declared(uint32_t type_idx, uint32_t name_idx, uint32_t proto_idx) const {
+  const uint32_t method_idx = scanner_.FindMethod(type_idx, name_idx, proto_idx);
+  return method_idx != DexScanner::kNoIndex && (flags_[method_idx] & VIRTUAL)
+      ? method_idx : DexScanner::kNoIndex;
+}
+
+void CallResolver::Compute(uint32_t type_idx, uint32_t name_idx, uint32_t proto_idx,
+                           CallTargets* targets) const {
+  // A receiver type without a class_def may itself be instantiated.
+  targets->external = hierarchy_.class_def(type_idx) == DexScanner::kNoIndex;
+  vector<uint32_t> subtypes;
+  hierarchy_.Subtypes(type_idx, &subtypes);
+  for (const uint32_t t : subtypes) {
+    const uint32_t class_def = hierarchy_.class_def(t);
+    if (class_def == DexScanner::kNoIndex) continue;
+    if (scanner_.class_defs()[class_def].access_flags() & (kAccAbstract | kAccInterface)) continue;
+    if (!Implementation(t, name_idx, proto_idx, &targets->methods)) {
+      targets->external = true;
+    }
+  }
+  std::sort(targets->methods.begin(), targets->methods.end());
+  targets->methods.erase(std::unique(targets->methods.begin(), targets->methods.end()),
+                         targets->methods.end());
+}
+
+bool CallResolver::Implementation(uint32_t type_idx, uint32_t name_idx, uint32_t proto_idx,
+                                  vector<uint32_t>* methods) const {
+  bool inside = true;
+  for (uint32_t t = type_idx; t != DexScanner::kNoIndex; t = hierarchy_.superclass(t)) {
+    if (hierarchy_.class_def(t) == DexScanner::kNoIndex) {
+      // The class outside may define the method, or leave it to a default
+      // method below.
+      inside = false;
+      break;
+    }
+    const uint32_t method_idx = Declared(t, name_idx, proto_idx);
+    if (method_idx != DexScanner::kNoIndex) {
+      // An abstract method met first has no implementation to call.
+      if (!(flags_[method_idx] & ABSTRACT)) methods->push_back(method_idx);
+      return true;
+    }
+  }
+  // Default methods; all of them are kept rather than the most specific.
+  for (const uint32_t* it = hierarchy_.interfaces_begin(type_idx);
+       it != hierarchy_.interfaces_end(type_idx); ++it) {
+    const uint32_t method_idx = Declared(*it, name_idx, proto_idx);
+    if (method_idx != DexScanner::kNoIndex && !(flags_[method_idx] & ABSTRACT)) {
+      methods->push_back(method_idx);
+    }
+  }
+  return inside;
+}
+
+}  // namespace rev
+}  // namespace egorich
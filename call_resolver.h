@@ -0,0 +1,91 @@
+#ifndef REV_CALL_RESOLVER_H__
+#define REV_CALL_RESOLVER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "class_hierarchy.h"
+#include "dex_scanner.h"
+
+using std::unordered_map;
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Methods an invoke-virtual or invoke-interface may land in, by class
+// hierarchy analysis: for every class which may be the receiver, that is
+// every concrete subtype of the static receiver type, the method it
+// inherits or overrides, falling back to default methods of interfaces.
+struct CallTargets {
+  // method_ids indices, sorted.
+  vector<uint32_t> methods;
+  // Whether some receiver may inherit the method from a class outside the
+  // dex, or be of such a class.
+  bool external;
+};
+
+// Resolves virtual calls against a ClassHierarchy and caches the results
+// by receiver type, name and proto, so that a signature queried over and
+// over is resolved once. Resolve() may be called from any number of
+// threads: the cache is split into shards by key, each behind a mutex of
+// its own, and a call resolves outside of the lock, so workers only wait
+// on one another for a map lookup in the same shard. Two workers missing
+// on the same key both resolve it, and the first result is kept.
+class CallResolver {
+ public:
+  // The hierarchy must be built.
+  CallResolver(const DexScanner& scanner, const ClassHierarchy& hierarchy);
+
+  // Targets of a call through the method reference, as invoke-virtual and
+  // invoke-interface make. The result stays valid as long as the resolver.
+  const CallTargets& Resolve(uint32_t method_idx);
+  // Targets of a call with the receiver type narrowed down, e.g. by the
+  // type of a new-instance.
+  const CallTargets& Resolve(uint32_t type_idx, uint32_t name_idx, uint32_t proto_idx);
+
+  // Distinct keys resolved, and calls answered from the cache.
+  size_t size() const;
+  size_t hits() const;
+
+ private:
+  enum MethodFlags {
+    VIRTUAL = 1,
+    ABSTRACT = 2,
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    unordered_map<uint64_t, CallTargets> targets;
+    size_t hits;
+  };
+
+  // The top bits of a hash pick the shard.
+  static constexpr size_t kShards = 64;
+
+  void Compute(uint32_t type_idx, uint32_t name_idx, uint32_t proto_idx,
+               CallTargets* targets) const;
+  // The implementation of the method in the concrete class, appended to
+  // methods; returns false if the class inherits it from outside the dex.
+  bool Implementation(uint32_t type_idx, uint32_t name_idx, uint32_t proto_idx,
+                      vector<uint32_t>* methods) const;
+  // Returns the method of the class with the signature if the class
+  // declares it virtual, or kNoIndex.
+  uint32_t Declared(uint32_t type_idx, uint32_t name_idx, uint32_t proto_idx) const;
+
+  const DexScanner& scanner_;
+  const ClassHierarchy& hierarchy_;
+  // MethodFlags of the virtual methods defined in the dex, by method_idx.
+  vector<uint8_t> flags_;
+  mutable Shard shards_[kShards];
+
+  CallResolver(const CallResolver&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_CALL_RESOLVER_H__
@@ -0,0 +1,226 @@
+#include "class_hierarchy.h"
+
+#include <algorithm>
+
+namespace egorich {
+namespace rev {
+namespace {
+
+const uint32_t kAccInterface = 0x200;
+
+}  // namespace
+
+void ClassHierarchy::Build() {
+  const size_t types = scanner_.type_ids().size();
+  class_def_.assign(types, DexScanner::kNoIndex);
+  parent_.assign(types, DexScanner::kNoIndex);
+  flags_.assign(types, 0);
+  object_ = scanner_.FindType("Ljava/lang/Object;");
+  for (uint32_t t = 0; t < types; ++t) {
+    const char c = scanner_.type_descriptor(t)[0];
+    if (c == 'L' || c == '[') flags_[t] = REFERENCE;
+  }
+
+  vector<pair<uint32_t, uint32_t>> direct;
+  const vector<ClassDefItem>& class_defs = scanner_.class_defs();
+  for (uint32_t i = 0; i < class_defs.size(); ++i) {
+    const ClassDefItem& class_def = class_defs[i];
+    const uint32_t t = class_def.type_idx();
+    // A type defined twice keeps its first class_def.
+    if (class_def_[t] != DexScanner::kNoIndex) continue;
+    class_def_[t] = i;
+    if (class_def.access_flags() & kAccInterface) flags_[t] |= INTERFACE;
+    if (t != object_ && class_def.superclass_idx() != t) parent_[t] = class_def.superclass_idx();
+    if (class_def.interfaces_offs()) {
+      const uint32_t offs = class_def.interfaces_offs();
+      const uint32_t size = scanner_.ReadUint32(offs);
+      for (uint32_t k = 0; k < size; ++k) {
+        direct.push_back({t, scanner_.ReadUShort(offs + 4 + 2*k)});
+      }
+    }
+  }
+
+  // Cuts superclass cycles: walking up from every type, a type met twice on
+  // the same walk is on a cycle, and loses its superclass.
+  vector<uint32_t> walk(types, DexScanner::kNoIndex);
+  for (uint32_t t = 0; t < types; ++t) {
+    uint32_t u = t;
+    while (walk[u] == DexScanner::kNoIndex) {
+      walk[u] = t;
+      if (parent_[u] == DexScanner::kNoIndex) break;
+      u = parent_[u];
+    }
+    if (walk[u] == t && parent_[u] != DexScanner::kNoIndex) {
+      parent_[u] = DexScanner::kNoIndex;
+    }
+  }
+
+  vector<pair<uint32_t, uint32_t>> pairs;
+  for (uint32_t t = 0; t < types; ++t) {
+    if (parent_[t] != DexScanner::kNoIndex) pairs.push_back({parent_[t], t});
+  }
+  std::sort(pairs.begin(), pairs.end());
+  MakeRows(pairs, &subclasses_);
+  LabelIntervals();
+
+  std::sort(direct.begin(), direct.end());
+  direct.erase(std::unique(direct.begin(), direct.end()), direct.end());
+  pairs.clear();
+  for (const auto& edge : direct) {
+    pairs.push_back({edge.second, edge.first});
+  }
+  std::sort(pairs.begin(), pairs.end());
+  MakeRows(pairs, &implementors_);
+  CloseInterfaces(direct);
+}
+
+void ClassHierarchy::MakeRows(const vector<pair<uint32_t, uint32_t>>& pairs, Rows* rows) const {
+  rows->offs.assign(parent_.size() + 1, 0);
+  rows->items.resize(pairs.size());
+  for (size_t i = 0; i < pairs.size(); ++i) {
+    ++rows->offs[pairs[i].first + 1];
+    rows->items[i] = pairs[i].second;
+  }
+  for (size_t t = 0; t < parent_.size(); ++t) {
+    rows->offs[t + 1] += rows->offs[t];
+  }
+}
+
+void ClassHierarchy::LabelIntervals() {
+  const size_t types = parent_.size();
+  order_.resize(types);
+  last_.resize(types);
+  types_.clear();
+  types_.reserve(types);
+  // Explicit stack of (type, next subclass), so deep hierarchies do not
+  // recurse.
+  vector<pair<uint32_t, const uint32_t*>> stack;
+  for (uint32_t root = 0; root < types; ++root) {
+    if (parent_[root] != DexScanner::kNoIndex) continue;
+    order_[root] = types_.size();
+    types_.push_back(root);
+    stack.push_back({root, subclasses_begin(root)});
+    while (!stack.empty()) {
+      const uint32_t t = stack.back().first;
+      if (stack.back().second == subclasses_end(t)) {
+        last_[t] = types_.size() - 1;
+        stack.pop_back();
+        continue;
+      }
+      const uint32_t sub = *stack.back().second++;
+      order_[sub] = types_.size();
+      types_.push_back(sub);
+      stack.push_back({sub, subclasses_begin(sub)});
+    }
+  }
+}
+
+void ClassHierarchy::CloseInterfaces(const vector<pair<uint32_t, uint32_t>>& direct) {
+  const size_t types = parent_.size();
+  Rows declared;
+  MakeRows(direct, &declared);
+
+  // The closure of a type joins its declared interfaces, their closures and
+  // the closure of its superclass. Types are closed in depth-first
+  // post-order over those edges, into slices of one buffer; a type adding
+  // nothing to its superclass shares its slice. An edge back to a type
+  // still open, on an interface cycle, is skipped.
+  enum State : uint8_t { NEW, OPEN, CLOSED };
+  vector<State> state(types, NEW);
+  vector<pair<uint32_t, uint32_t>> slice(types, {0, 0});
+  vector<uint32_t> buffer;
+  vector<uint32_t> scratch;
+  // (type, supertypes visited): the superclass first, then the declared
+  // interfaces.
+  vector<pair<uint32_t, uint32_t>> stack;
+  for (uint32_t start = 0; start < types; ++start) {
+    if (state[start] != NEW) continue;
+    state[start] = OPEN;
+    stack.push_back({start, 0});
+    while (!stack.empty()) {
+      const uint32_t t = stack.back().first;
+      const uint32_t* const begin = Row(declared, t);
+      const uint32_t count = Row(declared, t + 1) - begin;
+      const uint32_t next = stack.back().second++;
+      if (next <= count) {
+        const uint32_t super = next == 0 ? parent_[t] : begin[next - 1];
+        if (super != DexScanner::kNoIndex && state[super] == NEW) {
+          state[super] = OPEN;
+          stack.push_back({super, 0});
+        }
+        continue;
+      }
+      stack.pop_back();
+      state[t] = CLOSED;
+      const pair<uint32_t, uint32_t> inherited =
+          parent_[t] == DexScanner::kNoIndex ? pair<uint32_t, uint32_t>(0, 0) : slice[parent_[t]];
+      if (count == 0) {
+        slice[t] = inherited;
+        continue;
+      }
+      scratch.assign(buffer.begin() + inherited.first,
+                     buffer.begin() + inherited.first + inherited.second);
+      for (uint32_t k = 0; k < count; ++k) {
+        const uint32_t iface = begin[k];
+        scratch.push_back(iface);
+        if (state[iface] == CLOSED) {
+          scratch.insert(scratch.end(), buffer.begin() + slice[iface].first,
+                         buffer.begin() + slice[iface].first + slice[iface].second);
+        }
+      }
+      std::sort(scratch.begin(), scratch.end());
+      scratch.erase(std::unique(scratch.begin(), scratch.end()), scratch.end());
+      slice[t] = {buffer.size(), scratch.size()};
+      buffer.insert(buffer.end(), scratch.begin(), scratch.end());
+    }
+  }
+
+  interfaces_.offs.assign(types + 1, 0);
+  for (uint32_t t = 0; t < types; ++t) {
+    interfaces_.offs[t + 1] = interfaces_.offs[t] + slice[t].second;
+  }
+  interfaces_.items.resize(interfaces_.offs[types]);
+  for (uint32_t t = 0; t < types; ++t) {
+    std::copy(buffer.begin() + slice[t].first, buffer.begin() + slice[t].first + slice[t].second,
+              interfaces_.items.begin() + interfaces_.offs[t]);
+  }
+}
+
+bool ClassHierarchy::IsSubtypeOf(uint32_t sub, uint32_t super) const {
+  if (IsSubclassOf(sub, super)) return true;
+  if (super == object_) return flags_[sub] & REFERENCE;
+  return std::binary_search(interfaces_begin(sub), interfaces_end(sub), super);
+}
+
+void ClassHierarchy::Subtypes(uint32_t type_idx, vector<uint32_t>* types) const {
+  // Subtrees of the implementors of the interface and, in turn, of its
+  // subinterfaces. A subclass restating an interface of its superclass
+  // gives an interval nested in another; merging them lists every type
+  // once.
+  vector<pair<uint32_t, uint32_t>> intervals = {{order_[type_idx], last_[type_idx]}};
+  vector<uint32_t> pending = {type_idx};
+  vector<bool> seen(parent_.size());
+  seen[type_idx] = true;
+  while (!pending.empty()) {
+    const uint32_t iface = pending.back();
+    pending.pop_back();
+    for (const uint32_t* it = implementors_begin(iface); it != implementors_end(iface); ++it) {
+      intervals.push_back({order_[*it], last_[*it]});
+      if (!seen[*it] && implementors_begin(*it) != implementors_end(*it)) {
+        seen[*it] = true;
+        pending.push_back(*it);
+      }
+    }
+  }
+  std::sort(intervals.begin(), intervals.end());
+  uint32_t next = 0;
+  for (const auto& interval : intervals) {
+    for (uint32_t n = std::max(next, interval.first); n <= interval.second; ++n) {
+      types->push_back(types_[n]);
+    }
+    next = std::max(next, interval.second + 1);
+  }
+}
+
+}  // namespace rev
+}  // namespace egorich
@@ -0,0 +1,117 @@
+#ifndef REV_CLASS_HIERARCHY_H__
+#define REV_CLASS_HIERARCHY_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "dex_scanner.h"
+
+using std::pair;
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Superclass and interface edges of a whole dex, keyed by type_ids index.
+// Every type is a node, so classes defined outside the dex, say
+// Landroid/app/Activity;, tie together the classes extending them, but
+// their own supertypes are unknown.
+//
+// The superclass edges form a forest, which is labeled with pre-order
+// intervals: a class descends from another iff its pre-order number falls
+// within the interval of the other, so IsSubclassOf() is two comparisons.
+// Interfaces form a DAG instead; each type keeps the sorted closure of the
+// interfaces it implements, through its superclasses and superinterfaces
+// too, and IsSubtypeOf() binary searches that, usually a handful of types.
+// Adjacency lists are compressed sparse rows, like in CallGraph.
+class ClassHierarchy {
+ public:
+  explicit ClassHierarchy(const DexScanner& scanner) : scanner_(scanner) {
+  }
+
+  // Reads the class_defs of the parsed dex. On a superclass cycle, which
+  // only a broken dex has, one class loses its superclass.
+  void Build();
+
+  size_t size() const { return parent_.size(); }
+
+  // Index of the class_def of the type, or kNoIndex if it is not defined
+  // in the dex.
+  uint32_t class_def(uint32_t type_idx) const { return class_def_[type_idx]; }
+  // Whether the class_def of the type declares an interface.
+  bool is_interface(uint32_t type_idx) const { return flags_[type_idx] & INTERFACE; }
+  // Superclass of the type, or kNoIndex for types without a class_def and
+  // java.lang.Object.
+  uint32_t superclass(uint32_t type_idx) const { return parent_[type_idx]; }
+
+  // Direct subclasses, sorted.
+  const uint32_t* subclasses_begin(uint32_t type_idx) const { return Row(subclasses_, type_idx); }
+  const uint32_t* subclasses_end(uint32_t type_idx) const { return Row(subclasses_, type_idx + 1); }
+  // Classes and interfaces listing the interface among their direct
+  // interfaces, sorted.
+  const uint32_t* implementors_begin(uint32_t type_idx) const { return Row(implementors_, type_idx); }
+  const uint32_t* implementors_end(uint32_t type_idx) const { return Row(implementors_, type_idx + 1); }
+  // Interfaces the type implements or extends, directly or not, sorted.
+  const uint32_t* interfaces_begin(uint32_t type_idx) const { return Row(interfaces_, type_idx); }
+  const uint32_t* interfaces_end(uint32_t type_idx) const { return Row(interfaces_, type_idx + 1); }
+
+  // Whether sub is super or extends it, directly or not.
+  bool IsSubclassOf(uint32_t sub, uint32_t super) const {
+    return order_[super] <= order_[sub] && order_[sub] <= last_[super];
+  }
+  // Whether a reference of type sub may be assigned to one of type super:
+  // sub is a subclass of super, or implements it, or super is
+  // java.lang.Object and sub a class, interface or array.
+  bool IsSubtypeOf(uint32_t sub, uint32_t super) const;
+
+  // Appends the type and every type extending or implementing it, each
+  // once: the subtree of a class, or for an interface, the subtrees of the
+  // classes implementing it and of its subinterfaces.
+  void Subtypes(uint32_t type_idx, vector<uint32_t>* types) const;
+
+ private:
+  enum Flags {
+    INTERFACE = 1,
+    // Class, interface or array type.
+    REFERENCE = 2,
+  };
+
+  struct Rows {
+    vector<uint32_t> offs;
+    vector<uint32_t> items;
+  };
+
+  static const uint32_t* Row(const Rows& rows, uint32_t type_idx) {
+    return rows.items.data() + rows.offs[type_idx];
+  }
+  // Fills rows from (type, item) pairs sorted by type.
+  void MakeRows(const vector<pair<uint32_t, uint32_t>>& pairs, Rows* rows) const;
+  // Numbers the superclass forest in pre-order.
+  void LabelIntervals();
+  // Computes interfaces_ from the direct (type, interface) pairs.
+  void CloseInterfaces(const vector<pair<uint32_t, uint32_t>>& direct);
+
+  const DexScanner& scanner_;
+
+  vector<uint32_t> class_def_;
+  vector<uint32_t> parent_;
+  vector<uint8_t> flags_;
+  uint32_t object_;
+  // Pre-order number of a type, the last number within its subtree, and
+  // the type of a number.
+  vector<uint32_t> order_;
+  vector<uint32_t> last_;
+  vector<uint32_t> types_;
+  Rows subclasses_;
+  Rows implementors_;
+  Rows interfaces_;
+
+  ClassHierarchy(const ClassHierarchy&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_CLASS_HIERARCHY_H__
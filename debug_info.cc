@@ -0,0 +1,182 @@
+#include "debug_info.h"
+
+#include <algorithm>
+#include <new>
+
+namespace egorich {
+namespace rev {
+namespace {
+
+const uint32_t kAccStatic = 0x8;
+
+enum DebugOpcode {
+  DBG_END_SEQUENCE = 0x00,
+  DBG_ADVANCE_PC = 0x01,
+  DBG_ADVANCE_LINE = 0x02,
+  DBG_START_LOCAL = 0x03,
+  DBG_START_LOCAL_EXTENDED = 0x04,
+  DBG_END_LOCAL = 0x05,
+  DBG_RESTART_LOCAL = 0x06,
+  DBG_SET_PROLOGUE_END = 0x07,
+  DBG_SET_EPILOGUE_BEGIN = 0x08,
+  DBG_SET_FILE = 0x09,
+  DBG_FIRST_SPECIAL = 0x0A,
+};
+
+// Special opcodes advance the line by kLineBase + (op - DBG_FIRST_SPECIAL)
+// % kLineRange and the address by the quotient.
+const int kLineBase = -4;
+const int kLineRange = 15;
+
+// End of a local whose range is still open.
+const uint32_t kOpen = 0xFFFFFFFFU;
+
+// Reads an uleb128p1, where kNoIndex stands for -1.
+uint32_t ReadIndex(const DexScanner& scanner, size_t* pos) {
+  return scanner.ReadUleb128(pos) - 1;
+}
+
+}  // namespace
+
+const DebugInfo* DebugInfo::Decode(const DexScanner& scanner, uint32_t method_idx,
+                                   uint32_t access_flags, const CodeItem& code, Zone* zone) {
+  if (!code.debug_info_offs()) {
+    return NULL;
+  }
+  // The first run counts the entries, the second one fills them in.
+  DebugInfo counts;
+  counts.Run(scanner, method_idx, access_flags, code, NULL);
+
+  const size_t start = zone->Mark();
+  void* const storage = zone->Allocate(sizeof(DebugInfo));
+  Position* const positions = zone->AllocateArray<Position>(counts.position_count_);
+  Local* const locals = zone->AllocateArray<Local>(counts.local_count_);
+  const size_t mark = zone->Mark();
+  // Last local started in each register.
+  uint32_t* const open = zone->AllocateArray<uint32_t>(code.register_size());
+  if (storage == NULL || positions == NULL || locals == NULL || open == NULL) {
+    // Nothing is handed out unless all of it fits.
+    zone->Rewind(start);
+    return NULL;
+  }
+  DebugInfo* const info = new(storage) DebugInfo();
+  info->positions_ = positions;
+  info->locals_ = locals;
+  std::fill(open, open + code.register_size(), DexScanner::kNoIndex);
+  info->Run(scanner, method_idx, access_flags, code, open);
+  zone->Rewind(mark);
+  return info;
+}
+
+void DebugInfo::Run(const DexScanner& scanner, uint32_t method_idx, uint32_t access_flags,
+                    const CodeItem& code, uint32_t* open) {
+  position_count_ = 0;
+  local_count_ = 0;
+  auto start_local = [this, open] (uint16_t reg, uint32_t address, uint32_t name_idx,
+                                   uint32_t type_idx, uint32_t signature_idx) {
+    if (open) {
+      if (open[reg] != DexScanner::kNoIndex && locals_[open[reg]].end == kOpen) {
+        locals_[open[reg]].end = address;
+      }
+      open[reg] = local_count_;
+      locals_[local_count_] = {address, kOpen, reg, name_idx, type_idx, signature_idx};
+    }
+    ++local_count_;
+  };
+
+  size_t pos = code.debug_info_offs();
+  uint32_t line = scanner.ReadUleb128(&pos);
+  const uint32_t parameters_size = scanner.ReadUleb128(&pos);
+
+  // Parameters take the last registers, after the implicit this.
+  uint32_t reg = code.register_size() - code.ins_size() + ((access_flags & kAccStatic) ? 0 : 1);
+  const uint32_t parameters_offs = scanner.proto_id(scanner.method_id(method_idx).proto_idx).parameters_offs;
+  const uint32_t proto_size = parameters_offs ? scanner.ReadUint32(parameters_offs) : 0;
+  for (uint32_t i = 0; i < parameters_size; ++i) {
+    const uint32_t name_idx = ReadIndex(scanner, &pos);
+    if (i >= proto_size || reg >= code.register_size()) continue;
+    const uint32_t type_idx = scanner.ReadUShort(parameters_offs + 4 + 2*i);
+    if (name_idx != DexScanner::kNoIndex) {
+      start_local(reg, 0, name_idx, type_idx, DexScanner::kNoIndex);
+    }
+    const char wide = scanner.type_data(type_idx)[0];
+    reg += wide == 'J' || wide == 'D' ? 2 : 1;
+  }
+
+  uint32_t address = 0;
+  for (;;) {
+    const uint8_t opcode = static_cast<uint8_t>(scanner.data()[pos++]);
+    switch (opcode) {
+    case DBG_END_SEQUENCE:
+      if (open) {
+        for (size_t l = 0; l < local_count_; ++l) {
+          if (locals_[l].end == kOpen) locals_[l].end = code.instr_size();
+        }
+      }
+      return;
+    case DBG_ADVANCE_PC:
+      address += scanner.ReadUleb128(&pos);
+      break;
+    case DBG_ADVANCE_LINE:
+      line += scanner.ReadSleb128(&pos);
+      break;
+    case DBG_START_LOCAL:
+    case DBG_START_LOCAL_EXTENDED: {
+      const uint16_t local_reg = scanner.ReadUleb128(&pos);
+      const uint32_t name_idx = ReadIndex(scanner, &pos);
+      const uint32_t type_idx = ReadIndex(scanner, &pos);
+      const uint32_t signature_idx =
+          opcode == DBG_START_LOCAL_EXTENDED ? ReadIndex(scanner, &pos) : DexScanner::kNoIndex;
+      start_local(local_reg, address, name_idx, type_idx, signature_idx);
+      break;
+    }
+    case DBG_END_LOCAL: {
+      const uint16_t local_reg = scanner.ReadUleb128(&pos);
+      if (open && open[local_reg] != DexScanner::kNoIndex && locals_[open[local_reg]].end == kOpen) {
+        locals_[open[local_reg]].end = address;
+      }
+      break;
+    }
+    case DBG_RESTART_LOCAL: {
+      const uint16_t local_reg = scanner.ReadUleb128(&pos);
+      if (!open) {
+        // Counted whether or not there is a local to restart.
+        ++local_count_;
+      } else if (open[local_reg] != DexScanner::kNoIndex && locals_[open[local_reg]].end != kOpen) {
+        const Local last = locals_[open[local_reg]];
+        start_local(local_reg, address, last.name_idx, last.type_idx, last.signature_idx);
+      }
+      break;
+    }
+    case DBG_SET_PROLOGUE_END:
+    case DBG_SET_EPILOGUE_BEGIN:
+      break;
+    case DBG_SET_FILE:
+      // Methods of a class spanning several files are rare enough to
+      // report the lines only.
+      ReadIndex(scanner, &pos);
+      break;
+    default: {
+      const int adjusted = opcode - DBG_FIRST_SPECIAL;
+      line += kLineBase + adjusted % kLineRange;
+      address += adjusted / kLineRange;
+      if (open) {
+        positions_[position_count_] = {address, line};
+      }
+      ++position_count_;
+      break;
+    }
+    }
+  }
+}
+
+uint32_t DebugInfo::Line(uint32_t pc) const {
+  const Position* const end = positions_ + position_count_;
+  const Position* const begin = positions_;
+  const Position* it = std::upper_bound(begin, end, pc,
+                                        [] (uint32_t pc, const Position& p) { return pc < p.pc; });
+  return it == begin ? 0 : (it - 1)->line;
+}
+
+}  // namespace rev
+}  // namespace egorich
@@ -0,0 +1,68 @@
+#ifndef REV_DEBUG_INFO_H__
+#define REV_DEBUG_INFO_H__
+
+#include <cstddef>
+#include <cstdint>
+
+#include "dex_scanner.h"
+#include "zone.h"
+
+namespace egorich {
+namespace rev {
+
+// Source lines and local variables of a method, decoded from its
+// debug_info_item. Everything lives in the zone of the method, so a
+// DebugInfo is trivially destructible and goes away with Zone::Reset().
+class DebugInfo {
+ public:
+  // Line the instructions from pc on map to.
+  struct Position {
+    uint32_t pc;
+    uint32_t line;
+  };
+
+  // A register holding a named variable over [start, end).
+  struct Local {
+    uint32_t start;
+    uint32_t end;
+    uint16_t reg;
+    // Indices are kNoIndex when absent.
+    uint32_t name_idx;
+    uint32_t type_idx;
+    uint32_t signature_idx;
+  };
+
+  // Runs the debug_info state machine of the code. Returns NULL if the
+  // method has no debug info or the zone is exhausted.
+  static const DebugInfo* Decode(const DexScanner& scanner, uint32_t method_idx,
+                                 uint32_t access_flags, const CodeItem& code, Zone* zone);
+
+  // Line of the instruction at pc, or zero if no position covers it.
+  uint32_t Line(uint32_t pc) const;
+
+  // Ordered by pc.
+  const Position* positions() const { return positions_; }
+  size_t position_count() const { return position_count_; }
+  // Ordered by start, then by the order the bytecode declares them in.
+  const Local* locals() const { return locals_; }
+  size_t local_count() const { return local_count_; }
+
+ private:
+  DebugInfo() : positions_(NULL), position_count_(0), locals_(NULL), local_count_(0) {
+  }
+
+  // Runs the state machine and counts the entries of the tables. Given the
+  // index of the last local of every register, it fills them in as well.
+  void Run(const DexScanner& scanner, uint32_t method_idx, uint32_t access_flags,
+           const CodeItem& code, uint32_t* open);
+
+  Position* positions_;
+  size_t position_count_;
+  Local* locals_;
+  size_t local_count_;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_DEBUG_INFO_H__
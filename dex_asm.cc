@@ -278,5 +278,326 @@ const IDefBase* iTable[256] = {
   new IDef<UnknownLayout>("<unknown>"),
 };
 
+const uint8_t kInstructionUnits[256] = {
+  // 0
+  1, 1, 2, 3, 1, 2, 3, 1, 2, 3, 1, 1, 1, 1, 1, 1,
+  // 1
+  1, 1, 1, 2, 3, 2, 2, 3, 5, 2, 2, 3, 2, 1, 1, 2,
+  // 2
+  2, 1, 2, 2, 3, 3, 3, 1, 1, 2, 3, 3, 3, 2, 2, 2,
+  // 3
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1,
+  // 4
+  1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  // 5
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  // 6
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3,
+  // 7
+  3, 3, 3, 1, 3, 3, 3, 3, 3, 1, 1, 1, 1, 1, 1, 1,
+  // 8
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  // 9
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  // A
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  // B
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  // C
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  // D
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  // E
+  2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  // F
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+};
+
+namespace {
+
+// Number of registers taken by a value of the given width.
+enum Width { NONE = 0, NARROW = 1, WIDE = 2 };
+
+// Register widths of (result, first operand, second operand) of the unary and
+// binary arithmetic ops 0x7B..0xE2.
+struct ArithWidths {
+  Width def;
+  Width lhs;
+  Width rhs;
+};
+
+ArithWidths GetArithWidths(uint8_t opcode) {
+  if (opcode >= 0xB0 && opcode <= 0xCF) {
+    // binop/2addr has the same operand types as binop.
+    opcode -= 0x20;
+  }
+  switch (opcode) {
+  case 0x7D: case 0x7E: case 0x80: case 0x86: case 0x8B:
+    return {WIDE, WIDE, NONE};
+  case 0x81: case 0x83: case 0x88: case 0x89:
+    return {WIDE, NARROW, NONE};
+  case 0x84: case 0x85: case 0x8A: case 0x8C:
+    return {NARROW, WIDE, NONE};
+  default:
+    break;
+  }
+  if (opcode <= 0x8F) {
+    return {NARROW, NARROW, NONE};
+  }
+  if ((opcode >= 0x9B && opcode <= 0xA2) || (opcode >= 0xAB && opcode <= 0xAF)) {
+    return {WIDE, WIDE, WIDE};
+  }
+  if (opcode >= 0xA3 && opcode <= 0xA5) {
+    // shl/shr/ushr-long shift by an int.
+    return {WIDE, WIDE, NARROW};
+  }
+  return {NARROW, NARROW, NARROW};
+}
+
+void AddDef(RegisterAccess* access, uint16_t reg, Width width) {
+  for (int i = 0; i < width; ++i) {
+    access->defs[access->def_count++] = reg + i;
+  }
+}
+
+void AddUse(RegisterAccess* access, uint16_t reg, Width width) {
+  for (int i = 0; i < width; ++i) {
+    access->uses[access->use_count++] = reg + i;
+  }
+}
+
+}  // namespace
+
+ReferenceKind OpcodeReference(uint8_t opcode) {
+  switch (opcode) {
+  case 0x1A: case 0x1B:  // const-string, const-string/jumbo
+    return REF_STRING;
+  case 0x1C: case 0x1F: case 0x20:  // const-class, check-cast, instance-of
+  case 0x22: case 0x23:  // new-instance, new-array
+  case 0x24: case 0x25:  // filled-new-array, filled-new-array/range
+    return REF_TYPE;
+  default:
+    break;
+  }
+  if (0x52 <= opcode && opcode <= 0x6D) {  // iget*, iput*, sget*, sput*
+    return REF_FIELD;
+  }
+  if ((0x6E <= opcode && opcode <= 0x72) || (0x74 <= opcode && opcode <= 0x78)) {  // invoke-*
+    return REF_METHOD;
+  }
+  return REF_NONE;
+}
+
+template <typename Reader>
+ReferenceKind ReadReference(const Reader* scanner, size_t offs, uint32_t* index) {
+  const uint8_t opcode = scanner->ReadUShort(offs) & 0xFF;
+  const IDefBase* const instr = iTable[opcode];
+  const ReferenceKind kind = OpcodeReference(opcode);
+  // The format of the instruction tells where the index is.
+  switch (kind) {
+  case REF_NONE:
+    return REF_NONE;
+  case REF_STRING:
+    *index = opcode == 0x1B ? layout<L_31c>(instr)->B(scanner, offs) : layout<L_21c>(instr)->B(scanner, offs);
+    break;
+  case REF_TYPE:
+    if (opcode == 0x20 || opcode == 0x23) {
+      *index = layout<L_22c>(instr)->C(scanner, offs);
+    } else if (opcode == 0x24) {
+      *index = layout<L_35c>(instr)->B(scanner, offs);
+    } else if (opcode == 0x25) {
+      *index = layout<L_3rc>(instr)->B(scanner, offs);
+    } else {
+      *index = layout<L_21c>(instr)->B(scanner, offs);
+    }
+    break;
+  case REF_FIELD:
+    // iget*, iput* are 22c; sget*, sput* are 21c.
+    *index = opcode < 0x60 ? layout<L_22c>(instr)->C(scanner, offs) : layout<L_21c>(instr)->B(scanner, offs);
+    break;
+  case REF_METHOD:
+    *index = opcode < 0x74 ? layout<L_35c>(instr)->B(scanner, offs) : layout<L_3rc>(instr)->B(scanner, offs);
+    break;
+  }
+  return kind;
+}
+
+template <typename Reader>
+void ReadRegisterAccess(const Reader* scanner, size_t offs, RegisterAccess* access) {
+  access->def_count = 0;
+  access->use_count = 0;
+  const uint8_t opcode = scanner->ReadUShort(offs) & 0xFF;
+  const IDefBase* const instr = iTable[opcode];
+  const Width wide = (opcode >= 0x04 && opcode <= 0x06) || opcode == 0x0B || opcode == 0x10
+      || (opcode >= 0x16 && opcode <= 0x19) || opcode == 0x45 || opcode == 0x4C
+      || opcode == 0x53 || opcode == 0x5A || opcode == 0x61 || opcode == 0x68 ? WIDE : NARROW;
+
+  switch (opcode) {
+  case 0x01: case 0x04: case 0x07: {
+    const L_12x* l = layout<L_12x>(instr);
+    AddDef(access, l->vA(scanner, offs), wide);
+    AddUse(access, l->vB(scanner, offs), wide);
+    break;
+  }
+  case 0x02: case 0x05: case 0x08: {
+    const L_22x* l = layout<L_22x>(instr);
+    AddDef(access, l->vA(scanner, offs), wide);
+    AddUse(access, l->vB(scanner, offs), wide);
+    break;
+  }
+  case 0x03: case 0x06: case 0x09: {
+    const L_32x* l = layout<L_32x>(instr);
+    AddDef(access, l->vA(scanner, offs), wide);
+    AddUse(access, l->vB(scanner, offs), wide);
+    break;
+  }
+  case 0x0A: case 0x0B: case 0x0C: case 0x0D:
+    AddDef(access, layout<L_11x>(instr)->vA(scanner, offs), wide);
+    break;
+  case 0x0F: case 0x10: case 0x11:
+  case 0x1D: case 0x1E: case 0x27:
+    AddUse(access, layout<L_11x>(instr)->vA(scanner, offs), wide);
+    break;
+  case 0x12:
+    AddDef(access, layout<L_11n>(instr)->vA(scanner, offs), NARROW);
+    break;
+  case 0x13: case 0x16:
+    AddDef(access, layout<L_21s>(instr)->vA(scanner, offs), wide);
+    break;
+  case 0x14: case 0x17:
+    AddDef(access, layout<L_31i>(instr)->vA(scanner, offs), wide);
+    break;
+  case 0x15: case 0x19:
+    AddDef(access, layout<L_21h>(instr)->vA(scanner, offs), wide);
+    break;
+  case 0x18:
+    AddDef(access, layout<L_51l>(instr)->vA(scanner, offs), WIDE);
+    break;
+  case 0x1A: case 0x1C: case 0x22:
+  case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66:
+    AddDef(access, layout<L_21c>(instr)->vA(scanner, offs), wide);
+    break;
+  case 0x1B:
+    AddDef(access, layout<L_31c>(instr)->vA(scanner, offs), NARROW);
+    break;
+  case 0x1F: {
+    // check-cast narrows the type of its register in place.
+    const uint16_t reg = layout<L_21c>(instr)->vA(scanner, offs);
+    AddUse(access, reg, NARROW);
+    AddDef(access, reg, NARROW);
+    break;
+  }
+  case 0x67: case 0x68: case 0x69: case 0x6A: case 0x6B: case 0x6C: case 0x6D:
+    AddUse(access, layout<L_21c>(instr)->vA(scanner, offs), wide);
+    break;
+  case 0x20: case 0x23:
+  case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57: case 0x58: {
+    const L_22c* l = layout<L_22c>(instr);
+    AddDef(access, l->vA(scanner, offs), wide);
+    AddUse(access, l->vB(scanner, offs), NARROW);
+    break;
+  }
+  case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5E: case 0x5F: {
+    const L_22c* l = layout<L_22c>(instr);
+    AddUse(access, l->vA(scanner, offs), wide);
+    AddUse(access, l->vB(scanner, offs), NARROW);
+    break;
+  }
+  case 0x21: {
+    const L_12x* l = layout<L_12x>(instr);
+    AddDef(access, l->vA(scanner, offs), NARROW);
+    AddUse(access, l->vB(scanner, offs), NARROW);
+    break;
+  }
+  case 0x24:
+  case 0x6E: case 0x6F: case 0x70: case 0x71: case 0x72: {
+    const L_35c* l = layout<L_35c>(instr);
+    const size_t count = l->A(scanner, offs);
+    for (size_t i = 0; i < count; ++i) {
+      AddUse(access, l->v(scanner, offs, i), NARROW);
+    }
+    break;
+  }
+  case 0x25:
+  case 0x74: case 0x75: case 0x76: case 0x77: case 0x78: {
+    const L_3rc* l = layout<L_3rc>(instr);
+    const size_t count = l->A(scanner, offs);
+    for (size_t i = 0; i < count; ++i) {
+      AddUse(access, l->v(scanner, offs, i), NARROW);
+    }
+    break;
+  }
+  case 0x26: case 0x2B: case 0x2C:
+    AddUse(access, layout<L_31t>(instr)->vA(scanner, offs), NARROW);
+    break;
+  case 0x2D: case 0x2E: case 0x2F: case 0x30: case 0x31: {
+    const Width operand = opcode >= 0x2F ? WIDE : NARROW;
+    const L_23x* l = layout<L_23x>(instr);
+    AddDef(access, l->vA(scanner, offs), NARROW);
+    AddUse(access, l->vB(scanner, offs), operand);
+    AddUse(access, l->vC(scanner, offs), operand);
+    break;
+  }
+  case 0x32: case 0x33: case 0x34: case 0x35: case 0x36: case 0x37: {
+    const L_22t* l = layout<L_22t>(instr);
+    AddUse(access, l->vA(scanner, offs), NARROW);
+    AddUse(access, l->vB(scanner, offs), NARROW);
+    break;
+  }
+  case 0x38: case 0x39: case 0x3A: case 0x3B: case 0x3C: case 0x3D:
+    AddUse(access, layout<L_21t>(instr)->vA(scanner, offs), NARROW);
+    break;
+  case 0x44: case 0x45: case 0x46: case 0x47: case 0x48: case 0x49: case 0x4A: {
+    const L_23x* l = layout<L_23x>(instr);
+    AddDef(access, l->vA(scanner, offs), wide);
+    AddUse(access, l->vB(scanner, offs), NARROW);
+    AddUse(access, l->vC(scanner, offs), NARROW);
+    break;
+  }
+  case 0x4B: case 0x4C: case 0x4D: case 0x4E: case 0x4F: case 0x50: case 0x51: {
+    const L_23x* l = layout<L_23x>(instr);
+    AddUse(access, l->vA(scanner, offs), wide);
+    AddUse(access, l->vB(scanner, offs), NARROW);
+    AddUse(access, l->vC(scanner, offs), NARROW);
+    break;
+  }
+  default:
+    if (opcode >= 0x7B && opcode <= 0x8F) {
+      const ArithWidths w = GetArithWidths(opcode);
+      const L_12x* l = layout<L_12x>(instr);
+      AddDef(access, l->vA(scanner, offs), w.def);
+      AddUse(access, l->vB(scanner, offs), w.lhs);
+    } else if (opcode >= 0x90 && opcode <= 0xAF) {
+      const ArithWidths w = GetArithWidths(opcode);
+      const L_23x* l = layout<L_23x>(instr);
+      AddDef(access, l->vA(scanner, offs), w.def);
+      AddUse(access, l->vB(scanner, offs), w.lhs);
+      AddUse(access, l->vC(scanner, offs), w.rhs);
+    } else if (opcode >= 0xB0 && opcode <= 0xCF) {
+      const ArithWidths w = GetArithWidths(opcode);
+      const L_12x* l = layout<L_12x>(instr);
+      AddUse(access, l->vA(scanner, offs), w.lhs);
+      AddUse(access, l->vB(scanner, offs), w.rhs);
+      AddDef(access, l->vA(scanner, offs), w.def);
+    } else if (opcode >= 0xD0 && opcode <= 0xD7) {
+      const L_22s* l = layout<L_22s>(instr);
+      AddDef(access, l->vA(scanner, offs), NARROW);
+      AddUse(access, l->vB(scanner, offs), NARROW);
+    } else if (opcode >= 0xD8 && opcode <= 0xE2) {
+      const L_22b* l = layout<L_22b>(instr);
+      AddDef(access, l->vA(scanner, offs), NARROW);
+      AddUse(access, l->vB(scanner, offs), NARROW);
+    }
+    break;
+  }
+}
+
+template ReferenceKind ReadReference(const DexScanner*, size_t, uint32_t*);
+template ReferenceKind ReadReference(const DexReader<NativeOrder>*, size_t, uint32_t*);
+template ReferenceKind ReadReference(const DexReader<SwappedOrder>*, size_t, uint32_t*);
+template void ReadRegisterAccess(const DexScanner*, size_t, RegisterAccess*);
+template void ReadRegisterAccess(const DexReader<NativeOrder>*, size_t, RegisterAccess*);
+template void ReadRegisterAccess(const DexReader<SwappedOrder>*, size_t, RegisterAccess*);
+
 }  // namespace rev
 }  // namespace egorich
@@ -10,19 +10,24 @@ using std::stringstream;
 namespace egorich {
 namespace rev {
 
+// Operand decoders of the instruction formats. The accessors take either
+// the DexScanner or a DexReader of a fixed byte order.
 class ILayout {
  public:
-  uint16_t ReadUint16(const DexScanner* scanner, size_t offs, size_t begin, size_t length) const {
+  template <typename Reader>
+  uint16_t ReadUint16(const Reader* scanner, size_t offs, size_t begin, size_t length) const {
     uint16_t t = scanner->ReadUShort(offs);
     return (t >> begin) & ((1 << length) - 1);
   }
 
-  int16_t ReadInt16(const DexScanner* scanner, size_t offs, size_t begin, size_t length) const {
+  template <typename Reader>
+  int16_t ReadInt16(const Reader* scanner, size_t offs, size_t begin, size_t length) const {
     int16_t t = static_cast<int16_t>(scanner->ReadUShort(offs));
     return (t << (16 - begin - length)) >> (16 - length);
   }
 
-  uint16_t opcode(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  uint16_t opcode(const Reader* scanner, size_t offs) const {
     return ReadUint16(scanner, offs, 0, 8);
   }
 
@@ -31,14 +36,16 @@ class ILayout {
 
 class UnknownLayout : public ILayout {
  public:
-  size_t size(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  size_t size(const Reader* scanner, size_t offs) const {
     return 1;
   }
 };
 
 class VarSizeBlock : public ILayout {
  public:
-  size_t size(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  size_t size(const Reader* scanner, size_t offs) const {
     switch (mode(scanner, offs)) {
     case 1:
       // packed-switch-payload
@@ -55,7 +62,8 @@ class VarSizeBlock : public ILayout {
     }
   }
 
-  uint16_t mode(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  uint16_t mode(const Reader* scanner, size_t offs) const {
     return ReadUint16(scanner, offs, 8, 8);
   }
 };
@@ -63,26 +71,73 @@ class VarSizeBlock : public ILayout {
 template <size_t Size>
 class FixedLayout : public ILayout {
  public:
-  size_t size(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  size_t size(const Reader* scanner, size_t offs) const {
     return Size;
   }
 };
 
 class L_10x : public FixedLayout<1> {
+ public:
+  string dasm(const DexScanner* s, size_t o) const { return ""; }
 };
 
 class L_12x : public FixedLayout<1> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 4);
+  }
+
+  template <typename Reader>
+  uint16_t vB(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 12, 4);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", v" << vB(s, o);
+    return ss.str();
+  }
 };
 
 class L_11n : public FixedLayout<1> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 4);
+  }
+
+  template <typename Reader>
+  int16_t B(const Reader* scanner, size_t offs) const {
+    return ReadInt16(scanner, offs, 12, 4);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", #" << B(s, o);
+    return ss.str();
+  }
 };
 
 class L_11x : public FixedLayout<1> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 8);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o);
+    return ss.str();
+  }
 };
 
 class L_10t : public FixedLayout<1> {
  public:
-  int16_t A(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  int16_t A(const Reader* scanner, size_t offs) const {
     return ReadInt16(scanner, offs, 8, 8);
   }
 
@@ -95,7 +150,8 @@ class L_10t : public FixedLayout<1> {
 
 class L_20t : public FixedLayout<2> {
  public:
-  int16_t A(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  int16_t A(const Reader* scanner, size_t offs) const {
     return ReadInt16(scanner, offs + 2, 0, 16);
   }
 
@@ -110,15 +166,33 @@ class L_20bc : public FixedLayout<2> {
 };
 
 class L_22x : public FixedLayout<2> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 8);
+  }
+
+  template <typename Reader>
+  uint16_t vB(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs + 2, 0, 16);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", v" << vB(s, o);
+    return ss.str();
+  }
 };
 
 class L_21t : public FixedLayout<2> {
  public:
-  uint16_t vA(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
     return ReadUint16(scanner, offs, 8, 8);
   }
 
-  int16_t B(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  int16_t B(const Reader* scanner, size_t offs) const {
     return ReadInt16(scanner, offs + 2, 0, 16);
   }
 
@@ -130,31 +204,125 @@ class L_21t : public FixedLayout<2> {
 };
 
 class L_21s : public FixedLayout<2> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 8);
+  }
+
+  template <typename Reader>
+  int16_t B(const Reader* scanner, size_t offs) const {
+    return ReadInt16(scanner, offs + 2, 0, 16);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", #" << B(s, o);
+    return ss.str();
+  }
 };
 
+// B holds the high 16 bits of a 32-bit (or 64-bit for the wide form) literal.
 class L_21h : public FixedLayout<2> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 8);
+  }
+
+  template <typename Reader>
+  int16_t B(const Reader* scanner, size_t offs) const {
+    return ReadInt16(scanner, offs + 2, 0, 16);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", #" << B(s, o) << "h";
+    return ss.str();
+  }
 };
 
 class L_21c : public FixedLayout<2> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 8);
+  }
+
+  template <typename Reader>
+  uint16_t B(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs + 2, 0, 16);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", @" << B(s, o);
+    return ss.str();
+  }
 };
 
 class L_23x : public FixedLayout<2> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 8);
+  }
+
+  template <typename Reader>
+  uint16_t vB(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs + 2, 0, 8);
+  }
+
+  template <typename Reader>
+  uint16_t vC(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs + 2, 8, 8);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", v" << vB(s, o) << ", v" << vC(s, o);
+    return ss.str();
+  }
 };
 
 class L_22b : public FixedLayout<2> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 8);
+  }
+
+  template <typename Reader>
+  uint16_t vB(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs + 2, 0, 8);
+  }
+
+  template <typename Reader>
+  int16_t C(const Reader* scanner, size_t offs) const {
+    return ReadInt16(scanner, offs + 2, 8, 8);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", v" << vB(s, o) << ", #" << C(s, o);
+    return ss.str();
+  }
 };
 
 class L_22t : public FixedLayout<2> {
  public:
-  uint16_t vA(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
     return ReadUint16(scanner, offs, 8, 4);
   }
 
-  uint16_t vB(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  uint16_t vB(const Reader* scanner, size_t offs) const {
     return ReadUint16(scanner, offs, 12, 4);
   }
 
-  int16_t C(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  int16_t C(const Reader* scanner, size_t offs) const {
     return ReadInt16(scanner, offs + 2, 0, 16);
   }
 
@@ -166,9 +334,51 @@ class L_22t : public FixedLayout<2> {
 };
 
 class L_22s : public FixedLayout<2> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 4);
+  }
+
+  template <typename Reader>
+  uint16_t vB(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 12, 4);
+  }
+
+  template <typename Reader>
+  int16_t C(const Reader* scanner, size_t offs) const {
+    return ReadInt16(scanner, offs + 2, 0, 16);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", v" << vB(s, o) << ", #" << C(s, o);
+    return ss.str();
+  }
 };
 
 class L_22c : public FixedLayout<2> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 4);
+  }
+
+  template <typename Reader>
+  uint16_t vB(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 12, 4);
+  }
+
+  template <typename Reader>
+  uint16_t C(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs + 2, 0, 16);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", v" << vB(s, o) << ", @" << C(s, o);
+    return ss.str();
+  }
 };
 
 class L_22cs : public FixedLayout<2> {
@@ -176,7 +386,8 @@ class L_22cs : public FixedLayout<2> {
 
 class L_30t : public FixedLayout<3> {
  public:
-  int32_t A(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  int32_t A(const Reader* scanner, size_t offs) const {
     return static_cast<int32_t>(ReadUint16(scanner, offs + 2, 0, 16))
         | (static_cast<int32_t>(ReadInt16(scanner, offs + 4, 0, 16)) << 16);
   }
@@ -189,18 +400,53 @@ class L_30t : public FixedLayout<3> {
 };
 
 class L_32x : public FixedLayout<3> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs + 2, 0, 16);
+  }
+
+  template <typename Reader>
+  uint16_t vB(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs + 4, 0, 16);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", v" << vB(s, o);
+    return ss.str();
+  }
 };
 
 class L_31i : public FixedLayout<3> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 8);
+  }
+
+  template <typename Reader>
+  int32_t B(const Reader* scanner, size_t offs) const {
+    return static_cast<int32_t>(ReadUint16(scanner, offs + 2, 0, 16))
+        | (static_cast<int32_t>(ReadInt16(scanner, offs + 4, 0, 16)) << 16);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", #" << B(s, o);
+    return ss.str();
+  }
 };
 
 class L_31t : public FixedLayout<3> {
  public:
-  uint16_t vA(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
     return ReadUint16(scanner, offs, 8, 8);
   }
 
-  int32_t B(const DexScanner* scanner, size_t offs) const {
+  template <typename Reader>
+  int32_t B(const Reader* scanner, size_t offs) const {
     return static_cast<int32_t>(ReadUint16(scanner, offs + 2, 0, 16))
         | (static_cast<int32_t>(ReadInt16(scanner, offs + 4, 0, 16)) << 16);
   }
@@ -213,9 +459,53 @@ class L_31t : public FixedLayout<3> {
 };
 
 class L_31c : public FixedLayout<3> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 8);
+  }
+
+  template <typename Reader>
+  uint32_t B(const Reader* scanner, size_t offs) const {
+    return static_cast<uint32_t>(ReadUint16(scanner, offs + 2, 0, 16))
+        | (static_cast<uint32_t>(ReadUint16(scanner, offs + 4, 0, 16)) << 16);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", @" << B(s, o);
+    return ss.str();
+  }
 };
 
+// A is the number of argument registers, listed by v(0)...v(A - 1).
 class L_35c : public FixedLayout<3> {
+ public:
+  template <typename Reader>
+  uint16_t A(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 12, 4);
+  }
+
+  template <typename Reader>
+  uint16_t B(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs + 2, 0, 16);
+  }
+
+  template <typename Reader>
+  uint16_t v(const Reader* scanner, size_t offs, size_t i) const {
+    return i < 4 ? ReadUint16(scanner, offs + 4, 4 * i, 4)
+                 : ReadUint16(scanner, offs, 8, 4);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "{";
+    for (size_t i = 0; i < A(s, o); ++i) {
+      ss << (i ? ", v" : "v") << v(s, o, i);
+    }
+    ss << "}, @" << B(s, o);
+    return ss.str();
+  }
 };
 
 class L_35ms : public FixedLayout<3> {
@@ -224,7 +514,34 @@ class L_35ms : public FixedLayout<3> {
 class L_35mi : public FixedLayout<3> {
 };
 
+// A is the number of argument registers, starting from vC.
 class L_3rc : public FixedLayout<3> {
+ public:
+  template <typename Reader>
+  uint16_t A(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 8);
+  }
+
+  template <typename Reader>
+  uint16_t B(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs + 2, 0, 16);
+  }
+
+  template <typename Reader>
+  uint16_t vC(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs + 4, 0, 16);
+  }
+
+  template <typename Reader>
+  uint16_t v(const Reader* scanner, size_t offs, size_t i) const {
+    return vC(scanner, offs) + i;
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "{v" << vC(s, o) << " .. v" << vC(s, o) + A(s, o) - 1 << "}, @" << B(s, o);
+    return ss.str();
+  }
 };
 
 class L_3rms : public FixedLayout<3> {
@@ -234,6 +551,26 @@ class L_3rmi : public FixedLayout<3> {
 };
 
 class L_51l : public FixedLayout<5> {
+ public:
+  template <typename Reader>
+  uint16_t vA(const Reader* scanner, size_t offs) const {
+    return ReadUint16(scanner, offs, 8, 8);
+  }
+
+  template <typename Reader>
+  int64_t B(const Reader* scanner, size_t offs) const {
+    uint64_t result = 0;
+    for (size_t i = 0; i < 4; ++i) {
+      result |= static_cast<uint64_t>(ReadUint16(scanner, offs + 2 + 2*i, 0, 16)) << (16*i);
+    }
+    return static_cast<int64_t>(result);
+  }
+
+  string dasm(const DexScanner* s, size_t o) const {
+    stringstream ss;
+    ss << "v" << vA(s, o) << ", #" << B(s, o);
+    return ss.str();
+  }
 };
 
 class IDefBase {
@@ -276,6 +613,54 @@ class IDef : public IDefBase {
 
 extern const IDefBase* iTable[256];
 
+template <typename Layout>
+const Layout* layout(const IDefBase* base) {
+  return static_cast<const Layout*>(base->Get());
+}
+
+// Code units of the instruction of each opcode; nop stands for the payloads
+// as well, which InstructionSize() measures.
+extern const uint8_t kInstructionUnits[256];
+
+template <typename Reader>
+size_t InstructionSize(const Reader* scanner, size_t offs) {
+  const uint8_t opcode = scanner->ReadUShort(offs) & 0xFF;
+  return opcode ? kInstructionUnits[opcode] : VarSizeBlock().size(scanner, offs);
+}
+
+// Registers read and written by a single instruction. Wide values occupy a
+// register pair, and both registers of the pair are listed.
+struct RegisterAccess {
+  static constexpr size_t kMaxUses = 256;
+
+  uint16_t def_count;
+  uint16_t use_count;
+  uint16_t defs[2];
+  uint16_t uses[kMaxUses];
+};
+
+// Defined for the DexScanner and for DexReader of either byte order.
+template <typename Reader>
+void ReadRegisterAccess(const Reader* scanner, size_t offs, RegisterAccess* access);
+
+// Section of the ids an instruction refers to.
+enum ReferenceKind {
+  REF_NONE,
+  REF_STRING,
+  REF_TYPE,
+  REF_FIELD,
+  REF_METHOD,
+};
+
+// What instructions of the opcode refer to; ReadReference() reads their
+// index.
+ReferenceKind OpcodeReference(uint8_t opcode);
+
+// Returns what the instruction at offs refers to, and the index into the
+// section through *index. Defined as ReadRegisterAccess() is.
+template <typename Reader>
+ReferenceKind ReadReference(const Reader* scanner, size_t offs, uint32_t* index);
+
 }  // namespace rev
 }  // namespace egorich
 
@@ -0,0 +1,303 @@
+#include "dex_diff.h"
+
+#include <algorithm>
+
+#include "dex_asm.h"
+#include "parallel.h"
+
+namespace egorich {
+namespace rev {
+namespace {
+
+// Items mapped per task; small sections are mapped by a single one.
+const size_t kChunk = 4096;
+
+// Runs f(i) for every i in [0, size), in chunks spread over the threads.
+template <typename F>
+void ForChunks(size_t size, size_t threads, F f) {
+  ParallelFor((size + kChunk - 1) / kChunk, threads, [size, &f] (size_t chunk, size_t worker) {
+    for (size_t i = chunk * kChunk; i < std::min(size, (chunk + 1) * kChunk); ++i) {
+      f(i);
+    }
+  });
+}
+
+// Index of every method of the class, direct or virtual, sorted.
+void ClassMethods(const ClassDefItem& class_def, vector<pair<uint32_t, const EncodedMethod*>>* methods) {
+  for (int k = 0; k < 2; ++k) {
+    uint32_t method_idx = 0;
+    for (const EncodedMethod& method : k ? class_def.virtual_methods() : class_def.direct_methods()) {
+      method_idx += method.method_idx_diff;
+      methods->push_back({method_idx, &method});
+    }
+  }
+  std::sort(methods->begin(), methods->end());
+}
+
+}  // namespace
+
+void DexDiff::MapIds(size_t threads) {
+  // Strings and types are sorted by contents in both files, so they are
+  // merged.
+  const vector<string>& old_strings = old_.string_ids();
+  const vector<string>& new_strings = new_.string_ids();
+  strings_.assign(old_strings.size(), DexScanner::kNoIndex);
+  for (size_t i = 0, j = 0; i < old_strings.size() && j < new_strings.size();) {
+    const int order = old_strings[i].compare(new_strings[j]);
+    if (order == 0) strings_[i] = j;
+    i += order <= 0;
+    j += order >= 0;
+  }
+  const vector<TypeIdItem>& old_types = old_.type_ids();
+  const vector<TypeIdItem>& new_types = new_.type_ids();
+  types_.assign(old_types.size(), DexScanner::kNoIndex);
+  for (size_t i = 0, j = 0; i < old_types.size() && j < new_types.size();) {
+    const uint32_t descriptor_idx = strings_[old_types[i].descriptor_idx];
+    if (descriptor_idx == DexScanner::kNoIndex) {
+      ++i;
+      continue;
+    }
+    if (new_types[j].descriptor_idx < descriptor_idx) {
+      ++j;
+      continue;
+    }
+    if (new_types[j].descriptor_idx == descriptor_idx) types_[i] = j;
+    ++i;
+  }
+
+  // The others are looked up in the new file by the mapped key.
+  protos_.assign(old_.proto_ids().size(), DexScanner::kNoIndex);
+  ForChunks(protos_.size(), threads, [this] (size_t i) {
+    const ProtoIdItem proto = old_.proto_id(i);
+    vector<uint32_t> parameters;
+    const uint32_t size = proto.parameters_offs ? old_.ReadUint32(proto.parameters_offs) : 0;
+    for (uint32_t p = 0; p < size; ++p) {
+      parameters.push_back(types_[old_.ReadUShort(proto.parameters_offs + 4 + 2*p)]);
+      if (parameters.back() == DexScanner::kNoIndex) return;
+    }
+    if (types_[proto.return_type_idx] != DexScanner::kNoIndex) {
+      protos_[i] = new_.FindProto(types_[proto.return_type_idx], parameters);
+    }
+  });
+  fields_.assign(old_.field_ids().size(), DexScanner::kNoIndex);
+  ForChunks(fields_.size(), threads, [this] (size_t i) {
+    const FieldIdItem field = old_.field_id(i);
+    if (types_[field.class_idx] != DexScanner::kNoIndex && strings_[field.name_idx] != DexScanner::kNoIndex
+        && types_[field.type_idx] != DexScanner::kNoIndex) {
+      fields_[i] = new_.FindField(types_[field.class_idx], strings_[field.name_idx], types_[field.type_idx]);
+    }
+  });
+  methods_.assign(old_.method_ids().size(), DexScanner::kNoIndex);
+  ForChunks(methods_.size(), threads, [this] (size_t i) {
+    const MethodIdItem method = old_.method_id(i);
+    if (types_[method.class_idx] != DexScanner::kNoIndex && strings_[method.name_idx] != DexScanner::kNoIndex
+        && protos_[method.proto_idx] != DexScanner::kNoIndex) {
+      methods_[i] = new_.FindMethod(types_[method.class_idx], strings_[method.name_idx],
+                                    protos_[method.proto_idx]);
+    }
+  });
+
+  new_class_defs_.assign(new_types.size(), DexScanner::kNoIndex);
+  const vector<ClassDefItem>& new_class_defs = new_.class_defs();
+  for (uint32_t c = 0; c < new_class_defs.size(); ++c) {
+    // A type defined twice keeps its first class_def.
+    uint32_t& class_def = new_class_defs_[new_class_defs[c].type_idx()];
+    if (class_def == DexScanner::kNoIndex) class_def = c;
+  }
+}
+
+bool DexDiff::SameClass(const ClassDefItem& old_class, const ClassDefItem& new_class) const {
+  if (old_class.access_flags() != new_class.access_flags()) return false;
+  const uint32_t super = old_class.superclass_idx();
+  if (super == DexScanner::kNoIndex
+      ? new_class.superclass_idx() != DexScanner::kNoIndex
+      : types_[super] != new_class.superclass_idx()) {
+    return false;
+  }
+  const uint32_t old_interfaces = old_class.interfaces_offs() ? old_.ReadUint32(old_class.interfaces_offs()) : 0;
+  const uint32_t new_interfaces = new_class.interfaces_offs() ? new_.ReadUint32(new_class.interfaces_offs()) : 0;
+  if (old_interfaces != new_interfaces) return false;
+  for (uint32_t k = 0; k < old_interfaces; ++k) {
+    if (types_[old_.ReadUShort(old_class.interfaces_offs() + 4 + 2*k)]
+        != new_.ReadUShort(new_class.interfaces_offs() + 4 + 2*k)) {
+      return false;
+    }
+  }
+  for (int k = 0; k < 2; ++k) {
+    const vector<EncodedField>& old_fields = k ? old_class.instance_fields() : old_class.static_fields();
+    const vector<EncodedField>& new_fields = k ? new_class.instance_fields() : new_class.static_fields();
+    if (old_fields.size() != new_fields.size()) return false;
+    uint32_t old_idx = 0;
+    uint32_t new_idx = 0;
+    for (size_t f = 0; f < old_fields.size(); ++f) {
+      old_idx += old_fields[f].field_idx_diff;
+      new_idx += new_fields[f].field_idx_diff;
+      if (fields_[old_idx] != new_idx || old_fields[f].access_flags != new_fields[f].access_flags) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+template <typename Old, typename New>
+bool DexDiff::SameCode(const Old& old_reader, const New& new_reader,
+                       uint32_t old_offs, uint32_t new_offs) const {
+  if (!old_offs || !new_offs) return old_offs == new_offs;
+  const CodeItem old_code(&old_, old_offs);
+  const CodeItem new_code(&new_, new_offs);
+  if (old_code.register_size() != new_code.register_size() || old_code.ins_size() != new_code.ins_size()
+      || old_code.outs_size() != new_code.outs_size() || old_code.instr_size() != new_code.instr_size()
+      || old_code.tries().size() != new_code.tries().size()
+      || old_code.handlers().size() != new_code.handlers().size()) {
+    return false;
+  }
+  for (size_t t = 0; t < old_code.tries().size(); ++t) {
+    const TryItem& a = old_code.tries()[t];
+    const TryItem& b = new_code.tries()[t];
+    if (a.start_addr != b.start_addr || a.insn_count != b.insn_count || a.handler_idx != b.handler_idx) {
+      return false;
+    }
+  }
+  for (size_t h = 0; h < old_code.handlers().size(); ++h) {
+    const EncodedCatchHandler& a = old_code.handlers()[h];
+    const EncodedCatchHandler& b = new_code.handlers()[h];
+    if (a.catch_all_addr != b.catch_all_addr || a.handlers.size() != b.handlers.size()) return false;
+    for (size_t p = 0; p < a.handlers.size(); ++p) {
+      if (types_[a.handlers[p].type_idx] != b.handlers[p].type_idx || a.handlers[p].addr != b.handlers[p].addr) {
+        return false;
+      }
+    }
+  }
+
+  size_t old_pos = old_code.instr_offs();
+  size_t new_pos = new_code.instr_offs();
+  const size_t end = old_pos + 2*old_code.instr_size();
+  while (old_pos < end) {
+    const size_t units = InstructionSize(&old_reader, old_pos);
+    if (units != InstructionSize(&new_reader, new_pos)) return false;
+    // Code units of the index operand, which are compared through the map.
+    size_t index_begin = units;
+    size_t index_end = units;
+    uint32_t old_index;
+    const ReferenceKind kind = ReadReference(&old_reader, old_pos, &old_index);
+    if (kind != REF_NONE) {
+      uint32_t new_index;
+      if (ReadReference(&new_reader, new_pos, &new_index) != kind) return false;
+      const vector<uint32_t>& map = kind == REF_STRING ? strings_ : kind == REF_TYPE ? types_
+          : kind == REF_FIELD ? fields_ : methods_;
+      if (map[old_index] != new_index) return false;
+      // All of them keep the index right after the opcode, in two units for
+      // const-string/jumbo.
+      index_begin = 1;
+      index_end = (old_reader.ReadUShort(old_pos) & 0xFF) == 0x1B ? 3 : 2;
+    }
+    for (size_t u = 0; u < units; ++u) {
+      if ((u < index_begin || u >= index_end)
+          && old_reader.ReadUShort(old_pos + 2*u) != new_reader.ReadUShort(new_pos + 2*u)) {
+        return false;
+      }
+    }
+    old_pos += 2*units;
+    new_pos += 2*units;
+  }
+  return true;
+}
+
+template <typename Old, typename New>
+void DexDiff::CompareClass(const Old& old_reader, const New& new_reader, uint32_t old_class_def,
+                           ClassChange* change) const {
+  const ClassDefItem& old_class = old_.class_defs()[old_class_def];
+  change->class_def = old_class_def;
+  const uint32_t type_idx = types_[old_class.type_idx()];
+  const uint32_t new_class_def = type_idx == DexScanner::kNoIndex ? DexScanner::kNoIndex : new_class_defs_[type_idx];
+  if (new_class_def == DexScanner::kNoIndex) {
+    change->change = REMOVED;
+    change->methods_count = old_class.direct_methods().size() + old_class.virtual_methods().size();
+    return;
+  }
+  const ClassDefItem& new_class = new_.class_defs()[new_class_def];
+  change->change = CHANGED;
+
+  vector<pair<uint32_t, const EncodedMethod*>> old_methods;
+  vector<pair<uint32_t, const EncodedMethod*>> new_methods;
+  ClassMethods(old_class, &old_methods);
+  ClassMethods(new_class, &new_methods);
+  // Methods keep their order through the map, as every section does.
+  size_t j = 0;
+  for (const auto& method : old_methods) {
+    const uint32_t method_idx = methods_[method.first];
+    while (j < new_methods.size() && method_idx != DexScanner::kNoIndex && new_methods[j].first < method_idx) {
+      change->methods.push_back({ADDED, new_methods[j++].first});
+    }
+    if (method_idx == DexScanner::kNoIndex || j == new_methods.size() || new_methods[j].first != method_idx) {
+      change->methods.push_back({REMOVED, method.first});
+      continue;
+    }
+    const EncodedMethod& new_method = *new_methods[j++].second;
+    if (method.second->access_flags != new_method.access_flags
+        || !SameCode(old_reader, new_reader, method.second->code_offs, new_method.code_offs)) {
+      change->methods.push_back({CHANGED, method.first});
+    }
+  }
+  for (; j < new_methods.size(); ++j) {
+    change->methods.push_back({ADDED, new_methods[j].first});
+  }
+  // The merge leaves removed methods out of place among the added ones.
+  vector<pair<string, MethodChange>> named;
+  for (const MethodChange& method : change->methods) {
+    named.push_back({(method.change == ADDED ? new_ : old_).MethodDescriptor(method.method_idx), method});
+  }
+  std::sort(named.begin(), named.end(), [] (const pair<string, MethodChange>& a,
+                                            const pair<string, MethodChange>& b) { return a.first < b.first; });
+  for (size_t m = 0; m < named.size(); ++m) {
+    change->methods[m] = named[m].second;
+  }
+  change->methods_count = change->methods.size();
+  if (change->methods.empty() && SameClass(old_class, new_class)) {
+    change->class_def = DexScanner::kNoIndex;
+  }
+}
+
+void DexDiff::Run(size_t threads) {
+  MapIds(threads);
+  const vector<ClassDefItem>& old_class_defs = old_.class_defs();
+  vector<ClassChange> slots(old_class_defs.size());
+  ParallelFor(old_class_defs.size(), threads, [this, &slots] (size_t c, size_t worker) {
+    if (old_.IsMachineEndian() && new_.IsMachineEndian()) {
+      CompareClass(DexReader<NativeOrder>(old_), DexReader<NativeOrder>(new_), c, &slots[c]);
+    } else if (old_.IsMachineEndian()) {
+      CompareClass(DexReader<NativeOrder>(old_), DexReader<SwappedOrder>(new_), c, &slots[c]);
+    } else if (new_.IsMachineEndian()) {
+      CompareClass(DexReader<SwappedOrder>(old_), DexReader<NativeOrder>(new_), c, &slots[c]);
+    } else {
+      CompareClass(DexReader<SwappedOrder>(old_), DexReader<SwappedOrder>(new_), c, &slots[c]);
+    }
+  });
+
+  changes_.clear();
+  const vector<ClassDefItem>& new_class_defs = new_.class_defs();
+  vector<bool> matched(new_class_defs.size());
+  for (uint32_t c = 0; c < old_class_defs.size(); ++c) {
+    const uint32_t type_idx = types_[old_class_defs[c].type_idx()];
+    if (type_idx != DexScanner::kNoIndex && new_class_defs_[type_idx] != DexScanner::kNoIndex) {
+      matched[new_class_defs_[type_idx]] = true;
+    }
+    // Unchanged classes are left without a class_def.
+    if (slots[c].class_def != DexScanner::kNoIndex) changes_.push_back(std::move(slots[c]));
+  }
+  for (uint32_t c = 0; c < new_class_defs.size(); ++c) {
+    if (matched[c]) continue;
+    const uint32_t methods = new_class_defs[c].direct_methods().size() + new_class_defs[c].virtual_methods().size();
+    changes_.push_back({ADDED, c, methods, vector<MethodChange>()});
+  }
+  std::sort(changes_.begin(), changes_.end(), [this] (const ClassChange& a, const ClassChange& b) {
+    const DexScanner& a_dex = a.change == ADDED ? new_ : old_;
+    const DexScanner& b_dex = b.change == ADDED ? new_ : old_;
+    return a_dex.type_descriptor(a_dex.class_defs()[a.class_def].type_idx())
+        < b_dex.type_descriptor(b_dex.class_defs()[b.class_def].type_idx());
+  });
+}
+
+}  // namespace rev
+}  // namespace egorich
@@ -0,0 +1,93 @@
+#ifndef REV_DEX_DIFF_H__
+#define REV_DEX_DIFF_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "dex_scanner.h"
+
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Classes and methods added, removed and changed between two builds of a
+// dex, matched by descriptor.
+//
+// Every string, type, proto, field and method of the old dex is mapped to
+// its index in the new one first, so nothing is compared by name later on.
+// Method bodies are compared code unit by code unit, the index operands of
+// the old code through the map, so code which only refers to ids at other
+// indices, as it does once anything is added to the dex, is unchanged.
+// Debug info is left out; a method moved by a few lines is unchanged too.
+class DexDiff {
+ public:
+  enum Change {
+    ADDED,
+    REMOVED,
+    CHANGED,
+  };
+
+  // method_idx of the new dex for added methods, of the old one otherwise.
+  struct MethodChange {
+    Change change;
+    uint32_t method_idx;
+  };
+
+  // class_def of the new dex for added classes, of the old one otherwise.
+  // A changed class differs in its flags, supertypes or fields, or has
+  // methods listed. Added and removed classes list no methods but count
+  // them.
+  struct ClassChange {
+    Change change;
+    uint32_t class_def;
+    uint32_t methods_count;
+    vector<MethodChange> methods;
+  };
+
+  DexDiff(const DexScanner& old_dex, const DexScanner& new_dex) : old_(old_dex), new_(new_dex) {
+  }
+
+  // Compares the parsed dex files on up to `threads` threads.
+  void Run(size_t threads);
+
+  // Sorted by descriptor, classes and the methods of each.
+  const vector<ClassChange>& changes() const { return changes_; }
+
+ private:
+  // Maps the ids of the old dex in order, each section through the ones
+  // before it.
+  void MapIds(size_t threads);
+  // Compares a class of the old dex with its counterpart, if any, and
+  // leaves class_def kNoIndex if they are the same. Old and New are the
+  // DexReaders of the byte orders of the files.
+  template <typename Old, typename New>
+  void CompareClass(const Old& old_reader, const New& new_reader, uint32_t old_class_def,
+                    ClassChange* change) const;
+  bool SameClass(const ClassDefItem& old_class, const ClassDefItem& new_class) const;
+  template <typename Old, typename New>
+  bool SameCode(const Old& old_reader, const New& new_reader,
+                uint32_t old_offs, uint32_t new_offs) const;
+
+  const DexScanner& old_;
+  const DexScanner& new_;
+
+  // New index of the items of the old dex, or kNoIndex.
+  vector<uint32_t> strings_;
+  vector<uint32_t> types_;
+  vector<uint32_t> protos_;
+  vector<uint32_t> fields_;
+  vector<uint32_t> methods_;
+  // class_def of the types of the new dex, or kNoIndex.
+  vector<uint32_t> new_class_defs_;
+
+  vector<ClassChange> changes_;
+
+  DexDiff(const DexDiff&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_DEX_DIFF_H__
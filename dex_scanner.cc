@@ -9,6 +9,7 @@
 #include <cctype>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <utility>
 #include <sstream>
@@ -31,23 +32,265 @@ using std::vector;
 
 namespace egorich {
 namespace rev {
+namespace {
 
-void DexScanner::ParseHeader() {
-  endianness_ = *reinterpret_cast<const uint32_t*>(content_.data() + kEndiannessOffset);
+// Branch-free lower bound over [0, size): returns the first index i for
+// which less(i) is false. The loop has a fixed trip count for a given size
+// and its only branch is the loop condition.
+template <typename Less>
+uint32_t LowerBound(uint32_t size, Less less) {
+  if (size == 0) return 0;
+  uint32_t base = 0;
+  while (size > 1) {
+    const uint32_t half = size / 2;
+    base = less(base + half) ? base + half : base;
+    size -= half;
+  }
+  return base + less(base);
+}
+
+// Returns the length of the type descriptor at the start of s, or zero if
+// there is none.
+size_t DescriptorLength(const string& s, size_t start) {
+  size_t end = start;
+  while (end < s.size() && s[end] == '[') ++end;
+  if (end == s.size()) return 0;
+  if (s[end] == 'L') {
+    end = s.find(';', end);
+    return end == string::npos ? 0 : end + 1 - start;
+  }
+  return end + 1 - start;
+}
+
+}  // namespace
+
+constexpr uint32_t DexScanner::kNoIndex;
+
+bool DexScanner::ParseHeader() {
+  if (content_.size() < kHeaderSize) {
+    return false;
+  }
+  endianness_ = NativeOrder::Load32(content_.data() + kEndiannessOffset);
+  if (endianness_ != 0x12345678 && endianness_ != 0x78563412) {
+    return false;
+  }
   string_ids_size_ = ReadUint32(kStringIdsOffset);
   string_ids_offs_ = ReadUint32(kStringIdsOffset + 4);
   type_ids_size_ = ReadUint32(kTypeIdsOffset);
   type_ids_offs_ = ReadUint32(kTypeIdsOffset + 4);
+  proto_ids_size_ = ReadUint32(kProtoIdsOffset);
+  proto_ids_offs_ = ReadUint32(kProtoIdsOffset + 4);
+  field_ids_size_ = ReadUint32(kFieldIdsOffset);
+  field_ids_offs_ = ReadUint32(kFieldIdsOffset + 4);
   method_ids_size_ = ReadUint32(kMethodIdsOffset);
   method_ids_offs_ = ReadUint32(kMethodIdsOffset + 4);
   class_defs_size_ = ReadUint32(kClassDefsOffset);
   class_defs_offs_ = ReadUint32(kClassDefsOffset + 4);
+  return true;
+}
 
-  cout << "E: " << (IsMachineEndian() ? "machine" : "reverse") << endl;
-  cout << "SS: offs=" << string_ids_offs_ << " size=" << string_ids_size_ << endl;
-  cout << "TS: offs=" << type_ids_offs_ << " size=" << type_ids_size_ << endl;
-  cout << "MS: offs=" << method_ids_offs_ << " size=" << method_ids_size_ << endl;
-  cout << "CS: offs=" << class_defs_offs_ << " size=" << class_defs_size_ << endl;
+void DexScanner::PrintHeader(ostream& out) const {
+  out << "E: " << (IsMachineEndian() ? "machine" : "reverse") << endl;
+  out << "SS: offs=" << string_ids_offs_ << " size=" << string_ids_size_ << endl;
+  out << "TS: offs=" << type_ids_offs_ << " size=" << type_ids_size_ << endl;
+  out << "PS: offs=" << proto_ids_offs_ << " size=" << proto_ids_size_ << endl;
+  out << "FS: offs=" << field_ids_offs_ << " size=" << field_ids_size_ << endl;
+  out << "MS: offs=" << method_ids_offs_ << " size=" << method_ids_size_ << endl;
+  out << "CS: offs=" << class_defs_offs_ << " size=" << class_defs_size_ << endl;
+}
+
+string DexScanner::MethodDescriptor(uint32_t method_idx) const {
+  const MethodIdItem method = method_id(method_idx);
+  const size_t proto_offs = proto_ids_offs_ + kProtoIdSize*method.proto_idx;
+  const uint32_t parameters_offs = ReadUint32(proto_offs + 8);
+  string result = type_data(method.class_idx);
+  result += "->";
+  result += string_data(method.name_idx);
+  result += '(';
+  if (parameters_offs) {
+    const uint32_t size = ReadUint32(parameters_offs);
+    for (uint32_t i = 0; i < size; ++i) {
+      result += type_data(ReadUShort(parameters_offs + 4 + 2*i));
+    }
+  }
+  result += ')';
+  result += type_data(ReadUint32(proto_offs + 4));
+  return result;
+}
+
+string DexScanner::FieldDescriptor(uint32_t field_idx) const {
+  const FieldIdItem field = field_id(field_idx);
+  return string(type_data(field.class_idx)) + "->" + string_data(field.name_idx) + ":"
+      + type_data(field.type_idx);
+}
+
+const char* DexScanner::string_data(uint32_t string_idx) const {
+  size_t offs = ReadUint32(string_ids_offs_ + 4*string_idx);
+  ReadUleb128(&offs);
+  return content_.data() + offs;
+}
+
+const char* DexScanner::type_data(uint32_t type_idx) const {
+  return string_data(ReadUint32(type_ids_offs_ + 4*type_idx));
+}
+
+FieldIdItem DexScanner::field_id(uint32_t field_idx) const {
+  const size_t offs = field_ids_offs_ + kFieldIdSize*field_idx;
+  return {ReadUShort(offs), ReadUShort(offs + 2), ReadUint32(offs + 4)};
+}
+
+MethodIdItem DexScanner::method_id(uint32_t method_idx) const {
+  const size_t offs = method_ids_offs_ + kMethodIdSize*method_idx;
+  return {ReadUShort(offs), ReadUShort(offs + 2), ReadUint32(offs + 4)};
+}
+
+ProtoIdItem DexScanner::proto_id(uint32_t proto_idx) const {
+  const size_t offs = proto_ids_offs_ + kProtoIdSize*proto_idx;
+  return {ReadUint32(offs), ReadUint32(offs + 4), ReadUint32(offs + 8)};
+}
+
+uint64_t DexScanner::MethodKey(uint32_t method_idx) const {
+  const MethodIdItem method = method_id(method_idx);
+  return (static_cast<uint64_t>(method.class_idx) << 48)
+      | (static_cast<uint64_t>(method.name_idx) << 16)
+      | method.proto_idx;
+}
+
+uint32_t DexScanner::FindString(const string& s) const {
+  const uint32_t i = LowerBound(string_ids_size_, [this, &s] (uint32_t i) {
+    return strcmp(string_data(i), s.c_str()) < 0;
+  });
+  return i < string_ids_size_ && string_data(i) == s ? i : kNoIndex;
+}
+
+uint32_t DexScanner::FindType(const string& descriptor) const {
+  const uint32_t string_idx = FindString(descriptor);
+  if (string_idx == kNoIndex) return kNoIndex;
+  const uint32_t i = LowerBound(type_ids_size_, [this, string_idx] (uint32_t i) {
+    return ReadUint32(type_ids_offs_ + 4*i) < string_idx;
+  });
+  return i < type_ids_size_ && ReadUint32(type_ids_offs_ + 4*i) == string_idx ? i : kNoIndex;
+}
+
+int DexScanner::CompareParameters(uint32_t proto_idx, const vector<uint32_t>& parameters) const {
+  const uint32_t parameters_offs = ReadUint32(proto_ids_offs_ + kProtoIdSize*proto_idx + 8);
+  const uint32_t size = parameters_offs ? ReadUint32(parameters_offs) : 0;
+  for (uint32_t i = 0; i < size && i < parameters.size(); ++i) {
+    const uint32_t type_idx = ReadUShort(parameters_offs + 4 + 2*i);
+    if (type_idx != parameters[i]) {
+      return type_idx < parameters[i] ? -1 : 1;
+    }
+  }
+  return size < parameters.size() ? -1 : size > parameters.size() ? 1 : 0;
+}
+
+uint32_t DexScanner::FindProto(const string& signature) const {
+  if (signature.empty() || signature[0] != '(') return kNoIndex;
+  vector<uint32_t> parameters;
+  size_t pos = 1;
+  while (pos < signature.size() && signature[pos] != ')') {
+    const size_t length = DescriptorLength(signature, pos);
+    if (!length) return kNoIndex;
+    parameters.push_back(FindType(signature.substr(pos, length)));
+    if (parameters.back() == kNoIndex) return kNoIndex;
+    pos += length;
+  }
+  if (pos == signature.size()) return kNoIndex;
+  const uint32_t return_type_idx = FindType(signature.substr(pos + 1));
+  if (return_type_idx == kNoIndex) return kNoIndex;
+  return FindProto(return_type_idx, parameters);
+}
+
+uint32_t DexScanner::FindProto(uint32_t return_type_idx, const vector<uint32_t>& parameters) const {
+  // proto_ids are sorted by return type, then by parameters.
+  auto less = [this, return_type_idx, &parameters] (uint32_t i) {
+    const uint32_t type_idx = ReadUint32(proto_ids_offs_ + kProtoIdSize*i + 4);
+    return type_idx < return_type_idx
+        || (type_idx == return_type_idx && CompareParameters(i, parameters) < 0);
+  };
+  const uint32_t i = LowerBound(proto_ids_size_, less);
+  if (i == proto_ids_size_
+      || ReadUint32(proto_ids_offs_ + kProtoIdSize*i + 4) != return_type_idx
+      || CompareParameters(i, parameters) != 0) {
+    return kNoIndex;
+  }
+  return i;
+}
+
+pair<uint32_t, uint32_t> DexScanner::FindMethods(const string& query) const {
+  const pair<uint32_t, uint32_t> none(0, 0);
+  const size_t arrow = query.find("->");
+  if (arrow == string::npos) return none;
+  const size_t paren = query.find('(', arrow);
+  const uint32_t class_idx = FindType(query.substr(0, arrow));
+  const uint32_t name_idx =
+      FindString(query.substr(arrow + 2, paren == string::npos ? string::npos : paren - arrow - 2));
+  if (class_idx == kNoIndex || name_idx == kNoIndex) return none;
+
+  // method_ids are sorted by class, name and proto, which MethodKey() packs
+  // into a single integer in the same order.
+  uint64_t from = (static_cast<uint64_t>(class_idx) << 48) | (static_cast<uint64_t>(name_idx) << 16);
+  uint64_t to = from + (1 << 16);
+  if (paren != string::npos) {
+    const uint32_t proto_idx = FindProto(query.substr(paren));
+    if (proto_idx == kNoIndex) return none;
+    from += proto_idx;
+    to = from + 1;
+  }
+  const uint32_t begin = LowerBound(method_ids_size_, [this, from] (uint32_t i) { return MethodKey(i) < from; });
+  const uint32_t end = LowerBound(method_ids_size_, [this, to] (uint32_t i) { return MethodKey(i) < to; });
+  return {begin, end};
+}
+
+uint32_t DexScanner::FindMethod(uint32_t class_idx, uint32_t name_idx, uint32_t proto_idx) const {
+  const uint64_t key = (static_cast<uint64_t>(class_idx) << 48)
+      | (static_cast<uint64_t>(name_idx) << 16) | proto_idx;
+  const uint32_t i = LowerBound(method_ids_size_, [this, key] (uint32_t i) { return MethodKey(i) < key; });
+  return i < method_ids_size_ && MethodKey(i) == key ? i : kNoIndex;
+}
+
+uint32_t DexScanner::FindField(uint32_t class_idx, uint32_t name_idx, uint32_t type_idx) const {
+  // field_ids are sorted by class, name and type.
+  const uint64_t key = (static_cast<uint64_t>(class_idx) << 48)
+      | (static_cast<uint64_t>(name_idx) << 16) | type_idx;
+  auto field_key = [this] (uint32_t i) {
+    const FieldIdItem field = field_id(i);
+    return (static_cast<uint64_t>(field.class_idx) << 48)
+        | (static_cast<uint64_t>(field.name_idx) << 16) | field.type_idx;
+  };
+  const uint32_t i = LowerBound(field_ids_size_, [key, &field_key] (uint32_t i) { return field_key(i) < key; });
+  return i < field_ids_size_ && field_key(i) == key ? i : kNoIndex;
+}
+
+uint32_t DexScanner::FindClassDef(uint32_t class_idx) const {
+  for (uint32_t t = 0; t < class_defs_size_; ++t) {
+    if (ReadUint32(class_defs_offs_ + kClassDefSize*t) == class_idx) {
+      return t;
+    }
+  }
+  return kNoIndex;
+}
+
+bool DexScanner::FindEncodedMethod(uint32_t method_idx, EncodedMethod* method) const {
+  const uint32_t t = FindClassDef(method_id(method_idx).class_idx);
+  if (t == kNoIndex) {
+    return false;
+  }
+  const ClassDefItem class_def(this, class_defs_offs_ + kClassDefSize*t);
+  for (int k = 0; k < 2; ++k) {
+    const vector<EncodedMethod>& methods =
+        k ? class_def.virtual_methods() : class_def.direct_methods();
+    uint32_t idx = 0;
+    for (const EncodedMethod& encoded : methods) {
+      idx += encoded.method_idx_diff;
+      if (idx == method_idx) {
+        *method = encoded;
+        method->method_idx_diff = idx;
+        return true;
+      }
+    }
+  }
+  return false;
 }
 
 void DexScanner::LoadStrings() {
@@ -76,6 +319,22 @@ void DexScanner::LoadTypes() {
   */
 }
 
+void DexScanner::LoadProtos() {
+  for (size_t t = 0; t < proto_ids_size_; ++t) {
+    const size_t offs = proto_ids_offs_ + kProtoIdSize*t;
+    proto_ids_.push_back({ReadUint32(offs), ReadUint32(offs + 4), ReadUint32(offs + 8)});
+  }
+}
+
+void DexScanner::LoadFields() {
+  for (size_t t = 0; t < field_ids_size_; ++t) {
+    uint16_t class_idx = ReadUShort(field_ids_offs_ + kFieldIdSize*t);
+    uint16_t type_idx = ReadUShort(field_ids_offs_ + kFieldIdSize*t + 2);
+    uint32_t name_idx = ReadUint32(field_ids_offs_ + kFieldIdSize*t + 4);
+    field_ids_.push_back({class_idx, type_idx, name_idx});
+  }
+}
+
 void DexScanner::LoadMethods() {
   for (size_t t = 0; t < method_ids_size_; ++t) {
     uint16_t class_idx = ReadUShort(method_ids_offs_ + kMethodIdSize*t);
@@ -83,14 +342,12 @@ void DexScanner::LoadMethods() {
     uint32_t name_idx = ReadUint32(method_ids_offs_ + kMethodIdSize*t + 4);
     method_ids_.push_back({class_idx, proto_idx, name_idx});
   }
-  cout << "MS: loaded." << endl;
 }
 
 void DexScanner::LoadClassDefs() {
   for (size_t t = 0; t < class_defs_size_; ++t) {
     class_defs_.emplace_back(this, class_defs_offs_ + kClassDefSize*t);
   }
-  cout << "CS: loaded." << endl;
 }
 
 CodeItem::CodeItem(const DexScanner* dex, size_t def_offs)
@@ -156,7 +413,7 @@ uint8_t CodeItem::opcode(size_t addr) const {
 }
 
 size_t CodeItem::opsize(size_t addr) const {
-  return instr(addr)->size(dex_, instr_offs() + 2 * addr);
+  return InstructionSize(dex_, instr_offs() + 2 * addr);
 }
 
 const IDefBase* CodeItem::instr(size_t addr) const {
@@ -217,5 +474,12 @@ void ClassDefItem::Init() {
   }
 }
 
+bool MatchesMethod(const string& descriptor, const string& query) {
+  if (descriptor.compare(0, query.size(), query) != 0) {
+    return false;
+  }
+  return descriptor.size() == query.size() || descriptor[query.size()] == '(';
+}
+
 }  // namespace rev
 }  // namespace egorich
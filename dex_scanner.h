@@ -2,9 +2,15 @@
 #define REV_DEX_SCANNER_H__
 
 #include <cstdint>
+#include <ostream>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "endian.h"
+
+using std::ostream;
+using std::pair;
 using std::string;
 using std::vector;
 
@@ -13,6 +19,7 @@ namespace rev {
 
 class IDefBase;
 class DexScanner;
+class DexValidator;
 
 struct TypeIdItem {
   uint32_t descriptor_idx;
@@ -29,6 +36,19 @@ struct EncodedMethod {
   uint32_t code_offs;
 };
 
+struct ProtoIdItem {
+  uint32_t shorty_idx;
+  uint32_t return_type_idx;
+  // type_list of the parameters, or zero.
+  uint32_t parameters_offs;
+};
+
+struct FieldIdItem {
+  uint16_t class_idx;
+  uint16_t type_idx;
+  uint32_t name_idx;
+};
+
 struct MethodIdItem {
   uint16_t class_idx;
   uint16_t proto_idx;
@@ -57,6 +77,15 @@ class CodeItem {
   CodeItem(const DexScanner* dex, size_t def_offs);
   uint32_t instr_offs() const { return def_offs_ + 16; }
   uint32_t instr_size() const { return insns_size_; }
+  uint16_t register_size() const { return register_size_; }
+  uint16_t ins_size() const { return ins_size_; }
+  uint16_t outs_size() const { return outs_size_; }
+  const vector<TryItem>& tries() const { return tries_; }
+  // Catch handlers in the order of the file, which handler_idx of a try
+  // indexes.
+  const vector<EncodedCatchHandler>& handlers() const { return handlers_; }
+  // debug_info_item of the method, or zero.
+  uint32_t debug_info_offs() const { return debug_info_offs_; }
   uint8_t opcode(size_t addr) const;
   size_t opsize(size_t addr) const;
   const IDefBase* instr(size_t addr) const;
@@ -80,9 +109,20 @@ class CodeItem {
 class ClassDefItem {
  public:
   ClassDefItem(const DexScanner* dex, size_t def_offs);
+  const vector<EncodedField>& static_fields() const { return static_fields_; }
+  const vector<EncodedField>& instance_fields() const { return instance_fields_; }
   const vector<EncodedMethod>& direct_methods() const { return direct_methods_; }
   const vector<EncodedMethod>& virtual_methods() const { return virtual_methods_; }
   uint32_t type_idx() const { return type_idx_; }
+  uint32_t access_flags() const { return access_flags_; }
+  // Type of the superclass, or kNoIndex for java.lang.Object.
+  uint32_t superclass_idx() const { return superclass_idx_; }
+  // type_list of the interfaces the class implements, or zero.
+  uint32_t interfaces_offs() const { return interfaces_offs_; }
+  // annotations_directory_item of the class, or zero; see AnnotationsDirectory.
+  uint32_t annotations_offs() const { return annotations_offs_; }
+  // encoded_array_item with the initial values of the static fields, or zero.
+  uint32_t static_values_offs() const { return static_values_offs_; }
 
  private:
   void Init();
@@ -112,7 +152,7 @@ class ClassDefItem {
 
 class DexScanner {
  public:
-  explicit DexScanner(string&& content) : content_(content) {
+  explicit DexScanner(string&& content) : content_(std::move(content)) {
   }
 
   void Parse() {
@@ -125,15 +165,34 @@ class DexScanner {
     LoadClassDefs();
   }
 
+  // Reads the header only. It is all the lookups below, MethodDescriptor()
+  // and ClassDefItem need, so a single method can be pulled out of a huge
+  // dex without the full Parse(). Returns false if the file is too short
+  // for a header or has an unknown byte order.
+  bool ParseHeader();
+
+  // Whether the file is in the byte order of this machine, as the endian
+  // tag read by ParseHeader() says.
+  bool IsMachineEndian() const {
+    return endianness_ == 0x12345678;
+  }
+
+  // The readers below do no bounds checks, and neither do the items built
+  // on them; DexValidator must have accepted the parts of the file read.
+  // ReadUint32() and ReadUShort() check the byte order on every call; loops
+  // decoding instructions in bulk use a DexReader instead.
+  template <typename Order>
+  uint32_t Read32(size_t position) const {
+    return Order::Load32(content_.data() + position);
+  }
+
+  template <typename Order>
+  uint16_t Read16(size_t position) const {
+    return Order::Load16(content_.data() + position);
+  }
+
   uint32_t ReadUint32(size_t position) const {
-    uint32_t result = *reinterpret_cast<const uint32_t*>(content_.data() + position);
-    if (IsMachineEndian()) {
-      return result;
-    }
-    return ((result & 0xFFU) << 24)
-           | ((result & 0xFF00U) << 8)
-           | ((result & 0xFF0000U) >> 8)
-           | ((result & 0xFF000000U) >> 24);
+    return IsMachineEndian() ? Read32<NativeOrder>(position) : Read32<SwappedOrder>(position);
   }
 
   uint32_t ReadUleb128(size_t* position) const {
@@ -168,33 +227,88 @@ class DexScanner {
   }
 
   uint16_t ReadUShort(size_t position) const {
-    uint16_t result = *reinterpret_cast<const uint16_t*>(content_.data() + position);
-    if (IsMachineEndian()) {
-      return result;
-    }
-    return ((result & 0xFFU) << 8) | ((result & 0xFF00U) >> 8);
+    return IsMachineEndian() ? Read16<NativeOrder>(position) : Read16<SwappedOrder>(position);
   }
 
+  // Prints the header summary.
+  void PrintHeader(ostream& out) const;
+
   const vector<ClassDefItem>& class_defs() const { return class_defs_; }
   const vector<MethodIdItem>& method_ids() const { return method_ids_; }
+  const vector<FieldIdItem>& field_ids() const { return field_ids_; }
+  const vector<ProtoIdItem>& proto_ids() const { return proto_ids_; }
   const vector<TypeIdItem>& type_ids() const { return type_ids_; }
   const vector<string>& string_ids() const { return string_ids_; }
 
+  const string& type_descriptor(uint32_t type_idx) const {
+    return string_ids_[type_ids_[type_idx].descriptor_idx];
+  }
+  // Returns the method reference in smali notation, e.g.
+  // "Ljava/lang/Object;->equals(Ljava/lang/Object;)Z".
+  string MethodDescriptor(uint32_t method_idx) const;
+  // Returns the field reference in smali notation, e.g.
+  // "Ljava/lang/System;->out:Ljava/io/PrintStream;".
+  string FieldDescriptor(uint32_t field_idx) const;
+
+  static constexpr uint32_t kNoIndex = 0xFFFFFFFFU;
+
+  // MUTF-8 contents of a string, read straight from the file.
+  const char* string_data(uint32_t string_idx) const;
+  const char* type_data(uint32_t type_idx) const;
+  FieldIdItem field_id(uint32_t field_idx) const;
+  MethodIdItem method_id(uint32_t method_idx) const;
+  ProtoIdItem proto_id(uint32_t proto_idx) const;
+  // Number of class_defs, and fields of class_defs()[class_def], read
+  // straight from the file as well.
+  uint32_t class_defs_size() const { return class_defs_size_; }
+  uint32_t class_type_idx(uint32_t class_def) const {
+    return ReadUint32(class_defs_offs_ + kClassDefSize*class_def);
+  }
+  uint32_t class_annotations_offs(uint32_t class_def) const {
+    return ReadUint32(class_defs_offs_ + kClassDefSize*class_def + 20);
+  }
+
+  // Binary searches over the id sections, which the format keeps sorted.
+  // They return kNoIndex on a miss. Strings are compared bytewise, which
+  // agrees with the UTF-16 order of the format outside of surrogates.
+  uint32_t FindString(const string& s) const;
+  uint32_t FindType(const string& descriptor) const;
+  // Takes a signature such as "(ILjava/lang/String;)V".
+  uint32_t FindProto(const string& signature) const;
+  uint32_t FindProto(uint32_t return_type_idx, const vector<uint32_t>& parameters) const;
+  // Returns the range of method_ids matching the query as MatchesMethod()
+  // does: all overloads when the query has no signature.
+  pair<uint32_t, uint32_t> FindMethods(const string& query) const;
+  // Returns the method_ids index of the method of the class with the name
+  // and proto, or kNoIndex.
+  uint32_t FindMethod(uint32_t class_idx, uint32_t name_idx, uint32_t proto_idx) const;
+  // The same for the field of the class with the name and type.
+  uint32_t FindField(uint32_t class_idx, uint32_t name_idx, uint32_t type_idx) const;
+  // Returns the index of the class_def of the type, or kNoIndex. Classes are
+  // not sorted by type, so this is a strided pass over class_defs.
+  uint32_t FindClassDef(uint32_t class_idx) const;
+  // Looks the method up in the class_data of its class. On success the
+  // method_idx_diff of the result is the method index itself, i.e. relative
+  // to zero.
+  bool FindEncodedMethod(uint32_t method_idx, EncodedMethod* method) const;
+
+  // Adler-32 checksum recorded in the header.
+  uint32_t checksum() const { return ReadUint32(kChecksumOffset); }
+  size_t size() const { return content_.size(); }
+  const char* data() const { return content_.data(); }
+
  private:
-  void ParseHeader();
   void LoadStrings();
   void LoadTypes();
-  void LoadProtos() {
-  }
-  void LoadFields() {
-  }
+  void LoadProtos();
+  void LoadFields();
 
   void LoadMethods();
   void LoadClassDefs();
 
-  bool IsMachineEndian() const {
-    return endianness_ == 0x12345678;
-  }
+  uint64_t MethodKey(uint32_t method_idx) const;
+  // Compares the parameters of the proto with the type list.
+  int CompareParameters(uint32_t proto_idx, const vector<uint32_t>& parameters) const;
 
  private:
   const string content_;
@@ -204,27 +318,64 @@ class DexScanner {
   uint32_t string_ids_size_;
   uint32_t type_ids_offs_;
   uint32_t type_ids_size_;
+  uint32_t proto_ids_offs_;
+  uint32_t proto_ids_size_;
+  uint32_t field_ids_offs_;
+  uint32_t field_ids_size_;
   uint32_t method_ids_offs_;
   uint32_t method_ids_size_;
   uint32_t class_defs_offs_;
   uint32_t class_defs_size_;
   vector<string> string_ids_;
   vector<TypeIdItem> type_ids_;
+  vector<ProtoIdItem> proto_ids_;
+  vector<FieldIdItem> field_ids_;
   vector<MethodIdItem> method_ids_;
   vector<ClassDefItem> class_defs_;
 
+  static constexpr size_t kHeaderSize = 0x70;
+  static constexpr size_t kChecksumOffset = 8;
+  static constexpr size_t kFileSizeOffset = 32;
+  static constexpr size_t kHeaderSizeOffset = 36;
+  static constexpr size_t kMapOffset = 52;
   static constexpr size_t kEndiannessOffset = 40;
   static constexpr size_t kStringIdsOffset = 56;
   static constexpr size_t kTypeIdsOffset = 64;
+  static constexpr size_t kProtoIdsOffset = 72;
+  static constexpr size_t kFieldIdsOffset = 80;
   static constexpr size_t kMethodIdsOffset = 88;
   static constexpr size_t kClassDefsOffset = 96;
 
+  static constexpr size_t kProtoIdSize = 12;
+  static constexpr size_t kFieldIdSize = 8;
   static constexpr size_t kMethodIdSize = 8;
   static constexpr size_t kClassDefSize = 32;
 
+  friend class DexValidator;
+
   DexScanner(const DexScanner&) = delete;
 };
 
+// The scanner with the byte order fixed at compile time, so the instruction
+// decoders instantiated on it read without a branch. Instantiate the loop
+// for both orders and pick one by IsMachineEndian() once, outside of it.
+template <typename Order>
+class DexReader {
+ public:
+  explicit DexReader(const DexScanner& scanner) : scanner_(scanner) {
+  }
+
+  uint32_t ReadUint32(size_t position) const { return scanner_.Read32<Order>(position); }
+  uint16_t ReadUShort(size_t position) const { return scanner_.Read16<Order>(position); }
+
+ private:
+  const DexScanner& scanner_;
+};
+
+// Returns whether the method reference matches the query, either as a whole
+// or up to its signature.
+bool MatchesMethod(const string& descriptor, const string& query);
+
 }  // namespace rev
 }  // namespace egorich
 
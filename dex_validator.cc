@@ -0,0 +1,596 @@
+#include "dex_validator.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "annotations.h"
+#include "dex_asm.h"
+
+using std::stringstream;
+
+namespace egorich {
+namespace rev {
+namespace {
+
+bool IsGoto(uint8_t opcode) { return 0x28 <= opcode && opcode <= 0x2A; }
+bool IsBranch(uint8_t opcode) { return 0x32 <= opcode && opcode <= 0x3D; }
+// fill-array-data, packed-switch and sparse-switch, pointing at a payload.
+bool IsPayloadRef(uint8_t opcode) { return opcode == 0x26 || opcode == 0x2B || opcode == 0x2C; }
+bool IsInvoke35c(uint8_t opcode) { return opcode == 0x24 || (0x6E <= opcode && opcode <= 0x72); }
+
+}  // namespace
+
+constexpr uint32_t DexValidator::kNoIndex;
+
+bool DexValidator::Fail(const string& what, uint64_t offs) {
+  stringstream ss;
+  ss << what << " at offset " << offs;
+  error_ = ss.str();
+  return false;
+}
+
+bool DexValidator::U16(size_t offs, uint16_t* value) {
+  if (!InBounds(offs, 2)) return Fail("truncated ushort", offs);
+  *value = scanner_.ReadUShort(offs);
+  return true;
+}
+
+bool DexValidator::U32(size_t offs, uint32_t* value) {
+  if (!InBounds(offs, 4)) return Fail("truncated uint", offs);
+  *value = scanner_.ReadUint32(offs);
+  return true;
+}
+
+bool DexValidator::Uleb(size_t* pos, uint32_t* value) {
+  const size_t start = *pos;
+  size_t end = start;
+  // At most five bytes, the last one without a continuation bit.
+  while (end < size_ && end - start < 5 && (scanner_.content_[end] & 0x80)) ++end;
+  if (end >= size_ || end - start == 5) return Fail("bad uleb128", start);
+  *value = scanner_.ReadUleb128(pos);
+  return true;
+}
+
+bool DexValidator::Sleb(size_t* pos, int32_t* value) {
+  uint32_t unused;
+  const size_t start = *pos;
+  if (!Uleb(pos, &unused)) return false;
+  *pos = start;
+  *value = scanner_.ReadSleb128(pos);
+  return true;
+}
+
+bool DexValidator::Section(const char* name, uint32_t size, uint32_t offs, size_t item_size) {
+  if (size == 0) return true;
+  if (offs % 4 || offs < DexScanner::kHeaderSize
+      || !InBounds(offs, static_cast<uint64_t>(size) * item_size)) {
+    return Fail(string(name) + " out of bounds", offs);
+  }
+  return true;
+}
+
+bool DexValidator::Map() {
+  uint32_t offs;
+  uint32_t count;
+  if (!U32(DexScanner::kMapOffset, &offs)) return false;
+  if (offs % 4 || !U32(offs, &count)) return Fail("bad map_list", offs);
+  if (!InBounds(offs + 4ULL, 12ULL * count)) return Fail("map_list out of bounds", offs);
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t item_offs;
+    U32(offs + 4 + 12*i + 8, &item_offs);
+    if (item_offs > size_) return Fail("map item out of bounds", offs + 4 + 12*i);
+  }
+  return true;
+}
+
+bool DexValidator::TypeList(size_t offs) {
+  uint32_t count;
+  if (offs % 4 || !U32(offs, &count) || !InBounds(offs + 4ULL, 2ULL * count)) {
+    return Fail("bad type_list", offs);
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    if (scanner_.ReadUShort(offs + 4 + 2*i) >= scanner_.type_ids_size_) {
+      return Fail("bad type index", offs + 4 + 2*i);
+    }
+  }
+  return true;
+}
+
+bool DexValidator::ValidateIds() {
+  const DexScanner& d = scanner_;
+  if (size_ < DexScanner::kHeaderSize || memcmp(d.content_.data(), "dex\n", 4) != 0) {
+    return Fail("not a dex file", 0);
+  }
+  uint32_t value;
+  if (!U32(DexScanner::kHeaderSizeOffset, &value) || value != DexScanner::kHeaderSize) {
+    return Fail("bad header_size", DexScanner::kHeaderSizeOffset);
+  }
+  if (!U32(DexScanner::kFileSizeOffset, &value) || value != size_) {
+    return Fail("file_size does not match the file", DexScanner::kFileSizeOffset);
+  }
+  // Type and proto indices are 16 bits wide in the other sections.
+  if (d.type_ids_size_ > 0x10000 || d.proto_ids_size_ > 0x10000) {
+    return Fail("too many type or proto ids", DexScanner::kTypeIdsOffset);
+  }
+  if (!Section("string_ids", d.string_ids_size_, d.string_ids_offs_, 4)
+      || !Section("type_ids", d.type_ids_size_, d.type_ids_offs_, 4)
+      || !Section("proto_ids", d.proto_ids_size_, d.proto_ids_offs_, DexScanner::kProtoIdSize)
+      || !Section("field_ids", d.field_ids_size_, d.field_ids_offs_, DexScanner::kFieldIdSize)
+      || !Section("method_ids", d.method_ids_size_, d.method_ids_offs_, DexScanner::kMethodIdSize)
+      || !Section("class_defs", d.class_defs_size_, d.class_defs_offs_, DexScanner::kClassDefSize)
+      || !Map()) {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < d.string_ids_size_; ++i) {
+    size_t pos = d.ReadUint32(d.string_ids_offs_ + 4*i);
+    uint32_t length;
+    if (pos > size_ || !Uleb(&pos, &length)
+        || memchr(d.content_.data() + pos, 0, size_ - pos) == NULL) {
+      return Fail("bad string_data", d.string_ids_offs_ + 4*i);
+    }
+  }
+  for (uint32_t i = 0; i < d.type_ids_size_; ++i) {
+    if (d.ReadUint32(d.type_ids_offs_ + 4*i) >= d.string_ids_size_) {
+      return Fail("bad type_id", d.type_ids_offs_ + 4*i);
+    }
+  }
+  for (uint32_t i = 0; i < d.proto_ids_size_; ++i) {
+    const size_t offs = d.proto_ids_offs_ + DexScanner::kProtoIdSize*i;
+    const uint32_t parameters_offs = d.ReadUint32(offs + 8);
+    if (d.ReadUint32(offs) >= d.string_ids_size_ || d.ReadUint32(offs + 4) >= d.type_ids_size_) {
+      return Fail("bad proto_id", offs);
+    }
+    if (parameters_offs && !TypeList(parameters_offs)) return false;
+  }
+  for (uint32_t i = 0; i < d.field_ids_size_; ++i) {
+    const size_t offs = d.field_ids_offs_ + DexScanner::kFieldIdSize*i;
+    if (d.ReadUShort(offs) >= d.type_ids_size_ || d.ReadUShort(offs + 2) >= d.type_ids_size_
+        || d.ReadUint32(offs + 4) >= d.string_ids_size_) {
+      return Fail("bad field_id", offs);
+    }
+  }
+  for (uint32_t i = 0; i < d.method_ids_size_; ++i) {
+    const size_t offs = d.method_ids_offs_ + DexScanner::kMethodIdSize*i;
+    if (d.ReadUShort(offs) >= d.type_ids_size_ || d.ReadUShort(offs + 2) >= d.proto_ids_size_
+        || d.ReadUint32(offs + 4) >= d.string_ids_size_) {
+      return Fail("bad method_id", offs);
+    }
+  }
+  return true;
+}
+
+bool DexValidator::ValidateClass(size_t index) {
+  const DexScanner& d = scanner_;
+  const size_t offs = d.class_defs_offs_ + DexScanner::kClassDefSize*index;
+  const uint32_t superclass_idx = d.ReadUint32(offs + 8);
+  const uint32_t interfaces_offs = d.ReadUint32(offs + 12);
+  const uint32_t source_file_idx = d.ReadUint32(offs + 16);
+  const uint32_t class_data_offs = d.ReadUint32(offs + 24);
+  if (d.ReadUint32(offs) >= d.type_ids_size_
+      || (superclass_idx != kNoIndex && superclass_idx >= d.type_ids_size_)
+      || (source_file_idx != kNoIndex && source_file_idx >= d.string_ids_size_)) {
+    return Fail("bad class_def", offs);
+  }
+  if (interfaces_offs && !TypeList(interfaces_offs)) return false;
+  if (!ValidateAnnotations(index)) return false;
+  if (!class_data_offs) return true;
+
+  size_t pos = class_data_offs;
+  uint32_t sizes[4];
+  for (uint32_t& size : sizes) {
+    if (!Uleb(&pos, &size)) return false;
+  }
+  for (int k = 0; k < 4; ++k) {
+    const bool methods = k >= 2;
+    const uint32_t limit = methods ? d.method_ids_size_ : d.field_ids_size_;
+    uint64_t idx = 0;
+    for (uint32_t i = 0; i < sizes[k]; ++i) {
+      const size_t item = pos;
+      uint32_t diff;
+      uint32_t access_flags;
+      if (!Uleb(&pos, &diff) || !Uleb(&pos, &access_flags)) return false;
+      idx += diff;
+      if (idx >= limit) return Fail(methods ? "bad method index" : "bad field index", item);
+      if (!methods) continue;
+      uint32_t code_offs;
+      if (!Uleb(&pos, &code_offs)) return false;
+      if (code_offs && !Code(code_offs)) return false;
+    }
+  }
+  return true;
+}
+
+bool DexValidator::Code(size_t offs) {
+  uint16_t registers;
+  uint16_t ins;
+  uint16_t tries_size;
+  uint32_t debug_info_offs;
+  uint32_t insns_size;
+  if (offs % 4 || !U16(offs, &registers) || !U16(offs + 2, &ins) || !U16(offs + 6, &tries_size)
+      || !U32(offs + 8, &debug_info_offs) || !U32(offs + 12, &insns_size)) {
+    return Fail("bad code_item", offs);
+  }
+  if (ins > registers) return Fail("more ins than registers", offs);
+  if (!InBounds(offs + 16ULL, 2ULL * insns_size)) return Fail("code out of bounds", offs);
+  const size_t insns_end = offs + 16 + 2*insns_size;
+  const bool instructions = scanner_.IsMachineEndian()
+      ? Instructions(DexReader<NativeOrder>(scanner_), offs + 16, insns_size, registers)
+      : Instructions(DexReader<SwappedOrder>(scanner_), offs + 16, insns_size, registers);
+  return instructions
+      && (!tries_size || Tries(offs, insns_end, insns_size, tries_size))
+      && (!debug_info_offs || DebugInfoItem(debug_info_offs, registers));
+}
+
+template <typename Reader>
+bool DexValidator::Instructions(const Reader& reader, size_t insns_offs, uint32_t insns_size,
+                                uint16_t registers) {
+  starts_.assign(insns_size, false);
+  targets_.clear();
+  RegisterAccess access;
+  uint32_t pc = 0;
+  while (pc < insns_size) {
+    const size_t offs = insns_offs + 2*pc;
+    const uint16_t unit = reader.ReadUShort(offs);
+    const uint8_t opcode = unit & 0xFF;
+    const uint32_t left = insns_size - pc;
+    starts_[pc] = true;
+
+    if (opcode == 0 && (unit >> 8) >= 1 && (unit >> 8) <= 3) {
+      // Payload pseudo-instructions; their size is recomputed without the
+      // 32-bit overflow the decoder's arithmetic would allow.
+      if (left < 4) return Fail("truncated payload", offs);
+      const uint64_t count = reader.ReadUShort(offs + 2);
+      uint64_t size;
+      switch (unit >> 8) {
+      case 1:
+        size = count * 2 + 4;
+        break;
+      case 2:
+        size = count * 4 + 2;
+        break;
+      default:
+        size = (count * reader.ReadUint32(offs + 4) + 1) / 2 + 4;
+        break;
+      }
+      if (size > left) return Fail("payload out of bounds", offs);
+      pc += size;
+      continue;
+    }
+
+    const size_t size = kInstructionUnits[opcode];
+    if (size > left) return Fail("instruction out of bounds", offs);
+
+    const IDefBase* const instr = iTable[opcode];
+    int64_t target = 0;
+    const bool branches = IsGoto(opcode) || IsBranch(opcode) || IsPayloadRef(opcode);
+    if (IsGoto(opcode)) {
+      target = opcode == 0x28 ? layout<L_10t>(instr)->A(&reader, offs)
+          : opcode == 0x29 ? layout<L_20t>(instr)->A(&reader, offs)
+          : layout<L_30t>(instr)->A(&reader, offs);
+    } else if (IsBranch(opcode)) {
+      target = opcode <= 0x37 ? layout<L_22t>(instr)->C(&reader, offs)
+          : layout<L_21t>(instr)->B(&reader, offs);
+    } else if (IsPayloadRef(opcode)) {
+      target = layout<L_31t>(instr)->B(&reader, offs);
+    }
+    if (branches) {
+      target += pc;
+      if (target < 0 || target >= insns_size) return Fail("branch out of the method", offs);
+      targets_.push_back(target);
+    }
+
+    uint32_t index;
+    switch (ReadReference(&reader, offs, &index)) {
+    case REF_STRING:
+      if (index >= scanner_.string_ids_size_) return Fail("bad string index", offs);
+      break;
+    case REF_TYPE:
+      if (index >= scanner_.type_ids_size_) return Fail("bad type index", offs);
+      break;
+    case REF_FIELD:
+      if (index >= scanner_.field_ids_size_) return Fail("bad field index", offs);
+      break;
+    case REF_METHOD:
+      if (index >= scanner_.method_ids_size_) return Fail("bad method index", offs);
+      break;
+    case REF_NONE:
+      break;
+    }
+
+    if (IsInvoke35c(opcode) && layout<L_35c>(instr)->A(&reader, offs) > 5) {
+      return Fail("too many arguments", offs);
+    }
+    ReadRegisterAccess(&reader, offs, &access);
+    for (size_t i = 0; i < access.def_count; ++i) {
+      if (access.defs[i] >= registers) return Fail("bad register", offs);
+    }
+    for (size_t i = 0; i < access.use_count; ++i) {
+      if (access.uses[i] >= registers) return Fail("bad register", offs);
+    }
+    pc += size;
+  }
+  for (uint32_t target : targets_) {
+    if (!starts_[target]) return Fail("branch into an instruction", insns_offs + 2*target);
+  }
+  return true;
+}
+
+bool DexValidator::Tries(size_t offs, size_t insns_end, uint32_t insns_size, uint16_t tries_size) {
+  const size_t tries_offs = (insns_end + 3) & ~static_cast<size_t>(3);
+  if (!InBounds(tries_offs, 8ULL * tries_size)) return Fail("tries out of bounds", offs);
+  const size_t handlers_offs = tries_offs + 8*tries_size;
+
+  size_t pos = handlers_offs;
+  uint32_t count;
+  if (!Uleb(&pos, &count)) return false;
+  vector<uint32_t> handler_offs;
+  for (uint32_t h = 0; h < count; ++h) {
+    handler_offs.push_back(pos - handlers_offs);
+    int32_t types;
+    if (!Sleb(&pos, &types)) return false;
+    if (types < -0xFFFF || types > 0xFFFF) return Fail("bad catch handler", pos);
+    for (int32_t t = 0; t < (types < 0 ? -types : types); ++t) {
+      uint32_t type_idx;
+      uint32_t addr;
+      if (!Uleb(&pos, &type_idx) || !Uleb(&pos, &addr)) return false;
+      if (type_idx >= scanner_.type_ids_size_ || addr >= insns_size) {
+        return Fail("bad catch handler", pos);
+      }
+    }
+    if (types <= 0) {
+      uint32_t addr;
+      if (!Uleb(&pos, &addr)) return false;
+      if (addr >= insns_size) return Fail("bad catch-all handler", pos);
+    }
+  }
+  for (uint16_t t = 0; t < tries_size; ++t) {
+    const size_t item = tries_offs + 8*t;
+    const uint64_t start = scanner_.ReadUint32(item);
+    const uint64_t insn_count = scanner_.ReadUShort(item + 4);
+    const uint32_t handler = scanner_.ReadUShort(item + 6);
+    if (start + insn_count > insns_size) return Fail("try out of the method", item);
+    if (!std::binary_search(handler_offs.begin(), handler_offs.end(), handler)) {
+      return Fail("bad handler offset", item);
+    }
+  }
+  return true;
+}
+
+bool DexValidator::IndexP1(size_t* pos, uint32_t limit) {
+  const size_t start = *pos;
+  uint32_t value;
+  if (!Uleb(pos, &value)) return false;
+  if (value != 0 && value - 1 >= limit) return Fail("bad index", start);
+  return true;
+}
+
+bool DexValidator::DebugInfoItem(size_t offs, uint16_t registers) {
+  size_t pos = offs;
+  uint32_t line_start;
+  uint32_t parameters_size;
+  if (!Uleb(&pos, &line_start) || !Uleb(&pos, &parameters_size)) return false;
+  for (uint32_t i = 0; i < parameters_size; ++i) {
+    if (!IndexP1(&pos, scanner_.string_ids_size_)) return false;
+  }
+  for (;;) {
+    if (pos >= size_) return Fail("truncated debug info", offs);
+    const uint8_t opcode = scanner_.content_[pos++];
+    uint32_t value;
+    int32_t diff;
+    switch (opcode) {
+    case 0x00:
+      // DBG_END_SEQUENCE
+      return true;
+    case 0x01:
+      if (!Uleb(&pos, &value)) return false;
+      break;
+    case 0x02:
+      if (!Sleb(&pos, &diff)) return false;
+      break;
+    case 0x03:
+    case 0x04:
+      // DBG_START_LOCAL and DBG_START_LOCAL_EXTENDED
+      if (!Uleb(&pos, &value)) return false;
+      if (value >= registers) return Fail("bad local register", pos);
+      if (!IndexP1(&pos, scanner_.string_ids_size_) || !IndexP1(&pos, scanner_.type_ids_size_)
+          || (opcode == 0x04 && !IndexP1(&pos, scanner_.string_ids_size_))) {
+        return false;
+      }
+      break;
+    case 0x05:
+    case 0x06:
+      if (!Uleb(&pos, &value)) return false;
+      if (value >= registers) return Fail("bad local register", pos);
+      break;
+    case 0x09:
+      if (!IndexP1(&pos, scanner_.string_ids_size_)) return false;
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+bool DexValidator::ValidateAnnotations(size_t index) {
+  const size_t offs = scanner_.class_defs_offs_ + DexScanner::kClassDefSize*index;
+  const uint32_t annotations_offs = scanner_.ReadUint32(offs + 20);
+  size_t static_values_offs = scanner_.ReadUint32(offs + 28);
+  if (scanner_.ReadUint32(offs) >= scanner_.type_ids_size_) return Fail("bad class_def", offs);
+  return (!annotations_offs || AnnotationsDirectoryItem(annotations_offs))
+      && (!static_values_offs || EncodedArrayItem(&static_values_offs, 0));
+}
+
+bool DexValidator::AnnotationsDirectoryItem(size_t offs) {
+  uint32_t class_offs;
+  uint32_t sizes[3];
+  if (offs % 4 || !U32(offs, &class_offs) || !U32(offs + 4, &sizes[0])
+      || !U32(offs + 8, &sizes[1]) || !U32(offs + 12, &sizes[2])
+      || !InBounds(offs + 16ULL, 8ULL * (static_cast<uint64_t>(sizes[0]) + sizes[1] + sizes[2]))) {
+    return Fail("bad annotations_directory_item", offs);
+  }
+  if (class_offs && !AnnotationSetItem(class_offs)) return false;
+  size_t entry = offs + 16;
+  for (int k = 0; k < 3; ++k) {
+    const uint32_t limit = k == 0 ? scanner_.field_ids_size_ : scanner_.method_ids_size_;
+    for (uint32_t i = 0; i < sizes[k]; ++i, entry += 8) {
+      const uint32_t idx = scanner_.ReadUint32(entry);
+      const uint32_t set_offs = scanner_.ReadUint32(entry + 4);
+      // Members are looked up by binary search.
+      if (idx >= limit || (i && idx <= scanner_.ReadUint32(entry - 8))) {
+        return Fail("bad annotated member", entry);
+      }
+      if (!(k == 2 ? AnnotationSetRefList(set_offs) : AnnotationSetItem(set_offs))) return false;
+    }
+  }
+  return true;
+}
+
+bool DexValidator::AnnotationSetItem(size_t offs) {
+  uint32_t count;
+  if (offs % 4 || !U32(offs, &count) || !InBounds(offs + 4ULL, 4ULL * count)) {
+    return Fail("bad annotation_set_item", offs);
+  }
+  uint32_t last = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    size_t pos = scanner_.ReadUint32(offs + 4 + 4*i);
+    const size_t item = pos;
+    if (pos >= size_ || scanner_.content_[pos] > Annotation::VISIBILITY_SYSTEM) {
+      return Fail("bad annotation_item", item);
+    }
+    ++pos;
+    const size_t annotation = pos;
+    uint32_t type_idx;
+    if (!Uleb(&pos, &type_idx)) return false;
+    // AnnotationSet binary searches by type.
+    if (i && type_idx <= last) return Fail("annotations out of order", item);
+    last = type_idx;
+    pos = annotation;
+    if (!EncodedAnnotationItem(&pos, 0)) return false;
+  }
+  return true;
+}
+
+bool DexValidator::AnnotationSetRefList(size_t offs) {
+  uint32_t count;
+  if (offs % 4 || !U32(offs, &count) || !InBounds(offs + 4ULL, 4ULL * count)) {
+    return Fail("bad annotation_set_ref_list", offs);
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    const uint32_t set_offs = scanner_.ReadUint32(offs + 4 + 4*i);
+    if (set_offs && !AnnotationSetItem(set_offs)) return false;
+  }
+  return true;
+}
+
+bool DexValidator::EncodedValueItem(size_t* pos, int depth) {
+  const size_t start = *pos;
+  if (start >= size_) return Fail("truncated encoded_value", start);
+  const uint8_t header = scanner_.content_[start];
+  const uint32_t arg = header >> 5;
+  uint32_t max_arg = 0;
+  uint32_t limit = 0;
+  switch (header & 0x1F) {
+  case EncodedValue::VALUE_BYTE:
+    break;
+  case EncodedValue::VALUE_SHORT:
+  case EncodedValue::VALUE_CHAR:
+  case EncodedValue::VALUE_BOOLEAN:
+    max_arg = 1;
+    break;
+  case EncodedValue::VALUE_INT:
+  case EncodedValue::VALUE_FLOAT:
+  case EncodedValue::VALUE_METHOD_HANDLE:
+    max_arg = 3;
+    break;
+  case EncodedValue::VALUE_LONG:
+  case EncodedValue::VALUE_DOUBLE:
+    max_arg = 7;
+    break;
+  case EncodedValue::VALUE_METHOD_TYPE:
+    max_arg = 3;
+    limit = scanner_.proto_ids_size_;
+    break;
+  case EncodedValue::VALUE_STRING:
+    max_arg = 3;
+    limit = scanner_.string_ids_size_;
+    break;
+  case EncodedValue::VALUE_TYPE:
+    max_arg = 3;
+    limit = scanner_.type_ids_size_;
+    break;
+  case EncodedValue::VALUE_FIELD:
+  case EncodedValue::VALUE_ENUM:
+    max_arg = 3;
+    limit = scanner_.field_ids_size_;
+    break;
+  case EncodedValue::VALUE_METHOD:
+    max_arg = 3;
+    limit = scanner_.method_ids_size_;
+    break;
+  case EncodedValue::VALUE_ARRAY:
+  case EncodedValue::VALUE_ANNOTATION:
+    if (arg) return Fail("bad encoded_value", start);
+    if (depth == EncodedValue::kMaxDepth) return Fail("encoded_value nested too deep", start);
+    ++*pos;
+    return (header & 0x1F) == EncodedValue::VALUE_ARRAY
+        ? EncodedArrayItem(pos, depth + 1) : EncodedAnnotationItem(pos, depth + 1);
+  case EncodedValue::VALUE_NULL:
+    break;
+  default:
+    return Fail("bad encoded_value type", start);
+  }
+  if (arg > max_arg) return Fail("bad encoded_value", start);
+  const EncodedValue value(scanner_, start);
+  const uint32_t type = header & 0x1F;
+  if (type == EncodedValue::VALUE_NULL || type == EncodedValue::VALUE_BOOLEAN) {
+    *pos = start + 1;
+    return true;
+  }
+  if (!InBounds(start + 1ULL, arg + 1)) return Fail("truncated encoded_value", start);
+  if (limit && value.AsIndex() >= limit) return Fail("bad index", start);
+  *pos = start + 2 + arg;
+  return true;
+}
+
+bool DexValidator::EncodedArrayItem(size_t* pos, int depth) {
+  uint32_t size;
+  if (!Uleb(pos, &size)) return false;
+  for (uint32_t i = 0; i < size; ++i) {
+    if (!EncodedValueItem(pos, depth)) return false;
+  }
+  return true;
+}
+
+bool DexValidator::EncodedAnnotationItem(size_t* pos, int depth) {
+  const size_t start = *pos;
+  uint32_t type_idx;
+  uint32_t size;
+  if (!Uleb(pos, &type_idx) || !Uleb(pos, &size)) return false;
+  if (type_idx >= scanner_.type_ids_size_) return Fail("bad type index", start);
+  uint32_t last = 0;
+  for (uint32_t i = 0; i < size; ++i) {
+    const size_t element = *pos;
+    uint32_t name_idx;
+    if (!Uleb(pos, &name_idx)) return false;
+    // EncodedAnnotation::Find() stops at the first name past the one looked up.
+    if (name_idx >= scanner_.string_ids_size_ || (i && name_idx <= last)) {
+      return Fail("bad annotation element", element);
+    }
+    last = name_idx;
+    if (!EncodedValueItem(pos, depth)) return false;
+  }
+  return true;
+}
+
+bool DexValidator::Validate() {
+  if (!ValidateIds()) return false;
+  for (size_t i = 0; i < scanner_.class_defs_size_; ++i) {
+    if (!ValidateClass(i)) return false;
+  }
+  return true;
+}
+
+}  // namespace rev
+}  // namespace egorich
@@ -0,0 +1,89 @@
+#ifndef REV_DEX_VALIDATOR_H__
+#define REV_DEX_VALIDATOR_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dex_scanner.h"
+
+using std::string;
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Structural checks of a dex file, with bounds and overflow checks on every
+// read. Everything the scanner and the decoders index with is checked once
+// here: offsets and sizes of the sections, indices into the id sections,
+// class data, code items down to the operands, branch targets and
+// registers of every instruction, try blocks, debug info, annotations and
+// static values. Past validation the hot decoding loops keep their
+// unchecked reads.
+class DexValidator {
+ public:
+  // The scanner must have gone through ParseHeader().
+  explicit DexValidator(const DexScanner& scanner) : scanner_(scanner), size_(scanner.size()) {
+  }
+
+  // Checks the header, the map and the id sections.
+  bool ValidateIds();
+  // Checks a class_def and its class data and code, for class_defs()[index].
+  // Requires ValidateIds().
+  bool ValidateClass(size_t index);
+  // Checks the type, the annotations and the static values of
+  // class_defs()[index] only, which is all FindAnnotatedClasses() and the
+  // views of annotations read. Requires ValidateIds().
+  bool ValidateAnnotations(size_t index);
+  // Checks the whole file.
+  bool Validate();
+
+  // Describes the first problem found.
+  const string& error() const { return error_; }
+
+ private:
+  static constexpr uint32_t kNoIndex = 0xFFFFFFFFU;
+
+  bool Fail(const string& what, uint64_t offs);
+  bool InBounds(uint64_t offs, uint64_t size) const { return offs <= size_ && size <= size_ - offs; }
+  bool U16(size_t offs, uint16_t* value);
+  bool U32(size_t offs, uint32_t* value);
+  bool Uleb(size_t* pos, uint32_t* value);
+  bool Sleb(size_t* pos, int32_t* value);
+
+  bool Section(const char* name, uint32_t size, uint32_t offs, size_t item_size);
+  bool Map();
+  bool TypeList(size_t offs);
+  bool Code(size_t offs);
+  // Reader is the DexReader of the byte order of the file.
+  template <typename Reader>
+  bool Instructions(const Reader& reader, size_t insns_offs, uint32_t insns_size,
+                    uint16_t registers);
+  bool Tries(size_t offs, size_t insns_end, uint32_t insns_size, uint16_t tries_size);
+  bool DebugInfoItem(size_t offs, uint16_t registers);
+  // Checks an uleb128p1 index, where kNoIndex stands for none.
+  bool IndexP1(size_t* pos, uint32_t limit);
+  bool AnnotationsDirectoryItem(size_t offs);
+  bool AnnotationSetItem(size_t offs);
+  bool AnnotationSetRefList(size_t offs);
+  // The encoded readers advance pos past the item; depth is the number of
+  // arrays and annotations the item is nested in.
+  bool EncodedValueItem(size_t* pos, int depth);
+  bool EncodedArrayItem(size_t* pos, int depth);
+  bool EncodedAnnotationItem(size_t* pos, int depth);
+
+  const DexScanner& scanner_;
+  const size_t size_;
+  string error_;
+  // Scratch of Instructions(): code units starting an instruction.
+  vector<bool> starts_;
+  vector<uint32_t> targets_;
+
+  DexValidator(const DexValidator&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_DEX_VALIDATOR_H__
@@ -10,7 +10,12 @@ namespace egorich {
 namespace rev {
 
 DominatorEval::DominatorEval(const Edges& outbound)
+  : DominatorEval(outbound, 0) {
+}
+
+DominatorEval::DominatorEval(const Edges& outbound, Vertex root)
   : outbound_(outbound),
+    root_(root),
     inbound_(outbound.size()),
     time_(0),
     semi_(outbound.size(), -1),
@@ -32,16 +37,30 @@ DominatorEval::~DominatorEval() {
 }
 
 void DominatorEval::Compute() {
-  DFS(0);
+  DFS(root_);
   for (int i = 0; i < postorder_.size(); ++i) {
     postorder_index_[postorder_[i]] = i;
   }
   AssignSemi();
   ComputeDom();
-  TraverseTree(0);
+  TraverseTree(root_);
   RearrangeTree();
 }
 
+void DominatorEval::ComputePostDominators() {
+  reversed_.assign(outbound_.size() + 1, vector<Vertex>());
+  for (Vertex v : postorder_) {
+    for (Vertex w : outbound_[v]) {
+      reversed_[w].push_back(v);
+    }
+    if (outbound_[v].empty()) {
+      reversed_[exit()].push_back(v);
+    }
+  }
+  post_.reset(new DominatorEval(reversed_, exit()));
+  post_->Compute();
+}
+
 bool DominatorEval::IsDominated(int v, int by) const {
   return traversal_[by].first <= traversal_[v].first 
       && traversal_[v].first < traversal_[by].second;
@@ -51,19 +70,32 @@ bool DominatorEval::IsBefore(int v, int w) const {
   return postorder_index_[v] > postorder_index_[w];
 }
 
-void DominatorEval::DFS(Vertex v) {
-  semi_[v] = time_;
-  preorder_[time_] = v;
-  ++time_;
-
-  for (Vertex w : outbound_[v]) {
+void DominatorEval::DFS(Vertex root) {
+  // Explicit stack of (vertex, index of the next outbound edge).
+  vector<pair<Vertex, int>> stack;
+  semi_[root] = time_;
+  preorder_[time_++] = root;
+  stack.push_back({root, 0});
+  while (!stack.empty()) {
+    const Vertex v = stack.back().first;
+    const int i = stack.back().second;
+    if (i == outbound_[v].size()) {
+      postorder_.push_back(v);
+      stack.pop_back();
+      continue;
+    }
+    const Vertex w = outbound_[v][i];
     if (semi_[w] == -1) {
+      // The edge is revisited once the subtree of w is done.
       parent_[w] = v;
-      DFS(w);
+      semi_[w] = time_;
+      preorder_[time_++] = w;
+      stack.push_back({w, 0});
+      continue;
     }
     inbound_[w].push_back(v);
+    ++stack.back().second;
   }
-  postorder_.push_back(v);
 }
 
 void DominatorEval::AssignSemi() {
@@ -97,12 +129,22 @@ void DominatorEval::ComputeDom() {
   time_ = 0;
 }
 
-void DominatorEval::TraverseTree(Vertex v) {
-  traversal_[v].first = time_++;
-  for (Vertex w : bucket_[v]) {
-    TraverseTree(w);
+void DominatorEval::TraverseTree(Vertex root) {
+  vector<pair<Vertex, int>> stack;
+  traversal_[root].first = time_++;
+  stack.push_back({root, 0});
+  while (!stack.empty()) {
+    const Vertex v = stack.back().first;
+    const int i = stack.back().second++;
+    if (i == bucket_[v].size()) {
+      traversal_[v].second = time_++;
+      stack.pop_back();
+      continue;
+    }
+    const Vertex w = bucket_[v][i];
+    traversal_[w].first = time_++;
+    stack.push_back({w, 0});
   }
-  traversal_[v].second = time_++;
 }
 
 void DominatorEval::RearrangeTree() {
@@ -126,14 +168,19 @@ DominatorEval::Vertex DominatorEval::Eval(Vertex v) {
 }
 
 void DominatorEval::Compress(Vertex v) {
-  if (ancestor_[ancestor_[v]] == -1) {
-    return;
+  // Walks the ancestor path up, then compresses it top-down.
+  path_.clear();
+  for (; ancestor_[ancestor_[v]] != -1; v = ancestor_[v]) {
+    path_.push_back(v);
   }
-  Compress(ancestor_[v]);
-  if (semi_[label_[ancestor_[v]]] < semi_[label_[v]]) {
-    label_[v] = label_[ancestor_[v]];
+  while (!path_.empty()) {
+    v = path_.back();
+    path_.pop_back();
+    if (semi_[label_[ancestor_[v]]] < semi_[label_[v]]) {
+      label_[v] = label_[ancestor_[v]];
+    }
+    ancestor_[v] = ancestor_[ancestor_[v]];
   }
-  ancestor_[v] = ancestor_[ancestor_[v]];
 }
 
 }  // namespace rev
@@ -1,10 +1,12 @@
 #ifndef REV_DOMINATOR_EVAL_H__
 #define REV_DOMINATOR_EVAL_H__
 
+#include <memory>
 #include <utility>
 #include <vector>
 
 using std::pair;
+using std::unique_ptr;
 using std::vector;
 
 namespace egorich {
@@ -17,24 +19,35 @@ class DominatorEval {
   typedef int Vertex;
 
   explicit DominatorEval(const Edges& outbound);
+  DominatorEval(const Edges& outbound, Vertex root);
   ~DominatorEval();
 
   void Compute();
+  // Computes post-dominators on the reversed graph, must follow Compute().
+  // Vertices without outbound edges are connected to the virtual exit().
+  void ComputePostDominators();
   const vector<int>& dom() const { return dom_; }
   const Edges& inbound() const { return inbound_; }
   const Edges& outbound() const { return outbound_; }
   const vector<vector<Vertex>>& dom_tree() const { return bucket_; }
+  // Reachable vertices in DFS postorder.
+  const vector<Vertex>& postorder() const { return postorder_; }
   bool IsDominated(int v, int by) const;
   // Returns true iff v is earlier than w in topological sort.
   bool IsBefore(int v, int w) const;
 
+  Vertex exit() const { return outbound_.size(); }
+  // Returns the immediate post-dominator of v, exit() if there is none among
+  // the real vertices, or -1 if exit() is not reachable from v.
+  Vertex post_dom(Vertex v) const { return post_->dom()[v]; }
+
  private:
   typedef int Time;
 
-  void DFS(Vertex v);
+  void DFS(Vertex root);
   void AssignSemi();
   void ComputeDom();
-  void TraverseTree(Vertex v);
+  void TraverseTree(Vertex root);
   void RearrangeTree();
   void Link(Vertex v, Vertex w);
   Vertex Eval(Vertex v);
@@ -42,6 +55,7 @@ class DominatorEval {
 
  private:
   const Edges& outbound_;
+  const Vertex root_;
   Edges inbound_;
   Time time_;
   int reachable_count_;
@@ -55,7 +69,12 @@ class DominatorEval {
   vector<int> label_;
   vector<Vertex> dom_;
   vector<pair<Time, Time>> traversal_;
-  
+  // Scratch stack of Compress().
+  vector<Vertex> path_;
+
+  Edges reversed_;
+  unique_ptr<DominatorEval> post_;
+
   DominatorEval(const DominatorEval&) = delete;
 };
 
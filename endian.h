@@ -0,0 +1,40 @@
+#ifndef REV_ENDIAN_H__
+#define REV_ENDIAN_H__
+
+#include <cstdint>
+#include <cstring>
+
+namespace egorich {
+namespace rev {
+
+// Byte order policies of the readers. Loads go through memcpy, which is
+// safe at any alignment and compiles to a plain load.
+struct NativeOrder {
+  static uint16_t Load16(const char* p) {
+    uint16_t result;
+    memcpy(&result, p, sizeof(result));
+    return result;
+  }
+
+  static uint32_t Load32(const char* p) {
+    uint32_t result;
+    memcpy(&result, p, sizeof(result));
+    return result;
+  }
+};
+
+// A file written on a machine of the opposite byte order.
+struct SwappedOrder {
+  static uint16_t Load16(const char* p) {
+    return __builtin_bswap16(NativeOrder::Load16(p));
+  }
+
+  static uint32_t Load32(const char* p) {
+    return __builtin_bswap32(NativeOrder::Load32(p));
+  }
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_ENDIAN_H__
@@ -0,0 +1,425 @@
+#include "expr_tree.h"
+
+#include <algorithm>
+
+#include "log.h"
+
+namespace egorich {
+namespace rev {
+namespace {
+
+bool IsWideConst(uint8_t opcode) { return 0x16 <= opcode && opcode <= 0x19; }
+bool IsMoveResult(uint8_t opcode) { return 0x0A <= opcode && opcode <= 0x0C; }
+bool IsInvoke(uint8_t opcode) {
+  return (0x6E <= opcode && opcode <= 0x72) || (0x74 <= opcode && opcode <= 0x78);
+}
+
+// Integer division and remainder throw on zero, so they are not moved
+// across other side effects.
+bool IsDivision(uint8_t opcode) {
+  switch (opcode) {
+  case 0x93: case 0x94: case 0x9E: case 0x9F:
+  case 0xB3: case 0xB4: case 0xBE: case 0xBF:
+  case 0xD3: case 0xD4: case 0xDB: case 0xDC:
+    return true;
+  default:
+    return false;
+  }
+}
+
+}  // namespace
+
+ExprPool::ExprPool(Zone* zone, size_t node_capacity, size_t stmt_capacity)
+    : nodes_(zone->AllocateArray<ExprNode>(node_capacity + 1)),
+      operands_(zone->AllocateArray<uint32_t>(node_capacity)),
+      stmts_(zone->AllocateArray<uint32_t>(stmt_capacity)),
+      node_capacity_(node_capacity),
+      stmt_capacity_(stmt_capacity),
+      node_count_(0),
+      operand_count_(0),
+      stmt_count_(0),
+      full_(false) {
+}
+
+uint32_t ExprPool::Add(ExprNode::Kind kind, uint8_t opcode, uint32_t pc, int64_t payload,
+                       const uint32_t* args, size_t arity) {
+  // Operands share the capacity of the nodes.
+  if (node_count_ == node_capacity_ || arity > node_capacity_ - operand_count_) {
+    full_ = true;
+    ExprNode& spare = nodes_[node_capacity_];
+    spare.kind = kind;
+    spare.opcode = opcode;
+    spare.arity = 0;
+    spare.operands = 0;
+    spare.pc = pc;
+    spare.payload = payload;
+    return node_capacity_;
+  }
+  ExprNode& node = nodes_[node_count_];
+  node.kind = kind;
+  node.opcode = opcode;
+  node.arity = arity;
+  node.operands = operand_count_;
+  node.pc = pc;
+  node.payload = payload;
+  std::copy(args, args + arity, operands_ + operand_count_);
+  operand_count_ += arity;
+  return node_count_++;
+}
+
+ExprBuilder::ExprBuilder(ExprPool* pool, const DexScanner& scanner, const CodeItem& code,
+                         const SsaForm& ssa, const vector<uint32_t>& block_size)
+    : pool_(pool),
+      scanner_(scanner),
+      code_(code),
+      ssa_(ssa),
+      block_size_(block_size),
+      call_(SsaForm::kUndefined),
+      cursor_(0),
+      pure_(true),
+      last_(false),
+      failed_(false) {
+}
+
+StatementList ExprBuilder::Build(uint32_t head) {
+  const auto it = built_.find(head);
+  if (it != built_.end()) {
+    return it->second;
+  }
+
+  StatementList result = {pool_->stmt_count(), 0};
+  const uint32_t end = head + block_size_[head];
+  for (uint32_t pc = head; pc < end;) {
+    const uint32_t next = pc + code_.opsize(pc);
+    last_ = next >= end;
+    BuildInstr(pc, end);
+    pc = next;
+  }
+  last_ = true;
+  Flush();
+  result.count = pool_->stmt_count() - result.first;
+  built_[head] = result;
+  return result;
+}
+
+bool ExprBuilder::IsHighHalf(uint32_t value) const {
+  const SsaForm::Value& v = ssa_.value(value);
+  return v.kind == SsaForm::INSTR && value != ssa_.DefAt(v.pc, 0);
+}
+
+uint32_t ExprBuilder::Operand(uint32_t pc, uint16_t reg) {
+  while (cursor_ < access_.use_count && access_.uses[cursor_] != reg) {
+    ++cursor_;
+  }
+  if (cursor_ == access_.use_count) {
+    failed_ = true;
+    return pool_->Add(ExprNode::OPAQUE, code_.opcode(pc), pc, reg, NULL, 0);
+  }
+  const uint32_t value = ssa_.UseAt(pc, cursor_++);
+  for (size_t i = 0; i < pending_.size(); ++i) {
+    if (pending_[i].value != value) continue;
+    const Pending inlined = pending_[i];
+    pending_.erase(pending_.begin() + i);
+    pure_ = pure_ && inlined.pure;
+    return inlined.node;
+  }
+  return pool_->Add(ExprNode::VALUE, 0, pc, value, NULL, 0);
+}
+
+uint32_t ExprBuilder::Add(ExprNode::Kind kind, uint32_t pc, int64_t payload,
+                          const uint32_t* args, size_t arity) {
+  return pool_->Add(kind, code_.opcode(pc), pc, payload, args, arity);
+}
+
+void ExprBuilder::Emit(ExprNode::Kind kind, uint32_t pc, int64_t payload,
+                       const uint32_t* args, size_t arity) {
+  if (last_) {
+    Flush();
+  } else {
+    FlushImpure();
+  }
+  pool_->AddStatement(Add(kind, pc, payload, args, arity));
+}
+
+void ExprBuilder::Define(uint32_t pc, uint32_t expr, bool pure) {
+  pure = pure && pure_;
+  if (!pure) {
+    FlushImpure();
+  }
+  const uint32_t value = ssa_.DefAt(pc, 0);
+  const uint32_t uses = ssa_.value(value).use_count;
+  if (uses == 1 && !last_) {
+    pending_.push_back({value, expr, pure});
+  } else if (uses == 0 && pure) {
+    // Dead and free of side effects.
+  } else {
+    // Impure expressions had the pending ones flushed above, so a pure one
+    // is free to go ahead of them.
+    if (last_) {
+      Flush();
+    }
+    pool_->AddStatement(Add(uses ? ExprNode::ASSIGN : ExprNode::EVAL, pc, uses ? value : 0, &expr, 1));
+  }
+}
+
+void ExprBuilder::FlushImpure() {
+  for (size_t i = 0; i < pending_.size(); ++i) {
+    if (pending_[i].pure) continue;
+    const Pending flushed = pending_[i];
+    pending_.erase(pending_.begin() + i);
+    pool_->AddStatement(pool_->Add(ExprNode::ASSIGN, code_.opcode(ssa_.value(flushed.value).pc),
+                                   ssa_.value(flushed.value).pc, flushed.value,
+                                   &flushed.node, 1));
+    // At most one impure expression is pending at a time.
+    return;
+  }
+}
+
+void ExprBuilder::Flush() {
+  if (call_ != SsaForm::kUndefined) {
+    pool_->AddStatement(
+        pool_->Add(ExprNode::EVAL, pool_->node(call_).opcode, pool_->node(call_).pc, 0, &call_, 1));
+    call_ = SsaForm::kUndefined;
+  }
+  for (const Pending& flushed : pending_) {
+    const uint32_t pc = ssa_.value(flushed.value).pc;
+    pool_->AddStatement(
+        pool_->Add(ExprNode::ASSIGN, code_.opcode(pc), pc, flushed.value, &flushed.node, 1));
+  }
+  pending_.clear();
+}
+
+void ExprBuilder::BuildInstr(uint32_t pc, uint32_t end) {
+  const size_t offs = code_.instr_offs() + 2*pc;
+  const uint8_t opcode = code_.opcode(pc);
+  const IDefBase* const instr = iTable[opcode];
+  ReadRegisterAccess(&scanner_, offs, &access_);
+  cursor_ = 0;
+  pure_ = true;
+
+  uint32_t args[3];
+  switch (opcode) {
+  case 0x00:
+  case 0x28: case 0x29: case 0x2A:
+    if (last_) Flush();
+    return;
+  case 0x01: case 0x04: case 0x07:
+    Define(pc, Operand(pc, layout<L_12x>(instr)->vB(&scanner_, offs)), true);
+    return;
+  case 0x02: case 0x05: case 0x08:
+    Define(pc, Operand(pc, layout<L_22x>(instr)->vB(&scanner_, offs)), true);
+    return;
+  case 0x03: case 0x06: case 0x09:
+    Define(pc, Operand(pc, layout<L_32x>(instr)->vB(&scanner_, offs)), true);
+    return;
+  case 0x0A: case 0x0B: case 0x0C:
+    if (call_ != SsaForm::kUndefined) {
+      const uint32_t call = call_;
+      call_ = SsaForm::kUndefined;
+      Define(pc, call, false);
+      return;
+    }
+    Define(pc, Add(ExprNode::OPAQUE, pc, 0, NULL, 0), false);
+    return;
+  case 0x0D:
+    Define(pc, Add(ExprNode::OPAQUE, pc, 0, NULL, 0), false);
+    return;
+  case 0x0E:
+    Emit(ExprNode::RETURN, pc, 0, NULL, 0);
+    return;
+  case 0x0F: case 0x10: case 0x11:
+    args[0] = Operand(pc, layout<L_11x>(instr)->vA(&scanner_, offs));
+    Emit(ExprNode::RETURN, pc, 0, args, 1);
+    return;
+  case 0x12:
+    Define(pc, Add(ExprNode::LITERAL, pc, layout<L_11n>(instr)->B(&scanner_, offs), NULL, 0), true);
+    return;
+  case 0x13: case 0x16:
+    Define(pc, Add(ExprNode::LITERAL, pc, layout<L_21s>(instr)->B(&scanner_, offs), NULL, 0), true);
+    return;
+  case 0x14: case 0x17:
+    Define(pc, Add(ExprNode::LITERAL, pc, layout<L_31i>(instr)->B(&scanner_, offs), NULL, 0), true);
+    return;
+  case 0x15: case 0x19: {
+    const int64_t high = layout<L_21h>(instr)->B(&scanner_, offs);
+    const int64_t literal = IsWideConst(opcode)
+        ? static_cast<int64_t>(static_cast<uint64_t>(high) << 48)
+        : static_cast<int32_t>(static_cast<uint32_t>(high) << 16);
+    Define(pc, Add(ExprNode::LITERAL, pc, literal, NULL, 0), true);
+    return;
+  }
+  case 0x18:
+    Define(pc, Add(ExprNode::LITERAL, pc, layout<L_51l>(instr)->B(&scanner_, offs), NULL, 0), true);
+    return;
+  case 0x1A:
+    Define(pc, Add(ExprNode::CONST_STRING, pc, layout<L_21c>(instr)->B(&scanner_, offs), NULL, 0), true);
+    return;
+  case 0x1B:
+    Define(pc, Add(ExprNode::CONST_STRING, pc, layout<L_31c>(instr)->B(&scanner_, offs), NULL, 0), true);
+    return;
+  case 0x1C:
+    Define(pc, Add(ExprNode::CONST_CLASS, pc, layout<L_21c>(instr)->B(&scanner_, offs), NULL, 0), true);
+    return;
+  case 0x1F: {
+    const L_21c* l = layout<L_21c>(instr);
+    args[0] = Operand(pc, l->vA(&scanner_, offs));
+    Define(pc, Add(ExprNode::CHECK_CAST, pc, l->B(&scanner_, offs), args, 1), false);
+    return;
+  }
+  case 0x20: {
+    const L_22c* l = layout<L_22c>(instr);
+    args[0] = Operand(pc, l->vB(&scanner_, offs));
+    Define(pc, Add(ExprNode::INSTANCE_OF, pc, l->C(&scanner_, offs), args, 1), true);
+    return;
+  }
+  case 0x21:
+    args[0] = Operand(pc, layout<L_12x>(instr)->vB(&scanner_, offs));
+    Define(pc, Add(ExprNode::UNARY, pc, 0, args, 1), false);
+    return;
+  case 0x22:
+    Define(pc, Add(ExprNode::NEW_INSTANCE, pc, layout<L_21c>(instr)->B(&scanner_, offs), NULL, 0), false);
+    return;
+  case 0x23: {
+    const L_22c* l = layout<L_22c>(instr);
+    args[0] = Operand(pc, l->vB(&scanner_, offs));
+    Define(pc, Add(ExprNode::NEW_ARRAY, pc, l->C(&scanner_, offs), args, 1), false);
+    return;
+  }
+  case 0x27:
+    args[0] = Operand(pc, layout<L_11x>(instr)->vA(&scanner_, offs));
+    Emit(ExprNode::THROW, pc, 0, args, 1);
+    return;
+  case 0x2D: case 0x2E: case 0x2F: case 0x30: case 0x31: {
+    const L_23x* l = layout<L_23x>(instr);
+    args[0] = Operand(pc, l->vB(&scanner_, offs));
+    args[1] = Operand(pc, l->vC(&scanner_, offs));
+    Define(pc, Add(ExprNode::BINARY, pc, 0, args, 2), true);
+    return;
+  }
+  case 0x32: case 0x33: case 0x34: case 0x35: case 0x36: case 0x37: {
+    const L_22t* l = layout<L_22t>(instr);
+    args[0] = Operand(pc, l->vA(&scanner_, offs));
+    args[1] = Operand(pc, l->vB(&scanner_, offs));
+    Emit(ExprNode::COND, pc, 0, args, 2);
+    return;
+  }
+  case 0x38: case 0x39: case 0x3A: case 0x3B: case 0x3C: case 0x3D:
+    args[0] = Operand(pc, layout<L_21t>(instr)->vA(&scanner_, offs));
+    Emit(ExprNode::COND, pc, 0, args, 1);
+    return;
+  case 0x44: case 0x45: case 0x46: case 0x47: case 0x48: case 0x49: case 0x4A: {
+    const L_23x* l = layout<L_23x>(instr);
+    args[0] = Operand(pc, l->vB(&scanner_, offs));
+    args[1] = Operand(pc, l->vC(&scanner_, offs));
+    Define(pc, Add(ExprNode::ARRAY_ELEMENT, pc, 0, args, 2), false);
+    return;
+  }
+  case 0x4B: case 0x4C: case 0x4D: case 0x4E: case 0x4F: case 0x50: case 0x51: {
+    // Operands are taken in the order the registers are read.
+    const L_23x* l = layout<L_23x>(instr);
+    args[2] = Operand(pc, l->vA(&scanner_, offs));
+    args[0] = Operand(pc, l->vB(&scanner_, offs));
+    args[1] = Operand(pc, l->vC(&scanner_, offs));
+    Emit(ExprNode::STORE_ARRAY, pc, 0, args, 3);
+    return;
+  }
+  case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57: case 0x58: {
+    const L_22c* l = layout<L_22c>(instr);
+    args[0] = Operand(pc, l->vB(&scanner_, offs));
+    Define(pc, Add(ExprNode::INSTANCE_FIELD, pc, l->C(&scanner_, offs), args, 1), false);
+    return;
+  }
+  case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5E: case 0x5F: {
+    const L_22c* l = layout<L_22c>(instr);
+    args[1] = Operand(pc, l->vA(&scanner_, offs));
+    args[0] = Operand(pc, l->vB(&scanner_, offs));
+    Emit(ExprNode::STORE_INSTANCE, pc, l->C(&scanner_, offs), args, 2);
+    return;
+  }
+  case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66:
+    Define(pc, Add(ExprNode::STATIC_FIELD, pc, layout<L_21c>(instr)->B(&scanner_, offs), NULL, 0), false);
+    return;
+  case 0x67: case 0x68: case 0x69: case 0x6A: case 0x6B: case 0x6C: case 0x6D: {
+    const L_21c* l = layout<L_21c>(instr);
+    args[0] = Operand(pc, l->vA(&scanner_, offs));
+    Emit(ExprNode::STORE_STATIC, pc, l->B(&scanner_, offs), args, 1);
+    return;
+  }
+  default:
+    break;
+  }
+
+  if (opcode >= 0x7B && opcode <= 0x8F) {
+    args[0] = Operand(pc, layout<L_12x>(instr)->vB(&scanner_, offs));
+    Define(pc, Add(ExprNode::UNARY, pc, 0, args, 1), true);
+    return;
+  }
+  if (opcode >= 0x90 && opcode <= 0xAF) {
+    const L_23x* l = layout<L_23x>(instr);
+    args[0] = Operand(pc, l->vB(&scanner_, offs));
+    args[1] = Operand(pc, l->vC(&scanner_, offs));
+    Define(pc, Add(ExprNode::BINARY, pc, 0, args, 2), !IsDivision(opcode));
+    return;
+  }
+  if (opcode >= 0xB0 && opcode <= 0xCF) {
+    const L_12x* l = layout<L_12x>(instr);
+    args[0] = Operand(pc, l->vA(&scanner_, offs));
+    args[1] = Operand(pc, l->vB(&scanner_, offs));
+    Define(pc, Add(ExprNode::BINARY, pc, 0, args, 2), !IsDivision(opcode));
+    return;
+  }
+  if (opcode >= 0xD0 && opcode <= 0xD7) {
+    const L_22s* l = layout<L_22s>(instr);
+    args[0] = Operand(pc, l->vB(&scanner_, offs));
+    args[1] = Add(ExprNode::LITERAL, pc, l->C(&scanner_, offs), NULL, 0);
+    Define(pc, Add(ExprNode::BINARY, pc, 0, args, 2), !IsDivision(opcode));
+    return;
+  }
+  if (opcode >= 0xD8 && opcode <= 0xE2) {
+    const L_22b* l = layout<L_22b>(instr);
+    args[0] = Operand(pc, l->vB(&scanner_, offs));
+    args[1] = Add(ExprNode::LITERAL, pc, l->C(&scanner_, offs), NULL, 0);
+    Define(pc, Add(ExprNode::BINARY, pc, 0, args, 2), !IsDivision(opcode));
+    return;
+  }
+
+  // Invokes and anything without a dedicated node read all their registers;
+  // the high halves of wide values are dropped where they are known.
+  args_.clear();
+  for (size_t i = 0; i < access_.use_count; ++i) {
+    const uint32_t value = ssa_.UseAt(pc, i);
+    if (value != SsaForm::kUndefined && IsHighHalf(value)) {
+      ++cursor_;
+      continue;
+    }
+    args_.push_back(Operand(pc, access_.uses[i]));
+  }
+  if (IsInvoke(opcode) || opcode == 0x24 || opcode == 0x25) {
+    const uint16_t idx = opcode == 0x24 || (0x6E <= opcode && opcode <= 0x72)
+        ? layout<L_35c>(instr)->B(&scanner_, offs)
+        : layout<L_3rc>(instr)->B(&scanner_, offs);
+    const uint32_t node = Add(IsInvoke(opcode) ? ExprNode::INVOKE : ExprNode::OPAQUE,
+                              pc, idx, args_.data(), args_.size());
+    const uint32_t next = pc + code_.opsize(pc);
+    if (next < end && IsMoveResult(code_.opcode(next))) {
+      // The call is folded into the move-result which follows.
+      FlushImpure();
+      call_ = node;
+    } else if (last_) {
+      Flush();
+      pool_->AddStatement(Add(ExprNode::EVAL, pc, 0, &node, 1));
+    } else {
+      FlushImpure();
+      pool_->AddStatement(Add(ExprNode::EVAL, pc, 0, &node, 1));
+    }
+    return;
+  }
+  if (access_.def_count) {
+    Define(pc, Add(ExprNode::OPAQUE, pc, 0, args_.data(), args_.size()), false);
+  } else {
+    Emit(ExprNode::STATEMENT, pc, 0, args_.data(), args_.size());
+  }
+}
+
+}  // namespace rev
+}  // namespace egorich
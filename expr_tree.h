@@ -0,0 +1,169 @@
+#ifndef REV_EXPR_TREE_H__
+#define REV_EXPR_TREE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "dex_asm.h"
+#include "dex_scanner.h"
+#include "java_blocks.h"
+#include "ssa_form.h"
+#include "zone.h"
+
+using std::unordered_map;
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Node of an expression or a statement. Nodes refer to each other by index
+// in the ExprPool, and the operands of a node are adjacent in the pool's
+// operand array.
+struct ExprNode {
+  enum Kind {
+    // Expressions.
+    VALUE = 1,       // payload: SSA value
+    LITERAL,         // payload: literal, wide if opcode is a -wide const
+    CONST_STRING,    // payload: string idx
+    CONST_CLASS,     // payload: type idx
+    UNARY,           // (operand)
+    BINARY,          // (lhs, rhs), rhs is a LITERAL for the /lit forms
+    INSTANCE_FIELD,  // payload: field idx; (object)
+    STATIC_FIELD,    // payload: field idx
+    ARRAY_ELEMENT,   // (array, index)
+    INSTANCE_OF,     // payload: type idx; (object)
+    CHECK_CAST,      // payload: type idx; (object)
+    NEW_INSTANCE,    // payload: type idx
+    NEW_ARRAY,       // payload: type idx; (size)
+    INVOKE,          // payload: method idx; (args...)
+    OPAQUE,          // instruction at pc kept as is; (registers read...)
+
+    // Statements.
+    ASSIGN,          // payload: SSA value; (expr)
+    EVAL,            // (expr)
+    STORE_INSTANCE,  // payload: field idx; (object, value)
+    STORE_STATIC,    // payload: field idx; (value)
+    STORE_ARRAY,     // (array, index, value)
+    RETURN,          // (value) or ()
+    THROW,           // (exception)
+    COND,            // (lhs, rhs) or (lhs) for the -z forms
+    STATEMENT,       // instruction at pc kept as is; (registers read...)
+  };
+
+  uint8_t kind;
+  uint8_t opcode;
+  uint16_t arity;
+  uint32_t operands;
+  uint32_t pc;
+  int64_t payload;
+};
+
+// Zone-allocated pool of the expression nodes of a method. The pool does
+// not grow: once a node, its operands or a statement do not fit, it is
+// full, and the method is left without statements.
+class ExprPool {
+ public:
+  ExprPool(Zone* zone, size_t node_capacity, size_t stmt_capacity);
+
+  // False if the zone could not hold the pool.
+  bool ok() const { return nodes_ != NULL && operands_ != NULL && stmts_ != NULL; }
+  // Whether something was dropped for want of room; the nodes and
+  // statements added are incomplete then.
+  bool full() const { return full_; }
+
+  const ExprNode& node(uint32_t n) const { return nodes_[n]; }
+  uint32_t operand(uint32_t n, size_t i) const { return operands_[nodes_[n].operands + i]; }
+  uint32_t stmt(uint32_t s) const { return stmts_[s]; }
+
+  uint32_t Add(ExprNode::Kind kind, uint8_t opcode, uint32_t pc, int64_t payload,
+               const uint32_t* args, size_t arity);
+  uint32_t AddStatement(uint32_t node) {
+    if (stmt_count_ == stmt_capacity_) {
+      full_ = true;
+      return stmt_count_;
+    }
+    stmts_[stmt_count_] = node;
+    return stmt_count_++;
+  }
+  uint32_t node_count() const { return node_count_; }
+  uint32_t stmt_count() const { return stmt_count_; }
+
+ private:
+  // node_capacity_ nodes, and a spare one past them taking the nodes which
+  // do not fit, so that the indices handed out may always be read.
+  ExprNode* nodes_;
+  uint32_t* operands_;
+  uint32_t* stmts_;
+  const uint32_t node_capacity_;
+  const uint32_t stmt_capacity_;
+  uint32_t node_count_;
+  uint32_t operand_count_;
+  uint32_t stmt_count_;
+  bool full_;
+};
+
+// Recovers the statements of the blocks of a method from its SSA form.
+// Single-use values are inlined into their use as long as no side effect
+// is reordered; other values are assigned by ASSIGN statements.
+class ExprBuilder {
+ public:
+  ExprBuilder(ExprPool* pool, const DexScanner& scanner, const CodeItem& code,
+              const SsaForm& ssa, const vector<uint32_t>& block_size);
+
+  // Statements of the block at head; a block is built once.
+  StatementList Build(uint32_t head);
+  // Whether an instruction read a register its access list lacks; the
+  // expressions built are meaningless then.
+  bool failed() const { return failed_; }
+
+ private:
+  struct Pending {
+    uint32_t value;
+    uint32_t node;
+    bool pure;
+  };
+
+  void BuildInstr(uint32_t pc, uint32_t end);
+  // Expression reading reg at pc; a pending expression of the value read is
+  // inlined. Registers are matched in the order the instruction reads them.
+  uint32_t Operand(uint32_t pc, uint16_t reg);
+  uint32_t Add(ExprNode::Kind kind, uint32_t pc, int64_t payload,
+               const uint32_t* args, size_t arity);
+  void Emit(ExprNode::Kind kind, uint32_t pc, int64_t payload,
+            const uint32_t* args, size_t arity);
+  // Binds the value defined at pc to the expression: single-use values are
+  // kept pending for inlining, the others are assigned.
+  void Define(uint32_t pc, uint32_t expr, bool pure);
+  // Assigns the pending impure expression, if any.
+  void FlushImpure();
+  // Assigns all pending expressions, before the end of the block.
+  void Flush();
+  bool IsHighHalf(uint32_t value) const;
+
+  ExprPool* const pool_;
+  const DexScanner& scanner_;
+  const CodeItem& code_;
+  const SsaForm& ssa_;
+  const vector<uint32_t>& block_size_;
+  RegisterAccess access_;
+
+  unordered_map<uint32_t, StatementList> built_;
+  vector<Pending> pending_;
+  // Invoke waiting for its move-result.
+  uint32_t call_;
+  vector<uint32_t> args_;
+  // Next use of the instruction being built to match against a register.
+  size_t cursor_;
+  // False once the instruction inlined an impure expression.
+  bool pure_;
+  // Whether the instruction being built ends its block.
+  bool last_;
+  bool failed_;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_EXPR_TREE_H__
@@ -0,0 +1,36 @@
+#include "file_util.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace egorich {
+namespace rev {
+
+bool ReadFileContent(const string& path, string* content) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  content->resize(st.st_size);
+  size_t done = 0;
+  while (done < content->size()) {
+    const ssize_t sz = read(fd, &(*content)[done], content->size() - done);
+    if (sz <= 0) {
+      close(fd);
+      return false;
+    }
+    done += sz;
+  }
+  close(fd);
+  return true;
+}
+
+}  // namespace rev
+}  // namespace egorich
@@ -0,0 +1,17 @@
+#ifndef REV_FILE_UTIL_H__
+#define REV_FILE_UTIL_H__
+
+#include <string>
+
+using std::string;
+
+namespace egorich {
+namespace rev {
+
+// Reads the whole file. Returns false if it cannot be read.
+bool ReadFileContent(const string& path, string* content);
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_FILE_UTIL_H__
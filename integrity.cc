@@ -0,0 +1,258 @@
+#include "integrity.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define REV_X86 1
+#endif
+
+namespace egorich {
+namespace rev {
+namespace {
+
+const uint32_t kAdlerBase = 65521;
+// Most bytes which can be summed before s2 may overflow 32 bits.
+const size_t kAdlerMax = 5552;
+
+const size_t kChecksumStart = 12;
+const size_t kSignatureOffset = 12;
+const size_t kSignatureStart = 32;
+
+uint32_t Adler32Scalar(uint32_t adler, const uint8_t* p, size_t size) {
+  uint32_t s1 = adler & 0xFFFF;
+  uint32_t s2 = adler >> 16;
+  while (size) {
+    size_t n = std::min(size, kAdlerMax);
+    size -= n;
+    for (; n; --n) {
+      s1 += *p++;
+      s2 += s1;
+    }
+    s1 %= kAdlerBase;
+    s2 %= kAdlerBase;
+  }
+  return s1 | (s2 << 16);
+}
+
+uint32_t Rotl(uint32_t x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+// Processes whole 64-byte blocks.
+void Sha1BlocksScalar(uint32_t* state, const uint8_t* p, size_t blocks) {
+  uint32_t w[80];
+  for (; blocks; --blocks, p += 64) {
+    for (int i = 0; i < 16; ++i) {
+      w[i] = static_cast<uint32_t>(p[4*i]) << 24 | p[4*i + 1] << 16 | p[4*i + 2] << 8 | p[4*i + 3];
+    }
+    for (int i = 16; i < 80; ++i) {
+      w[i] = Rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; ++i) {
+      uint32_t f;
+      uint32_t k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      const uint32_t t = Rotl(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = Rotl(b, 30);
+      b = a;
+      a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+  }
+}
+
+#ifdef REV_X86
+
+// 32 bytes per step: s1 gains the byte sums, s2 the sums weighted by the
+// distance to the end of the step, plus 32 times s1 for every step before.
+__attribute__((target("ssse3")))
+uint32_t Adler32Ssse3(uint32_t adler, const uint8_t* p, size_t size) {
+  uint32_t s1 = adler & 0xFFFF;
+  uint32_t s2 = adler >> 16;
+  const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  size_t steps = size / 32;
+  while (steps) {
+    size_t n = std::min(steps, kAdlerMax / 32);
+    steps -= n;
+    // Sum of s1 over the steps so far, scaled by 32 at the end.
+    __m128i v_ps = _mm_set_epi32(0, 0, 0, s1 * n);
+    __m128i v_s1 = zero;
+    __m128i v_s2 = _mm_set_epi32(0, 0, 0, s2);
+    for (; n; --n, p += 32) {
+      const __m128i bytes1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      const __m128i bytes2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+      v_ps = _mm_add_epi32(v_ps, v_s1);
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+    }
+    v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+    v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2, 3, 0, 1)));
+    v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 = (s1 + _mm_cvtsi128_si32(v_s1)) % kAdlerBase;
+    s2 = _mm_cvtsi128_si32(v_s2) % kAdlerBase;
+  }
+  return Adler32Scalar(s1 | (s2 << 16), p, size % 32);
+}
+
+// The SHA extensions do four rounds at a time. Group g of rounds consumes
+// the message words in msg[g % 4] and schedules the words of the groups
+// to come; e[] alternates between the E of this group and the next.
+__attribute__((target("sha,sse4.1")))
+void Sha1BlocksShaNi(uint32_t* state, const uint8_t* p, size_t blocks) {
+  const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090A0B0C0D0E0FULL);
+  __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B);
+  __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+  for (; blocks; --blocks, p += 64) {
+    const __m128i abcd_save = abcd;
+    const __m128i e_save = e0;
+    __m128i msg[4];
+    __m128i e[2] = {e0, e0};
+    for (int i = 0; i < 4; ++i) {
+      msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16*i)), mask);
+    }
+#pragma GCC unroll 20
+    for (int g = 0; g < 20; ++g) {
+      __m128i& cur = e[g % 2];
+      cur = g ? _mm_sha1nexte_epu32(cur, msg[g % 4]) : _mm_add_epi32(cur, msg[0]);
+      e[(g + 1) % 2] = abcd;
+      if (g >= 3 && g <= 18) msg[(g + 1) % 4] = _mm_sha1msg2_epu32(msg[(g + 1) % 4], msg[g % 4]);
+      switch (g / 5) {
+      case 0:
+        abcd = _mm_sha1rnds4_epu32(abcd, cur, 0);
+        break;
+      case 1:
+        abcd = _mm_sha1rnds4_epu32(abcd, cur, 1);
+        break;
+      case 2:
+        abcd = _mm_sha1rnds4_epu32(abcd, cur, 2);
+        break;
+      default:
+        abcd = _mm_sha1rnds4_epu32(abcd, cur, 3);
+        break;
+      }
+      if (g >= 1 && g <= 16) msg[(g + 3) % 4] = _mm_sha1msg1_epu32(msg[(g + 3) % 4], msg[g % 4]);
+      if (g >= 2 && g <= 17) msg[(g + 2) % 4] = _mm_xor_si128(msg[(g + 2) % 4], msg[g % 4]);
+    }
+    e0 = _mm_sha1nexte_epu32(e[0], e_save);
+    abcd = _mm_add_epi32(abcd, abcd_save);
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1B));
+  state[4] = _mm_extract_epi32(e0, 3);
+}
+
+#endif  // REV_X86
+
+uint32_t Adler32Update(uint32_t adler, const uint8_t* p, size_t size) {
+#ifdef REV_X86
+  static const bool ssse3 = __builtin_cpu_supports("ssse3");
+  if (ssse3) {
+    return Adler32Ssse3(adler, p, size);
+  }
+#endif
+  return Adler32Scalar(adler, p, size);
+}
+
+void Sha1Blocks(uint32_t* state, const uint8_t* p, size_t blocks) {
+#ifdef REV_X86
+  static const bool sha = __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+  if (sha) {
+    Sha1BlocksShaNi(state, p, blocks);
+    return;
+  }
+#endif
+  Sha1BlocksScalar(state, p, blocks);
+}
+
+}  // namespace
+
+uint32_t Adler32(const char* data, size_t size) {
+  return Adler32Update(1, reinterpret_cast<const uint8_t*>(data), size);
+}
+
+void Sha1(const char* data, size_t size, uint8_t* digest) {
+  uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+  const uint8_t* const p = reinterpret_cast<const uint8_t*>(data);
+  Sha1Blocks(state, p, size / 64);
+
+  // The tail, the 0x80 byte and the bit length, in one or two blocks.
+  uint8_t tail[128] = {0};
+  const size_t rest = size % 64;
+  memcpy(tail, p + size - rest, rest);
+  tail[rest] = 0x80;
+  const size_t tail_size = rest < 56 ? 64 : 128;
+  const uint64_t bits = static_cast<uint64_t>(size) * 8;
+  for (int i = 0; i < 8; ++i) {
+    tail[tail_size - 1 - i] = static_cast<uint8_t>(bits >> (8*i));
+  }
+  Sha1Blocks(state, tail, tail_size / 64);
+
+  for (int i = 0; i < 5; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      digest[4*i + j] = static_cast<uint8_t>(state[i] >> (24 - 8*j));
+    }
+  }
+}
+
+IntegrityCheck::IntegrityCheck(const DexScanner& scanner)
+    : scanner_(scanner), ok_(false), thread_(&IntegrityCheck::Run, this) {
+}
+
+IntegrityCheck::~IntegrityCheck() {
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool IntegrityCheck::Wait() {
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  return ok_;
+}
+
+void IntegrityCheck::Run() {
+  const char* const data = scanner_.data();
+  const size_t size = scanner_.size();
+  if (Adler32(data + kChecksumStart, size - kChecksumStart) != scanner_.checksum()) {
+    error_ = "checksum mismatch";
+    return;
+  }
+  uint8_t digest[kSha1Size];
+  Sha1(data + kSignatureStart, size - kSignatureStart, digest);
+  if (memcmp(digest, data + kSignatureOffset, kSha1Size) != 0) {
+    error_ = "signature mismatch";
+    return;
+  }
+  ok_ = true;
+}
+
+}  // namespace rev
+}  // namespace egorich
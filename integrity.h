@@ -0,0 +1,51 @@
+#ifndef REV_INTEGRITY_H__
+#define REV_INTEGRITY_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "dex_scanner.h"
+
+using std::string;
+
+namespace egorich {
+namespace rev {
+
+// Adler-32 of the data, as the checksum of the dex header is computed.
+uint32_t Adler32(const char* data, size_t size);
+
+const size_t kSha1Size = 20;
+// SHA-1 digest of the data, as the signature of the dex header.
+void Sha1(const char* data, size_t size, uint8_t* digest);
+
+// Checks the checksum and the signature of the dex header on a thread of
+// its own, so that it overlaps with validation and parsing instead of
+// adding a pass of its own to the wall time.
+class IntegrityCheck {
+ public:
+  // Starts the check. The scanner must have gone through ParseHeader().
+  explicit IntegrityCheck(const DexScanner& scanner);
+  ~IntegrityCheck();
+
+  // Waits for the check; returns false if the checksum or the signature
+  // does not match, and error() says which.
+  bool Wait();
+  const string& error() const { return error_; }
+
+ private:
+  void Run();
+
+  const DexScanner& scanner_;
+  bool ok_;
+  string error_;
+  std::thread thread_;
+
+  IntegrityCheck(const IntegrityCheck&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_INTEGRITY_H__
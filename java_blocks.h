@@ -3,54 +3,23 @@
 
 #include <cstddef>
 #include <cstdint>
-#include <new>
 #include <vector>
 
-#include "log.h"
+#include "zone.h"
 
 using std::vector;
 
 namespace egorich {
 namespace rev {
 
-class Zone {
- public:
-  Zone(size_t capacity) : capacity_(capacity), zone_(new char[capacity]), head_(0) {
-  }
-
-  ~Zone() {
-    delete[] zone_;
-  }
-
-  void* Allocate(size_t sz) {
-    void* const result = 
-      head_ + sz <= capacity_ ? zone_ + head_ : 0;
-    if (result) {
-      head_ += sz + 7;
-      head_ &= ~static_cast<size_t>(0) << 3;
-    }
-    return result;
-  }
-
- private:
-  const size_t capacity_;
-  char *const zone_;
-  size_t head_;
-
-  Zone(const Zone&) = delete;
-};
-
 class JavaBlock {
  public:
-  static void* operator new(size_t sz, Zone* zone) {
-    void* result = zone->Allocate(sz);
-    ASSERT(result != NULL) << "OOMing...";
-    return result;
-  }
-  static void* operator new(size_t sz) {
-    ASSERT(false) << "Use placement new.";
-    throw std::bad_alloc();
+  // Returns NULL once the zone is exhausted, and the new-expression then
+  // makes no block.
+  static void* operator new(size_t sz, Zone* zone) noexcept {
+    return zone->Allocate(sz);
   }
+  static void* operator new(size_t sz) = delete;
 
   enum Kind {
     BASIC = 1,
@@ -80,6 +49,12 @@ class JavaBlock {
   uint32_t head_;
 };
 
+// Statements of a block, ExprPool::stmt(first)..ExprPool::stmt(first + count - 1).
+struct StatementList {
+  uint32_t first;
+  uint32_t count;
+};
+
 template <JavaBlock::Kind K>
 class TypedBlock : public JavaBlock {
  public:
@@ -89,8 +64,10 @@ class TypedBlock : public JavaBlock {
 
 class BasicBlock : public TypedBlock<JavaBlock::BASIC> {
  public:
-  BasicBlock(JavaBlock* parent, uint32_t head) : TypedBlock(parent, head) {
+  BasicBlock(JavaBlock* parent, uint32_t head) : TypedBlock(parent, head), stmts{0, 0} {
   }
+
+  StatementList stmts;
 };
 
 class BreakBlock : public TypedBlock<JavaBlock::BREAK> {
@@ -113,14 +90,18 @@ class ContinueBlock : public TypedBlock<JavaBlock::CONTINUE> {
 
 class ReturnBlock : public TypedBlock<JavaBlock::RETURN> {
  public:
-  ReturnBlock(JavaBlock* parent, uint32_t head) : TypedBlock(parent, head) {
+  ReturnBlock(JavaBlock* parent, uint32_t head) : TypedBlock(parent, head), stmts{0, 0} {
   }
+
+  StatementList stmts;
 };
 
 class ThrowBlock : public TypedBlock<JavaBlock::THROW> {
  public:
-  ThrowBlock(JavaBlock* parent, uint32_t head) : TypedBlock(parent, head) {
+  ThrowBlock(JavaBlock* parent, uint32_t head) : TypedBlock(parent, head), stmts{0, 0} {
   }
+
+  StatementList stmts;
 };
 
 class BranchBlock : public TypedBlock<JavaBlock::BRANCH> {
@@ -0,0 +1,759 @@
+#include "java_emitter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "dex_asm.h"
+
+namespace egorich {
+namespace rev {
+namespace {
+
+const uint32_t kAccPublic = 0x1;
+const uint32_t kAccPrivate = 0x2;
+const uint32_t kAccProtected = 0x4;
+const uint32_t kAccStatic = 0x8;
+const uint32_t kAccFinal = 0x10;
+const uint32_t kAccNative = 0x100;
+const uint32_t kAccInterface = 0x200;
+const uint32_t kAccAbstract = 0x400;
+const uint32_t kAccDeclaredSynchronized = 0x20000;
+
+// Prefixes of neg-int..int-to-short.
+const char* const kUnaryOps[] = {
+  "-", "~", "-", "~", "-", "-",
+  "(long) ", "(float) ", "(double) ",
+  "(int) ", "(float) ", "(double) ",
+  "(int) ", "(long) ", "(double) ",
+  "(int) ", "(long) ", "(float) ",
+  "(byte) ", "(char) ", "(short) ",
+};
+
+// Operators of add..ushr, in the order of the int and long opcodes; float
+// and double only have the first five.
+const char* const kBinaryOps[] = {
+  "+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>", ">>>",
+};
+
+// Operators of add..ushr/lit8; rsub is printed as "-x + lit".
+const char* const kLiteralOps[] = {
+  "+", "+", "*", "/", "%", "&", "|", "^", "<<", ">>", ">>>",
+};
+
+const char* const kCompareOps[] = {
+  "cmpl", "cmpg", "cmpl", "cmpg", "cmp",
+};
+
+// Operators of if-eq..if-le, negated by flipping the lowest bit of the index.
+const char* const kCondOps[] = {
+  "==", "!=", "<", ">=", ">", "<=",
+};
+
+bool IsWideConst(uint8_t opcode) { return 0x16 <= opcode && opcode <= 0x19; }
+bool IsCompare(uint8_t opcode) { return 0x2D <= opcode && opcode <= 0x31; }
+bool IsReverseSub(uint8_t opcode) { return opcode == 0xD1 || opcode == 0xD9; }
+bool IsStaticInvoke(uint8_t opcode) { return opcode == 0x71 || opcode == 0x77; }
+bool IsSuperInvoke(uint8_t opcode) { return opcode == 0x6F || opcode == 0x75; }
+
+const char* BinaryOp(uint8_t opcode) {
+  if (opcode >= 0xD0 && opcode <= 0xD7) return kLiteralOps[opcode - 0xD0];
+  if (opcode >= 0xD8) return kLiteralOps[opcode - 0xD8];
+  if (opcode >= 0xB0) opcode -= 0xB0 - 0x90;
+  if (opcode < 0x9B) return kBinaryOps[opcode - 0x90];
+  if (opcode < 0xA6) return kBinaryOps[opcode - 0x9B];
+  if (opcode < 0xAB) return kBinaryOps[opcode - 0xA6];
+  return kBinaryOps[opcode - 0xAB];
+}
+
+size_t ArrayDims(const string& descriptor) {
+  size_t dims = 0;
+  while (dims < descriptor.size() && descriptor[dims] == '[') {
+    ++dims;
+  }
+  return dims;
+}
+
+}  // namespace
+
+string JavaTypeName(const string& descriptor) {
+  const size_t dims = ArrayDims(descriptor);
+  if (dims == descriptor.size()) {
+    return descriptor;
+  }
+  string result;
+  switch (descriptor[dims]) {
+  case 'V': result = "void"; break;
+  case 'Z': result = "boolean"; break;
+  case 'B': result = "byte"; break;
+  case 'S': result = "short"; break;
+  case 'C': result = "char"; break;
+  case 'I': result = "int"; break;
+  case 'J': result = "long"; break;
+  case 'F': result = "float"; break;
+  case 'D': result = "double"; break;
+  case 'L':
+    result = descriptor.substr(dims + 1, descriptor.size() - dims - 2);
+    for (char& c : result) {
+      if (c == '/') c = '.';
+    }
+    break;
+  default:
+    result = descriptor.substr(dims);
+    break;
+  }
+  for (size_t d = 0; d < dims; ++d) {
+    result += "[]";
+  }
+  return result;
+}
+
+void JavaEmitter::EmitClass(const ClassDefItem& class_def, Zone* zone) {
+  *out_ << ((class_def.access_flags() & kAccInterface) ? "interface " : "class ");
+  EmitType(class_def.type_idx());
+  *out_ << " {\n";
+  bool first = true;
+  zone->set_limit(budget_.memory());
+  for (int k = 0; k < 2; ++k) {
+    const vector<EncodedMethod>& methods =
+        k ? class_def.virtual_methods() : class_def.direct_methods();
+    uint32_t method_idx = 0;
+    for (const EncodedMethod& method : methods) {
+      if (!first) *out_ << '\n';
+      first = false;
+      {
+        MethodDasm dasm(zone, scanner_, method, &method_idx);
+        dasm.set_budget(budget_);
+        Budget::Verdict verdict;
+        MethodDasm::Failure failure;
+        if (cache_ != NULL && method.code_offs) {
+          EmitCached(&dasm, zone, &verdict, &failure);
+        } else {
+          Analyze(&dasm);
+          EmitMethod(dasm);
+          verdict = dasm.verdict();
+          failure = dasm.failure();
+        }
+        if (verdict != Budget::WITHIN) {
+          degraded_.push_back({method_idx, verdict});
+        }
+        if (failure != MethodDasm::NO_FAILURE) {
+          failed_.push_back({method_idx, failure});
+        }
+      }
+      zone->Reset();
+    }
+  }
+  *out_ << "}\n\n";
+  zone->set_limit(0);
+}
+
+void JavaEmitter::Analyze(MethodDasm* dasm) {
+  dasm->Run();
+  dasm->AnalyzeRegisters();
+  dasm->ReconstructAst();
+  dasm->RecoverExpressions();
+  dasm->DecodeDebugInfo();
+}
+
+void JavaEmitter::EmitCached(MethodDasm* dasm, Zone* zone, Budget::Verdict* verdict,
+                             MethodDasm::Failure* failure) {
+  // The key needs the source positions before anything is analyzed; on a
+  // miss DecodeDebugInfo() decodes them again into the same zone.
+  const CodeItem code(&scanner_, dasm->method().code_offs);
+  const DebugInfo* const debug_info =
+      DebugInfo::Decode(scanner_, dasm->method_idx(), dasm->method().access_flags, code, zone);
+  keys_->Compute(code, dasm->method().access_flags, debug_info, &key_);
+  EmitSignature(*dasm);
+  const BodyCache::Body* const body = cache_->Find(key_);
+  if (body != NULL) {
+    *out_ << body->text;
+    *verdict = Budget::WITHIN;
+    *failure = MethodDasm::NO_FAILURE;
+    return;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  Analyze(dasm);
+  const size_t offset = out_->size();
+  EmitBody(*dasm);
+  *verdict = dasm->verdict();
+  *failure = dasm->failure();
+  // A body printed raw refers to the items of its own dex by index, and
+  // whether a method runs out of time differs from run to run, so only
+  // bodies decompiled within budget are shared.
+  if (*verdict != Budget::WITHIN || *failure != MethodDasm::NO_FAILURE) {
+    return;
+  }
+  BodyCache::Body computed;
+  out_->CopyTo(offset, &computed.text);
+  computed.time = std::chrono::steady_clock::now() - start;
+  cache_->Insert(key_, std::move(computed));
+}
+
+void JavaEmitter::EmitMethod(const MethodDasm& dasm) {
+  EmitSignature(dasm);
+  if (dasm.code() == NULL) {
+    *out_ << ";\n";
+    return;
+  }
+  EmitBody(dasm);
+}
+
+void JavaEmitter::EmitBody(const MethodDasm& dasm) {
+  dasm_ = &dasm;
+  exprs_ = dasm.exprs();
+  line_ = 0;
+  *out_ << " {\n";
+  if (exprs_ == NULL) {
+    if (dasm.verdict() != Budget::WITHIN) {
+      Indent(2);
+      *out_ << "// " << VerdictName(dasm.verdict()) << ", disassembly follows.\n";
+    } else if (dasm.failure() != MethodDasm::NO_FAILURE) {
+      Indent(2);
+      *out_ << "// Not decompiled, " << MethodDasm::FailureName(dasm.failure())
+            << "; disassembly follows.\n";
+    }
+    EmitRaw(dasm);
+  } else {
+    items_.assign(1, {dasm.ast(), BLOCK, 2});
+    while (!items_.empty()) {
+      const Item item = items_.back();
+      items_.pop_back();
+      EmitBlock(item);
+    }
+  }
+  Indent(1);
+  *out_ << "}\n";
+  dasm_ = NULL;
+  exprs_ = NULL;
+}
+
+void JavaEmitter::EmitSignature(const MethodDasm& dasm) {
+  const MethodIdItem& method_id = scanner_.method_ids()[dasm.method_idx()];
+  const ProtoIdItem& proto = scanner_.proto_ids()[method_id.proto_idx];
+  const string& name = scanner_.string_ids()[method_id.name_idx];
+  const uint32_t flags = dasm.method().access_flags;
+
+  Indent(1);
+  if (name == "<clinit>") {
+    *out_ << "static";
+    return;
+  }
+  if (flags & kAccPublic) *out_ << "public ";
+  if (flags & kAccPrivate) *out_ << "private ";
+  if (flags & kAccProtected) *out_ << "protected ";
+  if (flags & kAccStatic) *out_ << "static ";
+  if (flags & kAccFinal) *out_ << "final ";
+  if (flags & kAccDeclaredSynchronized) *out_ << "synchronized ";
+  if (flags & kAccNative) *out_ << "native ";
+  if (flags & kAccAbstract) *out_ << "abstract ";
+  if (name == "<init>") {
+    const string type = JavaTypeName(
+        scanner_.string_ids()[scanner_.type_ids()[method_id.class_idx].descriptor_idx]);
+    *out_ << type.substr(type.rfind('.') + 1);
+  } else {
+    EmitType(proto.return_type_idx);
+    *out_ << ' ' << name;
+  }
+
+  // Parameters are named after their register, counted from the first
+  // argument register as in smali.
+  *out_ << '(';
+  uint32_t reg = (flags & kAccStatic) ? 0 : 1;
+  if (proto.parameters_offs) {
+    const uint32_t size = scanner_.ReadUint32(proto.parameters_offs);
+    for (uint32_t i = 0; i < size; ++i) {
+      const uint16_t type_idx = scanner_.ReadUShort(proto.parameters_offs + 4 + 2*i);
+      const string& descriptor = scanner_.string_ids()[scanner_.type_ids()[type_idx].descriptor_idx];
+      if (i) *out_ << ", ";
+      EmitType(type_idx);
+      *out_ << " p" << reg;
+      reg += descriptor == "J" || descriptor == "D" ? 2 : 1;
+    }
+  }
+  *out_ << ')';
+}
+
+void JavaEmitter::EmitRaw(const MethodDasm& dasm) {
+  const CodeItem& code = *dasm.code();
+  for (uint32_t pc = 0; pc < code.instr_size(); pc += code.opsize(pc)) {
+    EmitLine(pc, 2);
+    Indent(2);
+    *out_ << "// " << pc << ": " << code.instr(pc)->dasm(&scanner_, code.instr_offs() + 2*pc) << '\n';
+  }
+}
+
+bool JavaEmitter::IsEmpty(const JavaBlock* block) const {
+  return block == NULL
+      || (block->kind() == JavaBlock::COMPOUND
+          && static_cast<const CompoundBlock*>(block)->child.empty());
+}
+
+void JavaEmitter::EmitBlock(const Item& item) {
+  const JavaBlock* const block = item.block;
+  const size_t indent = item.indent;
+  switch (item.action) {
+  case CLOSE:
+    Indent(indent);
+    *out_ << "}\n";
+    return;
+  case ELSE:
+    Indent(indent);
+    *out_ << "} else {\n";
+    return;
+  case CLOSE_DO: {
+    const DoBlock* const loop = static_cast<const DoBlock*>(block);
+    Indent(indent);
+    *out_ << "} while (";
+    EmitCond(loop->cond, loop->invert);
+    *out_ << ");\n";
+    return;
+  }
+  case PRELUDE: {
+    const BasicBlock* const cond = static_cast<const BasicBlock*>(block);
+    EmitPhis(cond->head(), indent);
+    if (cond->stmts.count) {
+      EmitStatements(cond->head(), {cond->stmts.first, cond->stmts.count - 1}, indent);
+    }
+    return;
+  }
+  case BLOCK:
+    break;
+  }
+
+  if (block == NULL) {
+    return;
+  }
+  switch (block->kind()) {
+  case JavaBlock::BASIC: {
+    const BasicBlock* const basic = static_cast<const BasicBlock*>(block);
+    EmitPhis(basic->head(), indent);
+    EmitStatements(basic->head(), basic->stmts, indent);
+    break;
+  }
+  case JavaBlock::RETURN: {
+    const ReturnBlock* const ret = static_cast<const ReturnBlock*>(block);
+    EmitPhis(ret->head(), indent);
+    EmitStatements(ret->head(), ret->stmts, indent);
+    break;
+  }
+  case JavaBlock::THROW: {
+    const ThrowBlock* const thr = static_cast<const ThrowBlock*>(block);
+    EmitPhis(thr->head(), indent);
+    EmitStatements(thr->head(), thr->stmts, indent);
+    break;
+  }
+  case JavaBlock::BREAK:
+    Indent(indent);
+    *out_ << "break;\n";
+    break;
+  case JavaBlock::CONTINUE:
+    Indent(indent);
+    *out_ << "continue;\n";
+    break;
+  case JavaBlock::COMPOUND: {
+    const vector<JavaBlock*>& child = static_cast<const CompoundBlock*>(block)->child;
+    for (auto it = child.rbegin(); it != child.rend(); ++it) {
+      items_.push_back({*it, BLOCK, indent});
+    }
+    break;
+  }
+  case JavaBlock::BRANCH: {
+    const BranchBlock* const branch = static_cast<const BranchBlock*>(block);
+    EmitBlock({branch->cond, PRELUDE, indent});
+    const JavaBlock* on_true = branch->on_true;
+    const JavaBlock* on_false = branch->on_false;
+    bool negate = branch->invert;
+    if (IsEmpty(on_true) && !IsEmpty(on_false)) {
+      std::swap(on_true, on_false);
+      negate = !negate;
+    }
+    Indent(indent);
+    *out_ << "if (";
+    EmitCond(branch->cond, negate);
+    *out_ << ") {\n";
+    items_.push_back({NULL, CLOSE, indent});
+    if (!IsEmpty(on_false)) {
+      items_.push_back({on_false, BLOCK, indent + 1});
+      items_.push_back({NULL, ELSE, indent});
+    }
+    items_.push_back({on_true, BLOCK, indent + 1});
+    break;
+  }
+  case JavaBlock::WHILE_LOOP: {
+    const WhileBlock* const loop = static_cast<const WhileBlock*>(block);
+    if (loop->cond->stmts.count == 1) {
+      EmitPhis(loop->cond->head(), indent);
+      Indent(indent);
+      *out_ << "while (";
+      EmitCond(loop->cond, loop->invert);
+      *out_ << ") {\n";
+      items_.push_back({NULL, CLOSE, indent});
+      items_.push_back({loop->body, BLOCK, indent + 1});
+      break;
+    }
+    // The condition needs statements of its own, which run before every
+    // check of it.
+    Indent(indent);
+    *out_ << "while (true) {\n";
+    EmitBlock({loop->cond, PRELUDE, indent + 1});
+    Indent(indent + 1);
+    *out_ << "if (";
+    EmitCond(loop->cond, !loop->invert);
+    *out_ << ") break;\n";
+    items_.push_back({NULL, CLOSE, indent});
+    items_.push_back({loop->body, BLOCK, indent + 1});
+    break;
+  }
+  case JavaBlock::DO_LOOP: {
+    const DoBlock* const loop = static_cast<const DoBlock*>(block);
+    Indent(indent);
+    *out_ << "do {\n";
+    items_.push_back({loop, CLOSE_DO, indent});
+    items_.push_back({loop->cond, PRELUDE, indent + 1});
+    items_.push_back({loop->body, BLOCK, indent + 1});
+    break;
+  }
+  case JavaBlock::DO_FOREVER:
+    Indent(indent);
+    *out_ << "while (true) {\n";
+    items_.push_back({NULL, CLOSE, indent});
+    items_.push_back({static_cast<const DoForeverBlock*>(block)->body, BLOCK, indent + 1});
+    break;
+  default:
+    Indent(indent);
+    *out_ << "// unsupported block at " << block->head() << '\n';
+    break;
+  }
+}
+
+void JavaEmitter::EmitLine(uint32_t pc, size_t indent) {
+  const DebugInfo* const debug_info = dasm_->debug_info();
+  const uint32_t line = debug_info != NULL ? debug_info->Line(pc) : 0;
+  if (line != 0 && line != line_) {
+    Indent(indent);
+    *out_ << "// line " << line << '\n';
+    line_ = line;
+  }
+}
+
+void JavaEmitter::EmitStatements(uint32_t head, StatementList stmts, size_t indent) {
+  if (stmts.count) {
+    EmitLine(head, indent);
+  }
+  for (uint32_t s = stmts.first; s < stmts.first + stmts.count; ++s) {
+    const uint32_t stmt = exprs_->stmt(s);
+    Indent(indent);
+    if (exprs_->node(stmt).kind == ExprNode::COND) {
+      // A branch the AST has no construct for.
+      *out_ << "// if (";
+      EmitExpr(stmt);
+      *out_ << ")\n";
+      continue;
+    }
+    EmitExpr(stmt);
+    *out_ << ";\n";
+  }
+}
+
+void JavaEmitter::EmitPhis(uint32_t head, size_t indent) {
+  const SsaForm& ssa = *dasm_->ssa();
+  for (const SsaForm::Phi* phi = ssa.phis_begin(head); phi != ssa.phis_end(head); ++phi) {
+    Indent(indent);
+    *out_ << "// ";
+    EmitValue(phi->value);
+    *out_ << " = phi(";
+    for (size_t i = 0; i < ssa.phi_arity(head); ++i) {
+      if (i) *out_ << ", ";
+      EmitValue(phi->operands[i]);
+    }
+    *out_ << ")\n";
+  }
+}
+
+void JavaEmitter::EmitCond(const BasicBlock* cond, bool negate) {
+  // MethodDasm::RecoverExpressions() fails the methods whose conditions do
+  // not end in a COND statement.
+  const uint32_t stmt = exprs_->stmt(cond->stmts.first + cond->stmts.count - 1);
+  negate_ = negate;
+  EmitExpr(stmt);
+  negate_ = false;
+}
+
+void JavaEmitter::EmitExpr(uint32_t root) {
+  frames_.clear();
+  frames_.push_back({root, 0, false});
+  EmitPiece(root, 0);
+  while (!frames_.empty()) {
+    ExprFrame& frame = frames_.back();
+    const uint32_t n = frame.node;
+    if (frame.next < exprs_->node(n).arity) {
+      const size_t i = frame.next++;
+      if (IsSkipped(n, i)) {
+        EmitPiece(n, i + 1);
+        continue;
+      }
+      const uint32_t child = exprs_->operand(n, i);
+      const bool parens = NeedsParens(n, i, child);
+      if (parens) *out_ << '(';
+      frames_.push_back({child, 0, parens});
+      EmitPiece(child, 0);
+      continue;
+    }
+    if (frame.parens) *out_ << ')';
+    frames_.pop_back();
+    if (!frames_.empty()) {
+      EmitPiece(frames_.back().node, frames_.back().next);
+    }
+  }
+}
+
+bool JavaEmitter::IsSkipped(uint32_t n, size_t i) const {
+  const ExprNode& node = exprs_->node(n);
+  // The receiver of invoke-super is always "this".
+  return node.kind == ExprNode::INVOKE && i == 0 && IsSuperInvoke(node.opcode);
+}
+
+bool JavaEmitter::NeedsParens(uint32_t parent, size_t i, uint32_t child) const {
+  const ExprNode& p = exprs_->node(parent);
+  const ExprNode& c = exprs_->node(child);
+  const bool binary = (c.kind == ExprNode::BINARY && !IsCompare(c.opcode))
+      || c.kind == ExprNode::INSTANCE_OF;
+  const bool prefix = (c.kind == ExprNode::UNARY && c.opcode != 0x21)
+      || c.kind == ExprNode::CHECK_CAST;
+  if (!binary && !prefix) {
+    return false;
+  }
+  switch (p.kind) {
+  case ExprNode::UNARY:
+    return p.opcode == 0x21 || binary;
+  case ExprNode::BINARY:
+    return !IsCompare(p.opcode) && binary;
+  case ExprNode::INSTANCE_OF:
+  case ExprNode::CHECK_CAST:
+  case ExprNode::COND:
+    return binary;
+  case ExprNode::INSTANCE_FIELD:
+    return true;
+  case ExprNode::ARRAY_ELEMENT:
+  case ExprNode::STORE_ARRAY:
+  case ExprNode::STORE_INSTANCE:
+    return i == 0;
+  case ExprNode::INVOKE:
+    return i == 0 && !IsStaticInvoke(p.opcode);
+  default:
+    return false;
+  }
+}
+
+void JavaEmitter::EmitPiece(uint32_t n, size_t i) {
+  const ExprNode& node = exprs_->node(n);
+  const size_t arity = node.arity;
+  switch (node.kind) {
+  case ExprNode::VALUE:
+    EmitValue(node.payload);
+    break;
+  case ExprNode::LITERAL:
+    *out_ << node.payload;
+    if (IsWideConst(node.opcode)) *out_ << 'L';
+    break;
+  case ExprNode::CONST_STRING:
+    EmitString(scanner_.string_ids()[node.payload]);
+    break;
+  case ExprNode::CONST_CLASS:
+    EmitType(node.payload);
+    *out_ << ".class";
+    break;
+  case ExprNode::UNARY:
+    if (node.opcode == 0x21) {
+      if (i == 1) *out_ << ".length";
+    } else if (i == 0) {
+      *out_ << kUnaryOps[node.opcode - 0x7B];
+    }
+    break;
+  case ExprNode::BINARY:
+    if (IsCompare(node.opcode)) {
+      *out_ << (i == 0 ? kCompareOps[node.opcode - 0x2D] : i == 1 ? ", " : ")");
+      if (i == 0) *out_ << '(';
+    } else if (i == 0) {
+      if (IsReverseSub(node.opcode)) *out_ << '-';
+    } else if (i == 1) {
+      *out_ << ' ' << BinaryOp(node.opcode) << ' ';
+    }
+    break;
+  case ExprNode::INSTANCE_FIELD:
+    if (i == 1) {
+      *out_ << '.';
+      EmitField(node.payload, false);
+    }
+    break;
+  case ExprNode::STATIC_FIELD:
+    EmitField(node.payload, true);
+    break;
+  case ExprNode::ARRAY_ELEMENT:
+    *out_ << (i == 0 ? "" : i == 1 ? "[" : "]");
+    break;
+  case ExprNode::INSTANCE_OF:
+    if (i == 1) {
+      *out_ << " instanceof ";
+      EmitType(node.payload);
+    }
+    break;
+  case ExprNode::CHECK_CAST:
+    if (i == 0) {
+      *out_ << '(';
+      EmitType(node.payload);
+      *out_ << ") ";
+    }
+    break;
+  case ExprNode::NEW_INSTANCE:
+    *out_ << "new ";
+    EmitType(node.payload);
+    break;
+  case ExprNode::NEW_ARRAY: {
+    const string& descriptor =
+        scanner_.string_ids()[scanner_.type_ids()[node.payload].descriptor_idx];
+    const size_t dims = ArrayDims(descriptor);
+    if (i == 0) {
+      *out_ << "new " << JavaTypeName(descriptor.substr(dims)) << '[';
+    } else {
+      *out_ << ']';
+      for (size_t d = 1; d < dims; ++d) {
+        *out_ << "[]";
+      }
+    }
+    break;
+  }
+  case ExprNode::INVOKE: {
+    const MethodIdItem& method_id = scanner_.method_ids()[node.payload];
+    const string& name = scanner_.string_ids()[method_id.name_idx];
+    if (IsStaticInvoke(node.opcode) || arity == 0) {
+      if (i == 0) {
+        EmitType(method_id.class_idx);
+        *out_ << '.' << name << '(';
+      }
+      if (i > 0 && i < arity) *out_ << ", ";
+      if (i == arity) *out_ << ')';
+      break;
+    }
+    if (i == 0 && IsSuperInvoke(node.opcode)) *out_ << "super";
+    if (i == 1) *out_ << '.' << name << '(';
+    if (i > 1 && i < arity) *out_ << ", ";
+    if (i == arity) *out_ << ')';
+    break;
+  }
+  case ExprNode::OPAQUE:
+  case ExprNode::STATEMENT:
+    if (i == 0) *out_ << iTable[node.opcode]->name() << '(';
+    if (i > 0 && i < arity) *out_ << ", ";
+    if (i == arity) *out_ << ')';
+    break;
+  case ExprNode::ASSIGN:
+    if (i == 0) {
+      EmitValue(node.payload);
+      *out_ << " = ";
+    }
+    break;
+  case ExprNode::EVAL:
+    break;
+  case ExprNode::STORE_INSTANCE:
+    if (i == 1) {
+      *out_ << '.';
+      EmitField(node.payload, false);
+      *out_ << " = ";
+    }
+    break;
+  case ExprNode::STORE_STATIC:
+    if (i == 0) {
+      EmitField(node.payload, true);
+      *out_ << " = ";
+    }
+    break;
+  case ExprNode::STORE_ARRAY:
+    *out_ << (i == 0 ? "" : i == 1 ? "[" : i == 2 ? "] = " : "");
+    break;
+  case ExprNode::RETURN:
+    if (i == 0) *out_ << (arity ? "return " : "return");
+    break;
+  case ExprNode::THROW:
+    if (i == 0) *out_ << "throw ";
+    break;
+  case ExprNode::COND:
+    if (i == 1) {
+      const size_t op = (node.opcode - 0x32) % 6;
+      *out_ << ' ' << kCondOps[negate_ ? op ^ 1 : op] << ' ';
+      if (arity == 1) *out_ << '0';
+    }
+    break;
+  default:
+    // Not in the pool of a method MethodDasm::RecoverExpressions() let
+    // through.
+    break;
+  }
+}
+
+void JavaEmitter::EmitValue(uint32_t value) {
+  if (value == SsaForm::kUndefined) {
+    *out_ << "undefined";
+    return;
+  }
+  const SsaForm::Value& v = dasm_->ssa()->value(value);
+  if (v.kind == SsaForm::ARGUMENT) {
+    const CodeItem& code = *dasm_->code();
+    const uint32_t arg = v.reg - (code.register_size() - code.ins_size());
+    if (arg == 0 && !(dasm_->method().access_flags & kAccStatic)) {
+      *out_ << "this";
+    } else {
+      *out_ << 'p' << arg;
+    }
+    return;
+  }
+  *out_ << 'v' << v.reg << '_' << value;
+}
+
+void JavaEmitter::EmitString(const string& text) {
+  static const char kHex[] = "0123456789abcdef";
+  *out_ << '"';
+  for (const char c : text) {
+    switch (c) {
+    case '"': *out_ << "\\\""; break;
+    case '\\': *out_ << "\\\\"; break;
+    case '\n': *out_ << "\\n"; break;
+    case '\r': *out_ << "\\r"; break;
+    case '\t': *out_ << "\\t"; break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        *out_ << "\\u00" << kHex[c >> 4] << kHex[c & 0xF];
+      } else {
+        *out_ << c;
+      }
+      break;
+    }
+  }
+  *out_ << '"';
+}
+
+void JavaEmitter::EmitType(uint32_t type_idx) {
+  *out_ << JavaTypeName(scanner_.string_ids()[scanner_.type_ids()[type_idx].descriptor_idx]);
+}
+
+void JavaEmitter::EmitField(uint32_t field_idx, bool qualified) {
+  const FieldIdItem& field_id = scanner_.field_ids()[field_idx];
+  if (qualified) {
+    EmitType(field_id.class_idx);
+    *out_ << '.';
+  }
+  *out_ << scanner_.string_ids()[field_id.name_idx];
+}
+
+void JavaEmitter::Indent(size_t indent) {
+  static const char kSpaces[] = "                                ";
+  for (indent *= 2; indent > 0;) {
+    const size_t n = std::min(indent, sizeof(kSpaces) - 1);
+    out_->Append(kSpaces, n);
+    indent -= n;
+  }
+}
+
+}  // namespace rev
+}  // namespace egorich
@@ -0,0 +1,134 @@
+#ifndef REV_JAVA_EMITTER_H__
+#define REV_JAVA_EMITTER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "body_cache.h"
+#include "budget.h"
+#include "dex_scanner.h"
+#include "expr_tree.h"
+#include "java_blocks.h"
+#include "method_dasm.h"
+#include "output_buffer.h"
+#include "ssa_form.h"
+#include "zone.h"
+
+using std::pair;
+using std::string;
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Returns the Java spelling of a type descriptor, e.g. "int[]" for "[I".
+string JavaTypeName(const string& descriptor);
+
+// Prints classes as Java-like source. The AST and the expression trees are
+// walked with explicit stacks, so deeply nested code does not recurse.
+class JavaEmitter {
+ public:
+  JavaEmitter(const DexScanner& scanner, OutputBuffer* out)
+      : scanner_(scanner), out_(out), cache_(NULL), keys_(NULL), dasm_(NULL), exprs_(NULL), line_(0),
+        negate_(false) {
+  }
+
+  // Limits the analysis of every method; the memory budget caps the zone
+  // too. Methods over budget are printed as disassembly.
+  void set_budget(const Budget& budget) { budget_ = budget; }
+  // Looks the bodies of methods up in the cache by their keys, and
+  // decompiles only those missing, adding those decompiled within budget.
+  // The keys must be of the scanner.
+  void set_cache(BodyCache* cache, const BodyKeys* keys) {
+    cache_ = cache;
+    keys_ = keys;
+  }
+  // Methods which went over budget so far, with the budget they exceeded.
+  const vector<pair<uint32_t, Budget::Verdict>>& degraded() const { return degraded_; }
+  // Methods whose reconstruction failed so far, with the reason.
+  const vector<pair<uint32_t, MethodDasm::Failure>>& failed() const { return failed_; }
+
+  // Decompiles and prints every method of the class, with comments giving
+  // the source lines of the debug info. The zone is reset after each method.
+  void EmitClass(const ClassDefItem& class_def, Zone* zone);
+  // Prints a method which went through ReconstructAst() and
+  // RecoverExpressions().
+  void EmitMethod(const MethodDasm& dasm);
+
+ private:
+  enum Action {
+    BLOCK,
+    // Statements of a condition block, but the condition.
+    PRELUDE,
+    CLOSE,
+    ELSE,
+    // "} while (cond);" of a DoBlock.
+    CLOSE_DO,
+  };
+
+  struct Item {
+    const JavaBlock* block;
+    Action action;
+    size_t indent;
+  };
+
+  struct ExprFrame {
+    uint32_t node;
+    uint16_t next;
+    bool parens;
+  };
+
+  // Runs the analyses EmitMethod() needs.
+  void Analyze(MethodDasm* dasm);
+  // Prints the method through the cache, and sets the verdict and the
+  // failure of its body.
+  void EmitCached(MethodDasm* dasm, Zone* zone, Budget::Verdict* verdict, MethodDasm::Failure* failure);
+  void EmitSignature(const MethodDasm& dasm);
+  // The method has code.
+  void EmitBody(const MethodDasm& dasm);
+  void EmitRaw(const MethodDasm& dasm);
+  void EmitBlock(const Item& item);
+  void EmitStatements(uint32_t head, StatementList stmts, size_t indent);
+  // Prints the source line of pc if it differs from the last one printed.
+  void EmitLine(uint32_t pc, size_t indent);
+  void EmitPhis(uint32_t head, size_t indent);
+  // Prints the condition of a block ending in an if-*, negated on request.
+  void EmitCond(const BasicBlock* cond, bool negate);
+  void EmitExpr(uint32_t root);
+  // Prints the text of node n which precedes its operand i, or follows the
+  // last one when i == arity.
+  void EmitPiece(uint32_t n, size_t i);
+  bool IsSkipped(uint32_t n, size_t i) const;
+  bool NeedsParens(uint32_t parent, size_t i, uint32_t child) const;
+  void EmitValue(uint32_t value);
+  void EmitString(const string& text);
+  void EmitType(uint32_t type_idx);
+  void EmitField(uint32_t field_idx, bool qualified);
+  void Indent(size_t indent);
+  bool IsEmpty(const JavaBlock* block) const;
+
+  const DexScanner& scanner_;
+  OutputBuffer* const out_;
+  Budget budget_;
+  BodyCache* cache_;
+  const BodyKeys* keys_;
+  string key_;
+  vector<pair<uint32_t, Budget::Verdict>> degraded_;
+  vector<pair<uint32_t, MethodDasm::Failure>> failed_;
+
+  // Method being printed.
+  const MethodDasm* dasm_;
+  const ExprPool* exprs_;
+  uint32_t line_;
+  bool negate_;
+  vector<Item> items_;
+  vector<ExprFrame> frames_;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_JAVA_EMITTER_H__
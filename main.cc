@@ -2,9 +2,11 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <algorithm>
 #include <cctype>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <iostream>
@@ -14,11 +16,29 @@
 #include <string>
 #include <vector>
 
+#include "annotations.h"
+#include "body_cache.h"
+#include "budget.h"
+#include "call_graph.h"
+#include "call_resolver.h"
+#include "class_hierarchy.h"
 #include "dex_asm.h"
+#include "dex_diff.h"
 #include "dex_scanner.h"
-#include "dominator_eval.h"
+#include "dex_validator.h"
+#include "file_util.h"
+#include "integrity.h"
+#include "java_emitter.h"
 #include "log.h"
 #include "method_dasm.h"
+#include "opcode_histogram.h"
+#include "output_buffer.h"
+#include "parallel.h"
+#include "pattern_search.h"
+#include "reachability.h"
+#include "schedule.h"
+#include "server.h"
+#include "xref_index.h"
 
 using std::cout;
 using std::cerr;
@@ -30,70 +50,977 @@ using std::ostream;
 using std::pair;
 using std::string;
 using std::stringstream;
+using std::unique_ptr;
 using std::vector;
 
 using namespace egorich::rev;
 
-void Print(const vector<int>& dom) {
-  for (int i = 0; i < dom.size(); ++i) {
-    cout << i << ": " << dom[i] << "; ";
-  }
-  cout << endl;
+int Usage() {
+  cerr << "Usage: rev <command> [options] <dex> [args]" << endl
+       << "Commands:" << endl
+       << "  raw                 disassemble every method" << endl
+       << "  java [<dex>...]     print classes as Java-like source, of the further dex" << endl
+       << "                      files of a multidex app too" << endl
+       << "  method <method>...  disassemble the matching methods only, without" << endl
+       << "                      parsing the whole dex" << endl
+       << "  metrics             print the size and shape of the code of every method as" << endl
+       << "                      CSV" << endl
+       << "  opcodes [<type>...] count the instructions by opcode in the dex, or in each" << endl
+       << "                      class" << endl
+       << "  grep <pattern>... [-- <dex>...]" << endl
+       << "                      list the methods with code matching each pattern, and" << endl
+       << "                      the address of the last instruction of each match, in" << endl
+       << "                      the further dex files of a multidex app too; see" << endl
+       << "                      pattern_search.h" << endl
+       << "  callers <method>... list the methods invoking each method" << endl
+       << "  callees <method>... list the methods invoked by each method" << endl
+       << "  targets <method>... list the methods a virtual call of each method may" << endl
+       << "                      land in" << endl
+       << "  devirt              count the virtual call sites by number of targets" << endl
+       << "  reachable <entry>..." << endl
+       << "                      list the classes and methods unreachable from the" << endl
+       << "                      entry points: classes, which reach all of their" << endl
+       << "                      methods, methods, and @types of annotations" << endl
+       << "  hierarchy <type>... list the superclasses, interfaces and subtypes of each" << endl
+       << "                      type" << endl
+       << "  xref-build <index>  save the string, type and field references to index" << endl
+       << "  xref <index> string|type|field <item>..." << endl
+       << "                      list the methods referencing each item, rebuilding" << endl
+       << "                      the index if it does not match the dex" << endl
+       << "  annotated <type>... list the classes, fields, methods and parameters" << endl
+       << "                      annotated with each type, without parsing the dex" << endl
+       << "  diff <dex>          list the classes and methods added, removed and changed" << endl
+       << "                      from the dex to the given one, a later build of it" << endl
+       << "  bench               time validation against parsing and decoding" << endl
+       << "Usage: rev serve [options] <socket>" << endl
+       << "  serve disassembly requests on a Unix domain socket, see server.h" << endl
+       << "Methods are given in smali notation, Lpkg/Class;->name(Args)Ret, and the" << endl
+       << "signature may be left out to match every overload. Fields are given as" << endl
+       << "Lpkg/Class;->name:Type, and the type may be left out." << endl
+       << "Options:" << endl
+       << "  -j N  number of threads, defaults to the number of cores" << endl
+       << "  -m N  megabytes of dex files kept parsed by serve, 1024 by default" << endl
+       << "  -t N  milliseconds per method for java, metrics and serve, 2000 by default" << endl
+       << "  -z N  megabytes per method for java, metrics and serve, 256 by default" << endl
+       << "  -c    verify the checksum and the signature of every dex, alongside parsing" << endl
+       << "Methods over the -t or -z budget are printed as disassembly, or with their sizes" << endl
+       << "only by metrics; 0 lifts a budget." << endl;
+  return 1;
 }
 
-void Do(const Edges& edges) {
-  DominatorEval d(edges);
-  d.Compute();
-  Print(d.dom());
+int RunRaw(const DexScanner& d) {
+  d.PrintHeader(cout);
+  Zone zone(1048576 * 16);
+
+  const auto& class_defs = d.class_defs();
+  for (const ClassDefItem& class_def : class_defs) {
+    cout << "== " << d.string_ids()[d.type_ids()[class_def.type_idx()].descriptor_idx] << endl;
+    uint32_t method_idx = 0;
+    for (const EncodedMethod& method : class_def.direct_methods()) {
+      {
+        MethodDasm dasm(&zone, d, method, &method_idx);
+        dasm.Run();
+        dasm.PrintRaw(cout);
+      }
+      zone.Reset();
+    }
+
+    method_idx = 0;
+    for (const EncodedMethod& method : class_def.virtual_methods()) {
+      {
+        MethodDasm dasm(&zone, d, method, &method_idx);
+        dasm.Run();
+        dasm.PrintRaw(cout);
+      }
+      zone.Reset();
+    }
+  }
+  return 0;
 }
 
-string ReadFileContent(const string& path) {
-  static char buffer[1048576];
-  string result;
-  int fd = open(path.c_str(), O_RDONLY);
-  int sz;
-  while ((sz = read(fd, buffer, 1048576)) > 0) {
-    result += string(buffer, sz);
+// Only the classes of the methods found are validated.
+int RunMethod(const DexScanner& d, DexValidator* validator, const vector<string>& queries) {
+  Zone zone(1048576 * 16);
+  int result = 0;
+  for (const string& query : queries) {
+    const pair<uint32_t, uint32_t> range = d.FindMethods(query);
+    if (range.first == range.second) {
+      cerr << "No method " << query << endl;
+      result = 1;
+    }
+    for (uint32_t m = range.first; m < range.second; ++m) {
+      cout << d.MethodDescriptor(m) << endl;
+      const uint32_t class_def = d.FindClassDef(d.method_id(m).class_idx);
+      if (class_def != DexScanner::kNoIndex && !validator->ValidateClass(class_def)) {
+        cerr << validator->error() << endl;
+        return 1;
+      }
+      EncodedMethod method;
+      if (!d.FindEncodedMethod(m, &method)) {
+        cout << "  not defined in this dex" << endl;
+        continue;
+      }
+      uint32_t base = 0;
+      MethodDasm dasm(&zone, d, method, &base);
+      dasm.Run();
+      dasm.PrintRaw(cout);
+      zone.Reset();
+    }
   }
-  close(fd);
   return result;
 }
 
-void ReconstructBlock(const DexScanner& scanner, const EncodedMethod& method, const DominatorEval& dom, uint32_t head) {
+// Returns the parsed dex file, or NULL after saying why it cannot be. With
+// verify, a file whose checksum or signature does not match is rejected.
+unique_ptr<DexScanner> LoadDex(const string& path, bool verify) {
+  string content;
+  if (!ReadFileContent(path, &content)) {
+    cerr << "Cannot read " << path << endl;
+    return NULL;
+  }
+  unique_ptr<DexScanner> d(new DexScanner(std::move(content)));
+  if (!d->ParseHeader()) {
+    cerr << path << ": not a dex file" << endl;
+    return NULL;
+  }
+  unique_ptr<IntegrityCheck> integrity(verify ? new IntegrityCheck(*d) : NULL);
+  DexValidator validator(*d);
+  if (!validator.Validate()) {
+    cerr << path << ": " << validator.error() << endl;
+    return NULL;
+  }
+  d->Parse();
+  if (integrity && !integrity->Wait()) {
+    cerr << path << ": " << integrity->error() << endl;
+    return NULL;
+  }
+  return d;
 }
 
-int main() {
-  Do(Edges(1));
-  /*
-  Do({{1}, {2}, {3}, {}});  // linear
-  Do({{1, 3}, {2}, {5}, {4}, {5}, {}});  // if (1) (2) else (3) (4); (5)
-  Do({{1, 3}, {2}, {3}, {4}, {}});  // if (1) (2); (3) (4)
-  */
+// Classes are emitted in parallel, largest first, each into a buffer of its
+// own, and the buffers are written out in class order. Methods over budget
+// are reported on stderr, and the failures of each kind counted.
+void EmitJava(const DexScanner& d, size_t threads, const Budget& budget, BodyCache* cache,
+              const vector<unique_ptr<Zone>>& zones, vector<size_t>* failures) {
+  const auto& class_defs = d.class_defs();
+  vector<unique_ptr<OutputBuffer>> out(class_defs.size());
+  vector<vector<pair<uint32_t, Budget::Verdict>>> degraded(class_defs.size());
+  vector<vector<pair<uint32_t, MethodDasm::Failure>>> failed(class_defs.size());
+  vector<size_t> costs;
+  costs.reserve(class_defs.size());
+  for (const ClassDefItem& class_def : class_defs) {
+    costs.push_back(ClassCost(d, class_def));
+  }
+  const vector<size_t> order = LargestFirst(costs);
+  const BodyKeys keys(d);
+
+  ParallelFor(class_defs.size(), std::min(threads, zones.size()), [&] (size_t task, size_t worker) {
+    const size_t c = order[task];
+    out[c].reset(new OutputBuffer());
+    JavaEmitter emitter(d, out[c].get());
+    emitter.set_budget(budget);
+    emitter.set_cache(cache, &keys);
+    emitter.EmitClass(class_defs[c], zones[worker].get());
+    degraded[c] = emitter.degraded();
+    failed[c] = emitter.failed();
+  });
+  for (const auto& buffer : out) {
+    buffer->WriteTo(cout);
+  }
+  for (const auto& slot : degraded) {
+    for (const auto& method : slot) {
+      cerr << "Printed as disassembly, " << VerdictName(method.second) << ": "
+           << d.MethodDescriptor(method.first) << endl;
+    }
+  }
+  for (const auto& slot : failed) {
+    for (const auto& method : slot) {
+      ++(*failures)[method.second];
+    }
+  }
+}
 
-  DexScanner d(ReadFileContent("/home/ivan/Downloads/classes.exe"));
-  d.Parse();
-  
-  Zone zone(1048576 * 16);
+// The dex files of a multidex app follow one another, and methods with the
+// same body in any of them are decompiled once; how many is reported on
+// stderr.
+int RunJava(const DexScanner& d, size_t threads, const Budget& budget, bool verify,
+            const vector<string>& paths) {
+  vector<unique_ptr<DexScanner>> others;
+  for (const string& path : paths) {
+    others.push_back(LoadDex(path, verify));
+    if (others.back() == NULL) {
+      return 1;
+    }
+  }
+  size_t classes = d.class_defs().size();
+  for (const auto& other : others) {
+    classes = std::max(classes, other->class_defs().size());
+  }
+  vector<unique_ptr<Zone>> zones;
+  for (size_t t = 0; t < std::max<size_t>(std::min(threads, classes), 1); ++t) {
+    zones.emplace_back(new Zone(1048576 * 16));
+  }
+  BodyCache cache;
+  vector<size_t> failures(MethodDasm::MALFORMED_STATEMENTS + 1);
+  EmitJava(d, threads, budget, &cache, zones, &failures);
+  for (const auto& other : others) {
+    EmitJava(*other, threads, budget, &cache, zones, &failures);
+  }
+  size_t failure_total = 0;
+  for (size_t count : failures) {
+    failure_total += count;
+  }
+  if (failure_total) {
+    cerr << "Printed as disassembly, not decompiled: " << failure_total << " methods" << endl;
+    for (size_t f = 0; f < failures.size(); ++f) {
+      if (failures[f]) {
+        cerr << "  " << MethodDasm::FailureName(static_cast<MethodDasm::Failure>(f))
+             << ": " << failures[f] << endl;
+      }
+    }
+  }
+  if (cache.hits()) {
+    cerr << "Identical bodies: " << cache.hits() << " of " << cache.lookups()
+         << " methods with code printed from " << cache.size() << " decompiled, saving "
+         << std::chrono::duration_cast<std::chrono::milliseconds>(cache.saved()).count()
+         << " ms" << endl;
+  }
+  return 0;
+}
 
+// Only the control flow graph and the dominators of each method are built,
+// in parallel as RunJava() does. Methods over budget get their sizes only.
+int RunMetrics(const DexScanner& d, size_t threads, const Budget& budget) {
   const auto& class_defs = d.class_defs();
+  vector<unique_ptr<OutputBuffer>> out(class_defs.size());
+  vector<size_t> costs;
+  costs.reserve(class_defs.size());
   for (const ClassDefItem& class_def : class_defs) {
-    cout << "== " << d.string_ids()[d.type_ids()[class_def.type_idx()].descriptor_idx] << endl;
-    uint32_t method_idx = 0;
-    for (const EncodedMethod& method : class_def.direct_methods()) {
-      MethodDasm dasm(&zone, d, method, &method_idx);
-      dasm.Run();
-      dasm.PrintRaw();
-      dasm.ReconstructAst();
+    costs.push_back(ClassCost(d, class_def));
+  }
+  const vector<size_t> order = LargestFirst(costs);
+
+  threads = std::min(threads, class_defs.size());
+  vector<unique_ptr<Zone>> zones;
+  for (size_t t = 0; t < std::max<size_t>(threads, 1); ++t) {
+    zones.emplace_back(new Zone(65536));
+  }
+  ParallelFor(class_defs.size(), threads, [&] (size_t task, size_t worker) {
+    const size_t c = order[task];
+    out[c].reset(new OutputBuffer());
+    for (int k = 0; k < 2; ++k) {
+      uint32_t method_idx = 0;
+      for (const EncodedMethod& method : k ? class_defs[c].virtual_methods() : class_defs[c].direct_methods()) {
+        MethodDasm dasm(zones[worker].get(), d, method, &method_idx);
+        if (!method.code_offs) continue;
+        dasm.set_budget(budget);
+        dasm.Run();
+        MethodDasm::Metrics metrics;
+        dasm.ComputeMetrics(&metrics);
+        *out[c] << d.MethodDescriptor(method_idx) << ',' << metrics.code_units << ','
+                << metrics.instructions << ',' << metrics.blocks << ',' << metrics.edges << ','
+                << metrics.cyclomatic << ',' << metrics.loop_depth << ',' << metrics.tries << '\n';
+      }
     }
+  });
+  cout << "method,code_units,instructions,blocks,edges,cyclomatic,loop_depth,tries" << endl;
+  for (const auto& buffer : out) {
+    buffer->WriteTo(cout);
+  }
+  return 0;
+}
 
-    method_idx = 0;
-    for (const EncodedMethod& method : class_def.virtual_methods()) {
-      MethodDasm dasm(&zone, d, method, &method_idx);
-      dasm.Run();
-      dasm.PrintRaw();
-      dasm.ReconstructAst();
+// Most frequent opcodes first, with their share of the instructions.
+void PrintHistogram(const OpcodeHistogram& histogram) {
+  const uint64_t total = histogram.total();
+  cout << "instructions: " << total << " in " << histogram.methods() << " methods" << endl;
+  vector<pair<uint64_t, int>> counts;
+  for (int opcode = 0; opcode < 256; ++opcode) {
+    if (histogram.count(opcode)) {
+      counts.emplace_back(histogram.count(opcode), opcode);
+    }
+  }
+  std::stable_sort(counts.begin(), counts.end(),
+                   [] (const pair<uint64_t, int>& lhs, const pair<uint64_t, int>& rhs) {
+                     return lhs.first > rhs.first;
+                   });
+  for (const auto& count : counts) {
+    const uint64_t permille = count.first * 1000 / total;
+    cout << "  " << (count.second ? iTable[count.second]->name() : "nop") << ' ' << count.first
+         << ' ' << permille / 10 << '.' << permille % 10 << '%' << endl;
+  }
+}
+
+int RunOpcodes(const DexScanner& d, size_t threads, const vector<string>& types) {
+  if (types.empty()) {
+    OpcodeHistogram histogram(d);
+    histogram.Run(threads);
+    PrintHistogram(histogram);
+    return 0;
+  }
+  int result = 0;
+  for (const string& type : types) {
+    const uint32_t type_idx = d.FindType(type);
+    const uint32_t class_def = type_idx == DexScanner::kNoIndex ? DexScanner::kNoIndex : d.FindClassDef(type_idx);
+    if (class_def == DexScanner::kNoIndex) {
+      cerr << "No class " << type << endl;
+      result = 1;
+      continue;
+    }
+    OpcodeHistogram histogram(d);
+    histogram.AddClass(d.class_defs()[class_def]);
+    cout << type << endl;
+    PrintHistogram(histogram);
+  }
+  return result;
+}
+
+// The patterns may be followed by "--" and the further dex files of a
+// multidex app, searched in turn; the matches of each pattern are listed
+// for all of them.
+int RunGrep(const DexScanner& d, size_t threads, bool verify, const vector<string>& args) {
+  const auto split = std::find(args.begin(), args.end(), "--");
+  const vector<string> texts(args.begin(), split);
+  if (texts.empty()) {
+    return Usage();
+  }
+  vector<unique_ptr<DexScanner>> others;
+  for (auto path = split == args.end() ? split : split + 1; path != args.end(); ++path) {
+    others.push_back(LoadDex(*path, verify));
+    if (others.back() == NULL) {
+      return 1;
+    }
+  }
+  vector<const DexScanner*> dexes(1, &d);
+  for (const auto& other : others) {
+    dexes.push_back(other.get());
+  }
+  // Patterns refer to items by index, so each dex compiles its own.
+  vector<unique_ptr<CodePattern>> patterns;
+  vector<unique_ptr<PatternSearch>> searches;
+  for (const DexScanner* dex : dexes) {
+    vector<const CodePattern*> compiled;
+    for (const string& text : texts) {
+      patterns.emplace_back(new CodePattern(*dex));
+      if (!patterns.back()->Compile(text)) {
+        cerr << patterns.back()->error() << endl;
+        return 1;
+      }
+      compiled.push_back(patterns.back().get());
+    }
+    searches.emplace_back(new PatternSearch(*dex, compiled));
+    searches.back()->Run(threads);
+  }
+  for (size_t p = 0; p < texts.size(); ++p) {
+    cout << texts[p] << endl;
+    for (size_t i = 0; i < dexes.size(); ++i) {
+      for (const PatternSearch::Match& match : searches[i]->matches()) {
+        if (match.pattern != p) continue;
+        cout << "  " << dexes[i]->MethodDescriptor(match.method_idx);
+        for (uint32_t end : match.ends) {
+          cout << ' ' << end;
+        }
+        cout << endl;
+      }
+    }
+  }
+  return 0;
+}
+
+int RunCalls(const DexScanner& d, size_t threads, const vector<string>& queries, bool callers) {
+  CallGraph graph(d);
+  graph.Build(threads);
+
+  vector<string> descriptors;
+  descriptors.reserve(d.method_ids().size());
+  for (uint32_t m = 0; m < d.method_ids().size(); ++m) {
+    descriptors.push_back(d.MethodDescriptor(m));
+  }
+  int result = 0;
+  for (const string& query : queries) {
+    bool found = false;
+    for (uint32_t m = 0; m < descriptors.size(); ++m) {
+      if (!MatchesMethod(descriptors[m], query)) continue;
+      found = true;
+      cout << descriptors[m] << endl;
+      const uint32_t* begin = callers ? graph.callers_begin(m) : graph.callees_begin(m);
+      const uint32_t* end = callers ? graph.callers_end(m) : graph.callees_end(m);
+      for (const uint32_t* it = begin; it != end; ++it) {
+        cout << "  " << descriptors[*it] << endl;
+      }
+    }
+    if (!found) {
+      cerr << "No method " << query << endl;
+      result = 1;
+    }
+  }
+  return result;
+}
+
+// Prints the annotation of the type in the set, if there is one, after the
+// annotated item.
+void PrintAnnotated(const DexScanner& d, const AnnotationSet& set, uint32_t type_idx,
+                    const string& item) {
+  Annotation annotation(d, 0);
+  if (!set.Find(type_idx, &annotation)) return;
+  cout << "  " << item << " @";
+  PrintAnnotation(d, annotation.annotation(), cout);
+  cout << endl;
+}
+
+// Only the annotations of the classes are validated.
+int RunAnnotated(const DexScanner& d, DexValidator* validator, const vector<string>& types) {
+  for (uint32_t t = 0; t < d.class_defs_size(); ++t) {
+    if (!validator->ValidateAnnotations(t)) {
+      cerr << validator->error() << endl;
+      return 1;
+    }
+  }
+  int result = 0;
+  for (const string& type : types) {
+    const uint32_t type_idx = d.FindType(type);
+    if (type_idx == DexScanner::kNoIndex) {
+      cerr << "No type " << type << endl;
+      result = 1;
+      continue;
+    }
+    cout << type << endl;
+    for (const uint32_t t : FindAnnotatedClasses(d, type_idx, true)) {
+      const AnnotationsDirectory directory(d, d.class_annotations_offs(t));
+      PrintAnnotated(d, directory.class_annotations(), type_idx, d.type_data(d.class_type_idx(t)));
+      for (uint32_t i = 0; i < directory.fields_size(); ++i) {
+        const AnnotationsDirectory::Member field = directory.field(i);
+        PrintAnnotated(d, AnnotationSet(d, field.offs), type_idx, d.FieldDescriptor(field.idx));
+      }
+      for (uint32_t i = 0; i < directory.methods_size(); ++i) {
+        const AnnotationsDirectory::Member method = directory.method(i);
+        PrintAnnotated(d, AnnotationSet(d, method.offs), type_idx, d.MethodDescriptor(method.idx));
+      }
+      for (uint32_t i = 0; i < directory.parameters_size(); ++i) {
+        const uint32_t method_idx = directory.parameters(i).idx;
+        for (uint32_t p = 0; p < directory.ParameterCount(method_idx); ++p) {
+          stringstream item;
+          item << d.MethodDescriptor(method_idx) << " parameter " << p;
+          PrintAnnotated(d, directory.ParameterAnnotations(method_idx, p), type_idx, item.str());
+        }
+      }
+    }
+  }
+  return result;
+}
+
+int RunHierarchy(const DexScanner& d, const vector<string>& types) {
+  ClassHierarchy hierarchy(d);
+  hierarchy.Build();
+  int result = 0;
+  for (const string& type : types) {
+    const uint32_t type_idx = d.FindType(type);
+    if (type_idx == DexScanner::kNoIndex) {
+      cerr << "No type " << type << endl;
+      result = 1;
+      continue;
+    }
+    cout << type << endl;
+    for (uint32_t t = hierarchy.superclass(type_idx); t != DexScanner::kNoIndex;
+         t = hierarchy.superclass(t)) {
+      cout << "  super " << d.type_descriptor(t) << endl;
+    }
+    for (const uint32_t* it = hierarchy.interfaces_begin(type_idx);
+         it != hierarchy.interfaces_end(type_idx); ++it) {
+      cout << "  interface " << d.type_descriptor(*it) << endl;
+    }
+    vector<uint32_t> subtypes;
+    hierarchy.Subtypes(type_idx, &subtypes);
+    for (const uint32_t t : subtypes) {
+      if (t != type_idx) cout << "  sub " << d.type_descriptor(t) << endl;
+    }
+  }
+  return result;
+}
+
+int RunTargets(const DexScanner& d, const vector<string>& queries) {
+  ClassHierarchy hierarchy(d);
+  hierarchy.Build();
+  CallResolver resolver(d, hierarchy);
+  int result = 0;
+  for (const string& query : queries) {
+    const pair<uint32_t, uint32_t> range = d.FindMethods(query);
+    if (range.first == range.second) {
+      cerr << "No method " << query << endl;
+      result = 1;
+    }
+    for (uint32_t m = range.first; m < range.second; ++m) {
+      cout << d.MethodDescriptor(m) << endl;
+      const CallTargets& targets = resolver.Resolve(m);
+      for (const uint32_t target : targets.methods) {
+        cout << "  " << d.MethodDescriptor(target) << endl;
+      }
+      if (targets.external) {
+        cout << "  (outside the dex)" << endl;
+      }
+    }
+  }
+  return result;
+}
+
+// Tallies of invoke-virtual and invoke-interface sites.
+struct DevirtCounts {
+  size_t sites;
+  // Sites with a single target in the dex and none outside.
+  size_t monomorphic;
+  size_t polymorphic;
+  // Sites with no target at all, e.g. on interfaces nothing implements.
+  size_t unreachable;
+  size_t external;
+};
+
+template <typename Reader>
+void CountVirtualSites(const DexScanner& d, const Reader& reader, const ClassDefItem& class_def,
+                       CallResolver* resolver, DevirtCounts* counts) {
+  for (int k = 0; k < 2; ++k) {
+    for (const EncodedMethod& method : k ? class_def.virtual_methods() : class_def.direct_methods()) {
+      if (!method.code_offs) continue;
+      const CodeItem code(&d, method.code_offs);
+      size_t offs = code.instr_offs();
+      const size_t end = offs + 2*code.instr_size();
+      for (; offs < end; offs += 2*InstructionSize(&reader, offs)) {
+        // invoke-virtual and invoke-interface, and their /range forms.
+        const uint8_t opcode = reader.ReadUShort(offs) & 0xFF;
+        if (opcode != 0x6E && opcode != 0x72 && opcode != 0x74 && opcode != 0x78) continue;
+        uint32_t method_idx;
+        ReadReference(&reader, offs, &method_idx);
+        const CallTargets& targets = resolver->Resolve(method_idx);
+        ++counts->sites;
+        if (targets.external) {
+          ++counts->external;
+        } else if (targets.methods.empty()) {
+          ++counts->unreachable;
+        } else if (targets.methods.size() == 1) {
+          ++counts->monomorphic;
+        } else {
+          ++counts->polymorphic;
+        }
+      }
+    }
+  }
+}
+
+// Resolves every virtual call site on up to `threads` threads, which share
+// the resolutions.
+int RunDevirt(const DexScanner& d, size_t threads) {
+  ClassHierarchy hierarchy(d);
+  hierarchy.Build();
+  CallResolver resolver(d, hierarchy);
+  const vector<ClassDefItem>& class_defs = d.class_defs();
+  vector<DevirtCounts> slots(class_defs.size(), DevirtCounts());
+  ParallelFor(class_defs.size(), threads, [&] (size_t c, size_t worker) {
+    if (d.IsMachineEndian()) {
+      CountVirtualSites(d, DexReader<NativeOrder>(d), class_defs[c], &resolver, &slots[c]);
+    } else {
+      CountVirtualSites(d, DexReader<SwappedOrder>(d), class_defs[c], &resolver, &slots[c]);
+    }
+  });
+  DevirtCounts total = DevirtCounts();
+  for (const DevirtCounts& slot : slots) {
+    total.sites += slot.sites;
+    total.monomorphic += slot.monomorphic;
+    total.polymorphic += slot.polymorphic;
+    total.unreachable += slot.unreachable;
+    total.external += slot.external;
+  }
+  cout << "virtual call sites: " << total.sites << endl
+       << "  monomorphic: " << total.monomorphic << endl
+       << "  polymorphic: " << total.polymorphic << endl
+       << "  no target: " << total.unreachable << endl
+       << "  may leave the dex: " << total.external << endl
+       << "signatures resolved: " << resolver.size() << ", cache hits: " << resolver.hits() << endl;
+  return 0;
+}
+
+// Entry points are components such as activities and services, by their
+// class, single methods, and annotation types marking what to keep, e.g.
+// @Landroidx/annotation/Keep;.
+int RunReachable(const DexScanner& d, size_t threads, const vector<string>& entries) {
+  ClassHierarchy hierarchy(d);
+  hierarchy.Build();
+  Reachability reachability(d, hierarchy);
+  int result = 0;
+  for (const string& entry : entries) {
+    if (entry.find("->") != string::npos) {
+      const pair<uint32_t, uint32_t> range = d.FindMethods(entry);
+      if (range.first == range.second) {
+        cerr << "No method " << entry << endl;
+        result = 1;
+      }
+      for (uint32_t m = range.first; m < range.second; ++m) {
+        reachability.AddMethod(m);
+      }
+      continue;
+    }
+    const bool annotation = entry[0] == '@';
+    const uint32_t type_idx = d.FindType(annotation ? entry.substr(1) : entry);
+    if (type_idx == DexScanner::kNoIndex) {
+      cerr << "No type " << entry << endl;
+      result = 1;
+    } else if (annotation) {
+      reachability.AddAnnotated(type_idx);
+    } else {
+      reachability.AddClass(type_idx);
+    }
+  }
+  reachability.Run(threads);
+
+  vector<uint32_t> classes;
+  for (uint32_t t = 0; t < d.type_ids().size(); ++t) {
+    const uint32_t class_def = hierarchy.class_def(t);
+    if (class_def != DexScanner::kNoIndex && !reachability.is_reached_class(class_def)) {
+      classes.push_back(t);
+    }
+  }
+  vector<uint32_t> methods;
+  size_t defined = 0;
+  for (uint32_t m = 0; m < d.method_ids().size(); ++m) {
+    const uint32_t class_def = hierarchy.class_def(d.method_id(m).class_idx);
+    if (!reachability.is_defined(m) || !reachability.is_reached_class(class_def)) continue;
+    ++defined;
+    if (!reachability.is_reached_method(m)) methods.push_back(m);
+  }
+  cout << "unreachable classes: " << classes.size() << " of " << d.class_defs().size() << endl;
+  for (const uint32_t t : classes) {
+    cout << "  " << d.type_descriptor(t) << endl;
+  }
+  cout << "unreachable methods of reachable classes: " << methods.size() << " of " << defined << endl;
+  for (const uint32_t m : methods) {
+    cout << "  " << d.MethodDescriptor(m) << endl;
+  }
+  return result;
+}
+
+int RunDiff(const DexScanner& d, size_t threads, bool verify, const string& new_path) {
+  const unique_ptr<DexScanner> loaded = LoadDex(new_path, verify);
+  if (loaded == NULL) {
+    return 1;
+  }
+  const DexScanner& new_dex = *loaded;
+
+  DexDiff diff(d, new_dex);
+  diff.Run(threads);
+  const char kSigns[] = {'+', '-', '~'};
+  size_t classes[3] = {0, 0, 0};
+  size_t methods[3] = {0, 0, 0};
+  for (const DexDiff::ClassChange& change : diff.changes()) {
+    const DexScanner& dex = change.change == DexDiff::ADDED ? new_dex : d;
+    cout << kSigns[change.change] << " " << dex.type_descriptor(dex.class_defs()[change.class_def].type_idx());
+    if (change.change != DexDiff::CHANGED) {
+      cout << " (" << change.methods_count << " methods)";
+      methods[change.change] += change.methods_count;
+    }
+    cout << endl;
+    ++classes[change.change];
+    for (const DexDiff::MethodChange& method : change.methods) {
+      cout << "  " << kSigns[method.change] << " "
+           << (method.change == DexDiff::ADDED ? new_dex : d).MethodDescriptor(method.method_idx) << endl;
+      ++methods[method.change];
+    }
+  }
+  cout << "classes: " << classes[DexDiff::ADDED] << " added, " << classes[DexDiff::REMOVED] << " removed, "
+       << classes[DexDiff::CHANGED] << " changed" << endl
+       << "methods: " << methods[DexDiff::ADDED] << " added, " << methods[DexDiff::REMOVED] << " removed, "
+       << methods[DexDiff::CHANGED] << " changed" << endl;
+  return 0;
+}
+
+int RunXrefBuild(const DexScanner& d, size_t threads, const string& index_path) {
+  XrefIndex index;
+  index.Build(d, threads);
+  if (!index.Save(index_path)) {
+    cerr << "Cannot write " << index_path << endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Returns the index of the string, or string_ids().size() if there is none.
+uint32_t FindString(const DexScanner& d, const string& text) {
+  const vector<string>& strings = d.string_ids();
+  // string_ids are sorted by contents.
+  auto it = lower_bound(strings.begin(), strings.end(), text);
+  return it != strings.end() && *it == text ? it - strings.begin() : strings.size();
+}
+
+// Returns the indices of the items of the kind matching the query.
+vector<uint32_t> FindXrefItems(const DexScanner& d, XrefIndex::Kind kind, const string& query) {
+  vector<uint32_t> result;
+  if (kind == XrefIndex::FIELD) {
+    for (uint32_t f = 0; f < d.field_ids().size(); ++f) {
+      const string descriptor = d.FieldDescriptor(f);
+      if (descriptor.compare(0, query.size(), query) == 0
+          && (descriptor.size() == query.size() || descriptor[query.size()] == ':')) {
+        result.push_back(f);
+      }
+    }
+    return result;
+  }
+  const uint32_t string_idx = FindString(d, query);
+  if (string_idx == d.string_ids().size()) {
+    return result;
+  }
+  if (kind == XrefIndex::STRING) {
+    result.push_back(string_idx);
+    return result;
+  }
+  // type_ids are sorted by descriptor_idx.
+  const vector<TypeIdItem>& types = d.type_ids();
+  auto it = lower_bound(types.begin(), types.end(), string_idx,
+                        [] (const TypeIdItem& type, uint32_t idx) { return type.descriptor_idx < idx; });
+  if (it != types.end() && it->descriptor_idx == string_idx) {
+    result.push_back(it - types.begin());
+  }
+  return result;
+}
+
+int RunXref(const DexScanner& d, size_t threads, const vector<string>& args) {
+  if (args.size() < 3) {
+    return Usage();
+  }
+  XrefIndex::Kind kind;
+  if (args[1] == "string") {
+    kind = XrefIndex::STRING;
+  } else if (args[1] == "type") {
+    kind = XrefIndex::TYPE;
+  } else if (args[1] == "field") {
+    kind = XrefIndex::FIELD;
+  } else {
+    return Usage();
+  }
+  XrefIndex index;
+  if (!index.Load(args[0], d)) {
+    cerr << "Rebuilding " << args[0] << ": missing, damaged or built for another dex" << endl;
+    index.Build(d, threads);
+    if (!index.Save(args[0])) {
+      cerr << "Cannot write " << args[0] << endl;
+    }
+  }
+  int result = 0;
+  vector<uint32_t> methods;
+  for (size_t q = 2; q < args.size(); ++q) {
+    const vector<uint32_t> items = FindXrefItems(d, kind, args[q]);
+    if (items.empty()) {
+      cerr << "No " << args[1] << " " << args[q] << endl;
+      result = 1;
+    }
+    for (uint32_t item : items) {
+      cout << (kind == XrefIndex::FIELD ? d.FieldDescriptor(item) : args[q]) << endl;
+      methods.clear();
+      index.Lookup(kind, item, &methods);
+      for (uint32_t m : methods) {
+        cout << "  " << d.MethodDescriptor(m) << endl;
+      }
     }
   }
+  return result;
+}
+
+// Walks every instruction as the analyses do: size, references and
+// registers. Reader is either the scanner itself or a DexReader. Returns a
+// checksum so the loop is not optimized out.
+template <typename Reader>
+size_t DecodeAll(const DexScanner& d, const Reader& reader) {
+  size_t sum = 0;
+  RegisterAccess access;
+  for (const ClassDefItem& class_def : d.class_defs()) {
+    for (int k = 0; k < 2; ++k) {
+      for (const EncodedMethod& method : k ? class_def.virtual_methods() : class_def.direct_methods()) {
+        if (!method.code_offs) continue;
+        const CodeItem code(&d, method.code_offs);
+        size_t offs = code.instr_offs();
+        const size_t end = offs + 2*code.instr_size();
+        for (; offs < end; offs += 2*InstructionSize(&reader, offs)) {
+          uint32_t index = 0;
+          sum += ReadReference(&reader, offs, &index) + index;
+          ReadRegisterAccess(&reader, offs, &access);
+          sum += access.def_count + access.use_count;
+        }
+      }
+    }
+  }
+  return sum;
+}
 
+// Times validation against parsing, decoding every instruction and building
+// the CFG of every method, taking the best of a few runs of each. Decoding
+// is timed with the readers checking the byte order on each read and with
+// the DexReader of the byte order of the file.
+int RunBench(const string& content) {
+  typedef std::chrono::steady_clock Clock;
+  const int kRuns = 5;
+  const char* const names[] = {"validate", "parse", "decode", "decode/reader", "cfg"};
+  double best[5] = {1e30, 1e30, 1e30, 1e30, 1e30};
+  size_t sum = 0;
+  Zone zone(1048576 * 64);
+  for (int run = 0; run < kRuns; ++run) {
+    DexScanner d{string(content)};
+    Clock::time_point times[6];
+    times[0] = Clock::now();
+    d.ParseHeader();
+    DexValidator validator(d);
+    if (!validator.Validate()) {
+      cerr << validator.error() << endl;
+      return 1;
+    }
+    times[1] = Clock::now();
+    d.Parse();
+    times[2] = Clock::now();
+    sum += DecodeAll(d, d);
+    times[3] = Clock::now();
+    if (d.IsMachineEndian()) {
+      sum += DecodeAll(d, DexReader<NativeOrder>(d));
+    } else {
+      sum += DecodeAll(d, DexReader<SwappedOrder>(d));
+    }
+    times[4] = Clock::now();
+    for (const ClassDefItem& class_def : d.class_defs()) {
+      for (int k = 0; k < 2; ++k) {
+        uint32_t base = 0;
+        for (const EncodedMethod& method : k ? class_def.virtual_methods() : class_def.direct_methods()) {
+          MethodDasm dasm(&zone, d, method, &base);
+          dasm.Run();
+          zone.Reset();
+        }
+      }
+    }
+    times[5] = Clock::now();
+    for (int i = 0; i < 5; ++i) {
+      best[i] = std::min(best[i], std::chrono::duration<double, std::milli>(times[i + 1] - times[i]).count());
+    }
+  }
+  for (int i = 0; i < 5; ++i) {
+    cout << names[i] << ": " << best[i] << " ms" << endl;
+  }
+  cout << "validation overhead: " << 100 * best[0] / (best[1] + best[2] + best[4]) << "%"
+       << " (checksum " << sum << ")" << endl;
   return 0;
 }
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    return Usage();
+  }
+  const string command = argv[1];
+  size_t threads = DefaultThreads();
+  size_t budget_mb = 1024;
+  int time_ms = 2000;
+  int method_mb = 256;
+  bool verify = false;
+  int arg = 2;
+  for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+    if (string(argv[arg]) == "-j" && arg + 1 < argc) {
+      threads = std::max(1, atoi(argv[++arg]));
+    } else if (string(argv[arg]) == "-m" && arg + 1 < argc) {
+      budget_mb = std::max(1, atoi(argv[++arg]));
+    } else if (string(argv[arg]) == "-t" && arg + 1 < argc) {
+      time_ms = std::max(0, atoi(argv[++arg]));
+    } else if (string(argv[arg]) == "-z" && arg + 1 < argc) {
+      method_mb = std::max(0, atoi(argv[++arg]));
+    } else if (string(argv[arg]) == "-c") {
+      verify = true;
+    } else {
+      return Usage();
+    }
+  }
+  if (arg == argc) {
+    return Usage();
+  }
+  const string path = argv[arg++];
+  const vector<string> args(argv + arg, argv + argc);
+  const Budget budget(std::chrono::milliseconds(time_ms), method_mb * 1048576ULL);
+
+  if (command == "serve") {
+    if (!args.empty()) {
+      return Usage();
+    }
+    DexCache cache(budget_mb * 1048576, verify);
+    Server server(&cache, threads, budget);
+    if (!server.Run(path)) {
+      cerr << "Cannot listen on " << path << endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  string content;
+  if (!ReadFileContent(path, &content)) {
+    cerr << "Cannot read " << path << endl;
+    return 1;
+  }
+  if (command == "bench") {
+    return RunBench(content);
+  }
+  DexScanner d(std::move(content));
+  DexValidator validator(d);
+  if (!d.ParseHeader() || !validator.ValidateIds()) {
+    cerr << path << ": " << (validator.error().empty() ? "not a dex file" : validator.error()) << endl;
+    return 1;
+  }
+  // The check runs while the file is validated and parsed, and nothing is
+  // printed before it is through.
+  unique_ptr<IntegrityCheck> integrity(verify ? new IntegrityCheck(d) : NULL);
+  if (command != "method" && command != "annotated") {
+    if (!validator.Validate()) {
+      cerr << path << ": " << validator.error() << endl;
+      return 1;
+    }
+    d.Parse();
+  }
+  if (integrity && !integrity->Wait()) {
+    cerr << path << ": " << integrity->error() << endl;
+    return 1;
+  }
+  if (command == "method") {
+    return args.empty() ? Usage() : RunMethod(d, &validator, args);
+  }
+  if (command == "annotated") {
+    return args.empty() ? Usage() : RunAnnotated(d, &validator, args);
+  }
+
+  if (command == "raw") {
+    return RunRaw(d);
+  }
+  if (command == "java") {
+    return RunJava(d, threads, budget, verify, args);
+  }
+  if (command == "metrics") {
+    return !args.empty() ? Usage() : RunMetrics(d, threads, budget);
+  }
+  if (command == "opcodes") {
+    return RunOpcodes(d, threads, args);
+  }
+  if (command == "grep") {
+    return RunGrep(d, threads, verify, args);
+  }
+  if (command == "callers" || command == "callees") {
+    return args.empty() ? Usage() : RunCalls(d, threads, args, command == "callers");
+  }
+  if (command == "targets") {
+    return args.empty() ? Usage() : RunTargets(d, args);
+  }
+  if (command == "devirt") {
+    return !args.empty() ? Usage() : RunDevirt(d, threads);
+  }
+  if (command == "reachable") {
+    return args.empty() ? Usage() : RunReachable(d, threads, args);
+  }
+  if (command == "hierarchy") {
+    return args.empty() ? Usage() : RunHierarchy(d, args);
+  }
+  if (command == "diff") {
+    return args.size() != 1 ? Usage() : RunDiff(d, threads, verify, args[0]);
+  }
+  if (command == "xref-build") {
+    return args.size() != 1 ? Usage() : RunXrefBuild(d, threads, args[0]);
+  }
+  if (command == "xref") {
+    return RunXref(d, threads, args);
+  }
+  return Usage();
+}
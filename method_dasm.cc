@@ -16,11 +16,6 @@ namespace egorich {
 namespace rev {
 namespace {
 
-template <typename Layout>
-const Layout* layout(const IDefBase* base) {
-  return static_cast<const Layout*>(base->Get());
-}
-
 bool IsReturn(uint16_t opcode) { return 0xE <= opcode && opcode <= 0x11; }
 bool IsBBranch(uint16_t opcode) { return 0x32 <= opcode && opcode <= 0x37; }
 bool IsUBranch(uint16_t opcode) { return 0x38 <= opcode && opcode <= 0x3D; }
@@ -28,13 +23,42 @@ bool IsGoto(uint16_t opcode) { return 0x28 <= opcode && opcode <= 0x2A; }
 bool IsThrow(uint16_t opcode) { return opcode == 0x27; }
 bool IsBranch(uint16_t opcode) { return IsBBranch(opcode) || IsUBranch(opcode); }
 
+// Rough heap footprint of DominatorEval per instruction, post-dominators
+// included; the CFG has a vertex for every code unit.
+const size_t kDomBytesPerVertex = 256;
+// Zone space of the AST nodes made for a block at most: a branch, its
+// condition, its two arms and a break or continue ending each.
+const size_t kAstBytesPerBlock = sizeof(BranchBlock) + sizeof(BasicBlock) + 2*sizeof(CompoundBlock)
+    + 2*sizeof(BreakBlock) + 4*8;
+
+size_t Words(size_t bits) { return (bits + 63) / 64; }
+
 }  // namespace
 
+bool MethodDasm::CheckTime() {
+  if (verdict_ == Budget::WITHIN && budget_.TimeExceeded()) {
+    verdict_ = Budget::TIME;
+  }
+  return verdict_ == Budget::WITHIN;
+}
+
+bool MethodDasm::CheckMemory(size_t bytes) {
+  if (verdict_ == Budget::WITHIN && !budget_.Fits(bytes)) {
+    verdict_ = Budget::MEMORY;
+  }
+  return verdict_ == Budget::WITHIN;
+}
+
+bool MethodDasm::CheckAstSpace() {
+  if (verdict_ == Budget::WITHIN && zone()->available() < kAstBytesPerBlock) {
+    verdict_ = Budget::MEMORY;
+  }
+  return verdict_ == Budget::WITHIN;
+}
+
 
 void MethodDasm::Run() {
-  const MethodIdItem& method_item = scanner_.method_ids()[method_idx_];
-  const uint32_t name_idx = method_item.name_idx;
-  cout << "  " << scanner_.string_ids()[name_idx] << endl;
+  budget_.Start();
   if (!method_.code_offs) {
     return;
   }
@@ -71,7 +95,7 @@ void MethodDasm::Run() {
     const size_t offs = code_->instr_offs() + 2*current_pc_;
     const uint16_t opcode = scanner_.ReadUShort(offs) & 0xff;
     const IDefBase* const instr = iTable[opcode];
-    next_pc_ = current_pc_ + instr->size(&scanner_, offs);
+    next_pc_ = current_pc_ + InstructionSize(&scanner_, offs);
 
     if (IsReturn(opcode) || IsThrow(opcode)) {
       if (next_pc_ < code_->instr_size()) edges_[next_pc_].clear();
@@ -113,43 +137,304 @@ void MethodDasm::Run() {
     }
     if (current_pc_ == code_->instr_size()) break;
     const size_t offs = code_->instr_offs() + 2*current_pc_;
-    const uint16_t opcode = scanner_.ReadUShort(offs) & 0xff;
-    const IDefBase* const instr = iTable[opcode];
-    current_pc_ += instr->size(&scanner_, offs);
+    current_pc_ += InstructionSize(&scanner_, offs);
   }
 
+  if (!CheckTime() || !CheckMemory(code_->instr_size() * kDomBytesPerVertex)) {
+    return;
+  }
   doms_.reset(new DominatorEval(edges_));
   doms_->Compute();
+  CheckTime();
+}
+
+void MethodDasm::ComputeMetrics(Metrics* metrics) const {
+  *metrics = Metrics();
+  if (code_ == NULL) return;
+  metrics->code_units = code_->instr_size();
+  metrics->tries = code_->tries().size();
+  for (uint32_t pc = 0; pc < code_->instr_size();) {
+    const size_t offs = code_->instr_offs() + 2*pc;
+    const uint16_t unit = scanner_.ReadUShort(offs);
+    // Payloads of switches and fill-array-data are nops with an ident.
+    if ((unit & 0xFF) != 0 || unit == 0) ++metrics->instructions;
+    pc += InstructionSize(&scanner_, offs);
+  }
+  if (doms_ == NULL) return;
+
+  const vector<int>& blocks = doms_->postorder();
+  metrics->blocks = blocks.size();
+  for (const int v : blocks) {
+    metrics->edges += doms_->outbound()[v].size();
+  }
+  metrics->cyclomatic = metrics->edges + 2 - metrics->blocks;
+
+  // The loop of a header is made of the blocks reaching a branch back to it
+  // without passing it. Loops of one header count once.
+  vector<uint32_t> depth(code_->instr_size(), 0);
+  vector<int> loop(code_->instr_size(), -1);
+  vector<int> stack;
+  for (const int header : blocks) {
+    for (const int latch : doms_->inbound()[header]) {
+      if (doms_->IsDominated(latch, header)) stack.push_back(latch);
+    }
+    if (stack.empty()) continue;
+    loop[header] = header;
+    ++depth[header];
+    while (!stack.empty()) {
+      const int v = stack.back();
+      stack.pop_back();
+      if (loop[v] == header) continue;
+      loop[v] = header;
+      ++depth[v];
+      for (const int u : doms_->inbound()[v]) {
+        // Other blocks enter an irreducible loop, which is left out.
+        if (loop[u] != header && doms_->IsDominated(u, header)) stack.push_back(u);
+      }
+    }
+  }
+  for (const int v : blocks) {
+    metrics->loop_depth = std::max(metrics->loop_depth, depth[v]);
+  }
+}
+
+void MethodDasm::AnalyzeRegisters() {
+  if (doms_ == NULL || !CheckTime()) return;
+  // Liveness keeps four register sets per block and reaching definitions
+  // one set of definitions, of which an instruction makes two at most.
+  const size_t blocks = doms_->postorder().size();
+  const size_t defs = 2*code_->instr_size() + code_->ins_size();
+  if (!CheckMemory(8 * blocks * (4*Words(code_->register_size()) + Words(defs)))) {
+    return;
+  }
+  flow_.reset(new RegisterFlow(scanner_, *code_, *doms_, block_size_));
+  flow_->Compute();
+  if (!CheckTime()) return;
+  // A partial SSA form would only take room from the AST.
+  const size_t mark = zone()->Mark();
+  ssa_.reset(new SsaForm(zone(), scanner_, *code_, *doms_, *flow_, block_size_));
+  if (!ssa_->Build()) {
+    ssa_.reset();
+    zone()->Rewind(mark);
+    verdict_ = Budget::MEMORY;
+  }
 }
 
 void MethodDasm::ReconstructAst() {
   DLOG() << "Reconstructing...";
-  if (code_ == NULL) return;
+  if (doms_ == NULL || !CheckTime()) return;
+  // Only the AST needs post-dominators, to find where the arms of a branch
+  // join.
+  doms_->ComputePostDominators();
+  if (!CheckTime()) return;
   indent_ = 0;
-  ast_ = current_compound_ = new(zone()) CompoundBlock(NULL, 0);
-  ReconstructBlock(0);
+  if (!CheckAstSpace()) return;
+  const size_t mark = zone()->Mark();
+  ast_ = current_compound_ = MakeNode<CompoundBlock>(NULL, 0);
+  regions_.clear();
+  regions_.push_back({0, false, current_compound_, -1, -1});
+  loops_.clear();
+  visited_.assign(code_->instr_size(), false);
+  visit_count_ = 0;
+  while (!regions_.empty() && failure_ == NO_FAILURE && CheckAstSpace() && CheckTime()) {
+    const Region region = regions_.back();
+    regions_.pop_back();
+    current_compound_ = region.compound;
+    follow_ = region.follow;
+    loop_ = region.loop;
+    failure_ = ReconstructBlock(region.head, region.ignore_loop);
+    regions_.insert(regions_.end(), scheduled_.rbegin(), scheduled_.rend());
+    scheduled_.clear();
+  }
+  // A block no region reached would be missing from the output.
+  if (failure_ == NO_FAILURE && verdict_ == Budget::WITHIN
+      && visit_count_ != doms_->postorder().size()) {
+    failure_ = UNSTRUCTURED;
+  }
+  if (failure_ != NO_FAILURE || verdict_ != Budget::WITHIN) {
+    // The method is left to be printed raw; its AST is dropped and the
+    // zone space it took is handed back.
+    regions_.clear();
+    DestroyAst();
+    zone()->Rewind(mark);
+  }
+}
+
+void MethodDasm::DestroyAst() {
+  for (CompoundBlock* compound : compounds_) {
+    compound->~CompoundBlock();
+  }
+  compounds_.clear();
+  ast_ = NULL;
+}
+
+const char* MethodDasm::FailureName(Failure failure) {
+  switch (failure) {
+  case NO_FAILURE:
+    return "none";
+  case LOOP_SHAPE:
+    return "unsupported loop shape";
+  case EXIT_EDGES:
+    return "return or throw with successors";
+  case BRANCH_EDGES:
+    return "branch without two successors";
+  case SEQUENCE_EDGES:
+    return "instruction without a single successor";
+  case UNSTRUCTURED:
+    return "jump without a structured form";
+  case EXPRESSIONS:
+    return "inconsistent register reads";
+  case EXPRESSION_POOL:
+    return "expression pool exhausted";
+  case MALFORMED_STATEMENTS:
+    return "malformed statements";
+  }
+  return "";
+}
+
+void MethodDasm::RecoverExpressions() {
+  if (ast_ == NULL || ssa_ == NULL || !CheckTime()) return;
+  const size_t size = code_->instr_size();
+  const size_t mark = zone()->Mark();
+  exprs_.reset(new ExprPool(zone(), 3*size + ssa_->use_total(), size));
+  if (!exprs_->ok()) {
+    exprs_.reset();
+    zone()->Rewind(mark);
+    verdict_ = Budget::MEMORY;
+    return;
+  }
+  ExprBuilder builder(exprs_.get(), scanner_, *code_, *ssa_, block_size_);
+  vector<JavaBlock*> stack(1, ast_);
+  // The printer reads the condition of these off their last statement.
+  vector<const BasicBlock*> conds;
+  while (!stack.empty()) {
+    JavaBlock* const block = stack.back();
+    stack.pop_back();
+    if (block == NULL) continue;
+    switch (block->kind()) {
+    case JavaBlock::BASIC:
+      static_cast<BasicBlock*>(block)->stmts = builder.Build(block->head());
+      break;
+    case JavaBlock::RETURN:
+      static_cast<ReturnBlock*>(block)->stmts = builder.Build(block->head());
+      break;
+    case JavaBlock::THROW:
+      static_cast<ThrowBlock*>(block)->stmts = builder.Build(block->head());
+      break;
+    case JavaBlock::COMPOUND: {
+      const vector<JavaBlock*>& child = static_cast<CompoundBlock*>(block)->child;
+      stack.insert(stack.end(), child.rbegin(), child.rend());
+      break;
+    }
+    case JavaBlock::BRANCH: {
+      BranchBlock* const branch = static_cast<BranchBlock*>(block);
+      stack.push_back(branch->on_false);
+      stack.push_back(branch->on_true);
+      stack.push_back(branch->cond);
+      conds.push_back(branch->cond);
+      break;
+    }
+    case JavaBlock::WHILE_LOOP: {
+      WhileBlock* const loop = static_cast<WhileBlock*>(block);
+      stack.push_back(loop->body);
+      stack.push_back(loop->cond);
+      conds.push_back(loop->cond);
+      break;
+    }
+    case JavaBlock::DO_LOOP: {
+      DoBlock* const loop = static_cast<DoBlock*>(block);
+      stack.push_back(loop->cond);
+      stack.push_back(loop->body);
+      conds.push_back(loop->cond);
+      break;
+    }
+    case JavaBlock::DO_FOREVER:
+      stack.push_back(static_cast<DoForeverBlock*>(block)->body);
+      break;
+    default:
+      break;
+    }
+  }
+  if (exprs_->full()) {
+    failure_ = EXPRESSION_POOL;
+  } else if (builder.failed()) {
+    failure_ = EXPRESSIONS;
+  } else if (!WellFormed(conds)) {
+    failure_ = MALFORMED_STATEMENTS;
+  }
+  if (failure_ != NO_FAILURE) {
+    // The method is printed raw, as when its AST fails.
+    exprs_.reset();
+    zone()->Rewind(mark);
+  }
 }
 
-void MethodDasm::PrintRaw() {
+bool MethodDasm::WellFormed(const vector<const BasicBlock*>& conds) const {
+  for (const BasicBlock* cond : conds) {
+    if (cond->stmts.count == 0
+        || exprs_->node(exprs_->stmt(cond->stmts.first + cond->stmts.count - 1)).kind != ExprNode::COND) {
+      return false;
+    }
+  }
+  for (uint32_t n = 0; n < exprs_->node_count(); ++n) {
+    const uint8_t kind = exprs_->node(n).kind;
+    if (kind < ExprNode::VALUE || kind > ExprNode::STATEMENT) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void MethodDasm::DecodeDebugInfo() {
+  if (code_ != NULL) {
+    debug_info_ = DebugInfo::Decode(scanner_, method_idx_, method_.access_flags, *code_, zone_);
+  }
+}
+
+void MethodDasm::PrintRaw(ostream& out) {
+  out << "  " << scanner_.string_data(scanner_.method_id(method_idx_).name_idx) << endl;
   if (code_ == NULL) {
     return;
   }
+  DecodeDebugInfo();
+  // Cursors into the positions and the locals, and the ends of the locals
+  // started so far.
+  size_t position = 0;
+  size_t local = 0;
+  vector<pair<uint32_t, uint16_t>> ends;
   uint32_t pc = 0;
   while (pc < code_->instr_size()) {
-    PrintInstruction(pc, 0);
-
     const size_t offs = code_->instr_offs() + 2*pc;
-    const uint16_t opcode = scanner_.ReadUShort(offs) & 0xff;
-    const IDefBase* const instr = iTable[opcode];
-    pc += instr->size(&scanner_, offs);
-    if (pc == code_->instr_size() || block_size_[pc]) cout << endl;
+    const uint32_t next = pc + InstructionSize(&scanner_, offs);
+    if (debug_info_ != NULL) {
+      for (auto it = ends.begin(); it != ends.end(); ) {
+        if (it->first <= pc) {
+          out << "\t.end local v" << it->second << endl;
+          it = ends.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      for (; position < debug_info_->position_count()
+             && debug_info_->positions()[position].pc < next; ++position) {
+        out << "\t.line " << debug_info_->positions()[position].line << endl;
+      }
+      for (; local < debug_info_->local_count() && debug_info_->locals()[local].start < next; ++local) {
+        const DebugInfo::Local& l = debug_info_->locals()[local];
+        out << "\t.local v" << l.reg << ", "
+            << (l.name_idx != DexScanner::kNoIndex ? scanner_.string_data(l.name_idx) : "?") << ":"
+            << (l.type_idx != DexScanner::kNoIndex ? scanner_.type_data(l.type_idx) : "?") << endl;
+        ends.push_back({l.end, l.reg});
+      }
+    }
+    PrintInstruction(pc, 0, out);
+    pc = next;
+    if (pc == code_->instr_size() || block_size_[pc]) out << endl;
   }
-
 }
 
-void MethodDasm::ReconstructBlock(uint32_t head, bool ignore_loop) {
+MethodDasm::Failure MethodDasm::ReconstructBlock(uint32_t head, bool ignore_loop) {
   DLOG() << "Head: " << head;
-  CompoundBlock* const prev_compound = current_compound_;
   const uint8_t opcode = code_->opcode(block_last(head));
   const auto& inbound = doms_->inbound()[head];
   const auto& outbound = doms_->outbound()[head];
@@ -157,13 +442,15 @@ void MethodDasm::ReconstructBlock(uint32_t head, bool ignore_loop) {
   vector<int> cyclic;
   std::copy_if(
       inbound.begin(), inbound.end(), std::back_inserter(cyclic),
-      [&doms_, head] (int v) -> bool { return doms_->IsDominated(v, head); });
+      [this, head] (int v) -> bool { return this->doms_->IsDominated(v, head); });
   if (!ignore_loop && !cyclic.empty()) {
     const bool precond = IsBranch(code_->opcode(block_last(head)))
         && (cyclic.size() != 1
             || !IsBranch(code_->opcode(block_last(cyclic[0]))));
     if (precond) {
       // while (cond) { body; } cont;
+      if (outbound.size() != 2) return BRANCH_EDGES;
+      if (!Visit(head)) return UNSTRUCTURED;
       const uint32_t then_block = outbound[0];
       const uint32_t else_block = outbound[1];
       WhileBlock* loop = AttachNode<WhileBlock>(head);
@@ -171,109 +458,198 @@ void MethodDasm::ReconstructBlock(uint32_t head, bool ignore_loop) {
       loop->invert = !doms_->IsDominated(then_block, head)
           || !doms_->IsDominated(cyclic[0], then_block);
       const uint32_t body_block = loop->invert ? else_block : then_block;
-      ASSERT(doms_->IsDominated(body_block, head)
-             && doms_->IsDominated(cyclic[0], body_block))
-          << "THEN: " << then_block << "; ELSE: " << else_block
-          << "; BODY: " << body_block;
-      ReconstructContinuation(then_block + else_block - body_block);
+      if (!doms_->IsDominated(body_block, head) || !doms_->IsDominated(cyclic[0], body_block)) {
+        return LOOP_SHAPE;
+      }
+      const uint32_t exit = then_block + else_block - body_block;
+      const bool owned = doms_->dom()[exit] == static_cast<int>(head) && !IsLoopTarget(exit);
+      const int follow = ScheduleRest(head, owned ? exit : -1, body_block, -1);
+      if (!owned) {
+        const Failure failure = ReconstructEdge(exit, follow, false);
+        if (failure != NO_FAILURE) return failure;
+      }
+      loops_.push_back({loop, head, static_cast<int>(exit), static_cast<int>(head), loop_});
       loop->body = current_compound_ = MakeNode<CompoundBlock>(loop, body_block);
-      ReconstructBlock(body_block);
+      ScheduleBlock(body_block, false, head, loops_.size() - 1);
     } else if (IsBranch(code_->opcode(block_last(cyclic[0])))) {
       // do { body; } while (cond); cont;
+      const uint32_t latch = cyclic[0];
+      const auto& latch_outbound = doms_->outbound()[latch];
+      if (latch_outbound.size() != 2) return BRANCH_EDGES;
+      if (!Visit(latch)) return UNSTRUCTURED;
       DoBlock* loop = AttachNode<DoBlock>(head);
-      loop->cond = MakeNode<BasicBlock>(loop, cyclic[0]);
-      loop->invert = doms_->outbound()[cyclic[0]][0] != head;
-      ReconstructContinuation(
-          doms_->outbound()[cyclic[0]][0] + doms_->outbound()[cyclic[0]][1] - head);
-      if (cyclic[0] != head) {
+      loop->cond = MakeNode<BasicBlock>(loop, latch);
+      loop->invert = latch_outbound[0] != head;
+      const uint32_t exit = latch_outbound[0] + latch_outbound[1] - head;
+      const Failure failure = ReconstructEdge(
+          exit, follow_, doms_->IsDominated(exit, head) && !IsLoopTarget(exit));
+      if (failure != NO_FAILURE) return failure;
+      if (latch != head) {
+        // A continue skips the statements the condition may need, so it
+        // only fits a condition which has none.
+        const int next = block_last(latch) == latch ? latch : -1;
+        loops_.push_back({loop, latch, static_cast<int>(exit), next, loop_});
         loop->body = current_compound_ = MakeNode<CompoundBlock>(loop, head);
-        ReconstructBlock(head, true);
+        ScheduleBlock(head, true, latch, loops_.size() - 1);
       }
     } else {
       // do { body; } while (true);
-      ASSERT(IsGoto(code_->opcode(block_last(cyclic[0]))));
+      if (!IsGoto(code_->opcode(block_last(cyclic[0])))) return LOOP_SHAPE;
       DoForeverBlock* loop = AttachNode<DoForeverBlock>(head);
+      loops_.push_back({loop, head, -1, static_cast<int>(head), loop_});
       loop->body = current_compound_ = MakeNode<CompoundBlock>(loop, head);
-      ReconstructBlock(head, true);
+      ScheduleBlock(head, true, head, loops_.size() - 1);
     }
-  } else if (IsReturn(opcode)) {
-    ASSERT(outbound.empty());
+    return NO_FAILURE;
+  }
+
+  if (!Visit(head)) return UNSTRUCTURED;
+  if (IsReturn(opcode)) {
+    if (!outbound.empty()) return EXIT_EDGES;
     AttachNode<ReturnBlock>(head);
   } else if (IsThrow(opcode)) {
-    ASSERT(outbound.empty());
+    if (!outbound.empty()) return EXIT_EDGES;
     AttachNode<ThrowBlock>(head);
   } else if (IsBranch(opcode)) {
-    ASSERT(outbound.size() == 2);
+    if (outbound.size() != 2) return BRANCH_EDGES;
     BranchBlock* branch = AttachNode<BranchBlock>(head);
     branch->cond = MakeNode<BasicBlock>(branch, head);
 
-    vector<int> dominated;
-    std::copy_if(
-        doms_->dom_tree()[head].begin(), doms_->dom_tree()[head].end(),
-        std::back_inserter(dominated),
-        [this] (int v) -> bool { return !this->doms_->outbound()[v].empty(); });
-    switch (dominated.size()) {
-    case 0: {
-      branch->on_true = current_compound_ = MakeNode<CompoundBlock>(branch, head);
-      ReconstructContinuation(outbound[0]);
-      branch->on_false = current_compound_ = MakeNode<CompoundBlock>(branch, head);
-      ReconstructContinuation(outbound[1]);
-      break;
-    }
-    case 1: {
-      ASSERT(dominated[0] == outbound[0] || dominated[0] == outbound[1]);
-      branch->invert = dominated[0] != outbound[0];
-      branch->on_true = current_compound_ = MakeNode<CompoundBlock>(branch, dominated[0]);
-      ReconstructBlock(dominated[0]);
-      branch->on_false = current_compound_ = MakeNode<CompoundBlock>(branch, head);
-      ReconstructContinuation(outbound[0] + outbound[1] - dominated[0]);
-      break;
+    // Both arms go on to the join, or else to the first block after the
+    // branch.
+    const int follow = ScheduleRest(head, BranchJoin(head), outbound[0], outbound[1]);
+    branch->invert = outbound[0] == follow;
+    const uint32_t then_block = branch->invert ? outbound[1] : outbound[0];
+    const uint32_t else_block = outbound[0] + outbound[1] - then_block;
+    branch->on_true = current_compound_ = MakeNode<CompoundBlock>(branch, then_block);
+    const Failure failure =
+        ReconstructEdge(then_block, follow, doms_->dom()[then_block] == static_cast<int>(head));
+    if (failure != NO_FAILURE) return failure;
+    branch->on_false = current_compound_ = MakeNode<CompoundBlock>(branch, else_block);
+    return ReconstructEdge(else_block, follow, doms_->dom()[else_block] == static_cast<int>(head));
+  } else if (IsGoto(opcode)) {
+    if (outbound.size() != 1) return SEQUENCE_EDGES;
+    if (block_last(head) != head) {
+      AttachNode<BasicBlock>(head);
     }
-    case 2: {
-      const bool has_else_block = std::all_of(
-          doms_->inbound()[dominated[1]].begin(),
-          doms_->inbound()[dominated[1]].end(),
-          [this, &dominated] (int v) -> bool { 
-              return !this->doms_->IsDominated(v, dominated[0]); });
-      if (has_else_block) {
-        branch->on_true = current_compound_ = MakeNode<CompoundBlock>(branch, outbound[0]);
-        ReconstructBlock(outbound[0]);
-        branch->on_false = current_compound_ = MakeNode<CompoundBlock>(branch, outbound[1]);
-        ReconstructBlock(outbound[1]);
-      } else {
-        ReconstructBlock(dominated[1]);
-        branch->invert = dominated[0] != outbound[0];
-        branch->on_true = current_compound_ = MakeNode<CompoundBlock>(branch, dominated[0]);
-        ReconstructBlock(dominated[0]);
-      }
-      break;
+    return ReconstructEdge(outbound[0], follow_, doms_->dom()[outbound[0]] == static_cast<int>(head));
+  } else {
+    if (outbound.size() != 1) return SEQUENCE_EDGES;
+    AttachNode<BasicBlock>(head);
+    return ReconstructEdge(outbound[0], follow_, doms_->dom()[outbound[0]] == static_cast<int>(head));
+  }
+  return NO_FAILURE;
+}
+
+bool MethodDasm::Visit(uint32_t head) {
+  if (visited_[head]) {
+    // A lone goto prints as nothing, so jumps past it may place it too.
+    return IsLoneGoto(head);
+  }
+  visited_[head] = true;
+  ++visit_count_;
+  return true;
+}
+
+bool MethodDasm::IsLoneGoto(uint32_t v) const {
+  return block_last(v) == v && IsGoto(code_->opcode(v)) && doms_->outbound()[v].size() == 1;
+}
+
+uint32_t MethodDasm::SkipGotos(uint32_t v) const {
+  // Bounded, as gotos may loop.
+  for (size_t i = 0; i < doms_->postorder().size() && IsLoneGoto(v); ++i) {
+    v = doms_->outbound()[v][0];
+  }
+  return v;
+}
+
+bool MethodDasm::JumpsTo(uint32_t to, int target) {
+  if (target < 0 || SkipGotos(to) != SkipGotos(target)) {
+    return false;
+  }
+  for (uint32_t v = to; static_cast<int>(v) != target && IsLoneGoto(v) && !visited_[v];
+       v = doms_->outbound()[v][0]) {
+    Visit(v);
+  }
+  return true;
+}
+
+MethodDasm::Failure MethodDasm::ReconstructEdge(uint32_t to, int follow, bool owned) {
+  if (JumpsTo(to, follow)) {
+    return NO_FAILURE;
+  }
+  if (loop_ >= 0) {
+    const Loop& loop = loops_[loop_];
+    if (JumpsTo(to, loop.exit)) {
+      AttachNode<BreakBlock>(to, loop.node);
+      return NO_FAILURE;
     }
-    case 3: {
-      ReconstructBlock(dominated[2]);
-      branch->on_true = current_compound_ = MakeNode<CompoundBlock>(branch, outbound[0]);
-      ReconstructBlock(outbound[0]);
-      branch->on_false = current_compound_ = MakeNode<CompoundBlock>(branch, outbound[1]);
-      ReconstructBlock(outbound[1]);
-      break;
+    if (JumpsTo(to, loop.next)) {
+      AttachNode<ContinueBlock>(to, loop.node);
+      return NO_FAILURE;
     }
-    default:
-      DLOG() << "doms = ";
-      for (uint32_t v : dominated) {DLOG() << v;}
-      UNREACHABLE();
+  }
+  // Merge points and the targets of outer loops cannot be reached from here
+  // without a goto.
+  if (!owned || IsLoopTarget(to)) {
+    return UNSTRUCTURED;
+  }
+  ScheduleBlock(to, false, follow, loop_);
+  return NO_FAILURE;
+}
+
+int MethodDasm::ScheduleRest(uint32_t head, int first, int skip0, int skip1) {
+  vector<uint32_t> rest;
+  for (int v : doms_->dom_tree()[head]) {
+    if (v != first && v != skip0 && v != skip1 && !IsLoopTarget(v)) {
+      rest.push_back(v);
     }
-  } else if (IsGoto(opcode)) {
-    ASSERT(outbound.size() == 1);
-    ReconstructContinuation(outbound[0]);
-  } else {
-    ASSERT(outbound.size() == 1);
-    AttachNode<BasicBlock>(head);
-    ReconstructContinuation(outbound[0]);
   }
+  std::sort(rest.begin(), rest.end(),
+            [this] (uint32_t v, uint32_t w) -> bool { return this->doms_->IsBefore(v, w); });
+  if (first >= 0) {
+    rest.insert(rest.begin(), first);
+  }
+  for (size_t i = 0; i < rest.size(); ++i) {
+    ScheduleBlock(rest[i], false, i + 1 < rest.size() ? rest[i + 1] : follow_, loop_);
+  }
+  return rest.empty() ? follow_ : rest[0];
+}
 
-  current_compound_ = prev_compound;
+bool MethodDasm::IsLoopTarget(uint32_t v) const {
+  for (int i = loop_; i >= 0; i = loops_[i].outer) {
+    if (loops_[i].back == v || loops_[i].exit == static_cast<int>(v)) {
+      return true;
+    }
+  }
+  return false;
 }
 
-void MethodDasm::ReconstructContinuation(uint32_t to) {
+int MethodDasm::BranchJoin(uint32_t head) const {
+  const int join = doms_->post_dom(head);
+  if (join >= 0 && join != doms_->exit() && doms_->dom()[join] == static_cast<int>(head)
+      && !IsLoopTarget(join)) {
+    return join;
+  }
+
+  // The arms do not meet in a block head owns, as both leave the method or
+  // the loop, yet one of them may still fall into the other one, e.g.
+  // "if (c) { if (d) return; } rest;".
+  const auto& outbound = doms_->outbound()[head];
+  for (int i = 0; i < 2; ++i) {
+    const int arm = outbound[i];
+    const int other = outbound[1 - i];
+    if (arm == other || doms_->dom()[arm] != static_cast<int>(head)
+        || doms_->dom()[other] != static_cast<int>(head) || IsLoopTarget(arm)) {
+      continue;
+    }
+    for (int v : doms_->inbound()[arm]) {
+      if (doms_->IsDominated(v, other)) {
+        return arm;
+      }
+    }
+  }
+  return -1;
 }
 
 void MethodDasm::PutEdge(uint32_t to) {
@@ -299,34 +675,34 @@ void MethodDasm::PutEdge(uint32_t to) {
   }
 }
 
-void MethodDasm::PrintBlockBody(uint32_t head, size_t indent) {
+void MethodDasm::PrintBlockBody(uint32_t head, size_t indent, ostream& out) {
   const int marker = -static_cast<int>(head) - 1;
   do {
-    PrintInstruction(head, indent);
+    PrintInstruction(head, indent, out);
     head += code_->opsize(head);
   } while (head < code_->instr_size() 
            && edges_[head].size() == 1
            && edges_[head][0] == marker);
 }
 
-void MethodDasm::PrintInstruction(uint32_t pc, size_t indent) {
+void MethodDasm::PrintInstruction(uint32_t pc, size_t indent, ostream& out) {
   const size_t offs = code_->instr_offs() + 2*pc;
   const uint16_t opcode = scanner_.ReadUShort(offs) & 0xff;
   const IDefBase* const instr = iTable[opcode];
 
-  cout << pc << "\t";
+  out << pc << "\t";
   for (int t = 0; t < indent; ++t) {
-    cout << "  ";
+    out << "  ";
   }
-  cout << instr->dasm(&scanner_, offs) << " [" << instr->size(&scanner_, offs) << "]";
+  out << instr->dasm(&scanner_, offs) << " [" << instr->size(&scanner_, offs) << "]";
   if (block_size_[pc]) {
-    cout << " { ";
+    out << " { ";
     for (int edge : edges_[pc]) {
-      cout << edge << " ";
+      out << edge << " ";
     }
-    cout << "}";
+    out << "}";
   }
-  cout << endl;
+  out << endl;
 }
 
 }  // namespace rev
@@ -5,12 +5,19 @@
 #include <cstdint>
 #include <cstdlib>
 #include <memory>
+#include <ostream>
 
+#include "budget.h"
+#include "debug_info.h"
 #include "dex_asm.h"
 #include "dex_scanner.h"
 #include "dominator_eval.h"
+#include "expr_tree.h"
 #include "java_blocks.h"
+#include "register_flow.h"
+#include "ssa_form.h"
 
+using std::ostream;
 using std::unique_ptr;
 
 namespace egorich {
@@ -19,15 +26,93 @@ namespace rev {
 class MethodDasm {
  public:
   MethodDasm(Zone* zone, const DexScanner& scanner, const EncodedMethod& method, uint32_t* method_idx)
-    : zone_(zone), scanner_(scanner), method_(method), method_idx_(*method_idx + method.method_idx_diff), ast_(NULL) {
+    : zone_(zone), scanner_(scanner), method_(method), method_idx_(*method_idx + method.method_idx_diff),
+      verdict_(Budget::WITHIN), failure_(NO_FAILURE), debug_info_(NULL), ast_(NULL) {
     *method_idx = method_idx_;
   }
+  ~MethodDasm() {
+    DestroyAst();
+  }
+
+  // Why the AST or the statements of a method could not be recovered. The
+  // method is then printed raw, and the methods after it are unaffected.
+  enum Failure {
+    NO_FAILURE,
+    // A loop whose body does not fit a while, do-while or endless loop.
+    LOOP_SHAPE,
+    // A return or throw with successors.
+    EXIT_EDGES,
+    // A conditional branch without two distinct successors.
+    BRANCH_EDGES,
+    // A goto or a plain instruction without a single successor.
+    SEQUENCE_EDGES,
+    // A jump that is neither a fall-through, a break or continue of the
+    // innermost loop, nor an edge to a block its source dominates, or a
+    // block left out of the AST or placed in it twice.
+    UNSTRUCTURED,
+    // An instruction reading a register its register accesses do not list.
+    EXPRESSIONS,
+    // More expressions or statements than the pool sized from the code
+    // holds.
+    EXPRESSION_POOL,
+    // A branch or loop condition whose statements do not end in a
+    // comparison, or an expression of no kind the printer knows.
+    MALFORMED_STATEMENTS,
+  };
+  static const char* FailureName(Failure failure);
+
+  // Limits the analyses below; the clock starts with Run(). Once a phase
+  // finds the method over budget the later ones do nothing, leaving the
+  // method to be printed raw.
+  void set_budget(const Budget& budget) { budget_ = budget; }
+  Budget::Verdict verdict() const { return verdict_; }
+  Failure failure() const { return failure_; }
 
   void Run();
+  // Size and shape of the code, over the blocks reachable from the entry.
+  // Loops are natural loops, closed by a branch back to a block dominating
+  // the branch.
+  struct Metrics {
+    uint32_t code_units;
+    // Switch and array payloads left out.
+    uint32_t instructions;
+    uint32_t blocks;
+    uint32_t edges;
+    // McCabe's, edges - blocks + 2.
+    uint32_t cyclomatic;
+    // Most loops a block is nested in.
+    uint32_t loop_depth;
+    uint32_t tries;
+  };
+  // Must follow Run(); needs none of the analyses below. All zeros for
+  // methods without code, and only the sizes for methods over the budget.
+  void ComputeMetrics(Metrics* metrics) const;
+  // Computes register liveness, def-use chains and the SSA form, must follow
+  // Run().
+  void AnalyzeRegisters();
   void ReconstructAst();
+  // Fills in the statements of the blocks of the AST, must follow
+  // AnalyzeRegisters() and ReconstructAst().
+  void RecoverExpressions();
+  // Decodes the source lines and local variables into the zone, for the
+  // printers which annotate with them. Must follow Run().
+  void DecodeDebugInfo();
+  uint32_t method_idx() const { return method_idx_; }
+  const EncodedMethod& method() const { return method_; }
+  // NULL for methods without code.
+  const CodeItem* code() const { return code_.get(); }
   const JavaBlock* ast() const { return ast_; }
+  // NULL unless the statements were recovered.
+  const ExprPool* exprs() const { return exprs_.get(); }
+  const RegisterFlow* flow() const { return flow_.get(); }
+  // NULL if the zone got exhausted.
+  const SsaForm* ssa() const { return ssa_.get(); }
+  // NULL unless DecodeDebugInfo() found debug info.
+  const DebugInfo* debug_info() const { return debug_info_; }
 
-  void PrintRaw();
+  // Prints the disassembly, annotated with the source lines and locals of
+  // the debug info.
+  void PrintRaw(ostream& out);
 
  private:
   Zone* zone() const { return zone_; }
@@ -35,20 +120,84 @@ class MethodDasm {
     return prev_instr_[head + block_size_[head] - 1];
   }
 
-  void ReconstructBlock(uint32_t head, bool ignore_loop);
-  void ReconstructBlock(uint32_t head) {
-    ReconstructBlock(head, false);
+  // Loop enclosing a region. Jumps to back fall through at the end of the
+  // body, to exit break out of the loop, and to next, the header of a while
+  // or endless loop or the lone condition of a do-while, may continue it;
+  // next is -1 if no jump may. outer indexes loops_, or is -1.
+  struct Loop {
+    JavaBlock* node;
+    uint32_t back;
+    int exit;
+    int next;
+    int outer;
+  };
+  // Region of the AST rooted at head and attached to compound. Control
+  // falling off its end goes to follow, the block reconstructed after it, or
+  // leaves the method if -1; loop indexes loops_, or is -1.
+  struct Region {
+    uint32_t head;
+    bool ignore_loop;
+    CompoundBlock* compound;
+    int follow;
+    int loop;
+  };
+
+  Failure ReconstructBlock(uint32_t head, bool ignore_loop);
+  // Whether the conditions end in a comparison and every expression is of
+  // a known kind, as the printer takes them to.
+  bool WellFormed(const vector<const BasicBlock*>& conds) const;
+  // Runs the destructors of the AST nodes, whose storage the zone owns.
+  void DestroyAst();
+  // Defers reconstruction of head into current_compound_ until the region
+  // being reconstructed is done; regions are processed in depth-first order.
+  void ScheduleBlock(uint32_t head, bool ignore_loop, int follow, int loop) {
+    scheduled_.push_back({head, ignore_loop, current_compound_, follow, loop});
   }
-  void ReconstructContinuation(uint32_t to);
+  // Marks head as placed in the AST, returning false if it already was.
+  bool Visit(uint32_t head);
+  // Whether v holds nothing but a goto, as dx leaves where arms join.
+  bool IsLoneGoto(uint32_t v) const;
+  // Returns the block a jump to v lands in past lone gotos.
+  uint32_t SkipGotos(uint32_t v) const;
+  // Whether a jump to `to` lands where one to target does, placing the lone
+  // gotos it passes on the way; false if target is -1.
+  bool JumpsTo(uint32_t to, int target);
+  // Reconstructs the jump to `to` at the end of current_compound_, which
+  // then goes on to follow: nothing if to is follow, a break or continue of
+  // the innermost loop, or the region at to if owned, that is if its source
+  // dominates to.
+  Failure ReconstructEdge(uint32_t to, int follow, bool owned);
+  // Schedules into current_compound_ the blocks head dominates other than
+  // skip0, skip1 and loop targets: first unless it is -1, then the others in
+  // topological order, each going on to the next and the last to follow_.
+  // Returns where control goes after the node of head.
+  int ScheduleRest(uint32_t head, int first, int skip0, int skip1);
+  // Whether jumps to v break out of or go back in an enclosing loop.
+  bool IsLoopTarget(uint32_t v) const;
+  // Returns the merge point of the branch at head if head owns it, or -1.
+  int BranchJoin(uint32_t head) const;
+
+  // Records the verdict if the budget is exceeded, and returns whether the
+  // analysis may go on.
+  bool CheckTime();
+  bool CheckMemory(size_t bytes);
+  // Records the memory verdict unless the zone has room for the nodes
+  // ReconstructBlock() makes for a block, so that MakeNode() does not fail.
+  bool CheckAstSpace();
 
   void PutEdge(uint32_t to);
-  void PrintBlockBody(uint32_t head, size_t indent);
-  void PrintInstruction(uint32_t pc, size_t indent);
+  void PrintBlockBody(uint32_t head, size_t indent, ostream& out);
+  void PrintInstruction(uint32_t pc, size_t indent, ostream& out);
 
   template <typename T, typename... Args>
   T* MakeNode(JavaBlock* parent, uint32_t head, Args&&... args) {
-    return new(zone()) T(parent, head, args...);
+    T* result = new(zone()) T(parent, head, args...);
+    Track(result);
+    return result;
   }
+  // Compound blocks hold a vector, the only node member needing destruction.
+  void Track(CompoundBlock* compound) { compounds_.push_back(compound); }
+  void Track(JavaBlock* block) {}
 
   template <typename T, typename... Args>
   T* AttachNode(uint32_t head, Args&&... args) {
@@ -61,6 +210,10 @@ class MethodDasm {
   const DexScanner& scanner_;
   const EncodedMethod& method_;
   const uint32_t method_idx_;
+  Budget budget_;
+  Budget::Verdict verdict_;
+  Failure failure_;
+  const DebugInfo* debug_info_;
 
   uint32_t current_pc_;
   uint32_t current_block_;
@@ -69,6 +222,9 @@ class MethodDasm {
   Edges edges_;
   unique_ptr<CodeItem> code_;
   unique_ptr<DominatorEval> doms_;
+  unique_ptr<RegisterFlow> flow_;
+  unique_ptr<SsaForm> ssa_;
+  unique_ptr<ExprPool> exprs_;
   size_t indent_;
   // previous instr offset for offsets in range [1, code_->instr_size()].
   // To obtain the prev instr for offset K, read prev_instr_[K - 1]
@@ -82,8 +238,20 @@ class MethodDasm {
   vector<int> times_r0_;
   int time_r0_;
 
+  // Explicit stack of regions pending reconstruction, and the regions
+  // scheduled by the ReconstructBlock() call in progress.
+  vector<Region> regions_;
+  vector<Region> scheduled_;
+  vector<Loop> loops_;
+  // Blocks placed in the AST so far.
+  vector<bool> visited_;
+  size_t visit_count_;
   CompoundBlock* current_compound_;
+  // follow and loop of the region being reconstructed.
+  int follow_;
+  int loop_;
   JavaBlock* ast_;
+  vector<CompoundBlock*> compounds_;
 
  private:
   MethodDasm(const MethodDasm&) = delete;
@@ -0,0 +1,94 @@
+#include "opcode_histogram.h"
+
+#include <memory>
+#include <vector>
+
+#include "dex_asm.h"
+#include "parallel.h"
+
+using std::unique_ptr;
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+constexpr size_t OpcodeHistogram::kLanes;
+
+template <typename Reader>
+void OpcodeHistogram::CountClass(const Reader& reader, const ClassDefItem& class_def, Lanes* lanes) const {
+  for (int k = 0; k < 2; ++k) {
+    for (const EncodedMethod& method : k ? class_def.virtual_methods() : class_def.direct_methods()) {
+      if (!method.code_offs) continue;
+      const CodeItem code(&scanner_, method.code_offs);
+      size_t offs = code.instr_offs();
+      const size_t end = offs + 2*code.instr_size();
+      size_t lane = 0;
+      while (offs < end) {
+        const uint16_t unit = reader.ReadUShort(offs);
+        const uint8_t opcode = unit & 0xFF;
+        if (opcode) {
+          ++lanes->counts[lane][opcode];
+          lane = (lane + 1) % kLanes;
+          offs += 2*kInstructionUnits[opcode];
+          continue;
+        }
+        // A payload has its kind in the upper byte of the nop.
+        if (!(unit & 0xFF00)) {
+          ++lanes->counts[lane][0];
+          lane = (lane + 1) % kLanes;
+        }
+        offs += 2*InstructionSize(&reader, offs);
+      }
+      ++lanes->methods;
+    }
+  }
+}
+
+void OpcodeHistogram::Merge(const Lanes& lanes) {
+  for (size_t l = 0; l < kLanes; ++l) {
+    for (size_t opcode = 0; opcode < 256; ++opcode) {
+      counts_[opcode] += lanes.counts[l][opcode];
+    }
+  }
+  methods_ += lanes.methods;
+}
+
+void OpcodeHistogram::AddClass(const ClassDefItem& class_def) {
+  unique_ptr<Lanes> lanes(new Lanes());
+  if (scanner_.IsMachineEndian()) {
+    CountClass(DexReader<NativeOrder>(scanner_), class_def, lanes.get());
+  } else {
+    CountClass(DexReader<SwappedOrder>(scanner_), class_def, lanes.get());
+  }
+  Merge(*lanes);
+}
+
+void OpcodeHistogram::Run(size_t threads) {
+  const vector<ClassDefItem>& class_defs = scanner_.class_defs();
+  threads = std::max<size_t>(1, std::min(threads, class_defs.size()));
+  vector<unique_ptr<Lanes>> workers;
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back(new Lanes());
+  }
+  ParallelFor(class_defs.size(), threads, [&] (size_t c, size_t worker) {
+    if (scanner_.IsMachineEndian()) {
+      CountClass(DexReader<NativeOrder>(scanner_), class_defs[c], workers[worker].get());
+    } else {
+      CountClass(DexReader<SwappedOrder>(scanner_), class_defs[c], workers[worker].get());
+    }
+  });
+  for (const auto& lanes : workers) {
+    Merge(*lanes);
+  }
+}
+
+uint64_t OpcodeHistogram::total() const {
+  uint64_t total = 0;
+  for (uint64_t count : counts_) {
+    total += count;
+  }
+  return total;
+}
+
+}  // namespace rev
+}  // namespace egorich
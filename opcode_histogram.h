@@ -0,0 +1,59 @@
+#ifndef REV_OPCODE_HISTOGRAM_H__
+#define REV_OPCODE_HISTOGRAM_H__
+
+#include <cstddef>
+#include <cstdint>
+
+#include "dex_scanner.h"
+
+namespace egorich {
+namespace rev {
+
+// Number of instructions of each opcode in the code of a dex or of some of
+// its classes, for telling which instruction formats matter most and how a
+// dex was produced. Payloads of switches and arrays are not instructions.
+//
+// Instructions are walked by their opcode byte and their size alone, and
+// counted into four tables in turn, so consecutive instructions of the same
+// opcode do not wait on each other's increment; the tables are summed once
+// counting is done.
+class OpcodeHistogram {
+ public:
+  explicit OpcodeHistogram(const DexScanner& scanner) : scanner_(scanner), counts_(), methods_(0) {
+  }
+
+  // Counts the code of every class on up to `threads` threads, each into
+  // a histogram of its own, merged when they are through.
+  void Run(size_t threads);
+  // Counts the code of the class.
+  void AddClass(const ClassDefItem& class_def);
+
+  uint64_t count(uint8_t opcode) const { return counts_[opcode]; }
+  uint64_t total() const;
+  // Methods with code counted.
+  size_t methods() const { return methods_; }
+
+ private:
+  static constexpr size_t kLanes = 4;
+
+  struct Lanes {
+    uint64_t counts[kLanes][256];
+    size_t methods;
+  };
+
+  // Reader is the DexReader of the byte order of the file.
+  template <typename Reader>
+  void CountClass(const Reader& reader, const ClassDefItem& class_def, Lanes* lanes) const;
+  void Merge(const Lanes& lanes);
+
+  const DexScanner& scanner_;
+  uint64_t counts_[256];
+  size_t methods_;
+
+  OpcodeHistogram(const OpcodeHistogram&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_OPCODE_HISTOGRAM_H__
@@ -0,0 +1,62 @@
+#include "output_buffer.h"
+
+#include <algorithm>
+
+namespace egorich {
+namespace rev {
+
+constexpr size_t OutputBuffer::kChunkSize;
+
+void OutputBuffer::Append(const char* data, size_t size) {
+  size_ += size;
+  while (size) {
+    if (tail_ == kChunkSize) {
+      chunks_.emplace_back(new char[kChunkSize]);
+      tail_ = 0;
+    }
+    const size_t n = std::min(size, kChunkSize - tail_);
+    std::memcpy(chunks_.back().get() + tail_, data, n);
+    tail_ += n;
+    data += n;
+    size -= n;
+  }
+}
+
+void OutputBuffer::AppendSigned(int64_t value) {
+  if (value < 0) {
+    Append("-", 1);
+    AppendUnsigned(-static_cast<uint64_t>(value));
+  } else {
+    AppendUnsigned(value);
+  }
+}
+
+void OutputBuffer::AppendUnsigned(uint64_t value) {
+  char digits[20];
+  char* const end = digits + sizeof(digits);
+  char* p = end;
+  do {
+    *--p = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  Append(p, end - p);
+}
+
+void OutputBuffer::WriteTo(ostream& out) const {
+  for (size_t c = 0; c < chunks_.size(); ++c) {
+    out.write(chunks_[c].get(), c + 1 < chunks_.size() ? kChunkSize : tail_);
+  }
+}
+
+void OutputBuffer::CopyTo(size_t offset, string* out) const {
+  out->reserve(out->size() + size_ - offset);
+  while (offset < size_) {
+    const size_t c = offset / kChunkSize;
+    const size_t end = c + 1 < chunks_.size() ? kChunkSize : tail_;
+    out->append(chunks_[c].get() + offset % kChunkSize, end - offset % kChunkSize);
+    offset += end - offset % kChunkSize;
+  }
+}
+
+}  // namespace rev
+}  // namespace egorich
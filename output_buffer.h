@@ -0,0 +1,76 @@
+#ifndef REV_OUTPUT_BUFFER_H__
+#define REV_OUTPUT_BUFFER_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+using std::ostream;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Append-only text buffer made of fixed-size chunks. Appending never moves
+// the text written so far, so a buffer grows at a constant cost per byte
+// however large the output gets.
+class OutputBuffer {
+ public:
+  static constexpr size_t kChunkSize = 65536;
+
+  OutputBuffer() : size_(0), tail_(kChunkSize) {
+  }
+
+  size_t size() const { return size_; }
+
+  void Append(const char* data, size_t size);
+
+  OutputBuffer& operator<<(const char* text) {
+    Append(text, std::strlen(text));
+    return *this;
+  }
+  OutputBuffer& operator<<(const string& text) {
+    Append(text.data(), text.size());
+    return *this;
+  }
+  OutputBuffer& operator<<(char c) {
+    Append(&c, 1);
+    return *this;
+  }
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value, OutputBuffer&>::type operator<<(T value) {
+    if (std::is_signed<T>::value) {
+      AppendSigned(value);
+    } else {
+      AppendUnsigned(value);
+    }
+    return *this;
+  }
+
+  void WriteTo(ostream& out) const;
+  // Appends the text from the offset on.
+  void CopyTo(size_t offset, string* out) const;
+
+ private:
+  void AppendSigned(int64_t value);
+  void AppendUnsigned(uint64_t value);
+
+  vector<unique_ptr<char[]>> chunks_;
+  size_t size_;
+  // Bytes used in the last chunk.
+  size_t tail_;
+
+  OutputBuffer(const OutputBuffer&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_OUTPUT_BUFFER_H__
@@ -0,0 +1,135 @@
+#ifndef REV_PARALLEL_H__
+#define REV_PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Runs f(task, worker) for every task in [0, tasks) on up to `threads`
+// threads, the calling one included. Tasks are handed out one by one, so
+// uneven tasks balance out; callers keep per-task results in slots indexed by
+// task and combine them in order once ParallelFor() returns.
+template <typename F>
+void ParallelFor(size_t tasks, size_t threads, F f) {
+  threads = std::max<size_t>(1, std::min(threads, tasks));
+  std::atomic<size_t> next(0);
+  auto worker = [&next, tasks, &f] (size_t id) {
+    for (size_t task = next++; task < tasks; task = next++) {
+      f(task, id);
+    }
+  };
+  vector<std::thread> pool;
+  for (size_t id = 1; id < threads; ++id) {
+    pool.emplace_back(worker, id);
+  }
+  worker(0);
+  for (std::thread& thread : pool) {
+    thread.join();
+  }
+}
+
+// Bits which threads set concurrently, e.g. the visited set of a graph
+// walk. Setting a bit is a single fetch_or.
+class AtomicBitset {
+ public:
+  explicit AtomicBitset(size_t size) : words_((size + 63) / 64), bits_(new std::atomic<uint64_t>[words_]) {
+    for (size_t w = 0; w < words_; ++w) {
+      bits_[w].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // Sets bit i; returns true if this call set it, false if it was set.
+  bool Set(size_t i) {
+    const uint64_t mask = 1ULL << (i % 64);
+    // Most bits are seen set many times over and set once, so a load spares
+    // the cache line a write.
+    if (bits_[i / 64].load(std::memory_order_relaxed) & mask) return false;
+    return !(bits_[i / 64].fetch_or(mask, std::memory_order_relaxed) & mask);
+  }
+  bool Test(size_t i) const {
+    return bits_[i / 64].load(std::memory_order_relaxed) & (1ULL << (i % 64));
+  }
+
+ private:
+  size_t words_;
+  std::unique_ptr<std::atomic<uint64_t>[]> bits_;
+
+  AtomicBitset(const AtomicBitset&) = delete;
+};
+
+// Worklist of the items of [0, capacity) shared by any number of threads,
+// for walks which push every item at most once, as those guarded by an
+// AtomicBitset do. Then the slots never wrap around: a push claims the slot
+// at the tail and a pop the slot at the head, each by an atomic increment,
+// and no lock is taken. The list drains once it is empty and every item
+// popped is Done(), since working on an item pushes the items it leads to
+// first.
+class WorkList {
+ public:
+  explicit WorkList(size_t capacity)
+      : slots_(new std::atomic<uint32_t>[capacity]), head_(0), tail_(0), pending_(0) {
+    for (size_t i = 0; i < capacity; ++i) {
+      slots_[i].store(kEmpty, std::memory_order_relaxed);
+    }
+  }
+
+  void Push(uint32_t item) {
+    pending_.fetch_add(1);
+    slots_[tail_.fetch_add(1)].store(item, std::memory_order_release);
+  }
+
+  // Pops an item, waiting for other threads to push more while the list is
+  // empty but not drained. Returns false once it is drained.
+  bool Pop(uint32_t* item) {
+    for (;;) {
+      size_t head = head_.load();
+      if (head < tail_.load()) {
+        if (!head_.compare_exchange_weak(head, head + 1)) continue;
+        // The slot is claimed before the item lands in it.
+        while ((*item = slots_[head].load(std::memory_order_acquire)) == kEmpty) {
+          std::this_thread::yield();
+        }
+        return true;
+      }
+      if (pending_.load() == 0) return false;
+      std::this_thread::yield();
+    }
+  }
+
+  // Marks an item popped as worked on.
+  void Done() { pending_.fetch_sub(1); }
+
+  // Items pushed so far.
+  size_t size() const { return tail_.load(); }
+
+ private:
+  static constexpr uint32_t kEmpty = 0xFFFFFFFFU;
+
+  std::unique_ptr<std::atomic<uint32_t>[]> slots_;
+  std::atomic<size_t> head_;
+  std::atomic<size_t> tail_;
+  // Items pushed and not yet Done().
+  std::atomic<size_t> pending_;
+
+  WorkList(const WorkList&) = delete;
+};
+
+// Number of threads to use when none is requested.
+inline size_t DefaultThreads() {
+  const unsigned hw = std::thread::hardware_concurrency();
+  return hw ? hw : 1;
+}
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_PARALLEL_H__
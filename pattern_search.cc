@@ -0,0 +1,312 @@
+#include "pattern_search.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "parallel.h"
+
+namespace egorich {
+namespace rev {
+namespace {
+
+// Nops with a payload of a switch or an array in their upper byte.
+template <typename Reader>
+bool IsPayload(const Reader& reader, size_t offs) {
+  return reader.ReadUShort(offs) & 0xFF00 && !(reader.ReadUShort(offs) & 0xFF);
+}
+
+string Trim(const string& text) {
+  size_t begin = 0;
+  size_t end = text.size();
+  while (begin < end && isspace(text[begin])) ++begin;
+  while (end > begin && isspace(text[end - 1])) --end;
+  return text.substr(begin, end - begin);
+}
+
+// Splits at the commas outside of double quotes.
+bool SplitSteps(const string& text, vector<string>* steps) {
+  string step;
+  bool quoted = false;
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (quoted && text[i] == '\\' && i + 1 < text.size()) {
+      step += text[i++];
+    } else if (text[i] == '"') {
+      quoted = !quoted;
+    } else if (text[i] == ',' && !quoted) {
+      steps->push_back(Trim(step));
+      step.clear();
+      continue;
+    }
+    step += text[i];
+  }
+  steps->push_back(Trim(step));
+  return !quoted;
+}
+
+}  // namespace
+
+constexpr uint32_t CodePattern::kUnbounded;
+constexpr size_t CodePattern::kMaxStates;
+
+bool CodePattern::Compile(const string& text) {
+  steps_.clear();
+  skip_ = 0;
+  loop_ = 0;
+  impossible_ = false;
+  vector<string> texts;
+  if (!SplitSteps(text, &texts)) {
+    error_ = "Unterminated string in " + text;
+    return false;
+  }
+  size_t states = 0;
+  uint32_t gap = 0;
+  bool after_gap = false;
+  for (const string& step_text : texts) {
+    if (step_text.compare(0, 3, "...") == 0) {
+      const string bound = step_text.substr(3);
+      if (steps_.empty() || after_gap
+          || (!bound.empty() && bound.find_first_not_of("0123456789") != string::npos)) {
+        error_ = "Misplaced gap " + step_text + " in " + text;
+        return false;
+      }
+      gap = bound.empty() ? kUnbounded : std::min<unsigned long>(strtoul(bound.c_str(), NULL, 10), kMaxStates);
+      after_gap = true;
+      continue;
+    }
+    Step step;
+    if (!ParseStep(step_text, &step)) {
+      return false;
+    }
+    // The first step waits in a single state, which every instruction
+    // enters anew, and the others in one state per instruction skipped.
+    step.gap = gap;
+    const size_t count = steps_.empty() || gap == kUnbounded ? 1 : gap + 1;
+    if (states + count > kMaxStates) {
+      error_ = "Gaps too long in " + text;
+      return false;
+    }
+    step.first_state = 1ULL << states;
+    step.states = (count == kMaxStates ? ~0ULL : (1ULL << count) - 1) << states;
+    if (!steps_.empty() && gap == kUnbounded) {
+      loop_ |= step.states;
+    } else {
+      skip_ |= step.states & ~(1ULL << (states + count - 1));
+    }
+    states += count;
+    steps_.push_back(step);
+    gap = 0;
+    after_gap = false;
+  }
+  if (steps_.empty() || after_gap) {
+    error_ = "Misplaced gap in " + text;
+    return false;
+  }
+  return true;
+}
+
+bool CodePattern::ParseStep(const string& text, Step* step) {
+  const size_t space = text.find_first_of(" \t");
+  const string name = text.substr(0, space);
+  const bool prefix = !name.empty() && name.back() == '*';
+  step->opcodes.Clear();
+  for (int opcode = 0; opcode < 256; ++opcode) {
+    // The table names nop "<nop>", as it stands for the payloads too.
+    const char* const opcode_name = opcode ? iTable[opcode]->name() : "nop";
+    if (strcmp(opcode_name, "<unknown>") == 0) continue;
+    if (prefix ? strncmp(opcode_name, name.c_str(), name.size() - 1) == 0 : name == opcode_name) {
+      step->opcodes.Add(opcode);
+    }
+  }
+  if (step->opcodes.Empty()) {
+    error_ = "No opcode " + name;
+    return false;
+  }
+  step->kind = REF_NONE;
+  step->begin = 0;
+  step->end = 0;
+  return space == string::npos || ParseOperand(Trim(text.substr(space)), step);
+}
+
+bool CodePattern::ParseOperand(const string& text, Step* step) {
+  ReferenceKind kind = REF_NONE;
+  for (int opcode = 0; opcode < 256; ++opcode) {
+    if (!step->opcodes.Has(opcode)) continue;
+    if (kind != REF_NONE && OpcodeReference(opcode) != kind) {
+      kind = REF_NONE;
+      break;
+    }
+    kind = OpcodeReference(opcode);
+    if (kind == REF_NONE) break;
+  }
+  step->kind = kind;
+  uint32_t idx = DexScanner::kNoIndex;
+  switch (kind) {
+  case REF_NONE:
+    error_ = "Opcodes of the step refer to no one kind of item: " + text;
+    return false;
+  case REF_STRING: {
+    if (text.size() < 2 || text.front() != '"' || text.back() != '"') {
+      error_ = "Not a quoted string: " + text;
+      return false;
+    }
+    string s;
+    for (size_t i = 1; i + 1 < text.size(); ++i) {
+      if (text[i] == '\\') ++i;
+      s += text[i];
+    }
+    idx = scanner_.FindString(s);
+    break;
+  }
+  case REF_TYPE:
+    idx = scanner_.FindType(text);
+    break;
+  case REF_FIELD: {
+    const size_t arrow = text.find("->");
+    if (arrow == string::npos) {
+      error_ = "Not a field: " + text;
+      return false;
+    }
+    const size_t colon = text.find(':', arrow);
+    const uint32_t class_idx = scanner_.FindType(text.substr(0, arrow));
+    const uint32_t name_idx =
+        scanner_.FindString(text.substr(arrow + 2, colon == string::npos ? string::npos : colon - arrow - 2));
+    const uint32_t type_idx = colon == string::npos ? DexScanner::kNoIndex : scanner_.FindType(text.substr(colon + 1));
+    if (class_idx == DexScanner::kNoIndex || name_idx == DexScanner::kNoIndex
+        || (colon != string::npos && type_idx == DexScanner::kNoIndex)) {
+      break;
+    }
+    // field_ids are sorted by class, name and type, so the fields of any
+    // type are adjacent.
+    const vector<FieldIdItem>& fields = scanner_.field_ids();
+    step->begin = fields.size();
+    for (uint32_t f = 0; f < fields.size(); ++f) {
+      if (fields[f].class_idx == class_idx && fields[f].name_idx == name_idx
+          && (colon == string::npos || fields[f].type_idx == type_idx)) {
+        step->begin = std::min(step->begin, f);
+        step->end = f + 1;
+      }
+    }
+    impossible_ |= step->begin >= step->end;
+    return true;
+  }
+  case REF_METHOD: {
+    if (text.find("->") == string::npos) {
+      error_ = "Not a method: " + text;
+      return false;
+    }
+    const pair<uint32_t, uint32_t> range = scanner_.FindMethods(text);
+    step->begin = range.first;
+    step->end = range.second;
+    impossible_ |= step->begin >= step->end;
+    return true;
+  }
+  }
+  if (idx == DexScanner::kNoIndex) {
+    impossible_ = true;
+  } else {
+    step->begin = idx;
+    step->end = idx + 1;
+  }
+  return true;
+}
+
+bool CodePattern::MayMatch(const OpcodeSet& opcodes) const {
+  if (impossible_) return false;
+  for (const Step& step : steps_) {
+    if (!step.opcodes.Intersects(opcodes)) return false;
+  }
+  return true;
+}
+
+template <typename Reader>
+void CodePattern::Match(const Reader& reader, const CodeItem& code, vector<uint32_t>* ends) const {
+  const size_t begin = code.instr_offs();
+  const size_t end = begin + 2*code.instr_size();
+  const Step* const last = &steps_.back();
+  uint64_t active = 0;
+  for (size_t offs = begin; offs < end; offs += 2*InstructionSize(&reader, offs)) {
+    if (IsPayload(reader, offs)) continue;
+    const uint8_t opcode = reader.ReadUShort(offs) & 0xFF;
+    active |= 1;
+    uint64_t next = ((active & skip_) << 1) | (active & loop_);
+    bool matched = false;
+    bool read = false;
+    uint32_t index = 0;
+    for (const Step* step = &steps_[0]; step <= last; ++step) {
+      if (!(active & step->states) || !step->opcodes.Has(opcode)) continue;
+      if (step->kind != REF_NONE) {
+        if (!read) {
+          ReadReference(&reader, offs, &index);
+          read = true;
+        }
+        if (index < step->begin || index >= step->end) continue;
+      }
+      if (step == last) {
+        matched = true;
+      } else {
+        next |= step[1].first_state;
+      }
+    }
+    if (matched) {
+      ends->push_back((offs - begin) / 2);
+    }
+    active = next;
+  }
+}
+
+template <typename Reader>
+void PatternSearch::SearchClass(const Reader& reader, const ClassDefItem& class_def,
+                                vector<Match>* matches) const {
+  OpcodeSet opcodes;
+  for (int k = 0; k < 2; ++k) {
+    uint32_t method_idx = 0;
+    for (const EncodedMethod& method : k ? class_def.virtual_methods() : class_def.direct_methods()) {
+      method_idx += method.method_idx_diff;
+      if (!method.code_offs) continue;
+      const CodeItem code(&scanner_, method.code_offs);
+      size_t offs = code.instr_offs();
+      const size_t end = offs + 2*code.instr_size();
+      opcodes.Clear();
+      for (; offs < end; offs += 2*InstructionSize(&reader, offs)) {
+        if (!IsPayload(reader, offs)) {
+          opcodes.Add(reader.ReadUShort(offs) & 0xFF);
+        }
+      }
+      for (size_t p = 0; p < patterns_.size(); ++p) {
+        if (!patterns_[p]->MayMatch(opcodes)) continue;
+        vector<uint32_t> ends;
+        patterns_[p]->Match(reader, code, &ends);
+        if (!ends.empty()) {
+          matches->push_back(Match{p, method_idx, std::move(ends)});
+        }
+      }
+    }
+  }
+}
+
+template void CodePattern::Match(const DexScanner&, const CodeItem&, vector<uint32_t>*) const;
+template void CodePattern::Match(const DexReader<NativeOrder>&, const CodeItem&, vector<uint32_t>*) const;
+template void CodePattern::Match(const DexReader<SwappedOrder>&, const CodeItem&, vector<uint32_t>*) const;
+
+void PatternSearch::Run(size_t threads) {
+  const vector<ClassDefItem>& class_defs = scanner_.class_defs();
+  vector<vector<Match>> slots(class_defs.size());
+  ParallelFor(class_defs.size(), threads, [&] (size_t c, size_t worker) {
+    if (scanner_.IsMachineEndian()) {
+      SearchClass(DexReader<NativeOrder>(scanner_), class_defs[c], &slots[c]);
+    } else {
+      SearchClass(DexReader<SwappedOrder>(scanner_), class_defs[c], &slots[c]);
+    }
+  });
+  matches_.clear();
+  for (vector<Match>& slot : slots) {
+    for (Match& match : slot) {
+      matches_.push_back(std::move(match));
+    }
+  }
+}
+
+}  // namespace rev
+}  // namespace egorich
@@ -0,0 +1,135 @@
+#ifndef REV_PATTERN_SEARCH_H__
+#define REV_PATTERN_SEARCH_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dex_asm.h"
+#include "dex_scanner.h"
+
+using std::string;
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Set of opcodes, one bit each.
+struct OpcodeSet {
+  uint64_t bits[4];
+
+  void Clear() { bits[0] = bits[1] = bits[2] = bits[3] = 0; }
+  bool Empty() const { return !(bits[0] | bits[1] | bits[2] | bits[3]); }
+  void Add(uint8_t opcode) { bits[opcode >> 6] |= 1ULL << (opcode & 63); }
+  bool Has(uint8_t opcode) const { return bits[opcode >> 6] >> (opcode & 63) & 1; }
+  bool Intersects(const OpcodeSet& other) const {
+    return (bits[0] & other.bits[0]) | (bits[1] & other.bits[1])
+        | (bits[2] & other.bits[2]) | (bits[3] & other.bits[3]);
+  }
+};
+
+// A sequence of instructions to look for in the code of methods, such as
+//   const-string "AES", ...3, invoke-static Ljavax/crypto/Cipher;->getInstance
+// Steps are separated by commas. An instruction step is an opcode name,
+// a prefix of names ending in '*' such as invoke-*, or '*' for any
+// instruction, and then optionally the string, type, field or method the
+// instructions refer to: a string in double quotes, with \" and \\ escaped,
+// or a type, field or method in the notation of the usage. Consecutive
+// instruction steps match consecutive instructions; a "...N" step between
+// them lets up to N other instructions come in between, and a "..." step
+// any number of them. Payloads of switches and arrays are not instructions.
+//
+// The pattern is compiled into a nondeterministic automaton over the
+// instruction stream whose states fit a 64-bit word, one bit per step and
+// per instruction skipped within a gap, and which is run on all the states
+// at once.
+class CodePattern {
+ public:
+  explicit CodePattern(const DexScanner& scanner) : scanner_(scanner) {}
+
+  // Returns false and sets error() when the text is no pattern.
+  bool Compile(const string& text);
+  const string& error() const { return error_; }
+
+  // Whether code with the opcodes may match at all: false when the code
+  // misses every opcode of a step, or the dex has no item a step refers to.
+  bool MayMatch(const OpcodeSet& opcodes) const;
+
+  // Appends the address of the last instruction of each match in the code,
+  // in code units. Reader is either the scanner itself or a DexReader.
+  template <typename Reader>
+  void Match(const Reader& reader, const CodeItem& code, vector<uint32_t>* ends) const;
+
+ private:
+  // Within a gap with no bound, the one state loops.
+  static constexpr uint32_t kUnbounded = 0xFFFFFFFFU;
+  static constexpr size_t kMaxStates = 64;
+
+  struct Step {
+    OpcodeSet opcodes;
+    ReferenceKind kind;
+    // Items referred to, contiguous in their section; all of them when
+    // kind is REF_NONE.
+    uint32_t begin;
+    uint32_t end;
+    // Other instructions allowed before this step, after the previous one.
+    uint32_t gap;
+    // Bit of the first state waiting for the step, and of all of them.
+    uint64_t first_state;
+    uint64_t states;
+  };
+
+  bool ParseStep(const string& text, Step* step);
+  bool ParseOperand(const string& text, Step* step);
+
+  const DexScanner& scanner_;
+  vector<Step> steps_;
+  // States moving on to the next when any instruction is skipped, and those
+  // staying.
+  uint64_t skip_;
+  uint64_t loop_;
+  // Some step refers to an item the dex does not have.
+  bool impossible_;
+  string error_;
+
+  CodePattern(const CodePattern&) = delete;
+};
+
+// Methods of a dex matching any of a set of patterns, searched on worker
+// threads, a class each. The opcodes of a method are collected first and
+// the automaton of a pattern only runs on the code MayMatch() lets through.
+class PatternSearch {
+ public:
+  struct Match {
+    size_t pattern;
+    uint32_t method_idx;
+    vector<uint32_t> ends;
+  };
+
+  // The patterns must be compiled.
+  PatternSearch(const DexScanner& scanner, const vector<const CodePattern*>& patterns)
+      : scanner_(scanner), patterns_(patterns) {
+  }
+
+  void Run(size_t threads);
+
+  // In the order of class_defs and of the methods of each, direct methods
+  // first, and of patterns for a method.
+  const vector<Match>& matches() const { return matches_; }
+
+ private:
+  template <typename Reader>
+  void SearchClass(const Reader& reader, const ClassDefItem& class_def, vector<Match>* matches) const;
+
+  const DexScanner& scanner_;
+  const vector<const CodePattern*> patterns_;
+  vector<Match> matches_;
+
+  PatternSearch(const PatternSearch&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_PATTERN_SEARCH_H__
@@ -0,0 +1,225 @@
+#include "reachability.h"
+
+#include <cstring>
+
+#include "annotations.h"
+#include "dex_asm.h"
+
+namespace egorich {
+namespace rev {
+namespace {
+
+// Methods of java.lang.Object a class may override, which code outside the
+// dex calls on any object.
+const char* const kObjectMethods[] = {"clone", "equals", "finalize", "hashCode", "toString"};
+
+bool IsObjectMethod(const char* name) {
+  for (const char* object_method : kObjectMethods) {
+    if (strcmp(name, object_method) == 0) return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+constexpr uint32_t Reachability::kUndefined;
+
+Reachability::Reachability(const DexScanner& scanner, const ClassHierarchy& hierarchy)
+    : scanner_(scanner), hierarchy_(hierarchy), resolver_(scanner, hierarchy),
+      code_(scanner.method_ids().size(), kUndefined), methods_(scanner.method_ids().size()),
+      classes_(scanner.class_defs().size()), work_(scanner.method_ids().size()) {
+  const vector<ClassDefItem>& class_defs = scanner_.class_defs();
+  const uint32_t object = scanner_.FindType("Ljava/lang/Object;");
+  kept_offs_.reserve(class_defs.size() + 1);
+  for (const ClassDefItem& class_def : class_defs) {
+    kept_offs_.push_back(kept_.size());
+    // A type defined twice keeps its first class_def, as in the hierarchy.
+    const uint32_t t = class_def.type_idx();
+    const bool first = hierarchy_.class_def(t) == kept_offs_.size() - 1;
+    kept_.push_back(kUndefined);
+    uint32_t method_idx = 0;
+    for (const EncodedMethod& method : class_def.direct_methods()) {
+      method_idx += method.method_idx_diff;
+      if (!first) continue;
+      code_[method_idx] = method.code_offs;
+      if (strcmp(scanner_.string_data(scanner_.method_id(method_idx).name_idx), "<clinit>") == 0) {
+        kept_.back() = method_idx;
+      }
+    }
+    if (!first) continue;
+
+    uint32_t top = t;
+    while (hierarchy_.superclass(top) != DexScanner::kNoIndex) {
+      top = hierarchy_.superclass(top);
+    }
+    bool external = hierarchy_.class_def(top) == DexScanner::kNoIndex && top != object;
+    for (const uint32_t* it = hierarchy_.interfaces_begin(t); it != hierarchy_.interfaces_end(t); ++it) {
+      external = external || hierarchy_.class_def(*it) == DexScanner::kNoIndex;
+    }
+    method_idx = 0;
+    for (const EncodedMethod& method : class_def.virtual_methods()) {
+      method_idx += method.method_idx_diff;
+      code_[method_idx] = method.code_offs;
+      if (external || IsObjectMethod(scanner_.string_data(scanner_.method_id(method_idx).name_idx))) {
+        kept_.push_back(method_idx);
+      }
+    }
+  }
+  kept_offs_.push_back(kept_.size());
+}
+
+void Reachability::ReachMethod(uint32_t method_idx) {
+  if (code_[method_idx] != kUndefined && methods_.Set(method_idx)) {
+    work_.Push(method_idx);
+  }
+}
+
+void Reachability::ReachClass(uint32_t type_idx) {
+  // Superclasses up to the first one reached already, which has reached the
+  // rest.
+  for (uint32_t t = type_idx; t != DexScanner::kNoIndex; t = hierarchy_.superclass(t)) {
+    const uint32_t class_def = hierarchy_.class_def(t);
+    if (class_def == DexScanner::kNoIndex || !classes_.Set(class_def)) return;
+    for (uint32_t k = kept_offs_[class_def]; k < kept_offs_[class_def + 1]; ++k) {
+      if (kept_[k] != kUndefined) ReachMethod(kept_[k]);
+    }
+    // Interfaces extend none but java.lang.Object, so their closure is all
+    // there is to reach for them.
+    for (const uint32_t* it = hierarchy_.interfaces_begin(t); it != hierarchy_.interfaces_end(t); ++it) {
+      const uint32_t iface = hierarchy_.class_def(*it);
+      if (iface == DexScanner::kNoIndex || !classes_.Set(iface)) continue;
+      for (uint32_t k = kept_offs_[iface]; k < kept_offs_[iface + 1]; ++k) {
+        if (kept_[k] != kUndefined) ReachMethod(kept_[k]);
+      }
+    }
+  }
+}
+
+void Reachability::ReachDirect(uint32_t method_idx) {
+  if (code_[method_idx] != kUndefined) {
+    ReachMethod(method_idx);
+    return;
+  }
+  // Static methods are called through subclasses as well, and invoke-super
+  // may name a class which inherits the method.
+  const MethodIdItem method = scanner_.method_id(method_idx);
+  for (uint32_t t = hierarchy_.superclass(method.class_idx);
+       t != DexScanner::kNoIndex && hierarchy_.class_def(t) != DexScanner::kNoIndex;
+       t = hierarchy_.superclass(t)) {
+    const uint32_t found = scanner_.FindMethod(t, method.name_idx, method.proto_idx);
+    if (found != DexScanner::kNoIndex && code_[found] != kUndefined) {
+      ReachMethod(found);
+      return;
+    }
+  }
+  for (const uint32_t* it = hierarchy_.interfaces_begin(method.class_idx);
+       it != hierarchy_.interfaces_end(method.class_idx); ++it) {
+    const uint32_t found = scanner_.FindMethod(*it, method.name_idx, method.proto_idx);
+    if (found != DexScanner::kNoIndex) ReachMethod(found);
+  }
+}
+
+void Reachability::AddMethod(uint32_t method_idx) {
+  ReachMethod(method_idx);
+}
+
+void Reachability::AddClass(uint32_t type_idx) {
+  const uint32_t class_def = hierarchy_.class_def(type_idx);
+  if (class_def == DexScanner::kNoIndex) return;
+  ReachClass(type_idx);
+  for (int k = 0; k < 2; ++k) {
+    const ClassDefItem& item = scanner_.class_defs()[class_def];
+    uint32_t method_idx = 0;
+    for (const EncodedMethod& method : k ? item.virtual_methods() : item.direct_methods()) {
+      method_idx += method.method_idx_diff;
+      ReachMethod(method_idx);
+    }
+  }
+}
+
+void Reachability::AddAnnotated(uint32_t type_idx) {
+  for (const uint32_t c : FindAnnotatedClasses(scanner_, type_idx, true)) {
+    const AnnotationsDirectory directory(scanner_, scanner_.class_annotations_offs(c));
+    if (directory.class_annotations().Contains(type_idx)) {
+      AddClass(scanner_.class_type_idx(c));
+    }
+    for (uint32_t i = 0; i < directory.fields_size(); ++i) {
+      const AnnotationsDirectory::Member field = directory.field(i);
+      if (AnnotationSet(scanner_, field.offs).Contains(type_idx)) {
+        ReachClass(scanner_.field_id(field.idx).class_idx);
+      }
+    }
+    for (uint32_t i = 0; i < directory.methods_size(); ++i) {
+      const AnnotationsDirectory::Member method = directory.method(i);
+      if (AnnotationSet(scanner_, method.offs).Contains(type_idx)) {
+        AddMethod(method.idx);
+      }
+    }
+    for (uint32_t i = 0; i < directory.parameters_size(); ++i) {
+      const uint32_t method_idx = directory.parameters(i).idx;
+      for (uint32_t p = 0; p < directory.ParameterCount(method_idx); ++p) {
+        if (directory.ParameterAnnotations(method_idx, p).Contains(type_idx)) {
+          AddMethod(method_idx);
+          break;
+        }
+      }
+    }
+  }
+}
+
+template <typename Reader>
+void Reachability::Scan(const Reader& reader, uint32_t method_idx) {
+  ReachClass(scanner_.method_id(method_idx).class_idx);
+  if (!code_[method_idx]) return;
+  const CodeItem code(&scanner_, code_[method_idx]);
+  size_t offs = code.instr_offs();
+  const size_t end = offs + 2*code.instr_size();
+  for (; offs < end; offs += 2*InstructionSize(&reader, offs)) {
+    uint32_t index;
+    switch (ReadReference(&reader, offs, &index)) {
+    case REF_TYPE:
+      ReachClass(index);
+      break;
+    case REF_FIELD:
+      ReachClass(scanner_.field_id(index).class_idx);
+      break;
+    case REF_METHOD: {
+      const uint8_t opcode = reader.ReadUShort(offs) & 0xFF;
+      if (opcode != 0x6E && opcode != 0x72 && opcode != 0x74 && opcode != 0x78) {
+        ReachDirect(index);
+        break;
+      }
+      for (const uint32_t target : resolver_.Resolve(index).methods) {
+        ReachMethod(target);
+      }
+      // An abstract method called keeps its declaration.
+      if (code_[index] == 0) ReachMethod(index);
+      break;
+    }
+    default:
+      break;
+    }
+  }
+}
+
+template <typename Reader>
+void Reachability::Work(const Reader& reader) {
+  uint32_t method_idx;
+  while (work_.Pop(&method_idx)) {
+    Scan(reader, method_idx);
+    work_.Done();
+  }
+}
+
+void Reachability::Run(size_t threads) {
+  ParallelFor(threads, threads, [this] (size_t task, size_t worker) {
+    if (scanner_.IsMachineEndian()) {
+      Work(DexReader<NativeOrder>(scanner_));
+    } else {
+      Work(DexReader<SwappedOrder>(scanner_));
+    }
+  });
+}
+
+}  // namespace rev
+}  // namespace egorich
@@ -0,0 +1,86 @@
+#ifndef REV_REACHABILITY_H__
+#define REV_REACHABILITY_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "call_resolver.h"
+#include "class_hierarchy.h"
+#include "dex_scanner.h"
+#include "parallel.h"
+
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Classes and methods of a dex reachable from a set of entry points, for
+// finding dead code. A reached method reaches the methods it invokes, the
+// targets of its virtual calls by CallResolver, and the classes of the
+// types and fields it refers to. A reached class reaches its superclasses,
+// its interfaces and its <clinit>. Code outside the dex may call into a
+// reached class too, so it reaches the virtual methods it may override
+// there: all of them under a superclass or interface outside the dex, and
+// those named as methods of java.lang.Object otherwise.
+//
+// Run() walks the methods on worker threads which share a WorkList, with
+// an AtomicBitset each for the methods and the classes reached.
+class Reachability {
+ public:
+  // The hierarchy must be built.
+  Reachability(const DexScanner& scanner, const ClassHierarchy& hierarchy);
+
+  // Entry points, added before Run(). A class stands for a component the
+  // platform instantiates, and reaches all of its methods.
+  void AddMethod(uint32_t method_idx);
+  void AddClass(uint32_t type_idx);
+  // Classes and methods annotated with the type, methods with a parameter
+  // annotated with it, and the classes of the fields annotated with it.
+  void AddAnnotated(uint32_t type_idx);
+
+  void Run(size_t threads);
+
+  // Only methods defined in the dex are ever reached.
+  bool is_reached_method(uint32_t method_idx) const { return methods_.Test(method_idx); }
+  bool is_reached_class(uint32_t class_def) const { return classes_.Test(class_def); }
+  // Whether the method_idx is defined by a class_def.
+  bool is_defined(uint32_t method_idx) const { return code_[method_idx] != kUndefined; }
+
+ private:
+  static constexpr uint32_t kUndefined = 0xFFFFFFFFU;
+
+  void ReachMethod(uint32_t method_idx);
+  void ReachClass(uint32_t type_idx);
+  // Reaches the method invoke-direct, invoke-static or invoke-super call:
+  // the first definition up the superclasses, or failing that, the default
+  // methods.
+  void ReachDirect(uint32_t method_idx);
+  // Reader is the DexReader of the byte order of the file.
+  template <typename Reader>
+  void Work(const Reader& reader);
+  template <typename Reader>
+  void Scan(const Reader& reader, uint32_t method_idx);
+
+  const DexScanner& scanner_;
+  const ClassHierarchy& hierarchy_;
+  CallResolver resolver_;
+  // code_offs by method_idx, zero for abstract and native methods and
+  // kUndefined for methods of other classes.
+  vector<uint32_t> code_;
+  // Methods of the class_defs, in the order of class_defs: the <clinit>, or
+  // kUndefined, then the virtual methods called from outside the dex when
+  // the class is reached.
+  vector<uint32_t> kept_offs_;
+  vector<uint32_t> kept_;
+  AtomicBitset methods_;
+  AtomicBitset classes_;
+  WorkList work_;
+
+  Reachability(const Reachability&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_REACHABILITY_H__
@@ -0,0 +1,301 @@
+#include "register_flow.h"
+
+#include <algorithm>
+#include <utility>
+
+using std::lower_bound;
+using std::pair;
+
+namespace egorich {
+namespace rev {
+namespace {
+
+size_t WordCount(size_t bits) {
+  return (bits + 63) / 64;
+}
+
+bool TestBit(const uint64_t* row, size_t bit) {
+  return (row[bit / 64] >> (bit % 64)) & 1;
+}
+
+void SetBit(uint64_t* row, size_t bit) {
+  row[bit / 64] |= static_cast<uint64_t>(1) << (bit % 64);
+}
+
+}  // namespace
+
+constexpr uint32_t RegisterFlow::kEntry;
+
+RegisterFlow::RegisterFlow(const DexScanner& scanner, const CodeItem& code,
+                           const DominatorEval& doms, const vector<uint32_t>& block_size)
+    : scanner_(scanner),
+      code_(code),
+      doms_(doms),
+      block_size_(block_size),
+      block_index_(code.instr_size(), -1),
+      words_(WordCount(code.register_size())) {
+  const vector<int>& postorder = doms_.postorder();
+  for (size_t b = 0; b < postorder.size(); ++b) {
+    block_index_[postorder[b]] = b;
+  }
+}
+
+void RegisterFlow::Compute() {
+  ComputeLocalSets();
+  ComputeLiveness();
+  CollectDefs();
+  ComputeReachingDefs();
+  LinkUses();
+}
+
+const uint64_t* RegisterFlow::live_in(uint32_t head) const {
+  return live_in_.data() + block_index_[head] * words_;
+}
+
+const uint64_t* RegisterFlow::live_out(uint32_t head) const {
+  return live_out_.data() + block_index_[head] * words_;
+}
+
+bool RegisterFlow::IsLiveIn(uint32_t head, uint16_t reg) const {
+  return TestBit(live_in(head), reg);
+}
+
+bool RegisterFlow::IsLiveOut(uint32_t head, uint16_t reg) const {
+  return TestBit(live_out(head), reg);
+}
+
+int RegisterFlow::FindDef(uint32_t pc, uint16_t reg) const {
+  const auto begin = defs_.begin() + reg_defs_[reg];
+  const auto end = defs_.begin() + reg_defs_[reg + 1];
+  const auto it = lower_bound(
+      begin, end, pc, [] (const Def& def, uint32_t pc) -> bool { return def.pc < pc; });
+  return it != end && it->pc == pc ? it - defs_.begin() : -1;
+}
+
+template <typename F>
+void RegisterFlow::ForEachInstr(uint32_t head, F f) {
+  const uint32_t end = head + block_size_[head];
+  for (uint32_t pc = head; pc < end; pc += code_.opsize(pc)) {
+    ReadRegisterAccess(&scanner_, code_.instr_offs() + 2*pc, &access_);
+    f(pc, access_);
+  }
+}
+
+void RegisterFlow::ComputeLocalSets() {
+  const vector<int>& postorder = doms_.postorder();
+  use_.assign(postorder.size() * words_, 0);
+  def_.assign(postorder.size() * words_, 0);
+  for (size_t b = 0; b < postorder.size(); ++b) {
+    uint64_t* const use = use_.data() + b * words_;
+    uint64_t* const def = def_.data() + b * words_;
+    ForEachInstr(postorder[b], [use, def] (uint32_t pc, const RegisterAccess& access) {
+      for (size_t i = 0; i < access.use_count; ++i) {
+        if (!TestBit(def, access.uses[i])) {
+          SetBit(use, access.uses[i]);
+        }
+      }
+      for (size_t i = 0; i < access.def_count; ++i) {
+        SetBit(def, access.defs[i]);
+      }
+    });
+  }
+}
+
+void RegisterFlow::ComputeLiveness() {
+  // Backward problem, so blocks are visited in postorder.
+  const vector<int>& postorder = doms_.postorder();
+  live_in_ = use_;
+  live_out_.assign(postorder.size() * words_, 0);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t b = 0; b < postorder.size(); ++b) {
+      uint64_t* const out = live_out_.data() + b * words_;
+      for (int succ : doms_.outbound()[postorder[b]]) {
+        const uint64_t* const succ_in = live_in_.data() + block_index_[succ] * words_;
+        for (size_t w = 0; w < words_; ++w) {
+          out[w] |= succ_in[w];
+        }
+      }
+      uint64_t* const in = live_in_.data() + b * words_;
+      const uint64_t* const use = use_.data() + b * words_;
+      const uint64_t* const def = def_.data() + b * words_;
+      uint64_t diff = 0;
+      for (size_t w = 0; w < words_; ++w) {
+        const uint64_t next = use[w] | (out[w] & ~def[w]);
+        diff |= next ^ in[w];
+        in[w] = next;
+      }
+      changed = changed || diff;
+    }
+  }
+}
+
+void RegisterFlow::CollectDefs() {
+  const size_t registers = code_.register_size();
+  const uint16_t first_arg = registers - code_.ins_size();
+  reg_defs_.assign(registers + 1, 0);
+  for (uint32_t head = 0; head < code_.instr_size(); head += block_size_[head]) {
+    if (block_index_[head] == -1) continue;
+    ForEachInstr(head, [this] (uint32_t pc, const RegisterAccess& access) {
+      for (size_t i = 0; i < access.def_count; ++i) {
+        ++reg_defs_[access.defs[i] + 1];
+      }
+    });
+  }
+  for (size_t reg = first_arg; reg < registers; ++reg) {
+    ++reg_defs_[reg + 1];
+  }
+  for (size_t reg = 0; reg < registers; ++reg) {
+    reg_defs_[reg + 1] += reg_defs_[reg];
+  }
+
+  // Visiting blocks by their heads keeps the defs of a register sorted by pc.
+  defs_.resize(reg_defs_[registers]);
+  vector<uint32_t> next(reg_defs_.begin(), reg_defs_.end() - 1);
+  for (uint32_t head = 0; head < code_.instr_size(); head += block_size_[head]) {
+    if (block_index_[head] == -1) continue;
+    ForEachInstr(head, [this, &next] (uint32_t pc, const RegisterAccess& access) {
+      for (size_t i = 0; i < access.def_count; ++i) {
+        defs_[next[access.defs[i]]++] = {pc, access.defs[i]};
+      }
+    });
+  }
+  for (size_t reg = first_arg; reg < registers; ++reg) {
+    defs_[next[reg]++] = {kEntry, static_cast<uint16_t>(reg)};
+  }
+
+  const vector<int>& postorder = doms_.postorder();
+  vector<int> last_def(registers, -1);
+  block_gen_offs_.assign(1, 0);
+  block_gen_.clear();
+  for (size_t b = 0; b < postorder.size(); ++b) {
+    const size_t begin = block_gen_.size();
+    ForEachInstr(postorder[b], [this, &last_def] (uint32_t pc, const RegisterAccess& access) {
+      for (size_t i = 0; i < access.def_count; ++i) {
+        const uint16_t reg = access.defs[i];
+        if (last_def[reg] == -1) {
+          block_gen_.push_back(reg);
+        }
+        last_def[reg] = FindDef(pc, reg);
+      }
+    });
+    for (size_t i = begin; i < block_gen_.size(); ++i) {
+      const uint16_t reg = block_gen_[i];
+      block_gen_[i] = last_def[reg];
+      last_def[reg] = -1;
+    }
+    block_gen_offs_.push_back(block_gen_.size());
+  }
+}
+
+void RegisterFlow::ComputeReachingDefs() {
+  // Every definition is carried forward on its own, from the end of its
+  // block, or from the entry for the arguments, through the blocks which do
+  // not redefine its register, and only while the register is live: a def
+  // is of no use past where the register dies. The sets are then bounded by
+  // the def-use information itself rather than by defs times blocks.
+  const vector<int>& postorder = doms_.postorder();
+  const size_t blocks = postorder.size();
+  vector<int> def_block(defs_.size(), -1);
+  for (size_t b = 0; b < blocks; ++b) {
+    for (size_t i = block_gen_offs_[b]; i < block_gen_offs_[b + 1]; ++i) {
+      def_block[block_gen_[i]] = b;
+    }
+  }
+  // Blocks reached by def d are marked with d + 1, so the marks need no
+  // clearing between defs.
+  vector<uint32_t> mark(blocks, 0);
+  vector<int> stack;
+  vector<pair<uint32_t, uint32_t>> reach;
+  for (uint32_t d = 0; d < defs_.size(); ++d) {
+    const uint16_t reg = defs_[d].reg;
+    if (defs_[d].pc == kEntry) {
+      stack.push_back(0);
+    } else if (def_block[d] != -1) {
+      for (int succ : doms_.outbound()[postorder[def_block[d]]]) {
+        stack.push_back(succ);
+      }
+    }
+    while (!stack.empty()) {
+      const int head = stack.back();
+      stack.pop_back();
+      const size_t b = block_index_[head];
+      if (mark[b] == d + 1) continue;
+      mark[b] = d + 1;
+      if (!TestBit(live_in_.data() + b * words_, reg)) continue;
+      reach.push_back({b, d});
+      if (TestBit(def_.data() + b * words_, reg)) continue;
+      for (int succ : doms_.outbound()[head]) {
+        stack.push_back(succ);
+      }
+    }
+  }
+
+  // Defs were visited in order, so the defs of every block come out sorted,
+  // and those of a register adjacent.
+  reach_offs_.assign(blocks + 1, 0);
+  for (const auto& r : reach) {
+    ++reach_offs_[r.first + 1];
+  }
+  for (size_t b = 0; b < blocks; ++b) {
+    reach_offs_[b + 1] += reach_offs_[b];
+  }
+  reach_defs_.resize(reach.size());
+  vector<uint32_t> next(reach_offs_.begin(), reach_offs_.end() - 1);
+  for (const auto& r : reach) {
+    reach_defs_[next[r.first]++] = r.second;
+  }
+}
+
+void RegisterFlow::LinkUses() {
+  const vector<int>& postorder = doms_.postorder();
+  vector<pair<uint32_t, uint32_t>> links;
+  // Last def of each register made so far in the block, or -1.
+  vector<int> local(code_.register_size(), -1);
+  vector<uint16_t> defined;
+  for (size_t b = 0; b < postorder.size(); ++b) {
+    const uint32_t* const in_begin = reach_defs_.data() + reach_offs_[b];
+    const uint32_t* const in_end = reach_defs_.data() + reach_offs_[b + 1];
+    ForEachInstr(postorder[b], [&] (uint32_t pc, const RegisterAccess& access) {
+      for (size_t i = 0; i < access.use_count; ++i) {
+        const uint16_t reg = access.uses[i];
+        if (local[reg] != -1) {
+          links.push_back({local[reg], pc});
+          continue;
+        }
+        for (const uint32_t* d = lower_bound(in_begin, in_end, reg_defs_[reg]);
+             d != in_end && *d < reg_defs_[reg + 1]; ++d) {
+          links.push_back({*d, pc});
+        }
+      }
+      for (size_t i = 0; i < access.def_count; ++i) {
+        const uint16_t reg = access.defs[i];
+        if (local[reg] == -1) {
+          defined.push_back(reg);
+        }
+        local[reg] = FindDef(pc, reg);
+      }
+    });
+    for (uint16_t reg : defined) {
+      local[reg] = -1;
+    }
+    defined.clear();
+  }
+
+  use_offs_.assign(defs_.size() + 1, 0);
+  for (const auto& link : links) {
+    ++use_offs_[link.first + 1];
+  }
+  for (size_t d = 0; d < defs_.size(); ++d) {
+    use_offs_[d + 1] += use_offs_[d];
+  }
+  use_pc_.resize(links.size());
+  vector<uint32_t> next(use_offs_.begin(), use_offs_.end() - 1);
+  for (const auto& link : links) {
+    use_pc_[next[link.first]++] = link.second;
+  }
+}
+
+}  // namespace rev
+}  // namespace egorich
@@ -0,0 +1,100 @@
+#ifndef REV_REGISTER_FLOW_H__
+#define REV_REGISTER_FLOW_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "dex_asm.h"
+#include "dex_scanner.h"
+#include "dominator_eval.h"
+
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Register liveness and def-use chains over the block CFG of a method.
+// Liveness sets are packed into 64-bit words, a row of words per reachable
+// block, so the transfer functions are plain loops of bitwise ops over the
+// rows. Reaching definitions are kept sparse instead, as lists of the defs
+// reaching each block whose register is live there: a row of bits per def
+// would grow with defs times blocks.
+class RegisterFlow {
+ public:
+  // Pseudo pc of the definitions of the incoming arguments.
+  static constexpr uint32_t kEntry = 0xFFFFFFFFU;
+
+  struct Def {
+    uint32_t pc;
+    uint16_t reg;
+  };
+
+  RegisterFlow(const DexScanner& scanner, const CodeItem& code,
+               const DominatorEval& doms, const vector<uint32_t>& block_size);
+
+  void Compute();
+
+  // Number of words in a row of registers.
+  size_t words() const { return words_; }
+  const uint64_t* live_in(uint32_t head) const;
+  const uint64_t* live_out(uint32_t head) const;
+  bool IsLiveIn(uint32_t head, uint16_t reg) const;
+  bool IsLiveOut(uint32_t head, uint16_t reg) const;
+
+  // Definitions ordered by (reg, pc), so the defs of a register are adjacent.
+  const vector<Def>& defs() const { return defs_; }
+  // Returns the index of the def of reg made at pc, or -1.
+  int FindDef(uint32_t pc, uint16_t reg) const;
+  // pcs of the instructions which may read the def; an instruction reading
+  // the register twice is listed twice.
+  const uint32_t* uses_begin(size_t def) const { return use_pc_.data() + use_offs_[def]; }
+  const uint32_t* uses_end(size_t def) const { return use_pc_.data() + use_offs_[def + 1]; }
+  size_t use_count(size_t def) const { return use_offs_[def + 1] - use_offs_[def]; }
+
+ private:
+  template <typename F>
+  void ForEachInstr(uint32_t head, F f);
+
+  void ComputeLocalSets();
+  void ComputeLiveness();
+  void CollectDefs();
+  void ComputeReachingDefs();
+  void LinkUses();
+
+  const DexScanner& scanner_;
+  const CodeItem& code_;
+  const DominatorEval& doms_;
+  const vector<uint32_t>& block_size_;
+  RegisterAccess access_;
+
+  // Blocks are numbered by their index in doms_.postorder().
+  vector<int> block_index_;
+  size_t words_;
+  vector<uint64_t> use_;
+  vector<uint64_t> def_;
+  vector<uint64_t> live_in_;
+  vector<uint64_t> live_out_;
+
+  vector<Def> defs_;
+  // Defs of register r are defs_[reg_defs_[r]..reg_defs_[r + 1]).
+  vector<uint32_t> reg_defs_;
+  // Last def of every register defined in block b, in
+  // block_gen_[block_gen_offs_[b]..block_gen_offs_[b + 1]).
+  vector<uint32_t> block_gen_offs_;
+  vector<uint32_t> block_gen_;
+  // Defs reaching the entry of block b with their register live there, by
+  // index, in reach_defs_[reach_offs_[b]..reach_offs_[b + 1]).
+  vector<uint32_t> reach_offs_;
+  vector<uint32_t> reach_defs_;
+
+  vector<uint32_t> use_offs_;
+  vector<uint32_t> use_pc_;
+
+  RegisterFlow(const RegisterFlow&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_REGISTER_FLOW_H__
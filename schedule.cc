@@ -0,0 +1,41 @@
+#include "schedule.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace egorich {
+namespace rev {
+namespace {
+
+const size_t kTryCost = 16;
+
+}  // namespace
+
+size_t MethodCost(const DexScanner& scanner, const EncodedMethod& method) {
+  if (!method.code_offs) return 0;
+  const size_t tries = scanner.ReadUShort(method.code_offs + 6);
+  const size_t insns = scanner.ReadUint32(method.code_offs + 12);
+  return insns + kTryCost * tries;
+}
+
+size_t ClassCost(const DexScanner& scanner, const ClassDefItem& class_def) {
+  size_t cost = 0;
+  for (const EncodedMethod& method : class_def.direct_methods()) {
+    cost += MethodCost(scanner, method);
+  }
+  for (const EncodedMethod& method : class_def.virtual_methods()) {
+    cost += MethodCost(scanner, method);
+  }
+  return cost;
+}
+
+vector<size_t> LargestFirst(const vector<size_t>& costs) {
+  vector<size_t> order(costs.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&costs] (size_t a, size_t b) { return costs[a] > costs[b]; });
+  return order;
+}
+
+}  // namespace rev
+}  // namespace egorich
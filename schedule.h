@@ -0,0 +1,28 @@
+#ifndef REV_SCHEDULE_H__
+#define REV_SCHEDULE_H__
+
+#include <cstddef>
+#include <vector>
+
+#include "dex_scanner.h"
+
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Predicted cost of analysing the method, read off the header of its code
+// item: the code units, plus a surcharge for every try block, as handlers
+// add edges all over the CFG.
+size_t MethodCost(const DexScanner& scanner, const EncodedMethod& method);
+size_t ClassCost(const DexScanner& scanner, const ClassDefItem& class_def);
+
+// Returns the tasks ordered by decreasing cost. Handing them out in this
+// order (longest processing time first) starts the stragglers early, so they
+// overlap with the bulk of the small tasks instead of trailing behind them.
+vector<size_t> LargestFirst(const vector<size_t>& costs);
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_SCHEDULE_H__
@@ -0,0 +1,351 @@
+#include "server.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <utility>
+
+#include "dex_validator.h"
+#include "file_util.h"
+#include "integrity.h"
+#include "java_emitter.h"
+#include "method_dasm.h"
+#include "output_buffer.h"
+#include "parallel.h"
+
+using std::pair;
+using std::stringstream;
+using std::unique_ptr;
+
+namespace egorich {
+namespace rev {
+namespace {
+
+// Longest string accepted in a request.
+constexpr uint32_t kMaxRequestString = 1 << 16;
+
+// Returns the size of the request at the front of in, 0 if it is not
+// complete yet, or -1 if it is malformed. A complete request is parsed.
+long ParseRequest(const string& in, uint8_t* op, string* path, string* arg) {
+  size_t pos = 1;
+  string* const strings[2] = {path, arg};
+  for (string* s : strings) {
+    uint32_t size;
+    if (in.size() < pos + sizeof(size)) {
+      return 0;
+    }
+    memcpy(&size, in.data() + pos, sizeof(size));
+    if (size > kMaxRequestString) {
+      return -1;
+    }
+    pos += sizeof(size);
+    if (in.size() < pos + size) {
+      return 0;
+    }
+    s->assign(in, pos, size);
+    pos += size;
+  }
+  *op = in[0];
+  return pos;
+}
+
+// Looks a method up as DexScanner::FindEncodedMethod() does, through the
+// class index of the dex.
+bool FindMethod(const ResidentDex& dex, uint32_t method_idx, EncodedMethod* method) {
+  const uint32_t t = dex.class_of_type[dex.scanner.method_id(method_idx).class_idx];
+  if (t == DexScanner::kNoIndex) {
+    return false;
+  }
+  const ClassDefItem& class_def = dex.scanner.class_defs()[t];
+  for (int k = 0; k < 2; ++k) {
+    uint32_t idx = 0;
+    for (const EncodedMethod& encoded : k ? class_def.virtual_methods() : class_def.direct_methods()) {
+      idx += encoded.method_idx_diff;
+      if (idx == method_idx) {
+        *method = encoded;
+        method->method_idx_diff = idx;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+shared_ptr<const ResidentDex> DexCache::Get(const string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return NULL;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(path);
+    if (it != entries_.end()) {
+      const Entry& entry = *it->second;
+      if (entry.size == st.st_size && entry.mtime == st.st_mtime) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return entry.dex;
+      }
+    }
+  }
+
+  // Parsing happens outside of the lock, so a slow file does not hold up
+  // requests to the cached ones. Two requests missing the same file both
+  // parse it, and the later one wins.
+  string content;
+  if (!ReadFileContent(path, &content)) {
+    return NULL;
+  }
+  shared_ptr<ResidentDex> dex(new ResidentDex(std::move(content)));
+  DexScanner& scanner = dex->scanner;
+  if (!scanner.ParseHeader()) {
+    return NULL;
+  }
+  unique_ptr<IntegrityCheck> integrity(verify_ ? new IntegrityCheck(scanner) : NULL);
+  if (!DexValidator(scanner).Validate()) {
+    return NULL;
+  }
+  scanner.Parse();
+  if (integrity && !integrity->Wait()) {
+    return NULL;
+  }
+  dex->class_of_type.assign(scanner.type_ids().size(), DexScanner::kNoIndex);
+  for (uint32_t t = 0; t < scanner.class_defs().size(); ++t) {
+    dex->class_of_type[scanner.class_defs()[t].type_idx()] = t;
+  }
+  size_t charge = scanner.size() + sizeof(uint32_t) * dex->class_of_type.size();
+  for (const string& s : scanner.string_ids()) {
+    charge += sizeof(string) + s.size();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(path);
+  if (it != entries_.end()) {
+    used_ -= it->second->charge;
+    lru_.erase(it->second);
+    entries_.erase(it);
+  }
+  lru_.push_front({path, dex, charge, st.st_size, st.st_mtime});
+  entries_[path] = lru_.begin();
+  used_ += charge;
+  // The file just parsed stays even if it alone exceeds the budget.
+  while (used_ > budget_ && lru_.size() > 1) {
+    const Entry& victim = lru_.back();
+    used_ -= victim.charge;
+    entries_.erase(victim.path);
+    lru_.pop_back();
+  }
+  return dex;
+}
+
+bool Server::Run(const string& socket_path) {
+  sockaddr_un addr;
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, socket_path.c_str(), socket_path.size());
+
+  const int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (listener < 0) {
+    return false;
+  }
+  unlink(socket_path.c_str());
+  if (bind(listener, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0
+      || listen(listener, SOMAXCONN) != 0
+      || pipe2(wake_, O_NONBLOCK) != 0) {
+    close(listener);
+    return false;
+  }
+
+  // The loop takes one thread, the workers the others.
+  ParallelFor(threads_ + 1, threads_ + 1, [this, listener] (size_t task, size_t worker) {
+    if (task == 0) {
+      Loop(listener);
+    } else {
+      Work();
+    }
+  });
+  return true;
+}
+
+void Server::Loop(int listener) {
+  unordered_map<int, Connection> connections;
+  vector<pollfd> fds;
+  vector<Response> responses;
+  char buffer[65536];
+  for (;;) {
+    // Busy connections are left out until their response is back, so a
+    // client hanging up meanwhile does not wake the loop over and over.
+    fds.clear();
+    fds.push_back({listener, POLLIN, 0});
+    fds.push_back({wake_[0], POLLIN, 0});
+    for (const auto& it : connections) {
+      const Connection& connection = it.second;
+      if (connection.busy) continue;
+      fds.push_back({it.first, static_cast<short>(connection.sent < connection.out.size() ? POLLOUT : POLLIN), 0});
+    }
+    if (poll(fds.data(), fds.size(), -1) < 0) continue;
+
+    if (fds[0].revents & POLLIN) {
+      int fd;
+      while ((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+        connections[fd] = Connection{string(), string(), 0, false, false};
+      }
+    }
+    if (fds[1].revents & POLLIN) {
+      while (read(wake_[0], buffer, sizeof(buffer)) > 0) {
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        responses.swap(responses_);
+      }
+      for (Response& response : responses) {
+        Connection& connection = connections[response.fd];
+        connection.out = std::move(response.data);
+        connection.sent = 0;
+        connection.busy = false;
+      }
+      responses.clear();
+    }
+
+    for (size_t i = 2; i < fds.size(); ++i) {
+      if (!fds[i].revents) continue;
+      const int fd = fds[i].fd;
+      Connection& connection = connections[fd];
+      bool alive = true;
+      if (connection.sent < connection.out.size()) {
+        // A client hanging up must not take the server down with SIGPIPE.
+        const ssize_t sz = send(fd, connection.out.data() + connection.sent,
+                                connection.out.size() - connection.sent, MSG_NOSIGNAL);
+        if (sz > 0) {
+          connection.sent += sz;
+        } else if (errno != EAGAIN && errno != EINTR) {
+          alive = false;
+        }
+      } else {
+        const ssize_t sz = read(fd, buffer, sizeof(buffer));
+        if (sz > 0) {
+          connection.in.append(buffer, sz);
+        } else if (sz == 0) {
+          connection.eof = true;
+        } else if (errno != EAGAIN && errno != EINTR) {
+          alive = false;
+        }
+      }
+      if (alive && connection.sent == connection.out.size()) {
+        connection.out.clear();
+        connection.sent = 0;
+        alive = Dispatch(fd, &connection) && !(connection.eof && !connection.busy);
+      }
+      if (!alive) {
+        close(fd);
+        connections.erase(fd);
+      }
+    }
+  }
+}
+
+bool Server::Dispatch(int fd, Connection* connection) {
+  Request request;
+  request.fd = fd;
+  const long size = ParseRequest(connection->in, &request.op, &request.path, &request.arg);
+  if (size <= 0) {
+    return size == 0;
+  }
+  connection->in.erase(0, size);
+  connection->busy = true;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requests_.push_back(std::move(request));
+  }
+  pending_.notify_one();
+  return true;
+}
+
+void Server::Work() {
+  Zone zone(1048576 * 16);
+  string out;
+  for (;;) {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      pending_.wait(lock, [this] { return !requests_.empty(); });
+      request = std::move(requests_.front());
+      requests_.pop_front();
+    }
+    out.clear();
+    const uint8_t status = Handle(request.op, request.path, request.arg, &zone, &out);
+    const uint32_t size = out.size();
+    Response response = {request.fd, string()};
+    response.data.reserve(sizeof(status) + sizeof(size) + size);
+    response.data.append(reinterpret_cast<const char*>(&status), sizeof(status));
+    response.data.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    response.data.append(out);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      responses_.push_back(std::move(response));
+    }
+    // A full pipe has the loop woken up already.
+    const char wake = 0;
+    while (write(wake_[1], &wake, sizeof(wake)) < 0 && errno == EINTR) {
+    }
+  }
+}
+
+Server::Status Server::Handle(uint8_t op, const string& path, const string& arg, Zone* zone,
+                              string* out) {
+  if (op != RAW && op != JAVA) {
+    return BAD_REQUEST;
+  }
+  const shared_ptr<const ResidentDex> dex = cache_->Get(path);
+  if (!dex) {
+    return NO_DEX;
+  }
+  const DexScanner& d = dex->scanner;
+
+  if (op == JAVA) {
+    const uint32_t type_idx = d.FindType(arg);
+    const uint32_t class_def = type_idx == DexScanner::kNoIndex ? DexScanner::kNoIndex : dex->class_of_type[type_idx];
+    if (class_def == DexScanner::kNoIndex) {
+      return NOT_FOUND;
+    }
+    OutputBuffer buffer;
+    JavaEmitter emitter(d, &buffer);
+    emitter.set_budget(budget_);
+    emitter.EmitClass(d.class_defs()[class_def], zone);
+    stringstream ss;
+    buffer.WriteTo(ss);
+    *out = ss.str();
+    return OK;
+  }
+
+  const pair<uint32_t, uint32_t> range = d.FindMethods(arg);
+  stringstream ss;
+  for (uint32_t m = range.first; m < range.second; ++m) {
+    EncodedMethod method;
+    if (!FindMethod(*dex, m, &method)) continue;
+    {
+      uint32_t base = 0;
+      MethodDasm dasm(zone, d, method, &base);
+      dasm.Run();
+      dasm.PrintRaw(ss);
+    }
+    zone->Reset();
+  }
+  *out = ss.str();
+  return out->empty() ? NOT_FOUND : OK;
+}
+
+}  // namespace rev
+}  // namespace egorich
@@ -0,0 +1,162 @@
+#ifndef REV_SERVER_H__
+#define REV_SERVER_H__
+
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "budget.h"
+#include "dex_scanner.h"
+#include "zone.h"
+
+using std::deque;
+using std::list;
+using std::shared_ptr;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// A parsed dex, with the lookups requests need built once as it is parsed.
+struct ResidentDex {
+  explicit ResidentDex(string content) : scanner(std::move(content)) {
+  }
+
+  DexScanner scanner;
+  // Index in class_defs() of the class defining each type, or kNoIndex.
+  vector<uint32_t> class_of_type;
+};
+
+// Parsed dex files keyed by path. Once the files charged exceed the memory
+// budget the least recently used ones are dropped; requests still holding
+// a dropped scanner keep it alive until they finish. A file whose size or
+// modification time changed is parsed anew.
+class DexCache {
+ public:
+  // With verify set, files are parsed only if their checksum and signature
+  // match.
+  DexCache(size_t budget, bool verify) : budget_(budget), verify_(verify), used_(0) {
+  }
+
+  // Returns NULL if the file cannot be read or is not a valid dex.
+  shared_ptr<const ResidentDex> Get(const string& path);
+
+ private:
+  struct Entry {
+    string path;
+    shared_ptr<const ResidentDex> dex;
+    // The dex is charged its file size plus the decoded strings, which make
+    // up most of a parsed scanner.
+    size_t charge;
+    off_t size;
+    time_t mtime;
+  };
+
+  const size_t budget_;
+  const bool verify_;
+  size_t used_;
+  std::mutex mutex_;
+  // Most recently used first.
+  list<Entry> lru_;
+  unordered_map<string, list<Entry>::iterator> entries_;
+
+  DexCache(const DexCache&) = delete;
+};
+
+// Serves requests on a Unix domain socket. A single thread polls the socket
+// and the connections, and hands every complete request to a pool of worker
+// threads; a connection may carry any number of requests, and holds no
+// worker while it waits for the next one. The requests of a connection are
+// answered in order, one at a time.
+//
+// A request is an opcode byte followed by two strings, the dex path and the
+// argument; a response is a status byte followed by a string. Strings are a
+// uint32_t length followed by the bytes, and integers are in host byte order.
+class Server {
+ public:
+  enum Op {
+    // Disassembles the methods matching a method query, as `rev raw`.
+    RAW = 1,
+    // Decompiles the class with the given descriptor, as `rev java`, the
+    // methods over the budget printed raw.
+    JAVA = 2,
+  };
+
+  enum Status {
+    OK = 0,
+    BAD_REQUEST = 1,
+    NO_DEX = 2,
+    NOT_FOUND = 3,
+  };
+
+  Server(DexCache* cache, size_t threads, const Budget& budget)
+      : cache_(cache), threads_(threads), budget_(budget) {
+  }
+
+  // Serves forever. Returns false if the socket cannot be set up.
+  bool Run(const string& socket_path);
+
+ private:
+  struct Request {
+    int fd;
+    uint8_t op;
+    string path;
+    string arg;
+  };
+
+  struct Response {
+    int fd;
+    // Status, size and text, as sent.
+    string data;
+  };
+
+  struct Connection {
+    // Received and not yet handed out.
+    string in;
+    // Response being sent, and how much of it is.
+    string out;
+    size_t sent;
+    // A request is with the workers.
+    bool busy;
+    // The client is done sending.
+    bool eof;
+  };
+
+  // Polls the listener, the idle connections and the wake-up pipe forever.
+  void Loop(int listener);
+  // Hands the request at the front of the input out to the workers, if it
+  // is complete. Returns false if it is malformed.
+  bool Dispatch(int fd, Connection* connection);
+  // Handles requests forever.
+  void Work();
+  Status Handle(uint8_t op, const string& path, const string& arg, Zone* zone, string* out);
+
+  DexCache* const cache_;
+  const size_t threads_;
+  const Budget budget_;
+
+  std::mutex mutex_;
+  std::condition_variable pending_;
+  deque<Request> requests_;
+  vector<Response> responses_;
+  // Workers write a byte to wake_[1] when they add a response.
+  int wake_[2];
+
+  Server(const Server&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_SERVER_H__
@@ -0,0 +1,285 @@
+#include "ssa_form.h"
+
+#include <algorithm>
+#include <utility>
+
+using std::pair;
+using std::sort;
+using std::unique;
+
+namespace egorich {
+namespace rev {
+
+constexpr uint32_t SsaForm::kUndefined;
+
+SsaForm::SsaForm(Zone* zone, const DexScanner& scanner, const CodeItem& code,
+                 const DominatorEval& doms, const RegisterFlow& flow,
+                 const vector<uint32_t>& block_size)
+    : zone_(zone),
+      scanner_(scanner),
+      code_(code),
+      doms_(doms),
+      flow_(flow),
+      block_size_(block_size),
+      value_count_(0),
+      values_(NULL),
+      def_offs_(NULL),
+      use_offs_(NULL),
+      use_values_(NULL),
+      phi_offs_(NULL),
+      phis_(NULL) {
+}
+
+bool SsaForm::Build() {
+  if (!AllocateOperands()) {
+    return false;
+  }
+  ComputeFrontiers();
+  if (!PlacePhis()) {
+    return false;
+  }
+  Rename();
+  return true;
+}
+
+template <typename F>
+void SsaForm::ForEachInstr(uint32_t head, F f) {
+  const uint32_t end = head + block_size_[head];
+  for (uint32_t pc = head; pc < end; pc += code_.opsize(pc)) {
+    ReadRegisterAccess(&scanner_, code_.instr_offs() + 2*pc, &access_);
+    f(pc, access_);
+  }
+}
+
+bool SsaForm::AllocateOperands() {
+  const uint32_t size = code_.instr_size();
+  def_offs_ = zone_->AllocateArray<uint32_t>(size + 1);
+  use_offs_ = zone_->AllocateArray<uint32_t>(size + 1);
+  if (def_offs_ == NULL || use_offs_ == NULL) {
+    return false;
+  }
+  uint32_t defs = 0;
+  uint32_t uses = 0;
+  for (uint32_t head = 0; head < size; head += block_size_[head]) {
+    ForEachInstr(head, [this, &defs, &uses] (uint32_t pc, const RegisterAccess& access) {
+      const uint32_t next = pc + code_.opsize(pc);
+      for (uint32_t q = pc; q < next; ++q) {
+        def_offs_[q] = defs;
+        use_offs_[q] = uses;
+      }
+      defs += access.def_count;
+      uses += access.use_count;
+    });
+  }
+  def_offs_[size] = defs;
+  use_offs_[size] = uses;
+  use_values_ = zone_->AllocateArray<uint32_t>(uses);
+  if (use_values_ == NULL && uses) {
+    return false;
+  }
+  std::fill(use_values_, use_values_ + uses, kUndefined);
+  return true;
+}
+
+void SsaForm::ComputeFrontiers() {
+  // Cooper, Harvey & Kennedy: walk up from each predecessor of a join point
+  // to its immediate dominator.
+  vector<pair<int, int>> frontier;
+  for (int v : doms_.postorder()) {
+    const vector<int>& preds = doms_.inbound()[v];
+    // The entry into the method joins block 0 too, from outside of every
+    // block, so it adds no frontier of its own.
+    if (preds.size() + (v == 0 ? 1 : 0) < 2) continue;
+    for (int pred : preds) {
+      for (int runner = pred; runner != -1 && runner != doms_.dom()[v];
+           runner = doms_.dom()[runner]) {
+        frontier.push_back({runner, v});
+      }
+    }
+  }
+  sort(frontier.begin(), frontier.end());
+  frontier.erase(unique(frontier.begin(), frontier.end()), frontier.end());
+
+  frontier_offs_.assign(code_.instr_size() + 1, 0);
+  frontier_.resize(frontier.size());
+  for (size_t i = 0; i < frontier.size(); ++i) {
+    ++frontier_offs_[frontier[i].first + 1];
+    frontier_[i] = frontier[i].second;
+  }
+  for (size_t pc = 0; pc < code_.instr_size(); ++pc) {
+    frontier_offs_[pc + 1] += frontier_offs_[pc];
+  }
+}
+
+bool SsaForm::PlacePhis() {
+  const uint32_t size = code_.instr_size();
+  const vector<RegisterFlow::Def>& defs = flow_.defs();
+  vector<int> block_of(size);
+  for (uint32_t head = 0; head < size; head += block_size_[head]) {
+    std::fill(block_of.begin() + head, block_of.begin() + head + block_size_[head], head);
+  }
+
+  // Iterated dominance frontier of the blocks defining each register, pruned
+  // to the blocks where the register is live.
+  vector<pair<uint32_t, uint16_t>> placed;
+  vector<int> has_phi(size, -1);
+  vector<int> in_work(size, -1);
+  vector<int> work;
+  for (size_t d = 0; d < defs.size();) {
+    const uint16_t reg = defs[d].reg;
+    for (; d < defs.size() && defs[d].reg == reg; ++d) {
+      // The arguments are defined on the entry into the method, which has
+      // no frontier.
+      if (defs[d].pc == RegisterFlow::kEntry) continue;
+      const int block = block_of[defs[d].pc];
+      if (in_work[block] != reg) {
+        in_work[block] = reg;
+        work.push_back(block);
+      }
+    }
+    while (!work.empty()) {
+      const int x = work.back();
+      work.pop_back();
+      for (size_t i = frontier_offs_[x]; i < frontier_offs_[x + 1]; ++i) {
+        const int y = frontier_[i];
+        if (has_phi[y] == reg) continue;
+        has_phi[y] = reg;
+        if (!flow_.IsLiveIn(y, reg)) continue;
+        placed.push_back({y, reg});
+        if (in_work[y] != reg) {
+          in_work[y] = reg;
+          work.push_back(y);
+        }
+      }
+    }
+  }
+  sort(placed.begin(), placed.end());
+
+  const uint32_t instr_defs = def_offs_[size];
+  const uint32_t args = code_.ins_size();
+  value_count_ = instr_defs + args + placed.size();
+  values_ = zone_->AllocateArray<Value>(value_count_);
+  phi_offs_ = zone_->AllocateArray<uint32_t>(size + 1);
+  phis_ = zone_->AllocateArray<Phi>(placed.size());
+  if (values_ == NULL || phi_offs_ == NULL || (phis_ == NULL && !placed.empty())) {
+    return false;
+  }
+
+  for (uint32_t head = 0; head < size; head += block_size_[head]) {
+    ForEachInstr(head, [this] (uint32_t pc, const RegisterAccess& access) {
+      for (size_t i = 0; i < access.def_count; ++i) {
+        values_[DefAt(pc, i)] = {pc, access.defs[i], INSTR, 0};
+      }
+    });
+  }
+  for (uint32_t i = 0; i < args; ++i) {
+    const uint16_t reg = code_.register_size() - args + i;
+    values_[instr_defs + i] = {RegisterFlow::kEntry, reg, ARGUMENT, 0};
+  }
+
+  std::fill(phi_offs_, phi_offs_ + size + 1, 0);
+  for (size_t i = 0; i < placed.size(); ++i) {
+    const uint32_t head = placed[i].first;
+    const size_t preds = phi_arity(head);
+    const uint32_t value = instr_defs + args + i;
+    values_[value] = {head, placed[i].second, PHI, 0};
+    phis_[i].value = value;
+    phis_[i].operands = zone_->AllocateArray<uint32_t>(preds);
+    if (phis_[i].operands == NULL) {
+      return false;
+    }
+    std::fill(phis_[i].operands, phis_[i].operands + preds, kUndefined);
+    ++phi_offs_[head + 1];
+  }
+  for (uint32_t pc = 0; pc < size; ++pc) {
+    phi_offs_[pc + 1] += phi_offs_[pc];
+  }
+  return true;
+}
+
+void SsaForm::DefineValue(uint32_t value) {
+  const uint16_t reg = values_[value].reg;
+  undo_.push_back({reg, current_[reg]});
+  current_[reg] = value;
+}
+
+void SsaForm::FillPhiOperands(int pred) {
+  for (int succ : doms_.outbound()[pred]) {
+    const vector<int>& inbound = doms_.inbound()[succ];
+    for (size_t k = 0; k < inbound.size(); ++k) {
+      if (inbound[k] != pred) continue;
+      for (const Phi* phi = phis_begin(succ); phi != phis_end(succ); ++phi) {
+        const uint32_t value = current_[values_[phi->value].reg];
+        phi->operands[k] = value;
+        if (value != kUndefined) {
+          ++values_[value].use_count;
+        }
+      }
+    }
+  }
+}
+
+void SsaForm::Rename() {
+  const uint32_t instr_defs = def_offs_[code_.instr_size()];
+  current_.assign(code_.register_size(), kUndefined);
+  for (uint32_t i = 0; i < code_.ins_size(); ++i) {
+    current_[values_[instr_defs + i].reg] = instr_defs + i;
+  }
+  undo_.clear();
+  // The phis of block 0 take the arguments, or kUndefined, on entry.
+  const size_t entry = doms_.inbound()[0].size();
+  for (const Phi* phi = phis_begin(0); phi != phis_end(0); ++phi) {
+    const uint32_t value = current_[values_[phi->value].reg];
+    phi->operands[entry] = value;
+    if (value != kUndefined) {
+      ++values_[value].use_count;
+    }
+  }
+
+  // Explicit stack of (block, next dominator tree child, undo log mark).
+  struct Frame {
+    int block;
+    size_t child;
+    size_t mark;
+  };
+  vector<Frame> stack;
+  int next = 0;
+  while (next != -1 || !stack.empty()) {
+    if (next != -1) {
+      stack.push_back({next, 0, undo_.size()});
+      for (const Phi* phi = phis_begin(next); phi != phis_end(next); ++phi) {
+        DefineValue(phi->value);
+      }
+      ForEachInstr(next, [this] (uint32_t pc, const RegisterAccess& access) {
+        for (size_t i = 0; i < access.use_count; ++i) {
+          const uint32_t value = current_[access.uses[i]];
+          use_values_[use_offs_[pc] + i] = value;
+          if (value != kUndefined) {
+            ++values_[value].use_count;
+          }
+        }
+        for (size_t i = 0; i < access.def_count; ++i) {
+          DefineValue(DefAt(pc, i));
+        }
+      });
+      FillPhiOperands(next);
+      next = -1;
+      continue;
+    }
+
+    Frame& frame = stack.back();
+    const vector<int>& children = doms_.dom_tree()[frame.block];
+    if (frame.child < children.size()) {
+      next = children[frame.child++];
+      continue;
+    }
+    while (undo_.size() > frame.mark) {
+      current_[undo_.back().first] = undo_.back().second;
+      undo_.pop_back();
+    }
+    stack.pop_back();
+  }
+}
+
+}  // namespace rev
+}  // namespace egorich
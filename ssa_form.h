@@ -0,0 +1,123 @@
+#ifndef REV_SSA_FORM_H__
+#define REV_SSA_FORM_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "dex_asm.h"
+#include "dex_scanner.h"
+#include "dominator_eval.h"
+#include "register_flow.h"
+#include "zone.h"
+
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// SSA form of the dex registers of a method. Phis are placed at the iterated
+// dominance frontiers of the defs where the register is live, and values are
+// renamed over the dominator tree. Values and phis live in the method's zone.
+//
+// Value ids are dense: the defs of the instructions by pc and operand, then
+// the incoming arguments, then the phis.
+//
+// Block 0 has a virtual predecessor besides its inbound edges: the entry
+// into the method, which brings in the arguments. A loop headed by block 0
+// thus gets its phis like any other.
+class SsaForm {
+ public:
+  // Value of a register read before any def.
+  static constexpr uint32_t kUndefined = 0xFFFFFFFFU;
+
+  enum ValueKind {
+    INSTR,
+    ARGUMENT,
+    PHI,
+  };
+
+  struct Value {
+    // Defining instruction, RegisterFlow::kEntry for arguments, or the head of
+    // the block of the phi.
+    uint32_t pc;
+    uint16_t reg;
+    uint16_t kind;
+    // Number of instruction operands and phi operands reading the value.
+    uint32_t use_count;
+  };
+
+  struct Phi {
+    uint32_t value;
+    // One value per inbound edge of the block, in DominatorEval::inbound()
+    // order; the phis of block 0 take the value on entry last.
+    uint32_t* operands;
+  };
+
+  SsaForm(Zone* zone, const DexScanner& scanner, const CodeItem& code,
+          const DominatorEval& doms, const RegisterFlow& flow,
+          const vector<uint32_t>& block_size);
+
+  // Returns false if the zone is exhausted.
+  bool Build();
+
+  size_t value_count() const { return value_count_; }
+  const Value& value(uint32_t v) const { return values_[v]; }
+  // Value defined by the i-th def of the instruction at pc.
+  uint32_t DefAt(uint32_t pc, size_t i) const { return def_offs_[pc] + i; }
+  // Value read by the i-th use of the instruction at pc.
+  uint32_t UseAt(uint32_t pc, size_t i) const { return use_values_[use_offs_[pc] + i]; }
+  // Number of instruction operands of the method.
+  size_t use_total() const { return use_offs_[code_.instr_size()]; }
+  const Phi* phis_begin(uint32_t head) const { return phis_ + phi_offs_[head]; }
+  const Phi* phis_end(uint32_t head) const { return phis_ + phi_offs_[head + 1]; }
+  // Number of operands of the phis of the block at head.
+  size_t phi_arity(uint32_t head) const {
+    return doms_.inbound()[head].size() + (head == 0 ? 1 : 0);
+  }
+
+ private:
+  template <typename F>
+  void ForEachInstr(uint32_t head, F f);
+
+  bool AllocateOperands();
+  void ComputeFrontiers();
+  bool PlacePhis();
+  void Rename();
+  void DefineValue(uint32_t value);
+  void FillPhiOperands(int pred);
+
+  Zone* const zone_;
+  const DexScanner& scanner_;
+  const CodeItem& code_;
+  const DominatorEval& doms_;
+  const RegisterFlow& flow_;
+  const vector<uint32_t>& block_size_;
+  RegisterAccess access_;
+
+  size_t value_count_;
+  Value* values_;
+  // Defs and uses of the instruction at pc start at def_offs_[pc] and
+  // use_offs_[pc]; both arrays have instr_size() + 1 entries.
+  uint32_t* def_offs_;
+  uint32_t* use_offs_;
+  uint32_t* use_values_;
+  // Phis of the block at head are phis_[phi_offs_[head]..phi_offs_[head + 1]).
+  uint32_t* phi_offs_;
+  Phi* phis_;
+
+  // Dominance frontiers, frontier_[frontier_offs_[v]..frontier_offs_[v + 1]).
+  vector<uint32_t> frontier_offs_;
+  vector<int> frontier_;
+  // Current value of each register and the undo log of the renaming.
+  vector<uint32_t> current_;
+  vector<std::pair<uint16_t, uint32_t>> undo_;
+
+  SsaForm(const SsaForm&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_SSA_FORM_H__
@@ -0,0 +1 @@
+diff testdata/ssa.dex testdata/bad_checksum.dex
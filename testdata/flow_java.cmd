@@ -0,0 +1 @@
+java testdata/flow.dex
@@ -0,0 +1 @@
+metrics testdata/flow.dex
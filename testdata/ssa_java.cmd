@@ -0,0 +1 @@
+java testdata/ssa.dex
@@ -0,0 +1 @@
+method testdata/ssa.dex Lfx/Ssa;->headerAtEntry Lfx/Ssa;->head Lfx/Ssb;->headerAtEntry Lfx/Ssa;->headerAfterEntry(I)I
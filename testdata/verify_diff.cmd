@@ -0,0 +1 @@
+diff -c testdata/ssa.dex testdata/bad_checksum.dex
@@ -0,0 +1 @@
+grep -c testdata/flow.dex add-int/lit8 -- testdata/bad_signature.dex
@@ -0,0 +1 @@
+java -c testdata/flow.dex testdata/ssa.dex
@@ -0,0 +1 @@
+java -c testdata/flow.dex testdata/bad_checksum.dex
@@ -0,0 +1 @@
+java -c testdata/bad_checksum.dex
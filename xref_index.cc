@@ -0,0 +1,311 @@
+#include "xref_index.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "dex_asm.h"
+#include "parallel.h"
+
+using std::pair;
+
+namespace egorich {
+namespace rev {
+namespace {
+
+const char kMagic[4] = {'R', 'X', 'R', 'F'};
+
+// (key, method) pairs; keys number strings, then types, then fields.
+typedef vector<pair<uint32_t, uint32_t>> Refs;
+
+// Reader is the DexReader of the byte order of the file.
+template <typename Reader>
+void ScanClass(const DexScanner& scanner, const Reader& reader, const ClassDefItem& class_def,
+               const uint32_t* base, Refs* refs) {
+  for (int k = 0; k < 2; ++k) {
+    const vector<EncodedMethod>& methods =
+        k ? class_def.virtual_methods() : class_def.direct_methods();
+    uint32_t method_idx = 0;
+    for (const EncodedMethod& method : methods) {
+      method_idx += method.method_idx_diff;
+      if (!method.code_offs) continue;
+      const CodeItem code(&scanner, method.code_offs);
+      size_t offs = code.instr_offs();
+      const size_t end = offs + 2*code.instr_size();
+      for (; offs < end; offs += 2*InstructionSize(&reader, offs)) {
+        uint32_t index;
+        const ReferenceKind kind = ReadReference(&reader, offs, &index);
+        uint32_t key;
+        if (kind == REF_STRING) {
+          key = base[XrefIndex::STRING] + index;
+        } else if (kind == REF_TYPE) {
+          key = base[XrefIndex::TYPE] + index;
+        } else if (kind == REF_FIELD) {
+          key = base[XrefIndex::FIELD] + index;
+        } else {
+          continue;
+        }
+        refs->push_back({key, method_idx});
+      }
+    }
+  }
+  std::sort(refs->begin(), refs->end());
+  refs->erase(std::unique(refs->begin(), refs->end()), refs->end());
+}
+
+void WriteVarint(uint32_t value, vector<char>* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+uint32_t ReadVarint(const uint8_t** p) {
+  uint32_t result = 0;
+  int s = 0;
+  uint8_t c;
+  do {
+    c = *(*p)++;
+    result |= static_cast<uint32_t>(c & 0x7F) << s;
+    s += 7;
+  } while (c & 0x80);
+  return result;
+}
+
+// ReadVarint() for untrusted data: false unless the varint ends before end
+// and fits 32 bits.
+bool ReadVarintWithin(const uint8_t** p, const uint8_t* end, uint32_t* value) {
+  uint32_t result = 0;
+  for (int s = 0; s < 35 && *p < end; s += 7) {
+    const uint8_t c = *(*p)++;
+    if (s == 28 && (c & 0x70)) {
+      return false;
+    }
+    result |= static_cast<uint32_t>(c & 0x7F) << s;
+    if (!(c & 0x80)) {
+      *value = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+constexpr uint32_t XrefIndex::kVersion;
+
+XrefIndex::~XrefIndex() {
+  if (map_size_) {
+    munmap(const_cast<char*>(base_), map_size_);
+  }
+}
+
+XrefIndex::Header XrefIndex::MakeHeader(const DexScanner& scanner) {
+  Header header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.dex_checksum = scanner.checksum();
+  header.dex_size = scanner.size();
+  header.counts[STRING] = scanner.string_ids().size();
+  header.counts[TYPE] = scanner.type_ids().size();
+  header.counts[FIELD] = scanner.field_ids().size();
+  header.data_size = 0;
+  return header;
+}
+
+size_t XrefIndex::key_count() const {
+  const Header* h = header();
+  return static_cast<size_t>(h->counts[STRING]) + h->counts[TYPE] + h->counts[FIELD];
+}
+
+void XrefIndex::Build(const DexScanner& scanner, size_t threads) {
+  Header header = MakeHeader(scanner);
+  const uint32_t base[3] = {0, header.counts[STRING], header.counts[STRING] + header.counts[TYPE]};
+  const size_t keys = base[FIELD] + header.counts[FIELD];
+
+  const vector<ClassDefItem>& class_defs = scanner.class_defs();
+  vector<Refs> refs(class_defs.size());
+  ParallelFor(class_defs.size(), threads, [&] (size_t c, size_t worker) {
+    if (scanner.IsMachineEndian()) {
+      ScanClass(scanner, DexReader<NativeOrder>(scanner), class_defs[c], base, &refs[c]);
+    } else {
+      ScanClass(scanner, DexReader<SwappedOrder>(scanner), class_defs[c], base, &refs[c]);
+    }
+  });
+
+  // Counting sort by key. Classes do not list their methods in method_ids
+  // order, so every row is sorted before it is encoded.
+  vector<uint32_t> offs(keys + 1, 0);
+  size_t total = 0;
+  for (const Refs& slot : refs) {
+    for (const auto& ref : slot) {
+      ++offs[ref.first + 1];
+    }
+    total += slot.size();
+  }
+  for (size_t k = 0; k < keys; ++k) {
+    offs[k + 1] += offs[k];
+  }
+  vector<uint32_t> methods(total);
+  vector<uint32_t> next(offs.begin(), offs.end() - 1);
+  for (Refs& slot : refs) {
+    for (const auto& ref : slot) {
+      methods[next[ref.first]++] = ref.second;
+    }
+    Refs().swap(slot);
+  }
+
+  vector<char> data;
+  vector<uint32_t> data_offs(keys + 1);
+  for (size_t k = 0; k < keys; ++k) {
+    data_offs[k] = data.size();
+    uint32_t* begin = methods.data() + offs[k];
+    uint32_t* end = methods.data() + offs[k + 1];
+    if (begin == end) continue;
+    std::sort(begin, end);
+    WriteVarint(end - begin, &data);
+    uint32_t last = 0;
+    for (const uint32_t* m = begin; m != end; ++m) {
+      WriteVarint(*m - last, &data);
+      last = *m;
+    }
+  }
+  data_offs[keys] = data.size();
+  header.data_size = data.size();
+
+  blob_.resize(sizeof(Header) + sizeof(uint32_t) * (keys + 1) + data.size());
+  char* p = blob_.data();
+  memcpy(p, &header, sizeof(Header));
+  p += sizeof(Header);
+  memcpy(p, data_offs.data(), sizeof(uint32_t) * (keys + 1));
+  p += sizeof(uint32_t) * (keys + 1);
+  if (!data.empty()) {
+    memcpy(p, data.data(), data.size());
+  }
+  base_ = blob_.data();
+}
+
+bool XrefIndex::Save(const string& path) const {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  const char* p = blob_.data();
+  size_t left = blob_.size();
+  while (left) {
+    const ssize_t sz = write(fd, p, left);
+    if (sz <= 0) {
+      close(fd);
+      return false;
+    }
+    p += sz;
+    left -= sz;
+  }
+  return close(fd) == 0;
+}
+
+bool XrefIndex::Load(const string& path, const DexScanner& scanner) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+    close(fd);
+    return false;
+  }
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  const char* const old_base = base_;
+  const size_t old_size = map_size_;
+  base_ = static_cast<const char*>(map);
+  map_size_ = st.st_size;
+
+  const Header expected = MakeHeader(scanner);
+  const Header* h = header();
+  const bool valid = memcmp(h->magic, kMagic, sizeof(kMagic)) == 0
+      && h->version == kVersion
+      && h->dex_checksum == expected.dex_checksum
+      && h->dex_size == expected.dex_size
+      && memcmp(h->counts, expected.counts, sizeof(h->counts)) == 0
+      && map_size_ == sizeof(Header) + sizeof(uint32_t) * (key_count() + 1) + h->data_size
+      && offsets()[key_count()] == h->data_size
+      && Verify(scanner.method_ids().size());
+  if (!valid) {
+    munmap(map, map_size_);
+    base_ = old_base;
+    map_size_ = old_size;
+    return false;
+  }
+  if (old_size) {
+    munmap(const_cast<char*>(old_base), old_size);
+  }
+  blob_.clear();
+  return true;
+}
+
+bool XrefIndex::Verify(size_t method_count) const {
+  const uint32_t* offs = offsets();
+  const uint8_t* const begin = data();
+  if (offs[0] != 0) {
+    return false;
+  }
+  for (size_t key = 0; key < key_count(); ++key) {
+    if (offs[key] > offs[key + 1]) {
+      return false;
+    }
+    if (offs[key] == offs[key + 1]) continue;
+    const uint8_t* p = begin + offs[key];
+    const uint8_t* const end = begin + offs[key + 1];
+    uint32_t count;
+    if (!ReadVarintWithin(&p, end, &count) || count == 0) {
+      return false;
+    }
+    uint64_t method = 0;
+    while (count--) {
+      uint32_t delta;
+      if (!ReadVarintWithin(&p, end, &delta)) {
+        return false;
+      }
+      method += delta;
+      if (method >= method_count) {
+        return false;
+      }
+    }
+    if (p != end) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void XrefIndex::Lookup(Kind kind, uint32_t idx, vector<uint32_t>* methods) const {
+  const Header* h = header();
+  if (idx >= h->counts[kind]) return;
+  size_t key = idx;
+  for (int k = STRING; k < kind; ++k) {
+    key += h->counts[k];
+  }
+  const uint32_t* offs = offsets();
+  if (offs[key] == offs[key + 1]) return;
+  const uint8_t* p = data() + offs[key];
+  uint32_t count = ReadVarint(&p);
+  uint32_t method = 0;
+  while (count--) {
+    method += ReadVarint(&p);
+    methods->push_back(method);
+  }
+}
+
+}  // namespace rev
+}  // namespace egorich
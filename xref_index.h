@@ -0,0 +1,82 @@
+#ifndef REV_XREF_INDEX_H__
+#define REV_XREF_INDEX_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dex_scanner.h"
+
+using std::string;
+using std::vector;
+
+namespace egorich {
+namespace rev {
+
+// Methods referencing each string, type and field of a dex. Every posting
+// list is sorted and stored as a varint count, the first method index and
+// the varint deltas to the next ones. The index is a single blob: a header,
+// the offsets of the lists and the lists, so a saved index is used straight
+// from an mmap-ed file.
+class XrefIndex {
+ public:
+  enum Kind {
+    STRING,
+    TYPE,
+    FIELD,
+  };
+
+  XrefIndex() : base_(NULL), map_size_(0) {
+  }
+  ~XrefIndex();
+
+  // Scans the code of every class on up to `threads` threads.
+  void Build(const DexScanner& scanner, size_t threads);
+  // Returns false on I/O errors.
+  bool Save(const string& path) const;
+  // Maps a saved index. Returns false on I/O errors, when the index does
+  // not match the dex it is loaded for, or when it is damaged: every list
+  // is checked to lie within its slot and to name methods of the dex, so
+  // Lookup() may trust it.
+  bool Load(const string& path, const DexScanner& scanner);
+
+  // Appends the methods referencing the item.
+  void Lookup(Kind kind, uint32_t idx, vector<uint32_t>* methods) const;
+
+ private:
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    // Identity of the dex: its checksum and size from the dex header.
+    uint32_t dex_checksum;
+    uint32_t dex_size;
+    uint32_t counts[3];
+    uint32_t data_size;
+  };
+
+  static constexpr uint32_t kVersion = 1;
+
+  const Header* header() const { return reinterpret_cast<const Header*>(base_); }
+  const uint32_t* offsets() const { return reinterpret_cast<const uint32_t*>(base_ + sizeof(Header)); }
+  size_t key_count() const;
+  const uint8_t* data() const { return reinterpret_cast<const uint8_t*>(offsets() + key_count() + 1); }
+
+  static Header MakeHeader(const DexScanner& scanner);
+  // Whether the offsets of a mapped index ascend within the data and every
+  // list ends in its slot, at methods below method_count. Reads the whole
+  // data once.
+  bool Verify(size_t method_count) const;
+
+  // Blob of a built index; base_ points either into it or into the mapping.
+  vector<char> blob_;
+  const char* base_;
+  size_t map_size_;
+
+  XrefIndex(const XrefIndex&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_XREF_INDEX_H__
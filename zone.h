@@ -0,0 +1,70 @@
+#ifndef REV_ZONE_H__
+#define REV_ZONE_H__
+
+#include <cstddef>
+
+namespace egorich {
+namespace rev {
+
+// Bump allocator; memory is released all at once with the zone.
+class Zone {
+ public:
+  Zone(size_t capacity) : capacity_(capacity), zone_(new char[capacity]), head_(0), limit_(capacity) {
+  }
+
+  ~Zone() {
+    delete[] zone_;
+  }
+
+  void* Allocate(size_t sz) {
+    void* const result = 
+      head_ + sz <= limit_ ? zone_ + head_ : 0;
+    if (result) {
+      head_ += sz + 7;
+      head_ &= ~static_cast<size_t>(0) << 3;
+    }
+    return result;
+  }
+
+  // Returns uninitialized storage for n objects of T, or NULL if the zone is
+  // exhausted.
+  template <typename T>
+  T* AllocateArray(size_t n) {
+    return static_cast<T*>(Allocate(n * sizeof(T)));
+  }
+
+  // Releases everything allocated so far, so the zone may be reused for the
+  // next method.
+  void Reset() {
+    head_ = 0;
+  }
+
+  // Rewind(Mark()) releases what was allocated in between.
+  size_t Mark() const {
+    return head_;
+  }
+  void Rewind(size_t mark) {
+    head_ = mark;
+  }
+
+  // Caps the bytes handed out until the next call; zero lifts the cap.
+  void set_limit(size_t limit) {
+    limit_ = limit && limit < capacity_ ? limit : capacity_;
+  }
+  size_t available() const {
+    return head_ < limit_ ? limit_ - head_ : 0;
+  }
+
+ private:
+  const size_t capacity_;
+  char *const zone_;
+  size_t head_;
+  size_t limit_;
+
+  Zone(const Zone&) = delete;
+};
+
+}  // namespace rev
+}  // namespace egorich
+
+#endif  // REV_ZONE_H__